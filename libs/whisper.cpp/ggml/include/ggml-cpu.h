@@ -42,6 +42,9 @@ extern "C" {
         // abort ggml_graph_compute when true
         ggml_abort_callback abort_callback;
         void *              abort_callback_data;
+
+        // CPUs the threads run on, GGML_MAX_N_THREADS entries (NULL - leave their affinity as it is)
+        const bool * cpumask;
     };
 
     // numa strategies
@@ -56,6 +59,7 @@ extern "C" {
 
     GGML_API void    ggml_numa_init(enum ggml_numa_strategy numa); // call once for better performance on NUMA systems
     GGML_API bool    ggml_is_numa(void); // true if init detected that system has >1 NUMA node
+    GGML_API bool    ggml_numa_place(void * data, size_t size); // put memory on the nodes the threads of the strategy run on, before it is first touched
 
     GGML_API struct ggml_tensor * ggml_new_i32(struct ggml_context * ctx, int32_t value);
     GGML_API struct ggml_tensor * ggml_new_f32(struct ggml_context * ctx, float value);
@@ -103,6 +107,16 @@ extern "C" {
     // get the sve vector length in bytes
     GGML_API int ggml_cpu_get_sve_cnt(void);
 
+    // vector kernels for post-processing results on the host (e.g. decoder logits)
+    GGML_API float  ggml_cpu_vec_max_f32     (int n, const float * x);
+    // y[i] = expf(x[i] - max), returns the sum of y
+    GGML_API double ggml_cpu_vec_soft_max_f32(int n, float * y, const float * x, float max);
+
+    // interleaved layout the matmul kernels of this CPU prefer for a 2D weight of this type (the type itself if none)
+    GGML_API enum ggml_type ggml_cpu_repack_type(enum ggml_type type, int64_t nrows);
+    // convert nrows rows of the plain type to the interleaved type returned by ggml_cpu_repack_type
+    GGML_API void           ggml_cpu_repack     (enum ggml_type type, void * dst, const void * src, int64_t nrows, int64_t n_per_row);
+
     // Internal types and functions exposed for tests and benchmarks
 
     typedef void (*ggml_from_float_to_mat_t)
@@ -138,6 +152,9 @@ extern "C" {
     GGML_API void ggml_backend_cpu_set_n_threads     (ggml_backend_t backend_cpu, int n_threads);
     GGML_API void ggml_backend_cpu_set_threadpool    (ggml_backend_t backend_cpu, ggml_threadpool_t threadpool);
     GGML_API void ggml_backend_cpu_set_abort_callback(ggml_backend_t backend_cpu, ggml_abort_callback abort_callback, void * abort_callback_data);
+    // pin the compute threads to the CPUs of cpumask (GGML_MAX_N_THREADS entries, copied) from the next graph on,
+    // NULL to leave their affinity as it is
+    GGML_API void ggml_backend_cpu_set_cpumask       (ggml_backend_t backend_cpu, const bool * cpumask);
 
     GGML_API ggml_backend_reg_t ggml_backend_cpu_reg(void);
 
@@ -145,6 +162,18 @@ extern "C" {
     GGML_API ggml_backend_buffer_type_t ggml_backend_cpu_hbm_buffer_type(void);
 #endif
 
+    // huge pages for CPU buffers
+    enum ggml_cpu_hugepages {
+        GGML_CPU_HUGEPAGES_NONE    = 0,
+        GGML_CPU_HUGEPAGES_THP     = 1, // transparent huge pages (madvise)
+        GGML_CPU_HUGEPAGES_HUGETLB = 2, // reserved huge pages (vm.nr_hugepages), transparent ones when there are not enough
+        GGML_CPU_HUGEPAGES_COUNT
+    };
+
+    // CPU buffers backed by huge pages and, with numa, placed on the nodes the threads of the ggml_numa_init strategy
+    // run on (see ggml_numa_place); the plain CPU buffer type when neither is asked for (or outside of Linux)
+    GGML_API ggml_backend_buffer_type_t ggml_backend_cpu_placed_buffer_type(enum ggml_cpu_hugepages hugepages, bool numa);
+
 #ifdef __cplusplus
 }
 #endif
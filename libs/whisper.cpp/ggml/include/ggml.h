@@ -389,6 +389,7 @@ extern "C" {
         GGML_TYPE_Q4_0_8_8 = 33,
         GGML_TYPE_TQ1_0   = 34,
         GGML_TYPE_TQ2_0   = 35,
+        GGML_TYPE_Q5_0_8_8 = 36,
         GGML_TYPE_COUNT,
     };
 
@@ -461,11 +462,13 @@ extern "C" {
         GGML_OP_CONCAT,
         GGML_OP_SILU_BACK,
         GGML_OP_NORM, // normalize
+        GGML_OP_NORM_AFFINE,
         GGML_OP_RMS_NORM,
         GGML_OP_RMS_NORM_BACK,
         GGML_OP_GROUP_NORM,
 
         GGML_OP_MUL_MAT,
+        GGML_OP_MUL_MAT_BIAS,
         GGML_OP_MUL_MAT_ID,
         GGML_OP_OUT_PROD,
 
@@ -487,6 +490,7 @@ extern "C" {
         GGML_OP_ROPE,
         GGML_OP_ROPE_BACK,
         GGML_OP_CLAMP,
+        GGML_OP_CONV_1D,
         GGML_OP_CONV_TRANSPOSE_1D,
         GGML_OP_IM2COL,
         GGML_OP_IM2COL_BACK,
@@ -1082,6 +1086,15 @@ extern "C" {
             struct ggml_tensor  * a,
             float                 eps);
 
+    // ggml_norm followed by the affine transform of layer normalization, w*x + b, in one pass
+    // w, b: [a->ne[0]] (either can be NULL)
+    GGML_API struct ggml_tensor * ggml_norm_affine(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * w,
+            struct ggml_tensor  * b,
+            float                 eps);
+
     GGML_API struct ggml_tensor * ggml_rms_norm(
             struct ggml_context * ctx,
             struct ggml_tensor  * a,
@@ -1128,6 +1141,17 @@ extern "C" {
             struct ggml_tensor * a,
             enum ggml_prec       prec);
 
+    // ggml_mul_mat(a, b) + c, optionally followed by GELU
+    // the CPU backend computes the product a block of b rows at a time and applies the bias and GELU to each block
+    // while it is still in cache
+    // c: [a->ne[1]] bias (can be NULL)
+    GGML_API struct ggml_tensor * ggml_mul_mat_bias(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,
+            struct ggml_tensor  * b,
+            struct ggml_tensor  * c,
+            bool                  gelu);
+
     // indirect matrix multiplication
     GGML_API struct ggml_tensor * ggml_mul_mat_id(
             struct ggml_context * ctx,
@@ -1574,6 +1598,19 @@ extern "C" {
             int                   s,  // stride
             int                   d); // dilation
 
+    // direct conv_1d, without the [N, OL, IC*K] im2col intermediate
+    // a: [OC, IC, K] kernel, b: [N, IC, L] data, c: [OC] bias or NULL
+    // result: [N, OC, OL], optionally passed through GELU
+    GGML_API struct ggml_tensor * ggml_conv_1d_direct(
+            struct ggml_context * ctx,
+            struct ggml_tensor  * a,   // convolution kernel
+            struct ggml_tensor  * b,   // data
+            struct ggml_tensor  * c,   // bias
+            int                   s0,  // stride
+            int                   p0,  // padding
+            int                   d0,  // dilation
+            bool                  gelu);
+
     GGML_API struct ggml_tensor * ggml_conv_transpose_1d(
             struct ggml_context * ctx,
             struct ggml_tensor  * a,   // convolution kernel
@@ -227,6 +227,33 @@ static block_q4_0x8 make_block_q4_0x8(block_q4_0 * in, unsigned int blck_size_in
     return out;
 }
 
+// interleave 8 block_q5_0s for 4-element dot products (see block_q5_0x8)
+// unpacking a group of 4 elements of all 8 rows is then one nibble mask or shift on 32 bytes of qs and
+// one shift of the 32 bytes of qh, with no shuffles
+static block_q5_0x8 make_block_q5_0x8(const block_q5_0 * in) {
+    block_q5_0x8 out;
+
+    memset(&out, 0, sizeof(out));
+
+    for (int r = 0; r < 8; r++) {
+        out.d[r] = in[r].d;
+
+        uint32_t qh;
+        memcpy(&qh, in[r].qh, sizeof(qh));
+
+        for (int i = 0; i < QK5_0; i++) {
+            const int q  = (in[r].qs[i % (QK5_0/2)] >> (4*(i / (QK5_0/2)))) & 0x0F;
+            const int sb = i / 4;
+            const int p  = 4*r + i % 4;
+
+            out.qs[32*(sb % 4) + p] |= q << (4*(sb / 4));
+            out.qh[p]               |= ((qh >> i) & 1) << sb;
+        }
+    }
+
+    return out;
+}
+
 void quantize_q8_0_4x4(const float * restrict x, void * restrict vy, int64_t k) {
     assert(QK8_0 == 32);
     assert(k % QK8_0 == 0);
@@ -599,6 +626,44 @@ size_t quantize_q4_0_8x8(const float * restrict src, void * restrict dst, int64_
     return quantize_q4_0_nr_bl(src, dst, nrow, n_per_row, 8, 8);
 }
 
+void repack_q4_0_8x8(const void * restrict src, void * restrict dst, int64_t nrow, int64_t n_per_row) {
+    assert(n_per_row % QK4_0 == 0);
+    assert(nrow % 8 == 0);
+    const int64_t nb = n_per_row / QK4_0;
+
+    const block_q4_0 * src_ptr = (const block_q4_0 *) src;
+    block_q4_0x8 * dst_ptr = (block_q4_0x8 *) dst;
+    block_q4_0 dst_tmp[8];
+
+    for (int64_t b = 0; b < nrow; b += 8) {
+        for (int64_t x = 0; x < nb; x++) {
+            for (int i = 0; i < 8; i++) {
+                dst_tmp[i] = src_ptr[(b + i) * nb + x];
+            }
+            *dst_ptr++ = make_block_q4_0x8(dst_tmp, 8, 0x88);
+        }
+    }
+}
+
+void repack_q5_0_8x8(const void * restrict src, void * restrict dst, int64_t nrow, int64_t n_per_row) {
+    assert(n_per_row % QK5_0 == 0);
+    assert(nrow % 8 == 0);
+    const int64_t nb = n_per_row / QK5_0;
+
+    const block_q5_0 * src_ptr = (const block_q5_0 *) src;
+    block_q5_0x8 * dst_ptr = (block_q5_0x8 *) dst;
+    block_q5_0 dst_tmp[8];
+
+    for (int64_t b = 0; b < nrow; b += 8) {
+        for (int64_t x = 0; x < nb; x++) {
+            for (int i = 0; i < 8; i++) {
+                dst_tmp[i] = src_ptr[(b + i) * nb + x];
+            }
+            *dst_ptr++ = make_block_q5_0x8(dst_tmp);
+        }
+    }
+}
+
 void ggml_gemv_q4_0_4x4_q8_0(int n, float * restrict s, size_t bs, const void * restrict vx, const void * restrict vy, int nr, int nc) {
     const int qk = QK8_0;
     const int nb = n / qk;
@@ -3476,3 +3541,323 @@ void ggml_gemm_q4_0_8x8_q8_0(int n, float * restrict s, size_t bs, const void *
         }
     }
 }
+
+#if defined(__AVX2__)
+// unpack a block_q5_0x8 to 8 vectors of unsigned quants (q + 16, in [0, 31])
+// rhs[k] holds elements 4*k .. 4*k + 3 of the 8 rows, 4 bytes per row
+static inline void unpack_q5_0x8_avx2(const block_q5_0x8 * restrict b, __m256i * restrict rhs) {
+    const __m256i m4b = _mm256_set1_epi8(0x0F);
+    const __m256i m5b = _mm256_set1_epi8(0x10);
+
+    const __m256i qh   = _mm256_loadu_si256((const __m256i *) b->qh);
+    const __m256i qs_0 = _mm256_loadu_si256((const __m256i *) b->qs + 0);
+    const __m256i qs_1 = _mm256_loadu_si256((const __m256i *) b->qs + 1);
+    const __m256i qs_2 = _mm256_loadu_si256((const __m256i *) b->qs + 2);
+    const __m256i qs_3 = _mm256_loadu_si256((const __m256i *) b->qs + 3);
+
+    // bit k of each qh byte is the 5th bit of group k, moved to bit 4 by a 16-bit shift that stays within the byte
+    rhs[0] = _mm256_or_si256(_mm256_and_si256(qs_0, m4b), _mm256_and_si256(_mm256_slli_epi16(qh, 4), m5b));
+    rhs[1] = _mm256_or_si256(_mm256_and_si256(qs_1, m4b), _mm256_and_si256(_mm256_slli_epi16(qh, 3), m5b));
+    rhs[2] = _mm256_or_si256(_mm256_and_si256(qs_2, m4b), _mm256_and_si256(_mm256_slli_epi16(qh, 2), m5b));
+    rhs[3] = _mm256_or_si256(_mm256_and_si256(qs_3, m4b), _mm256_and_si256(_mm256_slli_epi16(qh, 1), m5b));
+    rhs[4] = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(qs_0, 4), m4b), _mm256_and_si256(qh, m5b));
+    rhs[5] = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(qs_1, 4), m4b), _mm256_and_si256(_mm256_srli_epi16(qh, 1), m5b));
+    rhs[6] = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(qs_2, 4), m4b), _mm256_and_si256(_mm256_srli_epi16(qh, 2), m5b));
+    rhs[7] = _mm256_or_si256(_mm256_and_si256(_mm256_srli_epi16(qs_3, 4), m4b), _mm256_and_si256(_mm256_srli_epi16(qh, 3), m5b));
+}
+
+// dot products of one row of int8 quants with the 8 unpacked rows of a block_q5_0x8
+// group k of the lhs row starts at a + (k/2)*ps + 4*(k%2)
+static inline __m256i mul_sum_q5_0x8_avx2(const __m256i * restrict rhs, const int8_t * restrict a, const int ps, const int dp) {
+#if !defined(__AVXVNNI__) && !(defined(__AVX512VNNI__) && defined(__AVX512VL__))
+    if (dp == GGML_DPBUSD_NONE) {
+        // four products of at most 2*31*127 still fit in int16, eight do not
+        __m256i lo = _mm256_maddubs_epi16(rhs[0], _mm256_set1_epi32(*(const int32_t *)(a)));
+        lo = _mm256_add_epi16(lo, _mm256_maddubs_epi16(rhs[1], _mm256_set1_epi32(*(const int32_t *)(a + 4))));
+        lo = _mm256_add_epi16(lo, _mm256_maddubs_epi16(rhs[2], _mm256_set1_epi32(*(const int32_t *)(a + ps))));
+        lo = _mm256_add_epi16(lo, _mm256_maddubs_epi16(rhs[3], _mm256_set1_epi32(*(const int32_t *)(a + ps + 4))));
+        __m256i hi = _mm256_maddubs_epi16(rhs[4], _mm256_set1_epi32(*(const int32_t *)(a + 2*ps)));
+        hi = _mm256_add_epi16(hi, _mm256_maddubs_epi16(rhs[5], _mm256_set1_epi32(*(const int32_t *)(a + 2*ps + 4))));
+        hi = _mm256_add_epi16(hi, _mm256_maddubs_epi16(rhs[6], _mm256_set1_epi32(*(const int32_t *)(a + 3*ps))));
+        hi = _mm256_add_epi16(hi, _mm256_maddubs_epi16(rhs[7], _mm256_set1_epi32(*(const int32_t *)(a + 3*ps + 4))));
+        return _mm256_add_epi32(sum_i16_pairs_int32x8(lo), sum_i16_pairs_int32x8(hi));
+    }
+#endif
+    __m256i acc = _mm256_setzero_si256();
+    for (int k = 0; k < 8; k++) {
+        acc = ggml_mm256_dpbusd(acc, rhs[k], _mm256_set1_epi32(*(const int32_t *)(a + (k/2)*ps + 4*(k%2))), dp);
+    }
+    return acc;
+}
+
+// 16 times the sums of the 4 rows of a block_q8_0x4 (interleaved by 8), each broadcast to a vector
+// the quants are unpacked with a +16 bias, so this is subtracted from the integer dot products
+static inline void bias_q8_0x4_avx2(const block_q8_0x4 * restrict a, __m256i * restrict bias) {
+    const __m256i ones = _mm256_set1_epi8(1);
+
+    __m256i sum = _mm256_maddubs_epi16(ones, _mm256_loadu_si256((const __m256i *) a->qs + 0));
+    sum = _mm256_add_epi16(sum, _mm256_maddubs_epi16(ones, _mm256_loadu_si256((const __m256i *) a->qs + 1)));
+    sum = _mm256_add_epi16(sum, _mm256_maddubs_epi16(ones, _mm256_loadu_si256((const __m256i *) a->qs + 2)));
+    sum = _mm256_add_epi16(sum, _mm256_maddubs_epi16(ones, _mm256_loadu_si256((const __m256i *) a->qs + 3)));
+
+    // R0 R0 R1 R1 R2 R2 R3 R3 -> pairs summed
+    __m256i sum32 = sum_i16_pairs_int32x8(sum);
+    sum32 = _mm256_slli_epi32(_mm256_add_epi32(sum32, _mm256_shuffle_epi32(sum32, 177)), 4);
+
+    bias[0] = _mm256_permutevar8x32_epi32(sum32, _mm256_set1_epi32(0));
+    bias[1] = _mm256_permutevar8x32_epi32(sum32, _mm256_set1_epi32(2));
+    bias[2] = _mm256_permutevar8x32_epi32(sum32, _mm256_set1_epi32(4));
+    bias[3] = _mm256_permutevar8x32_epi32(sum32, _mm256_set1_epi32(6));
+}
+
+// one row of block_q8_0 times one group of 8 rows of block_q5_0x8
+static inline void gemv_q5_0x8_avx2(int nb, float * restrict s, const block_q5_0x8 * restrict b_ptr, const block_q8_0 * restrict a_ptr, const int dp) {
+    const __m256i ones = _mm256_set1_epi8(1);
+
+    __m256 acc_row = _mm256_setzero_ps();
+
+    for (int b = 0; b < nb; b++) {
+        __m256i rhs[8];
+        unpack_q5_0x8_avx2(b_ptr + b, rhs);
+
+        // 16 times the sum of the lhs quants, broadcast, to remove the +16 bias of the unpacked rhs
+        __m256i bias = sum_i16_pairs_int32x8(_mm256_maddubs_epi16(ones, _mm256_loadu_si256((const __m256i *) a_ptr[b].qs)));
+        bias = _mm256_add_epi32(bias, _mm256_shuffle_epi32(bias, 78));
+        bias = _mm256_add_epi32(bias, _mm256_shuffle_epi32(bias, 177));
+        bias = _mm256_slli_epi32(_mm256_add_epi32(bias, _mm256_permute2x128_si256(bias, bias, 1)), 4);
+
+        const __m256i iacc = _mm256_sub_epi32(mul_sum_q5_0x8_avx2(rhs, a_ptr[b].qs, 8, dp), bias);
+
+        const __m256 col_scale_f32 = GGML_F32Cx8_LOAD(b_ptr[b].d);
+        const __m256 row_scale_f32 = _mm256_set1_ps(GGML_FP16_TO_FP32(a_ptr[b].d));
+
+        acc_row = _mm256_fmadd_ps(_mm256_cvtepi32_ps(iacc), _mm256_mul_ps(col_scale_f32, row_scale_f32), acc_row);
+    }
+
+    _mm256_storeu_ps(s, acc_row);
+}
+
+// 4 rows of block_q8_0x4 times one group of 8 rows of block_q5_0x8
+static inline void gemm_q5_0x8_4x8_avx2(int nb, float * restrict s, size_t bs, const block_q5_0x8 * restrict b_ptr, const block_q8_0x4 * restrict a_ptr, const int dp) {
+    __m256 acc_rows[4];
+    for (int m = 0; m < 4; m++) {
+        acc_rows[m] = _mm256_setzero_ps();
+    }
+
+    for (int b = 0; b < nb; b++) {
+        __m256i rhs[8];
+        unpack_q5_0x8_avx2(b_ptr + b, rhs);
+
+        __m256i bias[4];
+        bias_q8_0x4_avx2(a_ptr + b, bias);
+
+        const __m256 col_scale_f32 = GGML_F32Cx8_LOAD(b_ptr[b].d);
+
+        for (int m = 0; m < 4; m++) {
+            const __m256i iacc = _mm256_sub_epi32(mul_sum_q5_0x8_avx2(rhs, a_ptr[b].qs + 8*m, 32, dp), bias[m]);
+            const __m256 row_scale_f32 = _mm256_set1_ps(GGML_FP16_TO_FP32(a_ptr[b].d[m]));
+
+            acc_rows[m] = _mm256_fmadd_ps(_mm256_cvtepi32_ps(iacc), _mm256_mul_ps(col_scale_f32, row_scale_f32), acc_rows[m]);
+        }
+    }
+
+    for (int m = 0; m < 4; m++) {
+        _mm256_storeu_ps(s + m * bs, acc_rows[m]);
+    }
+}
+#endif
+
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+// two block_q5_0x8 unpacked side by side, rhs[k] holds group k of 16 rows
+static inline void unpack_q5_0x8x2_avx512(const block_q5_0x8 * restrict b0, const block_q5_0x8 * restrict b1, __m512i * restrict rhs) {
+    const __m512i m4b = _mm512_set1_epi8(0x0F);
+    const __m512i m5b = _mm512_set1_epi8(0x10);
+
+#define LOAD_Q5_0x8x2(field, i) _mm512_inserti64x4(_mm512_castsi256_si512(_mm256_loadu_si256((const __m256i *) b0->field + (i))), \
+                                                    _mm256_loadu_si256((const __m256i *) b1->field + (i)), 1)
+    const __m512i qh   = LOAD_Q5_0x8x2(qh, 0);
+    const __m512i qs_0 = LOAD_Q5_0x8x2(qs, 0);
+    const __m512i qs_1 = LOAD_Q5_0x8x2(qs, 1);
+    const __m512i qs_2 = LOAD_Q5_0x8x2(qs, 2);
+    const __m512i qs_3 = LOAD_Q5_0x8x2(qs, 3);
+#undef LOAD_Q5_0x8x2
+
+    rhs[0] = _mm512_or_si512(_mm512_and_si512(qs_0, m4b), _mm512_and_si512(_mm512_slli_epi16(qh, 4), m5b));
+    rhs[1] = _mm512_or_si512(_mm512_and_si512(qs_1, m4b), _mm512_and_si512(_mm512_slli_epi16(qh, 3), m5b));
+    rhs[2] = _mm512_or_si512(_mm512_and_si512(qs_2, m4b), _mm512_and_si512(_mm512_slli_epi16(qh, 2), m5b));
+    rhs[3] = _mm512_or_si512(_mm512_and_si512(qs_3, m4b), _mm512_and_si512(_mm512_slli_epi16(qh, 1), m5b));
+    rhs[4] = _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi16(qs_0, 4), m4b), _mm512_and_si512(qh, m5b));
+    rhs[5] = _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi16(qs_1, 4), m4b), _mm512_and_si512(_mm512_srli_epi16(qh, 1), m5b));
+    rhs[6] = _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi16(qs_2, 4), m4b), _mm512_and_si512(_mm512_srli_epi16(qh, 2), m5b));
+    rhs[7] = _mm512_or_si512(_mm512_and_si512(_mm512_srli_epi16(qs_3, 4), m4b), _mm512_and_si512(_mm512_srli_epi16(qh, 3), m5b));
+}
+
+static inline __m512i mul_sum_q5_0x8x2_avx512(const __m512i * restrict rhs, const int8_t * restrict a, const int ps) {
+#if defined(__AVX512VNNI__)
+    __m512i acc = _mm512_setzero_si512();
+    for (int k = 0; k < 8; k++) {
+        acc = _mm512_dpbusd_epi32(acc, rhs[k], _mm512_set1_epi32(*(const int32_t *)(a + (k/2)*ps + 4*(k%2))));
+    }
+    return acc;
+#else
+    __m512i lo = _mm512_maddubs_epi16(rhs[0], _mm512_set1_epi32(*(const int32_t *)(a)));
+    lo = _mm512_add_epi16(lo, _mm512_maddubs_epi16(rhs[1], _mm512_set1_epi32(*(const int32_t *)(a + 4))));
+    lo = _mm512_add_epi16(lo, _mm512_maddubs_epi16(rhs[2], _mm512_set1_epi32(*(const int32_t *)(a + ps))));
+    lo = _mm512_add_epi16(lo, _mm512_maddubs_epi16(rhs[3], _mm512_set1_epi32(*(const int32_t *)(a + ps + 4))));
+    __m512i hi = _mm512_maddubs_epi16(rhs[4], _mm512_set1_epi32(*(const int32_t *)(a + 2*ps)));
+    hi = _mm512_add_epi16(hi, _mm512_maddubs_epi16(rhs[5], _mm512_set1_epi32(*(const int32_t *)(a + 2*ps + 4))));
+    hi = _mm512_add_epi16(hi, _mm512_maddubs_epi16(rhs[6], _mm512_set1_epi32(*(const int32_t *)(a + 3*ps))));
+    hi = _mm512_add_epi16(hi, _mm512_maddubs_epi16(rhs[7], _mm512_set1_epi32(*(const int32_t *)(a + 3*ps + 4))));
+    return _mm512_add_epi32(sum_i16_pairs_int_32x16(lo), sum_i16_pairs_int_32x16(hi));
+#endif
+}
+
+// 4 rows of block_q8_0x4 times two groups of 8 rows of block_q5_0x8
+static inline void gemm_q5_0x8_4x16_avx512(int nb, float * restrict s, size_t bs, const block_q5_0x8 * restrict b_ptr_0, const block_q5_0x8 * restrict b_ptr_1, const block_q8_0x4 * restrict a_ptr) {
+    __m512 acc_rows[4];
+    for (int m = 0; m < 4; m++) {
+        acc_rows[m] = _mm512_setzero_ps();
+    }
+
+    for (int b = 0; b < nb; b++) {
+        __m512i rhs[8];
+        unpack_q5_0x8x2_avx512(b_ptr_0 + b, b_ptr_1 + b, rhs);
+
+        __m256i bias[4];
+        bias_q8_0x4_avx2(a_ptr + b, bias);
+
+        const __m512 col_scale_f32 = GGML_F32Cx8x2_LOAD(b_ptr_0[b].d, b_ptr_1[b].d);
+
+        for (int m = 0; m < 4; m++) {
+            const __m512i bias_m = _mm512_inserti64x4(_mm512_castsi256_si512(bias[m]), bias[m], 1);
+            const __m512i iacc = _mm512_sub_epi32(mul_sum_q5_0x8x2_avx512(rhs, a_ptr[b].qs + 8*m, 32), bias_m);
+            const __m512 row_scale_f32 = _mm512_set1_ps(GGML_FP16_TO_FP32(a_ptr[b].d[m]));
+
+            acc_rows[m] = _mm512_fmadd_ps(_mm512_cvtepi32_ps(iacc), _mm512_mul_ps(col_scale_f32, row_scale_f32), acc_rows[m]);
+        }
+    }
+
+    for (int m = 0; m < 4; m++) {
+        _mm512_storeu_ps(s + m * bs, acc_rows[m]);
+    }
+}
+#endif
+
+void ggml_gemv_q5_0_8x8_q8_0(int n, float * restrict s, size_t bs, const void * restrict vx, const void * restrict vy, int nr, int nc) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+
+    assert (n % qk == 0);
+    assert (nc % ncols_interleaved == 0);
+
+#if defined(__AVX2__)
+    for (int y = 0; y < nr; y++) {
+        const block_q8_0 * a_ptr = (const block_q8_0 *) vy + (y * nb);
+
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_q5_0x8 * b_ptr = (const block_q5_0x8 *) vx + (x * nb);
+            GGML_DPBUSD_CALL(gemv_q5_0x8_avx2, nb, s + (y * bs + x * ncols_interleaved), b_ptr, a_ptr);
+        }
+    }
+    return;
+#endif
+    {
+        float sumf[8];
+        int sumi;
+
+        for (int y = 0; y < nr; y++) {
+            const block_q8_0 * a_ptr = (const block_q8_0 *) vy + (y * nb);
+            for (int x = 0; x < nc / ncols_interleaved; x++) {
+                const block_q5_0x8 * b_ptr = (const block_q5_0x8 *) vx + (x * nb);
+
+                for (int j = 0; j < ncols_interleaved; j++) sumf[j] = 0.0;
+                for (int l = 0; l < nb; l++) {
+                    for (int j = 0; j < ncols_interleaved; j++) {
+                        sumi = 0;
+                        for (int k = 0; k < 4; k++) {
+                            for (int i = 0; i < 4; ++i) {
+                                const uint8_t qs = b_ptr[l].qs[32 * k + 4 * j + i];
+                                const uint8_t qh = b_ptr[l].qh[4 * j + i];
+                                const int v0 = ((qs & 0x0F) | (((qh >> k)       & 1) << 4)) - 16;
+                                const int v1 = ((qs >>   4) | (((qh >> (k + 4)) & 1) << 4)) - 16;
+                                sumi += v0 * a_ptr[l].qs[4 * k + i] + v1 * a_ptr[l].qs[4 * k + i + qk / 2];
+                            }
+                        }
+                        sumf[j] += sumi * GGML_FP16_TO_FP32(b_ptr[l].d[j]) * GGML_FP16_TO_FP32(a_ptr[l].d);
+                    }
+                }
+                for (int j = 0; j < ncols_interleaved; j++) s[y * bs + x * ncols_interleaved + j] = sumf[j];
+            }
+        }
+    }
+}
+
+void ggml_gemm_q5_0_8x8_q8_0(int n, float * restrict s, size_t bs, const void * restrict vx, const void * restrict vy, int nr, int nc) {
+    const int qk = QK8_0;
+    const int nb = n / qk;
+    const int ncols_interleaved = 8;
+    const int blocklen = 8;
+
+    assert (n % qk == 0);
+    assert (nr % 4 == 0);
+    assert (nc % ncols_interleaved == 0);
+
+#if defined(__AVX2__)
+    // each group of 4 lhs rows is multiplied with the rhs 16 (AVX512) or 8 rows at a time, keeping the 4 rows of
+    // outputs in registers over the whole dot product
+    for (int y = 0; y < nr / 4; y++) {
+        const block_q8_0x4 * a_ptr = (const block_q8_0x4 *) vy + (y * nb);
+
+        int x = 0;
+#if defined(__AVX512F__) && defined(__AVX512BW__)
+        for (; x + 1 < nc / ncols_interleaved; x += 2) {
+            const block_q5_0x8 * b_ptr = (const block_q5_0x8 *) vx + (x * nb);
+            gemm_q5_0x8_4x16_avx512(nb, s + (y * 4 * bs + x * ncols_interleaved), bs, b_ptr, b_ptr + nb, a_ptr);
+        }
+#endif
+        for (; x < nc / ncols_interleaved; x++) {
+            const block_q5_0x8 * b_ptr = (const block_q5_0x8 *) vx + (x * nb);
+            GGML_DPBUSD_CALL(gemm_q5_0x8_4x8_avx2, nb, s + (y * 4 * bs + x * ncols_interleaved), bs, b_ptr, a_ptr);
+        }
+    }
+    return;
+#endif
+    float sumf[4][8];
+    int sumi;
+
+    for (int y = 0; y < nr / 4; y++) {
+        const block_q8_0x4 * a_ptr = (const block_q8_0x4 *) vy + (y * nb);
+        for (int x = 0; x < nc / ncols_interleaved; x++) {
+            const block_q5_0x8 * b_ptr = (const block_q5_0x8 *) vx + (x * nb);
+            for (int m = 0; m < 4; m++) {
+                for (int j = 0; j < ncols_interleaved; j++) sumf[m][j] = 0.0;
+            }
+            for (int l = 0; l < nb; l++) {
+                for (int m = 0; m < 4; m++) {
+                    for (int j = 0; j < ncols_interleaved; j++) {
+                        sumi = 0;
+                        for (int k = 0; k < 4; k++) {
+                            for (int i = 0; i < 4; ++i) {
+                                // element 4*k + i of lhs row m, and the one 16 further
+                                const int e0 = 4 * k + i;
+                                const int e1 = e0 + qk / 2;
+                                const uint8_t qs = b_ptr[l].qs[32 * k + 4 * j + i];
+                                const uint8_t qh = b_ptr[l].qh[4 * j + i];
+                                const int v0 = ((qs & 0x0F) | (((qh >> k)       & 1) << 4)) - 16;
+                                const int v1 = ((qs >>   4) | (((qh >> (k + 4)) & 1) << 4)) - 16;
+                                sumi += v0 * a_ptr[l].qs[(e0 / blocklen) * 4 * blocklen + m * blocklen + e0 % blocklen] +
+                                        v1 * a_ptr[l].qs[(e1 / blocklen) * 4 * blocklen + m * blocklen + e1 % blocklen];
+                            }
+                        }
+                        sumf[m][j] += sumi * GGML_FP16_TO_FP32(b_ptr[l].d[j]) * GGML_FP16_TO_FP32(a_ptr[l].d[m]);
+                    }
+                }
+            }
+            for (int m = 0; m < 4; m++) {
+                for (int j = 0; j < ncols_interleaved; j++)
+                    s[(y * 4 + m) * bs + x * ncols_interleaved + j] = sumf[m][j];
+            }
+        }
+    }
+}
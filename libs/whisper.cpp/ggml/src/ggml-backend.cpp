@@ -2239,6 +2239,141 @@ ggml_backend_buffer_type_t ggml_backend_cpu_hbm_buffer_type(void) {
 }
 #endif
 
+// buffer type with placed pages: huge pages, NUMA nodes
+
+#if defined(__linux__)
+
+#include <sys/mman.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#ifndef MAP_HUGE_2MB
+#define MAP_HUGE_2MB (21 << MAP_HUGE_SHIFT)
+#endif
+
+#define GGML_CPU_HUGE_PAGE_SIZE ((size_t) 2*1024*1024)
+
+struct ggml_backend_cpu_placed_buffer_type_context {
+    enum ggml_cpu_hugepages hugepages;
+    bool                    numa;
+    const char *            name;
+};
+
+static const char * ggml_backend_cpu_placed_buffer_type_get_name(ggml_backend_buffer_type_t buft) {
+    return ((const ggml_backend_cpu_placed_buffer_type_context *) buft->context)->name;
+}
+
+static void ggml_backend_cpu_placed_buffer_free_buffer(ggml_backend_buffer_t buffer) {
+    munmap(buffer->context, GGML_PAD(buffer->size, GGML_CPU_HUGE_PAGE_SIZE));
+}
+
+// size: multiple of GGML_CPU_HUGE_PAGE_SIZE
+static void * ggml_backend_cpu_placed_map(size_t size, enum ggml_cpu_hugepages hugepages) {
+    if (hugepages == GGML_CPU_HUGEPAGES_HUGETLB) {
+        void * data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_HUGE_2MB, -1, 0);
+        if (data != MAP_FAILED) {
+            return data;
+        }
+        GGML_LOG_WARN("%s: not enough huge pages reserved for %.2f MB (vm.nr_hugepages), using transparent huge pages\n",
+                __func__, size/(1024.0*1024.0));
+    }
+
+    // map one huge page more and trim it, so that the buffer starts on a huge page boundary and can be backed by
+    // huge pages from the first byte
+    char * base = (char *) mmap(NULL, size + GGML_CPU_HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == MAP_FAILED) {
+        return NULL;
+    }
+
+    char * data = (char *) GGML_PAD((uintptr_t) base, GGML_CPU_HUGE_PAGE_SIZE);
+    if (data > base) {
+        munmap(base, data - base);
+    }
+    munmap(data + size, base + GGML_CPU_HUGE_PAGE_SIZE - data);
+
+    if (hugepages != GGML_CPU_HUGEPAGES_NONE && madvise(data, size, MADV_HUGEPAGE) != 0) {
+        GGML_LOG_WARN("%s: madvise(MADV_HUGEPAGE) failed, transparent huge pages not available\n", __func__);
+    }
+
+    return data;
+}
+
+static ggml_backend_buffer_t ggml_backend_cpu_placed_buffer_type_alloc_buffer(ggml_backend_buffer_type_t buft, size_t size) {
+    const auto * ctx = (const ggml_backend_cpu_placed_buffer_type_context *) buft->context;
+
+    const size_t size_map = GGML_PAD(size, GGML_CPU_HUGE_PAGE_SIZE);
+
+    void * data = ggml_backend_cpu_placed_map(size_map, ctx->hugepages);
+    if (data == NULL) {
+        GGML_LOG_ERROR("%s: failed to allocate buffer of size %zu\n", __func__, size);
+        return NULL;
+    }
+
+    // the pages are placed when they are first touched, so the policy has to be set before anything is written
+    if (ctx->numa) {
+        ggml_numa_place(data, size_map);
+    }
+
+    ggml_backend_buffer_t buffer = ggml_backend_cpu_buffer_from_ptr(data, size);
+    buffer->buft = buft;
+    buffer->iface.free_buffer = ggml_backend_cpu_placed_buffer_free_buffer;
+
+    return buffer;
+}
+
+ggml_backend_buffer_type_t ggml_backend_cpu_placed_buffer_type(enum ggml_cpu_hugepages hugepages, bool numa) {
+    GGML_ASSERT(hugepages >= 0 && hugepages < GGML_CPU_HUGEPAGES_COUNT);
+
+    if (hugepages == GGML_CPU_HUGEPAGES_NONE && !numa) {
+        return ggml_backend_cpu_buffer_type();
+    }
+
+    static ggml_backend_cpu_placed_buffer_type_context ctxs[GGML_CPU_HUGEPAGES_COUNT][2] = {
+        { { GGML_CPU_HUGEPAGES_NONE,    false, "CPU"         }, { GGML_CPU_HUGEPAGES_NONE,    true, "CPU_NUMA"         } },
+        { { GGML_CPU_HUGEPAGES_THP,     false, "CPU_THP"     }, { GGML_CPU_HUGEPAGES_THP,     true, "CPU_THP_NUMA"     } },
+        { { GGML_CPU_HUGEPAGES_HUGETLB, false, "CPU_HugeTLB" }, { GGML_CPU_HUGEPAGES_HUGETLB, true, "CPU_HugeTLB_NUMA" } },
+    };
+
+    static ggml_backend_buffer_type bufts[GGML_CPU_HUGEPAGES_COUNT][2];
+
+    static const bool initialized = [] {
+        for (int h = 0; h < GGML_CPU_HUGEPAGES_COUNT; ++h) {
+            for (int n = 0; n < 2; ++n) {
+                bufts[h][n] = {
+                    /* .iface   = */ {
+                        /* .get_name         = */ ggml_backend_cpu_placed_buffer_type_get_name,
+                        /* .alloc_buffer     = */ ggml_backend_cpu_placed_buffer_type_alloc_buffer,
+                        /* .get_alignment    = */ ggml_backend_cpu_buffer_type_get_alignment,
+                        /* .get_max_size     = */ NULL, // defaults to SIZE_MAX
+                        /* .get_alloc_size   = */ NULL, // defaults to ggml_nbytes
+                        /* .is_host          = */ ggml_backend_cpu_buffer_type_is_host,
+                    },
+                    /* .device  = */ ggml_backend_reg_dev_get(ggml_backend_cpu_reg(), 0),
+                    /* .context = */ &ctxs[h][n],
+                };
+            }
+        }
+        return true;
+    }();
+
+    GGML_UNUSED(initialized);
+
+    return &bufts[hugepages][numa];
+}
+
+#else
+
+ggml_backend_buffer_type_t ggml_backend_cpu_placed_buffer_type(enum ggml_cpu_hugepages hugepages, bool numa) {
+    // TODO: huge pages and NUMA placement outside of Linux
+    GGML_UNUSED(hugepages);
+    GGML_UNUSED(numa);
+
+    return ggml_backend_cpu_buffer_type();
+}
+
+#endif
+
 static ggml_backend_buffer_type_t * ggml_backend_cpu_get_extra_bufts(ggml_backend_dev_t device) {
     static ggml_backend_buffer_type_t bufts[] = {
 #ifdef GGML_USE_CPU_HBM
@@ -2263,6 +2398,9 @@ struct ggml_backend_cpu_context {
 
     ggml_abort_callback abort_callback;
     void *              abort_callback_data;
+
+    bool                cpumask[GGML_MAX_N_THREADS];
+    bool                use_cpumask;
 };
 
 static const char * ggml_backend_cpu_get_name(ggml_backend_t backend) {
@@ -2301,6 +2439,7 @@ static ggml_backend_graph_plan_t ggml_backend_cpu_graph_plan_create(ggml_backend
 
     cpu_plan->cplan.abort_callback      = cpu_ctx->abort_callback;
     cpu_plan->cplan.abort_callback_data = cpu_ctx->abort_callback_data;
+    cpu_plan->cplan.cpumask             = cpu_ctx->use_cpumask ? cpu_ctx->cpumask : NULL;
 
     return cpu_plan;
 }
@@ -2340,6 +2479,7 @@ static enum ggml_status ggml_backend_cpu_graph_compute(ggml_backend_t backend, s
 
     cplan.abort_callback      = cpu_ctx->abort_callback;
     cplan.abort_callback_data = cpu_ctx->abort_callback_data;
+    cplan.cpumask             = cpu_ctx->use_cpumask ? cpu_ctx->cpumask : NULL;
 
     return ggml_graph_compute(cgraph, &cplan);
 }
@@ -2380,6 +2520,7 @@ ggml_backend_t ggml_backend_cpu_init(void) {
     ctx->work_size           = 0;
     ctx->abort_callback      = NULL;
     ctx->abort_callback_data = NULL;
+    ctx->use_cpumask         = false;
 
     ggml_backend_t cpu_backend = new ggml_backend {
         /* .guid      = */ ggml_backend_cpu_guid(),
@@ -2427,6 +2568,16 @@ void ggml_backend_cpu_set_abort_callback(ggml_backend_t backend_cpu, ggml_abort_
     ctx->abort_callback_data = abort_callback_data;
 }
 
+void ggml_backend_cpu_set_cpumask(ggml_backend_t backend_cpu, const bool * cpumask) {
+    GGML_ASSERT(ggml_backend_is_cpu(backend_cpu));
+
+    struct ggml_backend_cpu_context * ctx = (struct ggml_backend_cpu_context *)backend_cpu->context;
+    ctx->use_cpumask = cpumask != NULL;
+    if (cpumask) {
+        memcpy(ctx->cpumask, cpumask, sizeof(ctx->cpumask));
+    }
+}
+
 ggml_backend_buffer_t ggml_backend_cpu_buffer_from_ptr(void * ptr, size_t size) {
     GGML_ASSERT((uintptr_t)ptr % TENSOR_ALIGNMENT == 0 && "buffer pointer must be aligned");
     return ggml_backend_buffer_init(ggml_backend_cpu_buffer_from_ptr_type(), ggml_backend_cpu_buffer_from_ptr_i, ptr, size);
@@ -2566,10 +2717,13 @@ static bool ggml_backend_cpu_device_supports_op(ggml_backend_dev_t dev, const st
                 op->type != GGML_TYPE_IQ1_S   &&
                 op->type != GGML_TYPE_IQ1_M; // missing type_traits.from_float
         case GGML_OP_MUL_MAT:
+        case GGML_OP_MUL_MAT_BIAS:
             //return op->src[1]->type == GGML_TYPE_F32; // TMP: workaround until sync with latest ggml
             return op->src[1]->type == GGML_TYPE_F32 || op->src[1]->type == ggml_get_type_traits_cpu(op->src[0]->type)->vec_dot_type;
         case GGML_OP_ROPE_BACK:
             return op->src[2] == NULL && (op->op_params[2] & 4) == 0;
+        case GGML_OP_CONV_1D:
+            return (op->src[0]->type == GGML_TYPE_F16 || op->src[0]->type == GGML_TYPE_F32) && op->src[1]->type == GGML_TYPE_F32;
         case GGML_OP_IM2COL_BACK:
             return op->src[0]->type == GGML_TYPE_F32 && op->src[1]->type == GGML_TYPE_F32;
         case GGML_OP_OUT_PROD:
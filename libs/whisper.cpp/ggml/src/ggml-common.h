@@ -215,6 +215,16 @@ typedef struct {
 } block_q4_0x8;
 static_assert(sizeof(block_q4_0x8) == 8 * sizeof(ggml_half) + QK4_0 * 4, "wrong q4_0x8 block size/padding");
 
+// 8 q5_0 blocks interleaved for 4-element dot products across the 8 rows:
+// qs[32*k + 4*r + e] holds element 4*k + e of row r in the low nibble and element 4*k + 16 + e in the high nibble,
+// bit s of qh[4*r + e] is the 5th bit of element 4*s + e of row r
+typedef struct {
+    ggml_half d[8];             // deltas for 8 q5_0 blocks
+    uint8_t qh[QK5_0];          // 5-th bit of quants for 8 q5_0 blocks
+    uint8_t qs[QK5_0 * 4];      // nibbles / quants for 8 q5_0 blocks
+} block_q5_0x8;
+static_assert(sizeof(block_q5_0x8) == 8 * sizeof(ggml_half) + QK5_0 + QK5_0 * 4, "wrong q5_0x8 block size/padding");
+
 typedef struct {
     ggml_half d[4];        // deltas for 4 q8_0 blocks
     int8_t qs[QK8_0 * 4];  // quants for 4 q8_0 blocks
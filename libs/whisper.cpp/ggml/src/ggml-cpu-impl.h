@@ -609,6 +609,54 @@ inline static float ggml_lookup_fp16_to_fp32(ggml_fp16_t f) {
 #define GGML_FP32_TO_FP16(x) GGML_COMPUTE_FP32_TO_FP16(x)
 #endif
 
+// vpdpbusd (u8 x s8 dot products into int32 lanes)
+// builds without AVX-VNNI / AVX512-VNNI compiled in look the instruction up with CPUID in ggml_cpu_init and the int8
+// kernels pick an encoding at run time; GGML_DPBUSD_CALL passes it to an inline kernel as a constant, so each
+// encoding gets its own copy of the loop
+enum ggml_dpbusd {
+    GGML_DPBUSD_NONE, // maddubs + madd
+    GGML_DPBUSD_VEX,  // AVX-VNNI
+    GGML_DPBUSD_EVEX, // AVX512-VNNI + AVX512VL
+};
+
+#if defined(__AVX2__) && defined(__GNUC__) && !defined(__AVXVNNI__) && !(defined(__AVX512VNNI__) && defined(__AVX512VL__))
+#define GGML_DPBUSD_RUNTIME
+
+extern int ggml_x86_dpbusd;
+
+#define GGML_DPBUSD_CALL(f, ...) \
+    (ggml_x86_dpbusd == GGML_DPBUSD_EVEX ? f(__VA_ARGS__, GGML_DPBUSD_EVEX) : \
+     ggml_x86_dpbusd == GGML_DPBUSD_VEX  ? f(__VA_ARGS__, GGML_DPBUSD_VEX)  : \
+                                           f(__VA_ARGS__, GGML_DPBUSD_NONE))
+#else
+#define GGML_DPBUSD_CALL(f, ...) f(__VA_ARGS__, GGML_DPBUSD_NONE)
+#endif
+
+#if defined(__AVX2__)
+// acc + the sums of 4 adjacent products of unsigned u and signed s, in 32-bit lanes
+// u * s pairs must not saturate int16 when there is no vpdpbusd
+static inline __m256i ggml_mm256_dpbusd(__m256i acc, const __m256i u, const __m256i s, const int dp) {
+#if defined(__AVXVNNI__) || (defined(__AVX512VNNI__) && defined(__AVX512VL__))
+    (void) dp;
+    return _mm256_dpbusd_epi32(acc, u, s);
+#else
+#if defined(GGML_DPBUSD_RUNTIME)
+    // encoded by hand, the build may not enable the instruction set
+    if (dp == GGML_DPBUSD_VEX) {
+        __asm__("%{vex%} vpdpbusd %2, %1, %0" : "+x"(acc) : "x"(u), "x"(s));
+        return acc;
+    }
+    if (dp == GGML_DPBUSD_EVEX) {
+        __asm__("vpdpbusd %2, %1, %0" : "+x"(acc) : "x"(u), "x"(s));
+        return acc;
+    }
+#endif
+    (void) dp;
+    return _mm256_add_epi32(acc, _mm256_madd_epi16(_mm256_set1_epi16(1), _mm256_maddubs_epi16(u, s)));
+#endif
+}
+#endif
+
 #ifdef __cplusplus
 }
 #endif
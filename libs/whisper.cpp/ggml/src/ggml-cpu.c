@@ -116,6 +116,10 @@ struct ggml_arm_arch_features_type {
 } ggml_arm_arch_features = {-1, -1, -1, 0};
 #endif
 
+#if defined(GGML_DPBUSD_RUNTIME)
+int ggml_x86_dpbusd = GGML_DPBUSD_NONE;
+#endif
+
 
 #if defined(_WIN32)
 
@@ -426,6 +430,14 @@ static const struct ggml_type_traits_cpu type_traits_cpu[GGML_TYPE_COUNT] = {
         .vec_dot_type             = GGML_TYPE_Q8_K,
         .nrows                    = 1,
     },
+    [GGML_TYPE_Q5_0_8_8] = {
+        .vec_dot                  = NULL,
+        .vec_dot_type             = GGML_TYPE_Q8_0,
+        .nrows                    = 1,
+        .ncols                    = 8,
+        .gemv                     = ggml_gemv_q5_0_8x8_q8_0,
+        .gemm                     = ggml_gemm_q5_0_8x8_q8_0,
+    },
 };
 
 const struct ggml_type_traits_cpu * ggml_get_type_traits_cpu(enum ggml_type type) {
@@ -1639,6 +1651,59 @@ inline static void ggml_vec_mad_f16(const int n, ggml_fp16_t * restrict y, const
 #endif
 }
 
+// y += v*x for an FP16 row x, accumulating in FP32
+inline static void ggml_vec_mad_f32_f16(const int n, float * restrict y, const ggml_fp16_t * restrict x, const float v) {
+    int i = 0;
+#if defined(__AVX512F__)
+    const __m512 vx = _mm512_set1_ps(v);
+    for (; i + 15 < n; i += 16) {
+        const __m512 x16 = _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)(x + i)));
+        _mm512_storeu_ps(y + i, _mm512_fmadd_ps(x16, vx, _mm512_loadu_ps(y + i)));
+    }
+#elif defined(__AVX2__) && defined(__F16C__) && defined(__FMA__)
+    const __m256 vx = _mm256_set1_ps(v);
+    for (; i + 7 < n; i += 8) {
+        const __m256 x8 = _mm256_cvtph_ps(_mm_loadu_si128((const __m128i *)(x + i)));
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(x8, vx, _mm256_loadu_ps(y + i)));
+    }
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    const float32x4_t vx = vdupq_n_f32(v);
+    for (; i + 3 < n; i += 4) {
+        const float32x4_t x4 = vcvt_f32_f16(vld1_f16((const ggml_fp16_internal_t *)(x + i)));
+        vst1q_f32(y + i, vfmaq_f32(vld1q_f32(y + i), x4, vx));
+    }
+#endif
+    for (; i < n; ++i) {
+        y[i] += GGML_FP16_TO_FP32(x[i])*v;
+    }
+}
+
+// y += v*x for a quantized row x, dequantizing block by block without a temporary row
+inline static void ggml_vec_mad_q8_0(const int n, float * restrict y, const block_q8_0 * restrict x, const float v) {
+    const int nb = n / QK8_0;
+
+    for (int ib = 0; ib < nb; ++ib) {
+        const float d = GGML_FP16_TO_FP32(x[ib].d)*v;
+
+        for (int j = 0; j < QK8_0; ++j) {
+            y[ib*QK8_0 + j] += d*x[ib].qs[j];
+        }
+    }
+}
+
+inline static void ggml_vec_mad_q4_0(const int n, float * restrict y, const block_q4_0 * restrict x, const float v) {
+    const int nb = n / QK4_0;
+
+    for (int ib = 0; ib < nb; ++ib) {
+        const float d = GGML_FP16_TO_FP32(x[ib].d)*v;
+
+        for (int j = 0; j < QK4_0/2; ++j) {
+            y[ib*QK4_0 + j]           += d*((x[ib].qs[j] & 0x0F) - 8);
+            y[ib*QK4_0 + j + QK4_0/2] += d*((x[ib].qs[j] >>   4) - 8);
+        }
+    }
+}
+
 // xs and vs are byte strides of x and v
 inline static void ggml_vec_mad_f32_unroll(const int n, const int xs, const int vs, float * restrict y, const float * restrict xv, const float * restrict vv) {
 
@@ -2412,6 +2477,69 @@ bool ggml_is_numa(void) {
     return g_state.numa.n_nodes > 1;
 }
 
+// memory policies of mbind(2), as in <numaif.h>
+#define GGML_MPOL_BIND       2
+#define GGML_MPOL_INTERLEAVE 3
+
+bool ggml_numa_place(void * data, size_t size) {
+#if defined(__gnu_linux__) && defined(SYS_mbind)
+    if (!ggml_is_numa()) {
+        return false;
+    }
+
+    unsigned long nodemask = 0;
+    int mode;
+
+    switch (g_state.numa.numa_strategy) {
+        case GGML_NUMA_STRATEGY_DISTRIBUTE:
+            // the threads are spread round-robin over the nodes and each reads all of the memory: interleave it
+            nodemask = (1ul << g_state.numa.n_nodes) - 1;
+            mode = GGML_MPOL_INTERLEAVE;
+            break;
+        case GGML_NUMA_STRATEGY_ISOLATE:
+            // the threads run on the node of the main thread: keep the memory there
+            nodemask = 1ul << g_state.numa.current_node;
+            mode = GGML_MPOL_BIND;
+            break;
+        case GGML_NUMA_STRATEGY_NUMACTL:
+            // the threads run on the cpuset numactl gave us: the nodes of its CPUs
+            for (uint32_t n = 0; n < g_state.numa.n_nodes; ++n) {
+                const struct ggml_numa_node * node = &g_state.numa.nodes[n];
+                for (uint32_t i = 0; i < node->n_cpus; ++i) {
+                    if (CPU_ISSET(node->cpus[i], &g_state.numa.cpuset)) {
+                        nodemask |= 1ul << n;
+                        break;
+                    }
+                }
+            }
+            mode = (nodemask & (nodemask - 1)) == 0 ? GGML_MPOL_BIND : GGML_MPOL_INTERLEAVE;
+            break;
+        default:
+            return false;
+    }
+
+    if (nodemask == 0) {
+        return false;
+    }
+
+    // mbind wants whole pages
+    const uintptr_t page  = (uintptr_t) sysconf(_SC_PAGESIZE);
+    const uintptr_t begin = (uintptr_t) data & ~(page - 1);
+    const uintptr_t end   = ((uintptr_t) data + size + page - 1) & ~(page - 1);
+
+    if (syscall(SYS_mbind, (void *) begin, end - begin, mode, &nodemask, 8*sizeof(nodemask), 0) != 0) {
+        GGML_LOG_WARN("%s: mbind failed: %s\n", __func__, strerror(errno));
+        return false;
+    }
+
+    return true;
+#else
+    UNUSED(data);
+    UNUSED(size);
+    return false;
+#endif
+}
+
 #if defined(__ARM_ARCH)
 
 #if defined(__linux__) && defined(__aarch64__)
@@ -2476,6 +2604,29 @@ static void ggml_init_arm_arch_features(void) {
 }
 #endif
 
+#if defined(GGML_DPBUSD_RUNTIME)
+#include <cpuid.h>
+
+static void ggml_init_x86_arch_features(void) {
+    unsigned int eax, ebx, ecx, edx;
+
+    if (__get_cpuid_count(7, 1, &eax, &ebx, &ecx, &edx) && (eax & (1u << 4))) { // AVX-VNNI
+        ggml_x86_dpbusd = GGML_DPBUSD_VEX;
+        return;
+    }
+
+    // AVX512-VNNI and AVX512VL, usable only if the OS saves the opmask and upper zmm state
+    if (__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx) && (ecx & (1u << 11)) && (ebx & (1u << 31)) &&
+        __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & (1u << 27))) {
+        unsigned int xcr0, xcr0_hi;
+        __asm__("xgetbv" : "=a"(xcr0), "=d"(xcr0_hi) : "c"(0));
+        if ((xcr0 & 0xe6) == 0xe6) {
+            ggml_x86_dpbusd = GGML_DPBUSD_EVEX;
+        }
+    }
+}
+#endif
+
 struct ggml_tensor * ggml_new_i32(struct ggml_context * ctx, int32_t value) {
     GGML_ASSERT(!ggml_get_no_alloc(ctx));
 
@@ -4499,6 +4650,7 @@ static void ggml_compute_forward_add(
         case GGML_TYPE_Q4_0_4_4:
         case GGML_TYPE_Q4_0_4_8:
         case GGML_TYPE_Q4_0_8_8:
+        case GGML_TYPE_Q5_0_8_8:
             {
                 ggml_compute_forward_add_q_f32(params, dst);
             } break;
@@ -4879,6 +5031,7 @@ static void ggml_compute_forward_add1(
         case GGML_TYPE_Q4_0_4_4:
         case GGML_TYPE_Q4_0_4_8:
         case GGML_TYPE_Q4_0_8_8:
+        case GGML_TYPE_Q5_0_8_8:
             {
                 ggml_compute_forward_add1_q_f32(params, dst);
             } break;
@@ -5009,6 +5162,7 @@ static void ggml_compute_forward_acc(
         case GGML_TYPE_Q4_0_4_4:
         case GGML_TYPE_Q4_0_4_8:
         case GGML_TYPE_Q4_0_8_8:
+        case GGML_TYPE_Q5_0_8_8:
         default:
             {
                 GGML_ABORT("fatal error");
@@ -6935,6 +7089,10 @@ static void ggml_compute_forward_norm_f32(
 
     GGML_ASSERT(eps > 0.0f);
 
+    // affine transform of ggml_norm_affine
+    const float * w = dst->src[1] ? (const float *) dst->src[1]->data : NULL;
+    const float * b = dst->src[2] ? (const float *) dst->src[2]->data : NULL;
+
     // TODO: optimize
     for (int64_t i03 = 0; i03 < ne03; i03++) {
         for (int64_t i02 = 0; i02 < ne02; i02++) {
@@ -6961,6 +7119,13 @@ static void ggml_compute_forward_norm_f32(
                 const float scale = 1.0f/sqrtf(variance + eps);
 
                 ggml_vec_scale_f32(ne00, y, scale);
+
+                if (w) {
+                    ggml_vec_mul_f32(ne00, y, y, w);
+                }
+                if (b) {
+                    ggml_vec_add_f32(ne00, y, y, b);
+                }
             }
         }
     }
@@ -7413,6 +7578,115 @@ static void ggml_compute_forward_mul_mat_one_chunk(
     }
 }
 
+// ggml_mul_mat_bias computes the product a block of src1 rows at a time and applies the bias and GELU to each block
+// while it is still in cache; a block is also small enough for its src1 rows to stay in L2 while the src0 rows stream
+// past, which llamafile_sgemm does not do on its own for long src1
+
+#define GGML_MUL_MAT_BIAS_BLOCK 64 // src1 rows per block, multiple of 4 (gemm)
+
+// bias and GELU of the dst block with columns [ir0_start, ir0_end) and rows [ir1_start, ir1_end)
+static void ggml_compute_forward_mul_mat_bias_block(
+    const struct ggml_tensor * dst,
+    const int64_t ir0_start,
+    const int64_t ir0_end,
+    const int64_t ir1_start,
+    const int64_t ir1_end) {
+
+    const struct ggml_tensor * bias = dst->src[2];
+
+    const bool gelu = ggml_get_op_params_i32(dst, 0) != 0;
+
+    GGML_TENSOR_LOCALS(int64_t, ne, dst, ne)
+    GGML_TENSOR_LOCALS(size_t,  nb, dst, nb)
+
+    if (ir0_start >= ir0_end) {
+        return;
+    }
+
+    const int n = ir0_end - ir0_start;
+
+    for (int64_t ir1 = ir1_start; ir1 < ir1_end; ++ir1) {
+        const int64_t i3 = (ir1 / (ne2 * ne1));
+        const int64_t i2 = (ir1 - i3 * ne2 * ne1) / ne1;
+        const int64_t i1 = (ir1 - i3 * ne2 * ne1 - i2 * ne1);
+
+        float * y = (float *) ((char *) dst->data + i1*nb1 + i2*nb2 + i3*nb3) + ir0_start;
+
+        if (bias) {
+            ggml_vec_add_f32(n, y, y, (const float *) bias->data + ir0_start);
+        }
+        if (gelu) {
+            ggml_vec_gelu_f32(n, y, y);
+        }
+    }
+}
+
+#if GGML_USE_LLAMAFILE
+// ggml_mul_mat_bias with llamafile_sgemm: all threads compute one block at a time, then each applies the bias and GELU
+// to a range of columns of it (llamafile_sgemm hands out its tiles by columns too, so this mostly reads back what the
+// thread wrote); src1 rows come from wdata in wtype, with strides nbw1, nbw2, nbw3
+// returns false, on every thread, if llamafile_sgemm does not take the types
+static bool ggml_compute_forward_mul_mat_bias_sgemm(
+    const struct ggml_compute_params * params,
+          struct ggml_tensor * dst,
+    const char * wdata,
+    const size_t nbw1,
+    const size_t nbw2,
+    const size_t nbw3,
+    const enum ggml_type wtype) {
+
+    const struct ggml_tensor * src0 = dst->src[0];
+    const struct ggml_tensor * src1 = dst->src[1];
+
+    GGML_TENSOR_BINARY_OP_LOCALS
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    // broadcast factors
+    const int64_t r2 = ne12 / ne02;
+    const int64_t r3 = ne13 / ne03;
+
+    // balanced blocks: either a single one or all at least half a block long, so they all pass the same size checks
+    // of llamafile_sgemm and every thread makes the same calls
+    const int64_t nblk = (ne11 + GGML_MUL_MAT_BIAS_BLOCK - 1) / GGML_MUL_MAT_BIAS_BLOCK;
+
+    const int64_t ir0_start = (ith * ne01) / nth;
+    const int64_t ir0_end   = ((ith + 1) * ne01) / nth;
+
+    for (int64_t i13 = 0; i13 < ne13; i13++) {
+        for (int64_t i12 = 0; i12 < ne12; i12++) {
+            for (int64_t ib = 0; ib < nblk; ib++) {
+                const int64_t i11_start = (ib * ne11) / nblk;
+                const int64_t i11_end   = ((ib + 1) * ne11) / nblk;
+
+                if (!llamafile_sgemm(ne01, i11_end - i11_start, ne00/ggml_blck_size(src0->type),
+                                     (const char *)src0->data + i12/r2*nb02 + i13/r3*nb03,
+                                     nb01/ggml_type_size(src0->type),
+                                     wdata + i11_start*nbw1 + i12*nbw2 + i13*nbw3,
+                                     nbw1/ggml_type_size(wtype),
+                                     (char *)dst->data + i11_start*nb1 + i12*nb2 + i13*nb3,
+                                     nb1/ggml_type_size(dst->type),
+                                     ith, nth,
+                                     src0->type,
+                                     wtype,
+                                     dst->type)) {
+                    return false;
+                }
+
+                ggml_barrier(params->threadpool);
+
+                const int64_t ir1 = (i13 * ne12 + i12) * ne11;
+
+                ggml_compute_forward_mul_mat_bias_block(dst, ir0_start, ir0_end, ir1 + i11_start, ir1 + i11_end);
+            }
+        }
+    }
+
+    return true;
+}
+#endif
+
 static void ggml_compute_forward_mul_mat(
         const struct ggml_compute_params * params,
               struct ggml_tensor * dst) {
@@ -7436,6 +7710,9 @@ static void ggml_compute_forward_mul_mat(
     ggml_gemv_t              const gemv                 = type_traits_cpu[type].gemv;
     ggml_gemm_t              const gemm                 = type_traits_cpu[type].gemm;
 
+    // bias and GELU of ggml_mul_mat_bias
+    const bool fused = dst->op == GGML_OP_MUL_MAT_BIAS;
+
     GGML_ASSERT(ne0 == ne01);
     GGML_ASSERT(ne1 == ne11);
     GGML_ASSERT(ne2 == ne12);
@@ -7462,6 +7739,12 @@ static void ggml_compute_forward_mul_mat(
     const bool src1_cont = ggml_is_contiguous(src1);
 
     if (src1_cont) {
+        if (fused) {
+            if (!ggml_compute_forward_mul_mat_bias_sgemm(params, dst, (const char *) src1->data, nb11, nb12, nb13, src1->type)) {
+                goto UseGgmlGemm1;
+            }
+            return;
+        }
         for (int64_t i13 = 0; i13 < ne13; i13++)
             for (int64_t i12 = 0; i12 < ne12; i12++)
                 if (!llamafile_sgemm(ne01, ne11, ne00/ggml_blck_size(src0->type),
@@ -7523,6 +7806,12 @@ UseGgmlGemm1:;
         const void* wdata = (src1->type == vec_dot_type) ? src1->data : params->wdata;
         const size_t row_size = ggml_row_size(vec_dot_type, ne10);
 
+        if (fused) {
+            if (!ggml_compute_forward_mul_mat_bias_sgemm(params, dst, (const char *) wdata, row_size, row_size*ne11, row_size*ne11*ne12, vec_dot_type)) {
+                goto UseGgmlGemm2;
+            }
+            return;
+        }
         for (int64_t i13 = 0; i13 < ne13; i13++)
             for (int64_t i12 = 0; i12 < ne12; i12++)
                 if (!llamafile_sgemm(ne01, ne11, ne00/ggml_blck_size(src0->type),
@@ -7593,15 +7882,29 @@ UseGgmlGemm2:;
         if (src0_start >= src0_end) return;
 
         // If there are more than three rows in src1, use gemm; otherwise, use gemv.
-        if (gemm && (ne11 > 3)) {
-            gemm(ne00, (float *)((char *) dst->data) + src0_start, ne01, (const char *) src0->data + src0_start * nb01,
-                 (const char *) src1_wdata, ne11 - ne11 % 4, src0_end - src0_start);
+        const int64_t ne11_gemm = gemm && (ne11 > 3) ? ne11 - ne11 % 4 : 0;
+
+        // ggml_mul_mat_bias: a block of src1 rows at a time
+        const int64_t blck_1 = fused ? GGML_MUL_MAT_BIAS_BLOCK : MAX(ne11_gemm, 1);
+
+        for (int64_t iir1 = 0; iir1 < ne11_gemm; iir1 += blck_1) {
+            const int64_t ne11_blk = MIN(blck_1, ne11_gemm - iir1);
+
+            gemm(ne00, (float *)((char *) dst->data + (iir1 * nb1)) + src0_start, ne01, (const char *) src0->data + src0_start * nb01,
+                 (const char *) src1_wdata + (src1_col_stride * iir1), ne11_blk, src0_end - src0_start);
+
+            if (fused) {
+                ggml_compute_forward_mul_mat_bias_block(dst, src0_start, MIN(src0_end, ne01), iir1, iir1 + ne11_blk);
+            }
         }
-        for (int iter = gemm ? ne11 - ne11 % 4 : 0; iter < ne11; iter++) {
+        for (int iter = ne11_gemm; iter < ne11; iter++) {
             gemv(ne00, (float *)((char *) dst->data + (iter * nb1)) + src0_start, ne01,
                  (const char *) src0->data + src0_start * nb01, (const char *) src1_wdata + (src1_col_stride * iter), 1,
                  src0_end - src0_start);
         }
+        if (fused) {
+            ggml_compute_forward_mul_mat_bias_block(dst, src0_start, MIN(src0_end, ne01), ne11_gemm, ne11);
+        }
         return;
     }
 
@@ -7620,6 +7923,10 @@ UseGgmlGemm2:;
 
         ggml_compute_forward_mul_mat_one_chunk(params, dst, num_rows_per_vec_dot, ir0_start, ir0_end, ir1_start, ir1_end);
 
+        if (fused) {
+            ggml_compute_forward_mul_mat_bias_block(dst, ir0_start, ir0_end, ir1_start, ir1_end);
+        }
+
         if (nth >= nchunk0 * nchunk1) {
             break;
         }
@@ -8075,6 +8382,7 @@ static void ggml_compute_forward_out_prod(
         case GGML_TYPE_Q4_0_4_4:
         case GGML_TYPE_Q4_0_4_8:
         case GGML_TYPE_Q4_0_8_8:
+        case GGML_TYPE_Q5_0_8_8:
             {
                 ggml_compute_forward_out_prod_q_f32(params, dst);
             } break;
@@ -8265,6 +8573,7 @@ static void ggml_compute_forward_set(
         case GGML_TYPE_Q4_0_4_4:
         case GGML_TYPE_Q4_0_4_8:
         case GGML_TYPE_Q4_0_8_8:
+        case GGML_TYPE_Q5_0_8_8:
         default:
             {
                 GGML_ABORT("fatal error");
@@ -8529,6 +8838,7 @@ static void ggml_compute_forward_get_rows(
         case GGML_TYPE_Q4_0_4_4:
         case GGML_TYPE_Q4_0_4_8:
         case GGML_TYPE_Q4_0_8_8:
+        case GGML_TYPE_Q5_0_8_8:
             {
                 ggml_compute_forward_get_rows_q(params, dst);
             } break;
@@ -9121,6 +9431,7 @@ static void ggml_compute_forward_clamp(
         case GGML_TYPE_Q4_0_4_4:
         case GGML_TYPE_Q4_0_4_8:
         case GGML_TYPE_Q4_0_8_8:
+        case GGML_TYPE_Q5_0_8_8:
         case GGML_TYPE_I8:
         case GGML_TYPE_I16:
         case GGML_TYPE_I32:
@@ -9859,6 +10170,195 @@ static void ggml_compute_forward_im2col(
     }
 }
 
+// ggml_compute_forward_conv_1d
+//
+// direct convolution: each thread packs a tile of output positions into a small im2col block in its work buffer and
+// multiplies the kernel rows with it, so the [N, OL, IC*K] im2col tensor is never materialized, and the bias and GELU
+// are applied to the output tile while it is still in cache
+// src0: kernel [OC, IC, K]
+// src1: data   [N, IC, L]
+// src2: bias   [OC] (optional)
+// dst:  result [N, OC, OL]
+
+#define GGML_CONV_1D_TILE 32 // output positions per tile
+
+// work buffer per thread, in floats
+static size_t ggml_conv_1d_wsize(const struct ggml_tensor * kernel) {
+    const int64_t KIC = kernel->ne[0]*kernel->ne[1];
+    const int64_t OC  = kernel->ne[2];
+
+    return GGML_CONV_1D_TILE*KIC                   // FP32 im2col tile
+         + GGML_CONV_1D_TILE*MAX(KIC/2 + 1, OC)    // product tile or FP16 im2col tile
+         + CACHE_LINE_SIZE_F32;
+}
+
+static void ggml_compute_forward_conv_1d(
+        const struct ggml_compute_params * params,
+              struct ggml_tensor * dst) {
+
+    const struct ggml_tensor * src0 = dst->src[0];
+    const struct ggml_tensor * src1 = dst->src[1];
+    const struct ggml_tensor * src2 = dst->src[2];
+
+    GGML_ASSERT(src0->type == GGML_TYPE_F16 || src0->type == GGML_TYPE_F32);
+    GGML_ASSERT(src1->type == GGML_TYPE_F32);
+    GGML_ASSERT( dst->type == GGML_TYPE_F32);
+
+    GGML_TENSOR_BINARY_OP_LOCALS
+
+    const int32_t s0   = ggml_get_op_params_i32(dst, 0);
+    const int32_t p0   = ggml_get_op_params_i32(dst, 1);
+    const int32_t d0   = ggml_get_op_params_i32(dst, 2);
+    const bool    gelu = ggml_get_op_params_i32(dst, 3) != 0;
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t K  = ne00;
+    const int64_t IC = ne01;
+    const int64_t OC = ne02;
+    const int64_t L  = ne10;
+    const int64_t N  = ne12;
+    const int64_t OL = ne0;
+
+    // length of a kernel row / packed row
+    const int64_t KIC = K*IC;
+
+    GGML_ASSERT(ne11 == IC);
+    GGML_ASSERT(ne1 == OC && ne2 == N);
+    GGML_ASSERT(ggml_is_contiguous(src0));
+    GGML_ASSERT(src2 == NULL || (src2->type == GGML_TYPE_F32 && ggml_is_contiguous(src2)));
+    GGML_ASSERT(nb10 == sizeof(float));
+    GGML_ASSERT(nb0  == sizeof(float));
+
+    const bool f16 = src0->type == GGML_TYPE_F16;
+
+    // parallelize by (batch, tile, block of output channels); the channels are only split when there are too few
+    // tiles to keep every thread busy, as each block repacks its tile
+
+    const int64_t TL  = GGML_CONV_1D_TILE;
+    const int64_t ntl = (OL + TL - 1)/TL;
+
+    int64_t noc = 1;
+    while (N*ntl*noc < 4*nth && OC/(2*noc) >= 64) {
+        noc *= 2;
+    }
+
+    const int64_t doc = GGML_PAD((OC + noc - 1)/noc, 16);
+
+    noc = (OC + doc - 1)/doc;
+
+    // total blocks
+    const int64_t nr = N*ntl*noc;
+
+    // blocks per thread
+    const int64_t dr = (nr + nth - 1)/nth;
+
+    // block range for this thread
+    const int64_t ir0 = dr*ith;
+    const int64_t ir1 = MIN(ir0 + dr, nr);
+
+    float       * X   = (float *) params->wdata + ith*ggml_conv_1d_wsize(src0); // im2col tile [nt, IC*K]
+    float       * Y   = X + TL*KIC;                                              // product tile [nt, doc] (mode 0)
+    ggml_fp16_t * X16 = (ggml_fp16_t *) Y;                                       // FP16 im2col tile (mode 1, 2)
+
+    // how the products are computed, falling back to the next one when llamafile_sgemm does not take the types:
+    // 0: Y = X*W^T with the FP32 tile, transposed into dst
+    // 1: dst = W*X^T with the FP16 tile (FP16 kernel)
+    // 2: dot products
+#if GGML_USE_LLAMAFILE
+    int mode = 0;
+#else
+    int mode = 2;
+#endif
+
+    // the tile currently packed in X
+    int64_t in_packed  = -1;
+    int64_t itl_packed = -1;
+
+    bool x16 = false;
+
+    for (int64_t ir = ir0; ir < ir1; ++ir) {
+        const int64_t ioc = ir%noc;
+        const int64_t itl = ir/noc%ntl;
+        const int64_t in  = ir/(noc*ntl);
+
+        const int64_t t0 = itl*TL;
+        const int64_t nt = MIN(TL, OL - t0);
+
+        const int64_t oc0 = ioc*doc;
+        const int64_t oc1 = MIN(oc0 + doc, OC);
+
+        if (in != in_packed || itl != itl_packed) {
+            for (int64_t iic = 0; iic < IC; ++iic) {
+                const float * x = (const float *) ((const char *) src1->data + in*nb12 + iic*nb11);
+
+                for (int64_t it = 0; it < nt; ++it) {
+                    for (int64_t ik = 0; ik < K; ++ik) {
+                        const int64_t ix = (t0 + it)*s0 + ik*d0 - p0;
+
+                        X[it*KIC + iic*K + ik] = ix >= 0 && ix < L ? x[ix] : 0.0f;
+                    }
+                }
+            }
+
+            in_packed  = in;
+            itl_packed = itl;
+            x16        = false;
+        }
+
+        char * w = (char *) src0->data + oc0*nb02;
+
+        float * y0 = (float *) ((char *) dst->data + in*nb2 + oc0*nb1) + t0;
+
+#if GGML_USE_LLAMAFILE
+        if (mode == 0 && !llamafile_sgemm(oc1 - oc0, nt, KIC,
+                    w, nb02/ggml_type_size(src0->type),
+                    X, KIC,
+                    Y, oc1 - oc0, 0, 1, src0->type, GGML_TYPE_F32, GGML_TYPE_F32)) {
+            mode = f16 ? 1 : 2;
+        }
+#endif
+        if (mode != 0 && f16 && !x16) {
+            ggml_fp32_to_fp16_row(X, X16, nt*KIC);
+            x16 = true;
+        }
+#if GGML_USE_LLAMAFILE
+        if (mode == 1 && !llamafile_sgemm(nt, oc1 - oc0, KIC,
+                    X16, KIC,
+                    w, nb02/ggml_type_size(src0->type),
+                    y0, nb1/sizeof(float), 0, 1, GGML_TYPE_F16, GGML_TYPE_F16, GGML_TYPE_F32)) {
+            mode = 2;
+        }
+#endif
+
+        for (int64_t i = oc0; i < oc1; ++i) {
+            float * y = (float *) ((char *) y0 + (i - oc0)*nb1);
+
+            if (mode == 0) {
+                for (int64_t it = 0; it < nt; ++it) {
+                    y[it] = Y[it*(oc1 - oc0) + (i - oc0)];
+                }
+            } else if (mode == 2) {
+                for (int64_t it = 0; it < nt; ++it) {
+                    if (f16) {
+                        ggml_vec_dot_f16(KIC, y + it, 0, (ggml_fp16_t *) (w + (i - oc0)*nb02), 0, X16 + it*KIC, 0, 1);
+                    } else {
+                        ggml_vec_dot_f32(KIC, y + it, 0, (float       *) (w + (i - oc0)*nb02), 0, X   + it*KIC, 0, 1);
+                    }
+                }
+            }
+
+            if (src2) {
+                ggml_vec_add1_f32(nt, y, y, ((const float *) src2->data)[i]);
+            }
+            if (gelu) {
+                ggml_vec_gelu_f32(nt, y, y);
+            }
+        }
+    }
+}
+
 // ggml_compute_forward_im2col_back_f32
 
 static void ggml_compute_forward_im2col_back_f32(
@@ -10690,14 +11190,9 @@ static void ggml_compute_forward_flash_attn_ext_f16(
 
         float       * VKQ32 = (float       *) params->wdata + ith*(3*D + CACHE_LINE_SIZE_F32); // FP32 VKQ accumulator
         float       * V32   =                 (VKQ32 + 1*D); // (temporary) FP32 V buffer
-        ggml_fp16_t * VKQ16 = (ggml_fp16_t *) (VKQ32 + 1*D); // (temporary) FP16 VKQ accumulator
         ggml_fp16_t * Q_q   = (ggml_fp16_t *) (VKQ32 + 2*D); // (temporary) buffer for Q converted to quantized/FP16
 
-        if (v->type == GGML_TYPE_F16) {
-            memset(VKQ16, 0, D*sizeof(ggml_fp16_t));
-        } else {
-            memset(VKQ32, 0, D*sizeof(float));
-        }
+        memset(VKQ32, 0, D*sizeof(float));
 
         const ggml_fp16_t * mp = mask ? (ggml_fp16_t *)((char *) mask->data + iq1*mask->nb[1]) : NULL;
 
@@ -10741,49 +11236,33 @@ static void ggml_compute_forward_flash_attn_ext_f16(
 
             const char * v_data = ((const char *) v->data + (ic*nbv1 + iv2*nbv2 + iv3*nbv3));
 
-            if (v->type == GGML_TYPE_F16) {
-                if (s > M) {
-                    // s is new maximum, ms < 1.0f, vs == expf(s - s) == 1.0f
-                    M = s;
-                    ms = expf(Mold - M);
-
-                    // V = V*expf(Mold - M)
-                    ggml_vec_scale_f16(D, VKQ16, ms);
-                } else {
-                    // no new maximum, ms == 1.0f, vs != 1.0f
-                    vs = expf(s - M);
-                }
+            if (s > M) {
+                // s is new maximum, ms < 1.0f, vs == expf(s - s) == 1.0f
+                M = s;
+                ms = expf(Mold - M);
 
-                // V += v*expf(s - M)
-                ggml_vec_mad_f16(D, VKQ16, (const ggml_fp16_t *) v_data, vs);
+                // V = V*expf(Mold - M)
+                ggml_vec_scale_f32(D, VKQ32, ms);
             } else {
-                if (s > M) {
-                    // s is new maximum, ms < 1.0f, vs == expf(s - s) == 1.0f
-                    M = s;
-                    ms = expf(Mold - M);
-
-                    // V = V*expf(Mold - M)
-                    ggml_vec_scale_f32(D, VKQ32, ms);
-                } else {
-                    // no new maximum, ms == 1.0f, vs != 1.0f
-                    vs = expf(s - M);
-                }
+                // no new maximum, ms == 1.0f, vs != 1.0f
+                vs = expf(s - M);
+            }
 
+            // V += v*expf(s - M)
+            if (v->type == GGML_TYPE_F16) {
+                ggml_vec_mad_f32_f16(D, VKQ32, (const ggml_fp16_t *) v_data, vs);
+            } else if (v->type == GGML_TYPE_Q8_0) {
+                ggml_vec_mad_q8_0(D, VKQ32, (const block_q8_0 *) v_data, vs);
+            } else if (v->type == GGML_TYPE_Q4_0) {
+                ggml_vec_mad_q4_0(D, VKQ32, (const block_q4_0 *) v_data, vs);
+            } else {
                 v_to_float(v_data, V32, D);
-
-                // V += v*expf(s - M)
                 ggml_vec_mad_f32(D, VKQ32, V32, vs);
             }
 
             S = S*ms + vs; // scale and increment sum with partial sum
         }
 
-        if (v->type == GGML_TYPE_F16) {
-            for (int64_t d = 0; d < D; ++d) {
-                VKQ32[d] = GGML_FP16_TO_FP32(VKQ16[d]);
-            }
-        }
-
         // V /= S
         const float S_inv = 1.0f/S;
         ggml_vec_scale_f32(D, VKQ32, S_inv);
@@ -10801,6 +11280,281 @@ static void ggml_compute_forward_flash_attn_ext_f16(
     }
 }
 
+// tiled variant for F16 K and V: a block of query rows is processed against a tile of KV rows at a time, so each K/V
+// tile is read once per block instead of once per query row, the KQ and VKQ products are small matrix products, and
+// the exponentials are computed a row of the tile at a time
+// ref: https://arxiv.org/pdf/2205.14135.pdf
+
+#define GGML_FA_TILE_Q  64  // query rows per block
+#define GGML_FA_TILE_KV 256 // KV rows per tile, multiple of 16
+#define GGML_FA_TILE_VT 16  // smaller blocks (decoding) add up the V rows directly instead of transposing the tile
+
+static bool ggml_flash_attn_ext_tiled(const struct ggml_tensor * q, const struct ggml_tensor * k, const struct ggml_tensor * v) {
+    return q->type == GGML_TYPE_F32 && k->type == GGML_TYPE_F16 && v->type == GGML_TYPE_F16 && q->ne[0] % 16 == 0;
+}
+
+// work buffer per thread, in floats
+static size_t ggml_flash_attn_ext_tiled_wsize(int64_t D) {
+    return GGML_FA_TILE_Q*GGML_FA_TILE_KV     // KQ tile
+         + 2*GGML_FA_TILE_Q*D                 // VKQ accumulator + tile product
+         + 3*GGML_FA_TILE_Q                   // row max, row sum, rescale
+         + D*GGML_FA_TILE_KV/2                // transposed FP16 V tile
+         + GGML_FA_TILE_Q*D/2                 // FP16 Q block (no sgemm)
+         + CACHE_LINE_SIZE_F32;
+}
+
+static void ggml_compute_forward_flash_attn_ext_f16_tiled(
+        const struct ggml_compute_params * params,
+        const struct ggml_tensor * q,
+        const struct ggml_tensor * k,
+        const struct ggml_tensor * v,
+        const struct ggml_tensor * mask,
+        struct ggml_tensor * dst) {
+
+    GGML_TENSOR_LOCALS(int64_t, neq, q,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbq, q,   nb)
+    GGML_TENSOR_LOCALS(int64_t, nek, k,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbk, k,   nb)
+    GGML_TENSOR_LOCALS(int64_t, nev, v,   ne)
+    GGML_TENSOR_LOCALS(size_t,  nbv, v,   nb)
+    GGML_TENSOR_LOCALS(int64_t, ne,  dst, ne)
+    GGML_TENSOR_LOCALS(size_t,  nb,  dst, nb)
+
+    const int ith = params->ith;
+    const int nth = params->nth;
+
+    const int64_t D = neq0;
+    const int64_t N = neq1;
+
+    GGML_ASSERT(ne0 == D);
+    GGML_ASSERT(ne2 == N);
+
+    // input tensor rows must be contiguous
+    GGML_ASSERT(nbq0 == ggml_type_size(q->type));
+    GGML_ASSERT(nbk0 == ggml_type_size(k->type));
+    GGML_ASSERT(nbv0 == ggml_type_size(v->type));
+
+    GGML_ASSERT(nek0 == D);
+    GGML_ASSERT(nev0 == D);
+    GGML_ASSERT(nev1 == nek1);
+
+    // dst cannot be transposed or permuted
+    GGML_ASSERT(nb0 == sizeof(float));
+    GGML_ASSERT(nb0 <= nb1);
+    GGML_ASSERT(nb1 <= nb2);
+    GGML_ASSERT(nb2 <= nb3);
+
+    // broadcast factors
+    const int64_t rk2 = neq2/nek2;
+    const int64_t rk3 = neq3/nek3;
+
+    const int64_t rv2 = neq2/nev2;
+    const int64_t rv3 = neq3/nev3;
+
+    // parallelize by blocks of q rows
+
+    const int64_t nqb = (N + GGML_FA_TILE_Q - 1)/GGML_FA_TILE_Q;
+
+    // total blocks
+    const int nr = nqb*neq2*neq3;
+
+    // blocks per thread
+    const int dr = (nr + nth - 1)/nth;
+
+    // block range for this thread
+    const int ir0 = dr*ith;
+    const int ir1 = MIN(ir0 + dr, nr);
+
+    float scale         = 1.0f;
+    float max_bias      = 0.0f;
+    float logit_softcap = 0.0f;
+
+    memcpy(&scale,         (float *) dst->op_params + 0, sizeof(float));
+    memcpy(&max_bias,      (float *) dst->op_params + 1, sizeof(float));
+    memcpy(&logit_softcap, (float *) dst->op_params + 2, sizeof(float));
+
+    if (logit_softcap != 0) {
+        scale /= logit_softcap;
+    }
+
+    const uint32_t n_head      = neq2;
+    const uint32_t n_head_log2 = 1u << (uint32_t) floor(log2(n_head));
+
+    const float m0 = powf(2.0f, -(max_bias       ) / n_head_log2);
+    const float m1 = powf(2.0f, -(max_bias / 2.0f) / n_head_log2);
+
+    const int64_t TQ  = GGML_FA_TILE_Q;
+    const int64_t TKV = GGML_FA_TILE_KV;
+
+    float       * KQ    = (float *) params->wdata + ith*ggml_flash_attn_ext_tiled_wsize(D); // KQ tile, then softmax numerators
+    float       * VKQ32 = KQ    + TQ*TKV;                     // FP32 VKQ accumulator
+    float       * VKQt  = VKQ32 + TQ*D;                       // VKQ of the current tile
+    float       * M     = VKQt  + TQ*D;                       // maximum KQ value per row
+    float       * S     = M     + TQ;                         // sum per row
+    float       * ms    = S     + TQ;                         // rescale of the accumulator per row
+    ggml_fp16_t * Vt    = (ggml_fp16_t *) (ms + TQ);          // V tile, transposed
+    ggml_fp16_t * Q16   = Vt + D*TKV;                         // FP16 Q block
+
+#if GGML_USE_LLAMAFILE
+    bool use_sgemm = true;
+#else
+    bool use_sgemm = false;
+#endif
+
+    for (int ir = ir0; ir < ir1; ++ir) {
+        // q indices
+        const int iq3 = ir/(neq2*nqb);
+        const int iq2 = (ir - iq3*neq2*nqb)/nqb;
+        const int iq1 = (ir - iq3*neq2*nqb - iq2*nqb)*TQ;
+
+        const int64_t nq = MIN(TQ, N - iq1);
+
+        const uint32_t h = iq2; // head index
+        const float slope = (max_bias > 0.0f) ? h < n_head_log2 ? powf(m0, h + 1) : powf(m1, 2*(h - n_head_log2) + 1) : 1.0f;
+
+        // k indices
+        const int ik3 = iq3 / rk3;
+        const int ik2 = iq2 / rk2;
+
+        // v indices
+        const int iv3 = iq3 / rv3;
+        const int iv2 = iq2 / rv2;
+
+        const char * q_data = (const char *) q->data + (iq1*nbq1 + iq2*nbq2 + iq3*nbq3);
+
+        bool q16 = false; // Q16 holds the block
+
+        for (int64_t iq = 0; iq < nq; ++iq) {
+            M[iq] = -INFINITY;
+            S[iq] = 0.0f;
+        }
+        memset(VKQ32, 0, nq*D*sizeof(float));
+
+        for (int64_t ic0 = 0; ic0 < nek1; ic0 += TKV) {
+            const int64_t nc = MIN(TKV, nek1 - ic0);
+            // the reduction over the tile is padded with zero probabilities / V columns to a multiple of 16
+            const int64_t nc16 = GGML_PAD(nc, 16);
+
+                  char * k_data = (      char *) k->data + (ic0*nbk1 + ik2*nbk2 + ik3*nbk3);
+            const char * v_data = (const char *) v->data + (ic0*nbv1 + iv2*nbv2 + iv3*nbv3);
+
+            // KQ = K*Q^T, one row of nc values per q row
+#if GGML_USE_LLAMAFILE
+            if (use_sgemm && !llamafile_sgemm(nc, nq, D,
+                        k_data, nbk1/sizeof(ggml_fp16_t),
+                        q_data, nbq1/sizeof(float),
+                        KQ, TKV, 0, 1, GGML_TYPE_F16, GGML_TYPE_F32, GGML_TYPE_F32)) {
+                use_sgemm = false;
+            }
+#endif
+            if (!use_sgemm) {
+                if (!q16) {
+                    for (int64_t iq = 0; iq < nq; ++iq) {
+                        ggml_fp32_to_fp16_row((const float *) (q_data + iq*nbq1), Q16 + iq*D, D);
+                    }
+                    q16 = true;
+                }
+                for (int64_t iq = 0; iq < nq; ++iq) {
+                    for (int64_t ic = 0; ic < nc; ++ic) {
+                        ggml_vec_dot_f16(D, KQ + iq*TKV + ic, 0, (ggml_fp16_t *) (k_data + ic*nbk1), 0, Q16 + iq*D, 0, 1);
+                    }
+                }
+            }
+
+            // online softmax over the tile
+            for (int64_t iq = 0; iq < nq; ++iq) {
+                float * s = KQ + iq*TKV;
+
+                if (logit_softcap != 0.0f) {
+                    for (int64_t ic = 0; ic < nc; ++ic) {
+                        s[ic] = logit_softcap*tanhf(s[ic]*scale);
+                    }
+                } else {
+                    ggml_vec_scale_f32(nc, s, scale);
+                }
+
+                if (mask) {
+                    const ggml_fp16_t * mp = (const ggml_fp16_t *) ((const char *) mask->data + (iq1 + iq)*mask->nb[1]) + ic0;
+                    for (int64_t ic = 0; ic < nc; ++ic) {
+                        s[ic] += slope*GGML_FP16_TO_FP32(mp[ic]);
+                    }
+                }
+
+                float Mnew = M[iq];
+                ggml_vec_max_f32(nc, &Mnew, s);
+                Mnew = MAX(Mnew, M[iq]);
+
+                if (Mnew == -INFINITY) {
+                    // everything so far is masked out
+                    memset(s, 0, nc16*sizeof(float));
+                    ms[iq] = 1.0f;
+                    continue;
+                }
+
+                ms[iq] = expf(M[iq] - Mnew);
+                M[iq]  = Mnew;
+
+                const ggml_float sum = ggml_vec_soft_max_f32(nc, s, s, Mnew);
+                S[iq] = S[iq]*ms[iq] + (float) sum;
+
+                memset(s + nc, 0, (nc16 - nc)*sizeof(float));
+            }
+
+            // VKQ = V^T*softmax(KQ)
+            bool vt = use_sgemm && nq >= GGML_FA_TILE_VT;
+#if GGML_USE_LLAMAFILE
+            if (vt) {
+                for (int64_t ic = 0; ic < nc; ++ic) {
+                    const ggml_fp16_t * vr = (const ggml_fp16_t *) (v_data + ic*nbv1);
+                    for (int64_t d = 0; d < D; ++d) {
+                        Vt[d*TKV + ic] = vr[d];
+                    }
+                }
+                for (int64_t d = 0; d < D; ++d) {
+                    memset(Vt + d*TKV + nc, 0, (nc16 - nc)*sizeof(ggml_fp16_t));
+                }
+
+                if (!llamafile_sgemm(D, nq, nc16,
+                            Vt, TKV,
+                            KQ, TKV,
+                            VKQt, D, 0, 1, GGML_TYPE_F16, GGML_TYPE_F32, GGML_TYPE_F32)) {
+                    use_sgemm = false;
+                    vt = false;
+                }
+            }
+#endif
+            if (!vt) {
+                memset(VKQt, 0, nq*D*sizeof(float));
+                for (int64_t ic = 0; ic < nc; ++ic) {
+                    for (int64_t iq = 0; iq < nq; ++iq) {
+                        ggml_vec_mad_f32_f16(D, VKQt + iq*D, (const ggml_fp16_t *) (v_data + ic*nbv1), KQ[iq*TKV + ic]);
+                    }
+                }
+            }
+
+            for (int64_t iq = 0; iq < nq; ++iq) {
+                ggml_vec_scale_f32(D, VKQ32 + iq*D, ms[iq]);
+                ggml_vec_acc_f32  (D, VKQ32 + iq*D, VKQt + iq*D);
+            }
+        }
+
+        for (int64_t iq = 0; iq < nq; ++iq) {
+            // V /= S
+            float * VKQ = VKQ32 + iq*D;
+
+            ggml_vec_scale_f32(D, VKQ, S[iq] > 0.0f ? 1.0f/S[iq] : 0.0f);
+
+            // dst indices
+            const int i1 = iq1 + iq;
+            const int i2 = iq2;
+            const int i3 = iq3;
+
+            // permute(0, 2, 1, 3)
+            memcpy((char *) dst->data + (i3*ne2*ne1 + i2 + i1*ne1)*nb1, VKQ, nb1);
+        }
+    }
+}
+
 static void ggml_compute_forward_flash_attn_ext(
         const struct ggml_compute_params * params,
         const struct ggml_tensor * q,
@@ -10813,7 +11567,11 @@ static void ggml_compute_forward_flash_attn_ext(
         case GGML_PREC_F32:
             {
                 // uses F32 accumulators
-                ggml_compute_forward_flash_attn_ext_f16(params, q, k, v, mask, dst);
+                if (ggml_flash_attn_ext_tiled(q, k, v)) {
+                    ggml_compute_forward_flash_attn_ext_f16_tiled(params, q, k, v, mask, dst);
+                } else {
+                    ggml_compute_forward_flash_attn_ext_f16(params, q, k, v, mask, dst);
+                }
             } break;
         default:
             {
@@ -12399,6 +13157,7 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
                 ggml_compute_forward_silu_back(params, tensor);
             } break;
         case GGML_OP_NORM:
+        case GGML_OP_NORM_AFFINE:
             {
                 ggml_compute_forward_norm(params, tensor);
             } break;
@@ -12415,6 +13174,7 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
                 ggml_compute_forward_group_norm(params, tensor);
             } break;
         case GGML_OP_MUL_MAT:
+        case GGML_OP_MUL_MAT_BIAS:
             {
                 ggml_compute_forward_mul_mat(params, tensor);
             } break;
@@ -12498,6 +13258,10 @@ static void ggml_compute_forward(struct ggml_compute_params * params, struct ggm
             {
                 ggml_compute_forward_clamp(params, tensor);
             } break;
+        case GGML_OP_CONV_1D:
+            {
+                ggml_compute_forward_conv_1d(params, tensor);
+            } break;
         case GGML_OP_CONV_TRANSPOSE_1D:
             {
                 ggml_compute_forward_conv_transpose_1d(params, tensor);
@@ -12816,11 +13580,13 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
         case GGML_OP_MUL:
         case GGML_OP_DIV:
         case GGML_OP_NORM:
+        case GGML_OP_NORM_AFFINE:
         case GGML_OP_RMS_NORM:
         case GGML_OP_RMS_NORM_BACK:
         case GGML_OP_GROUP_NORM:
         case GGML_OP_CONCAT:
         case GGML_OP_MUL_MAT:
+        case GGML_OP_MUL_MAT_BIAS:
         case GGML_OP_MUL_MAT_ID:
         case GGML_OP_OUT_PROD:
             {
@@ -12861,6 +13627,7 @@ static int ggml_get_n_tasks(struct ggml_tensor * node, int n_threads) {
             {
                 n_tasks = MIN(n_threads, ggml_nrows(node->src[0]));
             } break;
+        case GGML_OP_CONV_1D:
         case GGML_OP_IM2COL:
         case GGML_OP_IM2COL_BACK:
         case GGML_OP_CONV_TRANSPOSE_1D:
@@ -13134,6 +13901,26 @@ static bool ggml_thread_cpumask_is_valid(const bool * mask) {
     return false;
 }
 
+#if defined(_MSC_VER)
+#define GGML_THREAD_LOCAL __declspec(thread)
+#else
+#define GGML_THREAD_LOCAL _Thread_local
+#endif
+
+// pin the calling thread to the CPUs of mask (ggml_cplan.cpumask) unless the last call already did: the threads of
+// OpenMP and of a threadpool outlive the graphs, which mostly keep the same mask
+static void ggml_thread_apply_cpumask(const bool * mask) {
+    static GGML_THREAD_LOCAL bool current[GGML_MAX_N_THREADS];
+    static GGML_THREAD_LOCAL bool applied = false;
+
+    if (applied && memcmp(current, mask, GGML_MAX_N_THREADS) == 0) {
+        return;
+    }
+
+    memcpy(current, mask, GGML_MAX_N_THREADS);
+    applied = ggml_thread_cpumask_is_valid(current) && ggml_thread_apply_affinity(current);
+}
+
 static void ggml_thread_cpumask_next(const bool * global_mask, bool * local_mask, bool strict, int32_t* iter) {
     if (!strict) {
         memcpy(local_mask, global_mask, GGML_MAX_N_THREADS);
@@ -13284,6 +14071,7 @@ struct ggml_cplan ggml_graph_plan(
                     cur = ggml_type_size(node->type)*n_tasks;
                 } break;
             case GGML_OP_MUL_MAT:
+            case GGML_OP_MUL_MAT_BIAS:
                 {
                     const enum ggml_type vec_dot_type = type_traits_cpu[node->src[0]->type].vec_dot_type;
 
@@ -13316,6 +14104,10 @@ struct ggml_cplan ggml_graph_plan(
                 {
                     cur = ggml_type_size(GGML_TYPE_F32) * node->ne[0] * n_tasks;
                 } break;
+            case GGML_OP_CONV_1D:
+                {
+                    cur = sizeof(float)*ggml_conv_1d_wsize(node->src[0])*n_tasks;
+                } break;
             case GGML_OP_CONV_TRANSPOSE_1D:
                 {
                     GGML_ASSERT(node->src[0]->ne[3] == 1);
@@ -13360,7 +14152,11 @@ struct ggml_cplan ggml_graph_plan(
                 {
                     const int64_t ne00 = node->src[0]->ne[0]; // D
 
-                    cur = 3*sizeof(float)*ne00*n_tasks; // 3x head size/thread
+                    if (ggml_flash_attn_ext_tiled(node->src[0], node->src[1], node->src[2])) {
+                        cur = sizeof(float)*ggml_flash_attn_ext_tiled_wsize(ne00)*n_tasks;
+                    } else {
+                        cur = 3*sizeof(float)*ne00*n_tasks; // 3x head size/thread
+                    }
                 } break;
             case GGML_OP_FLASH_ATTN_BACK:
                 {
@@ -13413,6 +14209,10 @@ static thread_ret_t ggml_graph_compute_thread(void * data) {
     const struct ggml_cgraph * cgraph = tp->cgraph;
     const struct ggml_cplan  * cplan  = tp->cplan;
 
+    if (cplan->cpumask) {
+        ggml_thread_apply_cpumask(cplan->cpumask);
+    }
+
     set_numa_thread_affinity(state->ith);
 
     struct ggml_compute_params params = {
@@ -13759,6 +14559,60 @@ enum ggml_status ggml_graph_compute_with_ctx(struct ggml_context * ctx, struct g
     return ggml_graph_compute(cgraph, &cplan);
 }
 
+float ggml_cpu_vec_max_f32(int n, const float * x) {
+    int i = 0;
+    float max = -INFINITY;
+#if defined(__AVX__)
+    __m256 vmax = _mm256_set1_ps(-INFINITY);
+    for (; i + 7 < n; i += 8) {
+        vmax = _mm256_max_ps(vmax, _mm256_loadu_ps(x + i));
+    }
+    __m128 vmax4 = _mm_max_ps(_mm256_extractf128_ps(vmax, 1), _mm256_castps256_ps128(vmax));
+    vmax4 = _mm_max_ps(vmax4, _mm_movehl_ps(vmax4, vmax4));
+    vmax4 = _mm_max_ss(vmax4, _mm_movehdup_ps(vmax4));
+    max = _mm_cvtss_f32(vmax4);
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+    float32x4_t vmax = vdupq_n_f32(-INFINITY);
+    for (; i + 3 < n; i += 4) {
+        vmax = vmaxq_f32(vmax, vld1q_f32(x + i));
+    }
+    max = vmaxvq_f32(vmax);
+#endif
+    for (; i < n; ++i) {
+        max = MAX(max, x[i]);
+    }
+    return max;
+}
+
+double ggml_cpu_vec_soft_max_f32(int n, float * y, const float * x, float max) {
+    return ggml_vec_soft_max_f32(n, y, x, max);
+}
+
+enum ggml_type ggml_cpu_repack_type(enum ggml_type type, int64_t nrows) {
+#if defined(__AVX2__)
+    // the interleaved kernels take the rows 8 at a time
+    if (nrows % 8 == 0) {
+        switch (type) {
+            case GGML_TYPE_Q4_0: return GGML_TYPE_Q4_0_8_8;
+            case GGML_TYPE_Q5_0: return GGML_TYPE_Q5_0_8_8;
+            default: break;
+        }
+    }
+#else
+    GGML_UNUSED(nrows);
+#endif
+    return type;
+}
+
+void ggml_cpu_repack(enum ggml_type type, void * dst, const void * src, int64_t nrows, int64_t n_per_row) {
+    switch (type) {
+        case GGML_TYPE_Q4_0_8_8: repack_q4_0_8x8(src, dst, nrows, n_per_row); break;
+        case GGML_TYPE_Q5_0_8_8: repack_q5_0_8x8(src, dst, nrows, n_per_row); break;
+        default:
+            GGML_ABORT("%s: cannot repack to %s", __func__, ggml_type_name(type));
+    }
+}
+
 int ggml_cpu_has_neon(void) {
 #if defined(__ARM_ARCH)
     return ggml_arm_arch_features.has_neon;
@@ -13827,6 +14681,10 @@ void ggml_cpu_init(void) {
         ggml_init_arm_arch_features();
 #endif
 
+#if defined(GGML_DPBUSD_RUNTIME)
+        ggml_init_x86_arch_features();
+#endif
+
         is_first_call = false;
     }
 
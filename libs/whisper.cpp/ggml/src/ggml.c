@@ -852,6 +852,16 @@ static const struct ggml_type_traits type_traits[GGML_TYPE_COUNT] = {
         .from_float               = quantize_row_tq2_0,
         .from_float_ref           = (ggml_from_float_t) quantize_row_tq2_0_ref,
     },
+    [GGML_TYPE_Q5_0_8_8] = {
+        .type_name                = "q5_0_8x8",
+        .blck_size                = QK5_0,
+        .blck_size_interleave     = 8,
+        .type_size                = sizeof(block_q5_0),
+        .is_quantized             = true,
+        .to_float                 = NULL,
+        .from_float               = NULL,
+        .from_float_ref           = NULL,
+    },
 };
 
 const struct ggml_type_traits * ggml_get_type_traits(enum ggml_type type) {
@@ -927,11 +937,13 @@ static const char * GGML_OP_NAME[GGML_OP_COUNT] = {
     "CONCAT",
     "SILU_BACK",
     "NORM",
+    "NORM_AFFINE",
     "RMS_NORM",
     "RMS_NORM_BACK",
     "GROUP_NORM",
 
     "MUL_MAT",
+    "MUL_MAT_BIAS",
     "MUL_MAT_ID",
     "OUT_PROD",
 
@@ -953,6 +965,7 @@ static const char * GGML_OP_NAME[GGML_OP_COUNT] = {
     "ROPE",
     "ROPE_BACK",
     "CLAMP",
+    "CONV_1D",
     "CONV_TRANSPOSE_1D",
     "IM2COL",
     "IM2COL_BACK",
@@ -995,7 +1008,7 @@ static const char * GGML_OP_NAME[GGML_OP_COUNT] = {
     "OPT_STEP_ADAMW",
 };
 
-static_assert(GGML_OP_COUNT == 81, "GGML_OP_COUNT != 81");
+static_assert(GGML_OP_COUNT == 84, "GGML_OP_COUNT != 84");
 
 static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "none",
@@ -1022,11 +1035,13 @@ static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "concat(x, y)",
     "silu_back(x)",
     "norm(x)",
+    "norm_affine(x)",
     "rms_norm(x)",
     "rms_norm_back(x)",
     "group_norm(x)",
 
     "X*Y",
+    "X*Y+b",
     "X[i]*Y",
     "X*Y",
 
@@ -1048,6 +1063,7 @@ static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "rope(x)",
     "rope_back(x)",
     "clamp(x)",
+    "conv_1d(x)",
     "conv_transpose_1d(x)",
     "im2col(x)",
     "im2col_back(x)",
@@ -1090,7 +1106,7 @@ static const char * GGML_OP_SYMBOL[GGML_OP_COUNT] = {
     "adamw(x)",
 };
 
-static_assert(GGML_OP_COUNT == 81, "GGML_OP_COUNT != 81");
+static_assert(GGML_OP_COUNT == 84, "GGML_OP_COUNT != 84");
 
 static_assert(GGML_OP_POOL_COUNT == 2, "GGML_OP_POOL_COUNT != 2");
 
@@ -2612,6 +2628,29 @@ struct ggml_tensor * ggml_norm_inplace(
     return ggml_norm_impl(ctx, a, eps, true);
 }
 
+// ggml_norm_affine
+
+struct ggml_tensor * ggml_norm_affine(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * w,
+        struct ggml_tensor  * b,
+        float                 eps) {
+    GGML_ASSERT(w == NULL || (w->type == GGML_TYPE_F32 && ggml_is_contiguous(w) && ggml_nelements(w) == a->ne[0]));
+    GGML_ASSERT(b == NULL || (b->type == GGML_TYPE_F32 && ggml_is_contiguous(b) && ggml_nelements(b) == a->ne[0]));
+
+    struct ggml_tensor * result = ggml_dup_tensor(ctx, a);
+
+    ggml_set_op_params(result, &eps, sizeof(eps));
+
+    result->op     = GGML_OP_NORM_AFFINE;
+    result->src[0] = a;
+    result->src[1] = w;
+    result->src[2] = b;
+
+    return result;
+}
+
 // ggml_rms_norm
 
 static struct ggml_tensor * ggml_rms_norm_impl(
@@ -2733,6 +2772,31 @@ void ggml_mul_mat_set_prec(
     ggml_set_op_params_i32(a, 0, prec_i32);
 }
 
+// ggml_mul_mat_bias
+
+struct ggml_tensor * ggml_mul_mat_bias(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * c,
+        bool                  gelu) {
+    GGML_ASSERT(ggml_can_mul_mat(a, b));
+    GGML_ASSERT(!ggml_is_transposed(a));
+    GGML_ASSERT(c == NULL || (c->type == GGML_TYPE_F32 && ggml_is_contiguous(c) && ggml_nelements(c) == a->ne[1]));
+
+    const int64_t ne[4] = { a->ne[1], b->ne[1], b->ne[2], b->ne[3] };
+    struct ggml_tensor * result = ggml_new_tensor(ctx, GGML_TYPE_F32, 4, ne);
+
+    ggml_set_op_params_i32(result, 0, gelu ? 1 : 0);
+
+    result->op     = GGML_OP_MUL_MAT_BIAS;
+    result->src[0] = a;
+    result->src[1] = b;
+    result->src[2] = c;
+
+    return result;
+}
+
 // ggml_mul_mat_id
 
 /*
@@ -3740,6 +3804,40 @@ struct ggml_tensor* ggml_conv_1d_ph(
     return ggml_conv_1d(ctx, a, b, s, a->ne[0] / 2, d);
 }
 
+// ggml_conv_1d_direct
+
+struct ggml_tensor * ggml_conv_1d_direct(
+        struct ggml_context * ctx,
+        struct ggml_tensor  * a,
+        struct ggml_tensor  * b,
+        struct ggml_tensor  * c,
+        int                   s0,
+        int                   p0,
+        int                   d0,
+        bool                  gelu) {
+    GGML_ASSERT(a->ne[1] == b->ne[1]);
+    GGML_ASSERT(a->ne[3] == 1);
+    GGML_ASSERT(b->ne[3] == 1);
+    GGML_ASSERT(c == NULL || ggml_nelements(c) == a->ne[2]);
+
+    const int64_t OL = ggml_calc_conv_output_size(b->ne[0], a->ne[0], s0, p0, d0);
+
+    GGML_ASSERT((OL > 0) && "b too small compared to a");
+
+    const int64_t ne[4] = { OL, a->ne[2], b->ne[2], 1 };
+    struct ggml_tensor * result = ggml_new_tensor(ctx, GGML_TYPE_F32, 4, ne);
+
+    int32_t params[] = { s0, p0, d0, gelu ? 1 : 0 };
+    ggml_set_op_params(result, params, sizeof(params));
+
+    result->op     = GGML_OP_CONV_1D;
+    result->src[0] = a;
+    result->src[1] = b;
+    result->src[2] = c;
+
+    return result;
+}
+
 // ggml_conv_transpose_1d
 
 static int64_t ggml_calc_conv_transpose_1d_output_size(int64_t ins, int64_t ks, int s, int p, int d) {
@@ -5481,6 +5579,10 @@ static void ggml_compute_backward(struct ggml_context * ctx, struct ggml_tensor
             {
                 GGML_ABORT("fatal error"); // TODO: not implemented
             }
+        case GGML_OP_NORM_AFFINE:
+            {
+                GGML_ABORT("fatal error"); // TODO: not implemented
+            }
         case GGML_OP_RMS_NORM:
             {
                 // necessary for llama
@@ -5560,6 +5662,10 @@ static void ggml_compute_backward(struct ggml_context * ctx, struct ggml_tensor
                                 zero_table, acc_table);
                 }
             } break;
+        case GGML_OP_MUL_MAT_BIAS:
+            {
+                GGML_ABORT("fatal error"); // TODO: not implemented
+            }
         case GGML_OP_MUL_MAT_ID:
             {
                 GGML_ABORT("fatal error"); // TODO: not implemented
@@ -5861,6 +5967,10 @@ static void ggml_compute_backward(struct ggml_context * ctx, struct ggml_tensor
             {
                 GGML_ABORT("fatal error"); // TODO: not implemented
             }
+        case GGML_OP_CONV_1D:
+            {
+                GGML_ABORT("fatal error"); // TODO: not implemented
+            }
         case GGML_OP_CONV_TRANSPOSE_1D:
             {
                 GGML_ABORT("fatal error"); // TODO: not implemented
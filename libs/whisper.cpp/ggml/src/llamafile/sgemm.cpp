@@ -50,6 +50,7 @@
 
 #include "sgemm.h"
 #include "ggml-impl.h"
+#include "ggml-cpu-impl.h"
 #include "ggml-quants.h"
 
 #ifdef _MSC_VER
@@ -185,7 +186,12 @@ inline float hsum(__m256 x) {
 
 #if defined(__AVX512F__)
 inline float hsum(__m512 x) {
-    return _mm512_reduce_add_ps(x);
+    // the zero-masking extracts with an all-ones mask compile to the plain ones; the
+    // plain intrinsics (and the 512->256 casts built on them) start from an undefined
+    // __m256d that gcc reports as maybe-uninitialized at every inlined call
+    const __m512d d = _mm512_castps_pd(x);
+    return hsum(_mm256_add_ps(_mm256_castpd_ps(_mm512_maskz_extractf64x4_pd((__mmask8)-1, d, 0)),
+                              _mm256_castpd_ps(_mm512_maskz_extractf64x4_pd((__mmask8)-1, d, 1))));
 }
 #endif // __AVX512F__
 
@@ -231,7 +237,8 @@ template <> inline __m512 load(const float *p) {
     return _mm512_loadu_ps(p);
 }
 template <> inline __m512 load(const ggml_fp16_t *p) {
-    return _mm512_cvtph_ps(_mm256_loadu_si256((const __m256i *)p));
+    // maskz for the same reason as hsum(__m512)
+    return _mm512_maskz_cvtph_ps((__mmask16)-1, _mm256_loadu_si256((const __m256i *)p));
 }
 #endif // __AVX512F__
 
@@ -595,10 +602,21 @@ class tinyBLAS_Q0_AVX {
     }
 
     void matmul(int64_t m, int64_t n) {
-        mnpack(0, m, 0, n);
+#if defined(GGML_DPBUSD_RUNTIME)
+        switch (ggml_x86_dpbusd) {
+        case GGML_DPBUSD_VEX:
+            mnpack<GGML_DPBUSD_VEX>(0, m, 0, n);
+            return;
+        case GGML_DPBUSD_EVEX:
+            mnpack<GGML_DPBUSD_EVEX>(0, m, 0, n);
+            return;
+        }
+#endif
+        mnpack<GGML_DPBUSD_NONE>(0, m, 0, n);
     }
 
   private:
+    template <int DP>
     void mnpack(int64_t m0, int64_t m, int64_t n0, int64_t n) {
         int64_t mc, nc, mp, np;
         switch ((MIN(m - m0, 4) << 4) | MIN(n - n0, 4)) {
@@ -606,32 +624,32 @@ class tinyBLAS_Q0_AVX {
         case 0x44:
             mc = 4;
             nc = 4;
-            gemm<4, 4>(m0, m, n0, n);
+            gemm<4, 4, DP>(m0, m, n0, n);
             break;
         case 0x43:
             mc = 4;
             nc = 3;
-            gemm<4, 3>(m0, m, n0, n);
+            gemm<4, 3, DP>(m0, m, n0, n);
             break;
         case 0x34:
             mc = 3;
             nc = 4;
-            gemm<3, 4>(m0, m, n0, n);
+            gemm<3, 4, DP>(m0, m, n0, n);
             break;
         case 0x33:
             mc = 3;
             nc = 3;
-            gemm<3, 3>(m0, m, n0, n);
+            gemm<3, 3, DP>(m0, m, n0, n);
             break;
         case 0x42:
             mc = 4;
             nc = 2;
-            gemm<4, 2>(m0, m, n0, n);
+            gemm<4, 2, DP>(m0, m, n0, n);
             break;
         case 0x24:
             mc = 2;
             nc = 4;
-            gemm<2, 4>(m0, m, n0, n);
+            gemm<2, 4, DP>(m0, m, n0, n);
             break;
 #else
         case 0x44:
@@ -639,76 +657,76 @@ class tinyBLAS_Q0_AVX {
         case 0x42:
             mc = 4;
             nc = 2;
-            gemm<4, 2>(m0, m, n0, n);
+            gemm<4, 2, DP>(m0, m, n0, n);
             break;
         case 0x34:
         case 0x24:
             mc = 2;
             nc = 4;
-            gemm<2, 4>(m0, m, n0, n);
+            gemm<2, 4, DP>(m0, m, n0, n);
             break;
         case 0x33:
 #endif
         case 0x32:
             mc = 3;
             nc = 2;
-            gemm<3, 2>(m0, m, n0, n);
+            gemm<3, 2, DP>(m0, m, n0, n);
             break;
         case 0x23:
             mc = 2;
             nc = 3;
-            gemm<2, 3>(m0, m, n0, n);
+            gemm<2, 3, DP>(m0, m, n0, n);
             break;
         case 0x41:
             mc = 4;
             nc = 1;
-            gemm<4, 1>(m0, m, n0, n);
+            gemm<4, 1, DP>(m0, m, n0, n);
             break;
         case 0x22:
             mc = 2;
             nc = 2;
-            gemm<2, 2>(m0, m, n0, n);
+            gemm<2, 2, DP>(m0, m, n0, n);
             break;
         case 0x14:
             mc = 1;
             nc = 4;
-            gemm<1, 4>(m0, m, n0, n);
+            gemm<1, 4, DP>(m0, m, n0, n);
             break;
         case 0x31:
             mc = 3;
             nc = 1;
-            gemm<3, 1>(m0, m, n0, n);
+            gemm<3, 1, DP>(m0, m, n0, n);
             break;
         case 0x13:
             mc = 1;
             nc = 3;
-            gemm<1, 3>(m0, m, n0, n);
+            gemm<1, 3, DP>(m0, m, n0, n);
             break;
         case 0x21:
             mc = 2;
             nc = 1;
-            gemm<2, 1>(m0, m, n0, n);
+            gemm<2, 1, DP>(m0, m, n0, n);
             break;
         case 0x12:
             mc = 1;
             nc = 2;
-            gemm<1, 2>(m0, m, n0, n);
+            gemm<1, 2, DP>(m0, m, n0, n);
             break;
         case 0x11:
             mc = 1;
             nc = 1;
-            gemm<1, 1>(m0, m, n0, n);
+            gemm<1, 1, DP>(m0, m, n0, n);
             break;
         default:
             return;
         }
         mp = m0 + (m - m0) / mc * mc;
         np = n0 + (n - n0) / nc * nc;
-        mnpack(mp, m, n0, np);
-        mnpack(m0, m, np, n);
+        mnpack<DP>(mp, m, n0, np);
+        mnpack<DP>(m0, m, np, n);
     }
 
-    template <int RM, int RN>
+    template <int RM, int RN, int DP>
     NOINLINE void gemm(int64_t m0, int64_t m, int64_t n0, int64_t n) {
         int64_t ytiles = (m - m0) / RM;
         int64_t xtiles = (n - n0) / RN;
@@ -726,7 +744,7 @@ class tinyBLAS_Q0_AVX {
                 for (int64_t j = 0; j < RN; ++j)
                     for (int64_t i = 0; i < RM; ++i) {
 #if defined(__AVX2__)
-                        __m256 udTmp = updot(_mm256_sign_epi8(load(A + lda * (ii + i) + l),
+                        __m256 udTmp = updot<DP>(_mm256_sign_epi8(load(A + lda * (ii + i) + l),
                                                               load(A + lda * (ii + i) + l)),
                                              _mm256_sign_epi8(load(B + ldb * (jj + j) + l),
                                                               load(A + lda * (ii + i) + l)));
@@ -784,10 +802,41 @@ class tinyBLAS_Q0_AVX {
         return _mm_sub_epi8(_mm_and_si128(_mm_set1_epi8(15), _mm_srli_epi16(x, 4)), _mm_set1_epi8(8));
     }
 
+    inline __m256i load(const block_q5_0 *b) {
+        return _mm256_or_si256(denibble(b->qs), bittobyte(b->qh));
+    }
+
+    inline __m128i load0(const block_q5_0 *b) {
+        const __m128i x = _mm_loadu_si128((const __m128i *)(b->qs));
+        uint32_t x32;
+        memcpy(&x32, b->qh, sizeof(uint32_t));
+        __m128i qxl = _mm_and_si128(_mm_set1_epi8(15), x);
+        __m128i bytesl = _mm_cmpeq_epi8(_mm_set1_epi64x(-1),
+                                        _mm_or_si128(_mm_set1_epi64x(0x7fbfdfeff7fbfdfe),
+                                                     _mm_shuffle_epi8(_mm_set1_epi32(x32),
+                                                                      _mm_set_epi64x(0x0101010101010101, 0x0000000000000000))));
+        bytesl = _mm_andnot_si128(bytesl, _mm_set1_epi8((char)0xF0));
+        return _mm_or_si128(qxl, bytesl);
+    }
+
+    inline __m128i load1(const block_q5_0 *b) {
+        const __m128i x = _mm_loadu_si128((const __m128i *)(b->qs));
+        uint32_t x32;
+        memcpy(&x32, b->qh, sizeof(uint32_t));
+        __m128i qxh = _mm_and_si128(_mm_set1_epi8(15), _mm_srli_epi16(x, 4));
+        __m128i bytesh = _mm_cmpeq_epi8(_mm_set1_epi64x(-1),
+                                        _mm_or_si128(_mm_set1_epi64x(0x7fbfdfeff7fbfdfe),
+                                                     _mm_shuffle_epi8(_mm_set1_epi32(x32),
+                                                                      _mm_set_epi64x(0x0303030303030303, 0x0202020202020202))));
+        bytesh = _mm_andnot_si128(bytesh, _mm_set1_epi8((char)0xF0));
+        return _mm_or_si128(qxh, bytesh);
+    }
+
+    template <int DP>
     inline __m256 updot(__m256i u, __m256i s) {
         __m256i res;
-#if defined(__AVXVNNI__) || (defined(__AVX512VNNI__) && defined(__AVX512VL__))
-        res = _mm256_dpbusd_epi32(_mm256_setzero_si256(), u, s);
+#if defined(__AVX2__)
+        res = ggml_mm256_dpbusd(_mm256_setzero_si256(), u, s, DP);
 #else
         res = _mm256_madd_epi16(_mm256_set1_epi16(1), _mm256_maddubs_epi16(u, s));
 #endif
@@ -801,6 +850,19 @@ class tinyBLAS_Q0_AVX {
                                                         _mm_srli_epi16(x, 4), 1));
     }
 
+    // 0x00 where bit i of p is set and 0xF0 where it is clear, so that or-ing
+    // it into a nibble gives the signed value q5 - 16 of a q5_0 quant
+    static inline __m256i bittobyte(const uint8_t *p) {
+        uint32_t x32;
+        memcpy(&x32, p, sizeof(uint32_t));
+        __m256i bytes = _mm256_cmpeq_epi8(_mm256_set1_epi64x(-1),
+                                          _mm256_or_si256(_mm256_set1_epi64x(0x7fbfdfeff7fbfdfe),
+                                                          _mm256_shuffle_epi8(_mm256_set1_epi32(x32),
+                                                                              _mm256_set_epi64x(0x0303030303030303, 0x0202020202020202,
+                                                                                                0x0101010101010101, 0x0000000000000000))));
+        return _mm256_andnot_si256(bytes, _mm256_set1_epi8((char)0xF0));
+    }
+
     const TA *const A;
     const TB *const B;
     TC *const C;
@@ -813,6 +875,290 @@ class tinyBLAS_Q0_AVX {
 };
 #endif // __AVX__
 
+//////////////////////////////////////////////////////////////////////////////////////////
+// QUANT ONE AND K-QUANT MATRIX MULTIPLICATION
+
+#if defined(__AVX2__)
+/**
+ * Multiplies weights that carry a min (x = d * q + m) with the q8_1 or q8_K
+ * activations their vec_dot kernels expect.
+ *
+ * A block is split into sub-blocks of 32 quants with their own scale (one
+ * for q5_1, eight per q4_K/q5_K super-block). Each sub-block is decoded into
+ * unsigned bytes in a register and multiplied with the activations like the
+ * q4_0 tiles do; the mins are folded in once per block from the activation
+ * sums, so nothing is dequantized to memory.
+ */
+template <typename TA, typename TB, typename TC>
+class tinyBLAS_Q1_AVX {
+  public:
+    tinyBLAS_Q1_AVX(int64_t k,
+                    const TA *A, int64_t lda,
+                    const TB *B, int64_t ldb,
+                    TC *C, int64_t ldc,
+                    int ith, int nth)
+        : A(A), B(B), C(C), k(k), lda(lda), ldb(ldb), ldc(ldc), ith(ith), nth(nth) {
+    }
+
+    void matmul(int64_t m, int64_t n) {
+#if defined(GGML_DPBUSD_RUNTIME)
+        switch (ggml_x86_dpbusd) {
+        case GGML_DPBUSD_VEX:
+            mnpack<GGML_DPBUSD_VEX>(0, m, 0, n);
+            return;
+        case GGML_DPBUSD_EVEX:
+            mnpack<GGML_DPBUSD_EVEX>(0, m, 0, n);
+            return;
+        }
+#endif
+        mnpack<GGML_DPBUSD_NONE>(0, m, 0, n);
+    }
+
+  private:
+    template <int DP>
+    void mnpack(int64_t m0, int64_t m, int64_t n0, int64_t n) {
+        int64_t mc, nc, mp, np;
+        switch ((MIN(m - m0, 4) << 4) | MIN(n - n0, 4)) {
+#if VECTOR_REGISTERS == 32
+        case 0x44:
+            mc = 4;
+            nc = 4;
+            gemm<4, 4, DP>(m0, m, n0, n);
+            break;
+        case 0x43:
+            mc = 4;
+            nc = 3;
+            gemm<4, 3, DP>(m0, m, n0, n);
+            break;
+        case 0x34:
+            mc = 3;
+            nc = 4;
+            gemm<3, 4, DP>(m0, m, n0, n);
+            break;
+#else
+        case 0x44:
+        case 0x43:
+        case 0x34:
+#endif
+        case 0x33:
+            mc = 3;
+            nc = 3;
+            gemm<3, 3, DP>(m0, m, n0, n);
+            break;
+        case 0x42:
+            mc = 4;
+            nc = 2;
+            gemm<4, 2, DP>(m0, m, n0, n);
+            break;
+        case 0x24:
+            mc = 2;
+            nc = 4;
+            gemm<2, 4, DP>(m0, m, n0, n);
+            break;
+        case 0x32:
+            mc = 3;
+            nc = 2;
+            gemm<3, 2, DP>(m0, m, n0, n);
+            break;
+        case 0x23:
+            mc = 2;
+            nc = 3;
+            gemm<2, 3, DP>(m0, m, n0, n);
+            break;
+        case 0x41:
+            mc = 4;
+            nc = 1;
+            gemm<4, 1, DP>(m0, m, n0, n);
+            break;
+        case 0x22:
+            mc = 2;
+            nc = 2;
+            gemm<2, 2, DP>(m0, m, n0, n);
+            break;
+        case 0x14:
+            mc = 1;
+            nc = 4;
+            gemm<1, 4, DP>(m0, m, n0, n);
+            break;
+        case 0x31:
+            mc = 3;
+            nc = 1;
+            gemm<3, 1, DP>(m0, m, n0, n);
+            break;
+        case 0x13:
+            mc = 1;
+            nc = 3;
+            gemm<1, 3, DP>(m0, m, n0, n);
+            break;
+        case 0x21:
+            mc = 2;
+            nc = 1;
+            gemm<2, 1, DP>(m0, m, n0, n);
+            break;
+        case 0x12:
+            mc = 1;
+            nc = 2;
+            gemm<1, 2, DP>(m0, m, n0, n);
+            break;
+        case 0x11:
+            mc = 1;
+            nc = 1;
+            gemm<1, 1, DP>(m0, m, n0, n);
+            break;
+        default:
+            return;
+        }
+        mp = m0 + (m - m0) / mc * mc;
+        np = n0 + (n - n0) / nc * nc;
+        mnpack<DP>(mp, m, n0, np);
+        mnpack<DP>(m0, m, np, n);
+    }
+
+    template <int RM, int RN, int DP>
+    NOINLINE void gemm(int64_t m0, int64_t m, int64_t n0, int64_t n) {
+        int64_t ytiles = (m - m0) / RM;
+        int64_t xtiles = (n - n0) / RN;
+        int64_t tiles = xtiles * ytiles;
+        int64_t duty = (tiles + nth - 1) / nth;
+        int64_t start = duty * ith;
+        int64_t end = start + duty;
+        if (end > tiles)
+            end = tiles;
+        for (int64_t job = start; job < end; ++job) {
+            int64_t ii = m0 + job / xtiles * RM;
+            int64_t jj = n0 + job % xtiles * RN;
+            __m256 Cv[RN][RM] = {};
+            for (int64_t l = 0; l < k; ++l) {
+                float da[RM];
+                uint8_t sc[RM][NS];
+                for (int64_t i = 0; i < RM; ++i) {
+                    const __m256 mv = scales(A + lda * (ii + i) + l, da + i, sc[i]);
+                    for (int64_t j = 0; j < RN; ++j)
+                        Cv[j][i] = madd(mv, bsums(B + ldb * (jj + j) + l), Cv[j][i]);
+                }
+                __m256i Iv[RN][RM] = {};
+                for (int s = 0; s < NS; ++s) {
+                    __m256i av[RM];
+                    for (int64_t i = 0; i < RM; ++i)
+                        av[i] = load(A + lda * (ii + i) + l, s);
+                    for (int64_t j = 0; j < RN; ++j) {
+                        const __m256i bv = _mm256_loadu_si256((const __m256i *)(B[ldb * (jj + j) + l].qs + 32 * s));
+                        for (int64_t i = 0; i < RM; ++i)
+                            Iv[j][i] = NS == 1 ? ggml_mm256_dpbusd(Iv[j][i], av[i], bv, DP)
+                                               : _mm256_add_epi32(Iv[j][i],
+                                                                  _mm256_madd_epi16(_mm256_set1_epi16(sc[i][s]),
+                                                                                    _mm256_maddubs_epi16(av[i], bv)));
+                    }
+                }
+                for (int64_t j = 0; j < RN; ++j) {
+                    const float db = scale(B + ldb * (jj + j) + l);
+                    for (int64_t i = 0; i < RM; ++i)
+                        Cv[j][i] = madd(_mm256_set1_ps(da[i] * db),
+                                        _mm256_cvtepi32_ps(Iv[j][i]),
+                                        Cv[j][i]);
+                }
+            }
+            for (int64_t j = 0; j < RN; ++j)
+                for (int64_t i = 0; i < RM; ++i)
+                    C[ldc * (jj + j) + (ii + i)] = hsum(Cv[j][i]);
+        }
+    }
+
+    // number of 32-quant sub-blocks per block
+    static const int NS = sizeof(TB) == sizeof(block_q8_K) ? QK_K / 32 : 1;
+
+    // Stores the scale of `a` in `d` and the integer scales of its sub-blocks
+    // in `sc`, and returns its mins laid out to be multiplied lane-wise with
+    // bsums() of the matching B block.
+    static inline __m256 scales(const block_q5_1 *a, float *d, uint8_t *sc) {
+        *d = unhalf(a->d);
+        sc[0] = 1;
+        return _mm256_setr_ps(unhalf(a->m), 0, 0, 0, 0, 0, 0, 0);
+    }
+
+    template <typename TK>
+    static inline __m256 scales(const TK *a, float *d, uint8_t *sc) {
+        // unpack the 6-bit scales and mins, as in ggml_vec_dot_q4_K_q8_K
+        uint32_t utmp[4];
+        memcpy(utmp, a->scales, 12);
+        utmp[3] = ((utmp[2] >> 4) & 0x0f0f0f0f) | (((utmp[1] >> 6) & 0x03030303) << 4);
+        const uint32_t uaux = utmp[1] & 0x3f3f3f3f;
+        utmp[1] = (utmp[2] & 0x0f0f0f0f) | (((utmp[0] >> 6) & 0x03030303) << 4);
+        utmp[2] = uaux;
+        utmp[0] &= 0x3f3f3f3f;
+        memcpy(sc, utmp, 8);
+        *d = unhalf(a->d);
+        const __m256i mn = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(utmp + 2)));
+        return mul(_mm256_cvtepi32_ps(mn), _mm256_set1_ps(-unhalf(a->dmin)));
+    }
+
+    static inline __m256 bsums(const block_q8_1 *b) {
+        return _mm256_set1_ps(unhalf(b->s));
+    }
+
+    static inline __m256 bsums(const block_q8_K *b) {
+        const __m256i s = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *)b->bsums),
+                                            _mm256_set1_epi16(1));
+        return mul(_mm256_cvtepi32_ps(s), _mm256_set1_ps(b->d));
+    }
+
+    static inline float scale(const block_q8_1 *b) {
+        return unhalf(b->d);
+    }
+
+    static inline float scale(const block_q8_K *b) {
+        return b->d;
+    }
+
+    // sub-block s of `a` as unsigned bytes
+    static inline __m256i load(const block_q5_1 *a, int s) {
+        (void)s;
+        return _mm256_or_si256(denibble(a->qs),
+                               _mm256_and_si256(_mm256_set1_epi8(16), bittobyte(a->qh)));
+    }
+
+    static inline __m256i load(const block_q4_K *a, int s) {
+        const __m256i x = _mm256_loadu_si256((const __m256i *)(a->qs + 32 * (s >> 1)));
+        return _mm256_and_si256(_mm256_set1_epi8(15), _mm256_srli_epi16(x, 4 * (s & 1)));
+    }
+
+    static inline __m256i load(const block_q5_K *a, int s) {
+        const __m256i x = _mm256_loadu_si256((const __m256i *)(a->qs + 32 * (s >> 1)));
+        const __m256i h = _mm256_loadu_si256((const __m256i *)a->qh);
+        return _mm256_or_si256(_mm256_and_si256(_mm256_set1_epi8(15), _mm256_srli_epi16(x, 4 * (s & 1))),
+                               _mm256_slli_epi16(_mm256_and_si256(_mm256_set1_epi8(1), _mm256_srli_epi16(h, s)), 4));
+    }
+
+    static inline __m256i denibble(const uint8_t *p) {
+        __m128i x = _mm_loadu_si128((const __m128i *)p);
+        return _mm256_and_si256(_mm256_set1_epi8(15),
+                                _mm256_insertf128_si256(_mm256_castsi128_si256(x),
+                                                        _mm_srli_epi16(x, 4), 1));
+    }
+
+    // 0xFF where bit i of p is set
+    static inline __m256i bittobyte(const uint8_t *p) {
+        uint32_t x32;
+        memcpy(&x32, p, sizeof(uint32_t));
+        __m256i bytes = _mm256_or_si256(_mm256_set1_epi64x(0x7fbfdfeff7fbfdfe),
+                                        _mm256_shuffle_epi8(_mm256_set1_epi32(x32),
+                                                            _mm256_set_epi64x(0x0303030303030303, 0x0202020202020202,
+                                                                              0x0101010101010101, 0x0000000000000000)));
+        return _mm256_cmpeq_epi8(bytes, _mm256_set1_epi64x(-1));
+    }
+
+    const TA *const A;
+    const TB *const B;
+    TC *const C;
+    const int64_t k;
+    const int64_t lda;
+    const int64_t ldb;
+    const int64_t ldc;
+    const int ith;
+    const int nth;
+};
+#endif // __AVX2__
+
 } // namespace
 
 /**
@@ -1006,6 +1352,74 @@ bool llamafile_sgemm(int64_t m, int64_t n, int64_t k, const void *A, int64_t lda
 #endif
     }
 
+    case GGML_TYPE_Q5_0: {
+        if (Btype != GGML_TYPE_Q8_0)
+            return false;
+#if defined(__AVX2__) || defined(__AVX512F__) || defined(__AVX__)
+        tinyBLAS_Q0_AVX<block_q5_0, block_q8_0, float> tb{
+            k, (const block_q5_0 *)A, lda,
+            (const block_q8_0 *)B, ldb,
+            (float *)C, ldc,
+            ith, nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_Q5_1: {
+        if (Btype != GGML_TYPE_Q8_1)
+            return false;
+#if defined(__AVX2__)
+        tinyBLAS_Q1_AVX<block_q5_1, block_q8_1, float> tb{
+            k, (const block_q5_1 *)A, lda,
+            (const block_q8_1 *)B, ldb,
+            (float *)C, ldc,
+            ith, nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_Q4_K: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+        if (n < 4)
+            return false;  // ggml's K-quant gemv is faster for a few columns
+#if defined(__AVX2__)
+        tinyBLAS_Q1_AVX<block_q4_K, block_q8_K, float> tb{
+            k, (const block_q4_K *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            ith, nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    case GGML_TYPE_Q5_K: {
+        if (Btype != GGML_TYPE_Q8_K)
+            return false;
+        if (n < 4)
+            return false;  // ggml's K-quant gemv is faster for a few columns
+#if defined(__AVX2__)
+        tinyBLAS_Q1_AVX<block_q5_K, block_q8_K, float> tb{
+            k, (const block_q5_K *)A, lda,
+            (const block_q8_K *)B, ldb,
+            (float *)C, ldc,
+            ith, nth};
+        tb.matmul(m, n);
+        return true;
+#else
+        return false;
+#endif
+    }
+
     default:
         return false;
     }
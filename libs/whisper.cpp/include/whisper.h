@@ -118,6 +118,22 @@ extern "C" {
         bool  flash_attn;
         int   gpu_device;  // CUDA device
 
+        // KV cache types: GGML_TYPE_F16 (default), GGML_TYPE_Q8_0 or GGML_TYPE_Q4_0 - quantized caches halve or quarter
+        // the state memory and the bandwidth each decoded token needs; only used on the CPU backend, and the V caches
+        // are only quantized with flash_attn (they are stored transposed without it)
+        enum ggml_type type_kv_self;
+        enum ggml_type type_kv_cross;
+
+        // CPU weight and compute buffers: huge pages cut the dTLB misses of the large matrix multiplications, and with
+        // cpu_numa the pages go to the nodes the compute threads run on (call ggml_numa_init first)
+        enum ggml_cpu_hugepages cpu_hugepages;
+        bool                    cpu_numa;
+
+        // file of weights transformed for this CPU by an earlier load (see whisper_weight_cache_save), used instead of
+        // the tensors of the model file when it was made for the same CPU features and ggml formats and holds tensors
+        // of the same names, types and shapes - name it after the contents of the model; only read while loading
+        const char * weight_cache;
+
         // [EXPERIMENTAL] Token-level timestamps with DTW
         bool dtw_token_timestamps;
         enum whisper_alignment_heads_preset dtw_aheads_preset;
@@ -259,6 +275,16 @@ extern "C" {
     WHISPER_API void whisper_free_params(struct whisper_full_params * params);
     WHISPER_API void whisper_free_context_params(struct whisper_context_params * params);
 
+    // Weight cache: the tensors of a model with CPU weights as loaded (repacked for the matmul kernels of this CPU), to
+    // be mapped by later loads through whisper_context_params.weight_cache instead of converting the model file again
+    // Saving only reads the weights, so it can run while the context is used by other threads
+    // abort_callback (may be NULL) is polled between writes of at most 16 MB; when it returns true the save stops,
+    // removes what it wrote and fails without logging an error
+    // whisper_weight_cache_loaded() tells whether the weights of the context came from the cache
+    WHISPER_API int  whisper_weight_cache_save  (struct whisper_context * ctx, const char * path,
+                                                 ggml_abort_callback abort_callback, void * abort_callback_data);
+    WHISPER_API bool whisper_weight_cache_loaded(struct whisper_context * ctx);
+
     // Convert RAW PCM audio to log mel spectrogram.
     // The resulting spectrogram is stored inside the default state of the provided whisper context.
     // Returns 0 on success
@@ -307,6 +333,20 @@ extern "C" {
                                int   offset,
                                int   n_threads);
 
+    // Encode the first audio window of several states in a single pass of the encoder, so the weights are
+    // read once for the whole batch instead of once per state. Each state gets its own cross-attention cache.
+    // Make sure to call whisper_pcm_to_mel_with_state() or whisper_set_mel_with_state() on every state first.
+    // n_audio_ctx overrides the audio context for all states (0 - use default), same as whisper_full_params.audio_ctx
+    // A following whisper_full_with_state() call with n_samples == 0 and the same audio_ctx reuses the result.
+    // None of the states may be in use by another thread during the call.
+    // Returns 0 on success
+    WHISPER_API int whisper_encode_batch(
+            struct whisper_context * ctx,
+             struct whisper_state ** states,
+                               int   n_states,
+                               int   n_audio_ctx,
+                               int   n_threads);
+
     // Run the Whisper decoder to obtain the logits and probabilities for the next token.
     // Make sure to call whisper_encode() first.
     // tokens + n_tokens is the provided context for the decoder.
@@ -435,6 +475,20 @@ extern "C" {
     WHISPER_API void whisper_print_timings(struct whisper_context * ctx);
     WHISPER_API void whisper_reset_timings(struct whisper_context * ctx);
 
+    // High-water mark of the compute buffers of a state, in bytes: they are reserved on first use for the shapes of
+    // the requests (audio context, decoder batch, rounded up to buckets) and only grow when a request does not fit
+    WHISPER_API size_t whisper_compute_buffer_size_max_from_state(struct whisper_state * state);
+
+    // Pin the CPU compute threads of the encoder and of the decoder graphs of a state to the CPUs of a mask
+    // (GGML_MAX_N_THREADS entries, copied), NULL to leave their affinity as it is
+    // The threads keep their CPUs after a graph, until one with another mask runs on them
+    WHISPER_API void whisper_set_cpumask_with_state(struct whisper_state * state, const bool * cpumask_encode, const bool * cpumask_decode);
+
+    // Abort whisper_encode_with_state() and whisper_decode_with_state() on a state when the callback returns true
+    // (polled after every graph node on the CPU, between graphs elsewhere); they then fail without logging an error
+    // whisper_full_with_state() uses the callback of its params instead. NULL to remove it
+    WHISPER_API void whisper_set_abort_callback_with_state(struct whisper_state * state, ggml_abort_callback abort_callback, void * user_data);
+
     // Print system information
     WHISPER_API const char * whisper_print_system_info(void);
 
@@ -477,6 +531,9 @@ extern "C" {
         enum whisper_sampling_strategy strategy;
 
         int n_threads;
+        int n_threads_mel;      // threads of the log mel spectrogram, n_threads when 0
+        int n_threads_encode;   // threads of the encoder (and of language detection), n_threads when 0
+        int n_threads_decode;   // threads of the decoder, n_threads when 0
         int n_max_text_ctx;     // max tokens to use from past text as prompt for the decoder
         int offset_ms;          // start offset in ms
         int duration_ms;        // audio duration to process in ms
@@ -521,6 +578,13 @@ extern "C" {
         const char * language;
         bool detect_language;
 
+        // with a language set (and detect_language off), project the decoder output only onto the tokens written in
+        // the language's script plus the byte, special and timestamp tokens (a subset built once per model and
+        // language); tokens whose best candidate gets less than vocab_subset_thold of the restricted softmax are
+        // projected onto the full vocabulary instead
+        bool  vocab_subset;
+        float vocab_subset_thold;
+
         // common decoding parameters:
         bool suppress_blank;    // ref: https://github.com/openai/whisper/blob/f82bc59f5ea234d4b97fb2860842ed38519f7e65/whisper/decoding.py#L89
         bool suppress_non_speech_tokens; // ref: https://github.com/openai/whisper/blob/7858aa9c08d98f75575035ecd6481f462d66ca27/whisper/tokenizer.py#L224-L253
@@ -536,6 +600,11 @@ extern "C" {
         float logprob_thold;
         float no_speech_thold;  // TODO: not implemented
 
+        // give up on a temperature as soon as every decoder is bound to fail the checks above instead of
+        // decoding to the end of the window first: the average logprob can no longer reach logprob_thold,
+        // or the decoder has repeated the same phrase for a whole entropy window (assumed to go on)
+        bool fail_early;
+
         struct {
             int best_of;    // ref: https://github.com/openai/whisper/blob/f82bc59f5ea234d4b97fb2860842ed38519f7e65/whisper/transcribe.py#L264
         } greedy;
@@ -570,6 +639,15 @@ extern "C" {
         size_t                           n_grammar_rules;
         size_t                           i_start_rule;
         float                            grammar_penalty;
+
+        // speculative decoding: a smaller model with the same vocabulary and number of mel bins (e.g. tiny for
+        // large-v2) drafts up to draft_n_tokens tokens per step, which this model checks in one batched decode
+        // only used for greedy sampling at temperature 0; the accepted tokens are the ones greedy decoding picks
+        // both models decode with n_threads_decode threads; a draft_state without CPU masks of its own (see
+        // whisper_set_cpumask_with_state) runs on the CPUs of the state it drafts for
+        struct whisper_context * draft_ctx;
+        struct whisper_state   * draft_state; // created from draft_ctx, owned by the caller
+        int                      draft_n_tokens;
     };
 
     // NOTE: this function allocates memory, and it is the responsibility of the caller to free the pointer - see whisper_free_context_params & whisper_free_params()
@@ -617,6 +695,21 @@ extern "C" {
     // Language id associated with the provided state
     WHISPER_API int whisper_full_lang_id_from_state(struct whisper_state * state);
 
+    // Start (in 10 ms frames) of the audio window whisper_full_with_state() was working on when it returned.
+    // Segments before it are final, so a run stopped through abort_callback or encoder_begin_callback
+    // can be resumed from this point with whisper_full_params.offset_ms = 10*seek.
+    WHISPER_API int whisper_full_get_seek_from_state(struct whisper_state * state);
+
+    // Temperature fallbacks since the state was created, and how many of them whisper_full_params.fail_early
+    // started before the decoders reached the end of the window
+    WHISPER_API int whisper_full_n_fallbacks_from_state      (struct whisper_state * state);
+    WHISPER_API int whisper_full_n_fallbacks_early_from_state(struct whisper_state * state);
+
+    // Text context (prompt tokens plus the tokens of the finished windows) the next window would be decoded with.
+    // Passing it back as whisper_full_params.prompt_tokens when resuming continues the run as if it had not stopped.
+    // Returns the number of tokens, or the negative of the number needed if n_max_tokens is too small.
+    WHISPER_API int whisper_full_get_prompt_past_from_state(struct whisper_state * state, whisper_token * tokens, int n_max_tokens);
+
     // Get the start and end time of the specified segment
     WHISPER_API int64_t whisper_full_get_segment_t0           (struct whisper_context * ctx, int i_segment);
     WHISPER_API int64_t whisper_full_get_segment_t0_from_state(struct whisper_state * state, int i_segment);
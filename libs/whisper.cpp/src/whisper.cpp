@@ -48,7 +48,7 @@
 #include <cstring>
 #include <fstream>
 #include <map>
-#include <set>
+#include <mutex>
 #include <string>
 #include <thread>
 #include <vector>
@@ -61,6 +61,13 @@
 #pragma warning(disable: 4244 4267) // possible loss of data
 #endif
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 #if defined(GGML_BIG_ENDIAN)
 #include <bit>
 
@@ -165,6 +172,21 @@ static void whisper_log_callback_default(ggml_log_level level, const char * text
 #define WHISPER_MAX_DECODERS 8
 #define WHISPER_MAX_NODES 4096
 
+// the entropy check of the temperature fallback looks at the last WHISPER_ENTROPY_N tokens
+#define WHISPER_ENTROPY_N 32
+// longest phrase (in tokens) whisper_full_params.fail_early recognizes as a repetition loop
+#define WHISPER_REP_MAX_PERIOD 16
+// seq_ids the self-attention cache can tell apart (whisper_kv_cell::seq_mask)
+#define WHISPER_KV_MAX_SEQ 32
+// granularity of the self-attention window the decoder graph attends to (see whisper_decode_internal)
+#define WHISPER_DECODE_KV_BUCKET 32
+
+// the compute buffers of a state are reserved on first use, for shape buckets that grow with the requests: the audio
+// context rounded up to a multiple of WHISPER_AUDIO_CTX_BUCKET, the decoder batch to a power of two from
+// WHISPER_DECODE_TOKENS_BUCKET (see whisper_sched_reserve_encode/decode)
+#define WHISPER_AUDIO_CTX_BUCKET 256
+#define WHISPER_DECODE_TOKENS_BUCKET 8
+
 //
 // ggml helpers
 //
@@ -188,15 +210,22 @@ static bool ggml_graph_compute_helper(
     return ggml_graph_compute(graph, &plan);
 }
 
+// abort_callback is polled by the CPU backends after every graph node; an aborted graph returns false like a failed one
 static bool ggml_graph_compute_helper(
       ggml_backend_sched_t   sched,
         struct ggml_cgraph * graph,
-                       int   n_threads) {
+                       int   n_threads,
+                const bool * cpumask,
+       ggml_abort_callback   abort_callback,
+                      void * abort_callback_data,
+                      bool   reset = true) {
 
     for (int i = 0; i < ggml_backend_sched_get_n_backends(sched); ++i) {
         ggml_backend_t backend = ggml_backend_sched_get_backend(sched, i);
         if (ggml_backend_is_cpu(backend)) {
             ggml_backend_cpu_set_n_threads(backend, n_threads);
+            ggml_backend_cpu_set_cpumask(backend, cpumask);
+            ggml_backend_cpu_set_abort_callback(backend, abort_callback, abort_callback_data);
         }
 #ifdef GGML_USE_BLAS
         if (ggml_backend_is_blas(backend)) {
@@ -206,7 +235,9 @@ static bool ggml_graph_compute_helper(
     }
 
     bool t = ggml_backend_sched_graph_compute(sched, graph) == GGML_STATUS_SUCCESS;
-    ggml_backend_sched_reset(sched);
+    if (reset) {
+        ggml_backend_sched_reset(sched);
+    }
     return t;
 }
 
@@ -371,6 +402,44 @@ static const std::map<std::string, std::pair<int, std::string>> g_lang = {
     { "yue", { 99,  "cantonese",      } },
 };
 
+// writing systems of the languages, for the vocabulary subsets of language-locked runs (whisper_full_params.vocab_subset)
+// code point ranges besides ASCII, Latin-1 and general punctuation; languages not listed use the full vocabulary
+struct whisper_lang_script {
+    const char * langs; // space separated
+    bool fragments;     // keep tokens that hold only part of a multi-byte character
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;
+};
+
+static const std::vector<whisper_lang_script> g_lang_scripts = {
+    { "en", false, {} },
+    { "de es fr pt tr pl ca nl sv it id fi vi ms cs ro da hu no hr lt la mi cy sk lv az sl et br eu is bs sq sw gl sn yo so af oc uz fo ht tk nn mt lb tl mg haw ln ha jw su",
+        true, { { 0x0100, 0x024F }, { 0x0300, 0x036F }, { 0x1E00, 0x1EFF } } },
+    { "ru uk bg sr mk mn kk be tg tt ba", true, { { 0x0400, 0x052F } } },
+    { "el",          true, { { 0x0370, 0x03FF }, { 0x1F00, 0x1FFF } } },
+    { "ar fa ur sd ps", true, { { 0x0600, 0x06FF }, { 0x0750, 0x077F }, { 0xFB50, 0xFDFF }, { 0xFE70, 0xFEFF } } },
+    { "he yi",       true, { { 0x0590, 0x05FF }, { 0xFB1D, 0xFB4F } } },
+    { "hi mr ne sa", true, { { 0x0900, 0x097F } } },
+    { "bn as",       true, { { 0x0980, 0x09FF } } },
+    { "pa",          true, { { 0x0A00, 0x0A7F } } },
+    { "gu",          true, { { 0x0A80, 0x0AFF } } },
+    { "ta",          true, { { 0x0B80, 0x0BFF } } },
+    { "te",          true, { { 0x0C00, 0x0C7F } } },
+    { "kn",          true, { { 0x0C80, 0x0CFF } } },
+    { "ml",          true, { { 0x0D00, 0x0D7F } } },
+    { "si",          true, { { 0x0D80, 0x0DFF } } },
+    { "th",          true, { { 0x0E00, 0x0E7F } } },
+    { "lo",          true, { { 0x0E80, 0x0EFF } } },
+    { "bo",          true, { { 0x0F00, 0x0FFF } } },
+    { "my",          true, { { 0x1000, 0x109F } } },
+    { "ka",          true, { { 0x10A0, 0x10FF } } },
+    { "hy",          true, { { 0x0530, 0x058F } } },
+    { "km",          true, { { 0x1780, 0x17FF } } },
+    { "am",          true, { { 0x1200, 0x139F } } },
+    { "zh yue",      true, { { 0x3000, 0x303F }, { 0x3400, 0x4DBF }, { 0x4E00, 0x9FFF }, { 0xF900, 0xFAFF }, { 0xFF00, 0xFFEF } } },
+    { "ja",          true, { { 0x3000, 0x30FF }, { 0x31F0, 0x31FF }, { 0x3400, 0x4DBF }, { 0x4E00, 0x9FFF }, { 0xFF00, 0xFFEF } } },
+    { "ko",          true, { { 0x1100, 0x11FF }, { 0x3000, 0x303F }, { 0x3130, 0x318F }, { 0xAC00, 0xD7AF }, { 0xFF00, 0xFFEF } } },
+};
+
 // [EXPERIMENTAL] Token-level timestamps with DTW
 static const whisper_ahead g_aheads_tiny_en[]   = { {1, 0}, {2, 0}, {2, 5}, {3, 0}, {3, 1}, {3, 2}, {3, 3}, {3, 4} };
 static const whisper_ahead g_aheads_tiny[]      = { {2, 2}, {3, 0}, {3, 2}, {3, 3}, {3, 4}, {3, 5} };
@@ -423,8 +492,26 @@ struct whisper_vocab {
 
     int n_vocab = 51864;
 
-    std::map<token, id> token_to_id;
-    std::map<id, token> id_to_token;
+    // token strings, NUL-terminated in one arena: token i starts at token_text[token_offs[i]]
+    std::vector<char>     token_text;
+    std::vector<uint32_t> token_offs;
+
+    // byte trie over the token strings, used for exact lookups and by the
+    // tokenizer's longest-match; node 0 is the root and the edges of a node are
+    // contiguous in trie_edges, sorted by byte
+    struct trie_node {
+        id       tid = -1; // token ending at this node, or -1
+        uint32_t edge0 = 0;
+        uint32_t n_edges = 0;
+    };
+
+    struct trie_edge {
+        uint8_t  byte;
+        uint32_t node;
+    };
+
+    std::vector<trie_node> trie_nodes;
+    std::vector<trie_edge> trie_edges;
 
     // reference: https://github.com/openai/whisper/blob/248b6cb124225dd263bb9bd32d060b6517e067f8/whisper/tokenizer.py#L334-L349
     id token_eot        = 50256;
@@ -446,6 +533,130 @@ struct whisper_vocab {
     int num_languages() const {
         return n_vocab - 51765 - (is_multilingual() ? 1 : 0);
     }
+
+    int n_tokens() const {
+        return token_offs.empty() ? 0 : (int) token_offs.size() - 1;
+    }
+
+    const char * token_str(id tid) const {
+        return tid >= 0 && tid < n_tokens() ? token_text.data() + token_offs[tid] : "";
+    }
+
+    size_t token_len(id tid) const {
+        return tid >= 0 && tid < n_tokens() ? token_offs[tid + 1] - token_offs[tid] - 1 : 0;
+    }
+
+    // append the next token id
+    void add_token(const std::string & word) {
+        if (token_offs.empty()) {
+            token_offs.push_back(0);
+        }
+        token_text.insert(token_text.end(), word.begin(), word.end());
+        token_text.push_back('\0');
+        token_offs.push_back(token_text.size());
+    }
+
+    uint32_t trie_child(uint32_t node, uint8_t byte) const {
+        const trie_edge * e0 = trie_edges.data() + trie_nodes[node].edge0;
+        const trie_edge * e1 = e0 + trie_nodes[node].n_edges;
+        const trie_edge * e  = std::lower_bound(e0, e1, byte, [](const trie_edge & e, uint8_t b) { return e.byte < b; });
+        return e != e1 && e->byte == byte ? e->node : 0;
+    }
+
+    // id of the token spelled exactly s[0, n), or -1
+    id find(const char * s, size_t n) const {
+        uint32_t node = 0;
+        for (size_t i = 0; i < n && !trie_nodes.empty(); ++i) {
+            node = trie_child(node, s[i]);
+            if (node == 0) {
+                return -1;
+            }
+        }
+        return trie_nodes.empty() ? -1 : trie_nodes[node].tid;
+    }
+
+    id find(const std::string & s) const {
+        return find(s.data(), s.size());
+    }
+
+    // length of the longest non-empty token that prefixes s[0, n) (0 if none), its id in tid
+    size_t match(const char * s, size_t n, id & tid) const {
+        size_t len = 0;
+        uint32_t node = 0;
+        for (size_t i = 0; i < n && !trie_nodes.empty(); ++i) {
+            node = trie_child(node, s[i]);
+            if (node == 0) {
+                break;
+            }
+            if (trie_nodes[node].tid >= 0) {
+                tid = trie_nodes[node].tid;
+                len = i + 1;
+            }
+        }
+        return len;
+    }
+
+    // build the trie once all tokens are added; a string listed twice maps to its last id
+    void build_trie() {
+        std::vector<id> ids(n_tokens());
+        for (id i = 0; i < (id) ids.size(); ++i) {
+            ids[i] = i;
+        }
+        std::stable_sort(ids.begin(), ids.end(), [this](id a, id b) {
+            const size_t la = token_len(a);
+            const size_t lb = token_len(b);
+            const int c = memcmp(token_str(a), token_str(b), std::min(la, lb));
+            return c < 0 || (c == 0 && la < lb);
+        });
+
+        trie_nodes.clear();
+        trie_edges.clear();
+        trie_nodes.reserve(token_text.size());
+        trie_edges.reserve(token_text.size());
+        build_trie(ids, 0, ids.size(), 0);
+        trie_nodes.shrink_to_fit();
+        trie_edges.shrink_to_fit();
+    }
+
+private:
+    uint8_t byte_at(id tid, size_t i) const {
+        return (uint8_t) token_str(tid)[i];
+    }
+
+    // node for the common prefix of length depth shared by ids[lo, hi)
+    uint32_t build_trie(const std::vector<id> & ids, size_t lo, size_t hi, size_t depth) {
+        const uint32_t node = trie_nodes.size();
+        trie_nodes.emplace_back();
+        for (; lo < hi && token_len(ids[lo]) == depth; ++lo) {
+            trie_nodes[node].tid = ids[lo];
+        }
+
+        uint32_t n_edges = 0;
+        for (size_t i = lo; i < hi; ++n_edges) {
+            const uint8_t b = byte_at(ids[i], depth);
+            while (i < hi && byte_at(ids[i], depth) == b) {
+                ++i;
+            }
+        }
+        const uint32_t edge0 = trie_edges.size();
+        trie_nodes[node].edge0   = edge0;
+        trie_nodes[node].n_edges = n_edges;
+        trie_edges.resize(edge0 + n_edges);
+
+        uint32_t e = edge0;
+        for (size_t i = lo; i < hi; ++e) {
+            const uint8_t b = byte_at(ids[i], depth);
+            size_t j = i;
+            while (j < hi && byte_at(ids[j], depth) == b) {
+                ++j;
+            }
+            const uint32_t child = build_trie(ids, i, j, depth + 1);
+            trie_edges[e] = { b, child };
+            i = j;
+        }
+
+        return node;
+    }
 };
 
 struct whisper_segment {
@@ -531,7 +742,35 @@ struct whisper_sched {
     std::vector<uint8_t> meta;
 };
 
+// a KV cache write of the decoder graph: the CPY node and the view of the cache it writes to
+// both are re-pointed at the current KV head when the graph is reused
+struct whisper_kv_store {
+    struct ggml_tensor * cpy;
+
+    size_t offs; // byte offset in the cache for kv_head == 0
+    size_t step; // bytes per KV cell
+};
+
+// the decoder graph of the last whisper_decode_internal() call, left allocated in sched_decode
+// consecutive tokens of one decoding share its shape, so only the inputs and the KV writes need updating
+struct whisper_graph_decode {
+    struct ggml_cgraph * gf = nullptr;
+
+    int32_t n_tokens    = 0;
+    int32_t n_kv        = 0;
+    int32_t n_audio_ctx = 0;
+    bool    save_aheads = false;
+
+    const struct whisper_vocab_subset * vocab_sub = nullptr;
+
+    std::vector<whisper_kv_store> kv_store;
+};
+
 static size_t whisper_sched_size(struct whisper_sched & allocr) {
+    if (!allocr.sched) {
+        return 0;
+    }
+
     size_t size = allocr.meta.size();
     for (int i = 0; i < ggml_backend_sched_get_n_backends(allocr.sched); ++i) {
         ggml_backend_t backend = ggml_backend_sched_get_backend(allocr.sched, i);
@@ -541,11 +780,17 @@ static size_t whisper_sched_size(struct whisper_sched & allocr) {
 }
 
 // measure the memory usage of a graph and prepare the allocr's internal data buffer
-static bool whisper_sched_graph_init(struct whisper_sched & allocr, std::vector<ggml_backend_t> backends, std::function<struct ggml_cgraph *()> && get_graph) {
+// buft_cpu: type of the compute buffer of the CPU backend
+static bool whisper_sched_graph_init(struct whisper_sched & allocr, std::vector<ggml_backend_t> backends, ggml_backend_buffer_type_t buft_cpu, std::function<struct ggml_cgraph *()> && get_graph) {
     auto & sched = allocr.sched;
     auto & meta  = allocr.meta;
 
-    sched = ggml_backend_sched_new(backends.data(), nullptr, backends.size(), WHISPER_MAX_NODES, false);
+    std::vector<ggml_backend_buffer_type_t> bufts;
+    for (auto & backend : backends) {
+        bufts.push_back(ggml_backend_is_cpu(backend) ? buft_cpu : ggml_backend_get_default_buffer_type(backend));
+    }
+
+    sched = ggml_backend_sched_new(backends.data(), bufts.data(), backends.size(), WHISPER_MAX_NODES, false);
 
     meta.resize(ggml_tensor_overhead()*WHISPER_MAX_NODES + ggml_graph_overhead());
 
@@ -682,10 +927,12 @@ struct whisper_layer_decoder {
 struct whisper_kv_cell {
     whisper_pos pos = -1;
 
-    std::set<whisper_seq_id> seq_id;
+    // the sequences that attend to this cell, one bit per seq_id
+    // decoders forked from the one that wrote the cell share it, and it is freed when the last of them drops it
+    uint32_t seq_mask = 0;
 
     bool has_seq_id(const whisper_seq_id & id) const {
-        return seq_id.find(id) != seq_id.end();
+        return (seq_mask >> id) & 1u;
     }
 };
 
@@ -701,6 +948,9 @@ struct whisper_kv_cache {
     struct ggml_tensor * k;
     struct ggml_tensor * v;
 
+    ggml_type type_k = GGML_TYPE_F16;
+    ggml_type type_v = GGML_TYPE_F16;
+
     ggml_backend_buffer_t buffer = nullptr;
 
     std::vector<uint8_t> ctx_buf;
@@ -746,6 +996,11 @@ struct whisper_model {
     // the model backend data is read-only and can be shared between processors
     ggml_backend_buffer_t buffer = nullptr;
 
+    // the tensors come from a weight cache (see whisper_weight_cache_load), which is used in place when mapped
+    bool   cached       = false;
+    void * mapping      = nullptr;
+    size_t mapping_size = 0;
+
     // tensors
     int n_loaded;
     std::map<std::string, struct ggml_tensor *> tensors;
@@ -781,6 +1036,10 @@ struct whisper_sequence {
     double avg_logprobs;     // the average log probability of the tokens
     double entropy;          // the entropy of the tokens
     double score;            // likelihood rank score
+
+    // n_rep[p - 1]: number of trailing tokens equal to the token p positions before them
+    // a run of WHISPER_ENTROPY_N means the last WHISPER_ENTROPY_N tokens repeat a phrase of p tokens
+    int n_rep[WHISPER_REP_MAX_PERIOD];
 };
 
 // TAGS: WHISPER_DECODER_INIT
@@ -803,6 +1062,10 @@ struct whisper_decoder {
     std::vector<float> logits;
     std::vector<float> logprobs;
 
+    // greedy pick at t = 0, made by whisper_process_logits() instead of filling probs and logprobs
+    bool               has_best = false;
+    whisper_token_data best     = {};
+
     // work container used to avoid memory allocations
     std::vector<whisper_pair<double, whisper_vocab::id>> logits_id;
 
@@ -816,6 +1079,16 @@ struct whisper_aheads_masks {
     ggml_backend_buffer_t buffer = nullptr;
 };
 
+// rows of the token embedding (the decoder's output projection) for the tokens of one language
+struct whisper_vocab_subset {
+    std::vector<whisper_token> ids; // ascending
+
+    struct ggml_context * ctx    = nullptr;
+    ggml_backend_buffer_t buffer = nullptr;
+
+    struct ggml_tensor * w = nullptr; // [n_text_state, ids.size()], same type as model.d_te
+};
+
 struct whisper_state {
     int64_t t_sample_us = 0;
     int64_t t_encode_us = 0;
@@ -831,6 +1104,9 @@ struct whisper_state {
     int32_t n_prompt = 0; // number of decoder calls with n_tokens >  1  (prompt encoding)
     int32_t n_fail_p = 0; // number of logprob threshold failures
     int32_t n_fail_h = 0; // number of entropy threshold failures
+    int32_t n_fail_e = 0; // number of fallbacks started early (whisper_full_params.fail_early)
+    int32_t n_proj_full = 0; // number of decoder rows projected onto the full vocabulary despite a vocabulary subset
+    int32_t n_graph_decode = 0; // number of decoder graphs built (the others were reused)
 
     // number of decoders for which we have constructed the KV cache
     int32_t kv_self_n_dec = 0;
@@ -842,9 +1118,13 @@ struct whisper_state {
     // shared between all decoders
     whisper_kv_cache kv_cross;
 
-    // padded buffer for flash-attention
+    // padded buffer for flash-attention on GPU backends
     whisper_kv_cache kv_pad;
 
+    // the encoder self-attention and the decoder cross-attention use ggml_flash_attn_ext
+    // with flash_attn, and on the CPU backend where its tiled kernel beats the explicit KQ matrix
+    bool flash_attn_audio = false;
+
     whisper_mel mel;
 
     whisper_batch batch;
@@ -859,6 +1139,39 @@ struct whisper_state {
     whisper_sched sched_cross;
     whisper_sched sched_decode;
 
+    // see whisper_decode_internal
+    whisper_graph_decode graph_decode;
+
+    // batched conv + encoder + cross graph (see whisper_encode_batch), reserved on first use
+    whisper_sched sched_batch;
+    int32_t sched_batch_n     = 0;
+    int32_t sched_batch_n_ctx = 0;
+
+    // CPUs the compute threads of the encoder and decoder graphs run on (see whisper_set_cpumask_with_state)
+    bool cpumask_encode[GGML_MAX_N_THREADS] = {};
+    bool cpumask_decode[GGML_MAX_N_THREADS] = {};
+
+    bool use_cpumask_encode = false;
+    bool use_cpumask_decode = false;
+    bool cpumask_inherited  = false; // copied by whisper_full from the state this one drafts for
+
+    // abort of whisper_encode_with_state/whisper_decode_with_state (see whisper_set_abort_callback_with_state)
+    ggml_abort_callback abort_callback      = nullptr;
+    void *              abort_callback_data = nullptr;
+
+    // shape buckets sched_conv/encode/cross and sched_decode are reserved for, 0 - not yet
+    int32_t sched_encode_n_ctx    = 0;
+    int32_t sched_decode_n_ctx    = 0;
+    int32_t sched_decode_n_tokens = 0;
+    int32_t sched_decode_n_kv     = 0;
+
+    // high-water mark of the compute buffers
+    size_t sched_size_max = 0;
+
+    // kv_cross already holds the encoder output for the window at this seek (-1 - none)
+    int32_t encoded_seek  = -1;
+    int32_t encoded_n_ctx = 0;
+
     // result of the encoder
     struct ggml_tensor * embd_conv = nullptr;
     struct ggml_tensor * embd_enc  = nullptr;
@@ -870,11 +1183,32 @@ struct whisper_state {
     // decode output (2-dimensional array: [n_tokens][n_vocab])
     std::vector<float> logits;
 
+    // restricted output projection of the current run (whisper_full_params.vocab_subset)
+    // rows whose best subset token gets less than vocab_sub_thold are projected onto the full vocabulary
+    const whisper_vocab_subset * vocab_sub = nullptr;
+    float vocab_sub_thold = 0.0f;
+
+    std::vector<float> logits_sub; // one row of restricted logits, then its softmax
+    std::vector<float> hidden;     // [n_rows][n_text_state] rows that need the full projection
+
+    // token ids whisper_process_logits() suppresses at every step, before and after the
+    // logits filter callback, for the params below (suppress_regex is matched against the vocab once)
+    std::vector<whisper_token> suppress_pre;
+    std::vector<whisper_token> suppress_post;
+    bool        suppress_valid      = false;
+    bool        suppress_tdrz       = false;
+    bool        suppress_non_speech = false;
+    bool        suppress_has_regex  = false;
+    std::string suppress_regex;
+
     std::vector<whisper_segment> result_all;
     std::vector<whisper_token>   prompt_past;
 
     int lang_id = 0; // english by default
 
+    // start of the window whisper_full_with_state() was on when it returned (resume point when stopped early)
+    int32_t full_seek = 0;
+
     std::string path_model; // populated by whisper_init_from_file_with_params()
 
 #ifdef WHISPER_USE_COREML
@@ -917,6 +1251,10 @@ struct whisper_context {
     whisper_state * state = nullptr;
 
     std::string path_model; // populated by whisper_init_from_file_with_params()
+
+    // vocabulary subsets by language id, built on first use and shared by all states
+    std::map<int, whisper_vocab_subset> vocab_subsets;
+    std::mutex vocab_subsets_mutex;
 };
 
 struct whisper_global {
@@ -936,7 +1274,8 @@ static void read_safe(whisper_model_loader * loader, T & dest) {
 static bool whisper_kv_cache_init(
              struct whisper_kv_cache & cache,
                       ggml_backend_t   backend,
-                           ggml_type   wtype,
+                           ggml_type   type_k,
+                           ggml_type   type_v,
                              int64_t   n_text_state,
                              int64_t   n_text_layer,
                                  int   n_ctx) {
@@ -964,8 +1303,11 @@ static bool whisper_kv_cache_init(
         return false;
     }
 
-    cache.k = ggml_new_tensor_1d(ctx, wtype, n_elements);
-    cache.v = ggml_new_tensor_1d(ctx, wtype, n_elements);
+    cache.type_k = type_k;
+    cache.type_v = type_v;
+
+    cache.k = ggml_new_tensor_1d(ctx, type_k, n_elements);
+    cache.v = ggml_new_tensor_1d(ctx, type_v, n_elements);
 
     cache.buffer = ggml_backend_alloc_ctx_tensors(ctx, backend);
     if (!cache.buffer) {
@@ -980,6 +1322,33 @@ static bool whisper_kv_cache_init(
     return true;
 }
 
+// the quantized cache types are written and read by the CPU kernels only
+// without flash attention V is stored transposed, one element per token, so it cannot be stored in blocks
+static void whisper_kv_cache_types(
+        const whisper_context & wctx,
+               ggml_backend_t   backend,
+                         bool   flash_attn,
+                    ggml_type   type,
+                    ggml_type & type_k,
+                    ggml_type & type_v) {
+    type_k = wctx.itype;
+    type_v = wctx.itype;
+
+    if (!ggml_is_quantized(type)) {
+        return;
+    }
+
+    if (!ggml_backend_is_cpu(backend)) {
+        WHISPER_LOG_WARN("%s: %s KV cache is only supported on the CPU backend - using %s\n", __func__, ggml_type_name(type), ggml_type_name(wctx.itype));
+        return;
+    }
+
+    type_k = type;
+    if (flash_attn) {
+        type_v = type;
+    }
+}
+
 static void whisper_kv_cache_free(struct whisper_kv_cache & cache) {
     ggml_backend_buffer_free(cache.buffer);
 }
@@ -1028,7 +1397,8 @@ static bool whisper_kv_cache_find_slot(
         cache.cells[cache.head + i].pos = batch.pos[i];
 
         for (int32_t j = 0; j < batch.n_seq_id[i]; j++) {
-            cache.cells[cache.head + i].seq_id.insert(batch.seq_id[i][j]);
+            WHISPER_ASSERT(batch.seq_id[i][j] < WHISPER_KV_MAX_SEQ);
+            cache.cells[cache.head + i].seq_mask |= 1u << batch.seq_id[i][j];
         }
     }
 
@@ -1038,7 +1408,7 @@ static bool whisper_kv_cache_find_slot(
 // find how many cells are currently in use
 static int32_t whisper_kv_cache_cell_max(const struct whisper_kv_cache & cache) {
     for (uint32_t i = cache.size - 1; i > 0; --i) {
-        if (cache.cells[i].pos >= 0 && !cache.cells[i].seq_id.empty()) {
+        if (cache.cells[i].pos >= 0 && cache.cells[i].seq_mask != 0) {
             return i + 1;
         }
     }
@@ -1049,7 +1419,7 @@ static int32_t whisper_kv_cache_cell_max(const struct whisper_kv_cache & cache)
 static void whisper_kv_cache_clear(struct whisper_kv_cache & cache) {
     for (int32_t i = 0; i < (int32_t) cache.size; ++i) {
         cache.cells[i].pos = -1;
-        cache.cells[i].seq_id.clear();
+        cache.cells[i].seq_mask = 0;
     }
     cache.head = 0;
 
@@ -1069,13 +1439,13 @@ static void whisper_kv_cache_seq_rm(
     for (uint32_t i = 0; i < cache.size; ++i) {
         if (cache.cells[i].pos >= p0 && cache.cells[i].pos < p1) {
             if (seq_id < 0) {
-                cache.cells[i].seq_id.clear();
+                cache.cells[i].seq_mask = 0;
             } else if (cache.cells[i].has_seq_id(seq_id)) {
-                cache.cells[i].seq_id.erase(seq_id);
+                cache.cells[i].seq_mask &= ~(1u << seq_id);
             } else {
                 continue;
             }
-            if (cache.cells[i].seq_id.empty()) {
+            if (cache.cells[i].seq_mask == 0) {
                 cache.cells[i].pos = -1;
                 if (new_head == cache.size) new_head = i;
             }
@@ -1099,9 +1469,49 @@ static void whisper_kv_cache_seq_cp(
 
     for (uint32_t i = 0; i < cache.size; ++i) {
         if (cache.cells[i].has_seq_id(seq_id_src) && cache.cells[i].pos >= p0 && cache.cells[i].pos < p1) {
-            cache.cells[i].seq_id.insert(seq_id_dst);
+            cache.cells[i].seq_mask |= 1u << seq_id_dst;
+        }
+    }
+}
+
+// re-parent sequences 0 .. n_seq - 1 in a single pass: sequence j continues from sequence src[j] (src[j] < 0 - keep it)
+// the cells of a parent become shared by all its children, and the cells no sequence refers to anymore are freed
+static void whisper_kv_cache_seq_fork(
+        struct whisper_kv_cache & cache,
+     const whisper_seq_id       * src,
+                            int   n_seq) {
+    uint32_t keep = ~0u;
+    uint32_t children[WHISPER_KV_MAX_SEQ] = { 0 };
+
+    for (int j = 0; j < n_seq; ++j) {
+        if (src[j] >= 0) {
+            keep &= ~(1u << j);
+            children[src[j]] |= 1u << j;
+        }
+    }
+
+    for (uint32_t i = 0; i < cache.size; ++i) {
+        auto & cell = cache.cells[i];
+
+        if (cell.pos < 0) {
+            continue;
+        }
+
+        uint32_t mask = cell.seq_mask & keep;
+        for (int s = 0; s < n_seq; ++s) {
+            if (cell.has_seq_id(s)) {
+                mask |= children[s];
+            }
+        }
+
+        cell.seq_mask = mask;
+        if (mask == 0) {
+            cell.pos = -1;
         }
     }
+
+    // first fit from the start keeps the window the decoder attends to short
+    cache.head = 0;
 }
 
 static uint32_t whisper_kv_cache_get_padding(const struct whisper_context & wctx) {
@@ -1124,6 +1534,12 @@ static uint32_t whisper_kv_cache_get_padding(const struct whisper_context & wctx
     return 1u;
 }
 
+// number of audio K/V rows seen by ggml_flash_attn_ext
+// the GPU kernels read them padded to 256 (the padding is zero), the CPU kernel takes the exact length
+static int whisper_audio_kv_len(const struct whisper_state & wstate, int n_audio_ctx) {
+    return ggml_backend_is_cpu(wstate.backends[0]) ? n_audio_ctx : GGML_PAD(n_audio_ctx, 256);
+}
+
 // [EXPERIMENTAL] Token-level timestamps with DTW
 static bool aheads_masks_init(
         const whisper_context_params & cparams,
@@ -1347,10 +1763,15 @@ static std::vector<ggml_backend_t> whisper_backend_init(const whisper_context_pa
     return result;
 }
 
+// CPU buffers, on huge pages / NUMA nodes as requested
+static ggml_backend_buffer_type_t whisper_cpu_buffer_type(const whisper_context_params & params) {
+    return ggml_backend_cpu_placed_buffer_type(params.cpu_hugepages, params.cpu_numa);
+}
+
 static ggml_backend_buffer_type_t whisper_default_buffer_type(const whisper_context_params & params) {
     ggml_backend_buffer_type_t result = nullptr;
 
-    params.use_gpu || (result = ggml_backend_cpu_buffer_type());
+    params.use_gpu || (result = whisper_cpu_buffer_type(params));
 
 #ifdef GGML_USE_CUDA
     result || (result = ggml_backend_cuda_buffer_type(params.gpu_device));
@@ -1372,11 +1793,228 @@ static ggml_backend_buffer_type_t whisper_default_buffer_type(const whisper_cont
     result || (result == ggml_backend_cann_buffer_type(params.gpu_device));
 #endif
 
-    result || (result = ggml_backend_cpu_buffer_type());
+    result || (result = whisper_cpu_buffer_type(params));
 
     return result;
 }
 
+// the layer matrices of CPU weights are stored in the interleaved layout of the CPU matmul kernels
+static bool whisper_cpu_weights(const whisper_context_params & params) {
+    return whisper_default_buffer_type(params) == whisper_cpu_buffer_type(params);
+}
+
+//
+// weight cache
+//
+// the tensors of a model as whisper_model_load transformed them for this CPU, saved by whisper_weight_cache_save so
+// that later loads map them instead of reading and repacking the model file again
+//
+// file format:
+//
+//   - magic, version
+//   - key (see whisper_weight_cache_key)
+//   - number of tensors, offset and size of the data
+//   - per tensor: name, type, shape, offset in the data and size
+//   - data, page aligned
+//
+
+#define WHISPER_WEIGHT_CACHE_MAGIC        0x77637763 // "cwcw"
+#define WHISPER_WEIGHT_CACHE_VERSION      1          // bump when the layout of a transformed tensor changes
+#define WHISPER_WEIGHT_CACHE_ALIGN        4096
+#define WHISPER_WEIGHT_CACHE_TENSOR_ALIGN 64
+
+// what the cached tensors depend on besides the model: the ggml formats and the CPU features the layouts of the
+// matmul kernels were selected for
+static std::string whisper_weight_cache_key() {
+    std::string s;
+
+#if defined(GGML_BIG_ENDIAN)
+    s += "BIG_ENDIAN | ";
+#endif
+    s += "QNT = "         + std::to_string(GGML_QNT_VERSION)            + " | ";
+    s += "AVX = "         + std::to_string(ggml_cpu_has_avx())          + " | ";
+    s += "AVX2 = "        + std::to_string(ggml_cpu_has_avx2())         + " | ";
+    s += "AVX_VNNI = "    + std::to_string(ggml_cpu_has_avx_vnni())     + " | ";
+    s += "AVX512 = "      + std::to_string(ggml_cpu_has_avx512())       + " | ";
+    s += "AVX512_VNNI = " + std::to_string(ggml_cpu_has_avx512_vnni())  + " | ";
+    s += "FMA = "         + std::to_string(ggml_cpu_has_fma())          + " | ";
+    s += "F16C = "        + std::to_string(ggml_cpu_has_f16c())         + " | ";
+    s += "NEON = "        + std::to_string(ggml_cpu_has_neon())         + " | ";
+    s += "SVE = "         + std::to_string(ggml_cpu_has_sve() ? ggml_cpu_get_sve_cnt() : 0) + " | ";
+    s += "MATMUL_INT8 = " + std::to_string(ggml_cpu_has_matmul_int8());
+
+    return s;
+}
+
+// reads the weights from the cache at path when it holds the tensors of this model, transformed for this CPU
+// with the plain CPU buffer type the file is mapped and its pages used in place (they stay in the page cache between
+// loads), otherwise (huge pages, NUMA placement) the tensors are copied into a buffer of that type
+static bool whisper_weight_cache_load(whisper_context & wctx, const char * path) {
+#ifdef _POSIX_MAPPED_FILES
+    auto & model = wctx.model;
+
+    const int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        WHISPER_LOG_INFO("%s: no weight cache at '%s'\n", __func__, path);
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+        close(fd);
+        return false;
+    }
+
+    const size_t size = st.st_size;
+
+    void * addr = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        WHISPER_LOG_WARN("%s: failed to map the weight cache '%s'\n", __func__, path);
+        return false;
+    }
+
+    const char * func = __func__;
+
+    auto invalid = [&](const char * why) {
+        WHISPER_LOG_WARN("%s: weight cache '%s' %s, loading the model file\n", func, path, why);
+        munmap(addr, size);
+        return false;
+    };
+
+    const uint8_t * p   = (const uint8_t *) addr;
+    size_t          pos = 0;
+
+    auto get = [&](void * dst, size_t n) {
+        if (size - pos < n) {
+            return false;
+        }
+        memcpy(dst, p + pos, n);
+        pos += n;
+        return true;
+    };
+
+    auto get_str = [&](std::string & dst) {
+        uint32_t n;
+        if (!get(&n, sizeof(n)) || size - pos < n) {
+            return false;
+        }
+        dst.assign((const char *) p + pos, n);
+        pos += n;
+        return true;
+    };
+
+    uint32_t magic   = 0;
+    uint32_t version = 0;
+    if (!get(&magic, sizeof(magic)) || magic != WHISPER_WEIGHT_CACHE_MAGIC || !get(&version, sizeof(version))) {
+        return invalid("is not a weight cache");
+    }
+    if (version != WHISPER_WEIGHT_CACHE_VERSION) {
+        return invalid("has another version");
+    }
+
+    std::string key;
+    if (!get_str(key)) {
+        return invalid("is truncated");
+    }
+    if (key != whisper_weight_cache_key()) {
+        return invalid("was made for another CPU or ggml version");
+    }
+
+    uint32_t n_tensors   = 0;
+    uint64_t data_offset = 0;
+    uint64_t data_size   = 0;
+    if (!get(&n_tensors, sizeof(n_tensors)) || !get(&data_offset, sizeof(data_offset)) || !get(&data_size, sizeof(data_size))) {
+        return invalid("is truncated");
+    }
+    if (data_offset % WHISPER_WEIGHT_CACHE_ALIGN != 0 || data_offset > size || size - data_offset != data_size) {
+        return invalid("is truncated");
+    }
+
+    // every tensor of the model (all of them are in model.tensors) has to be in the cache, with the same type and shape
+    int n_ctx_tensors = 0;
+    for (ggml_tensor * t = ggml_get_first_tensor(model.ctx); t != nullptr; t = ggml_get_next_tensor(model.ctx, t)) {
+        n_ctx_tensors++;
+    }
+    if (n_tensors != model.tensors.size() || n_ctx_tensors != (int) model.tensors.size()) {
+        return invalid("holds another model");
+    }
+
+    std::vector<std::pair<ggml_tensor *, uint64_t>> entries;
+    entries.reserve(n_tensors);
+
+    for (uint32_t i = 0; i < n_tensors; ++i) {
+        std::string name;
+        int32_t     type;
+        int64_t     ne[GGML_MAX_DIMS];
+        uint64_t    offset;
+        uint64_t    nbytes;
+
+        if (!get_str(name) || !get(&type, sizeof(type)) || !get(ne, sizeof(ne)) || !get(&offset, sizeof(offset)) || !get(&nbytes, sizeof(nbytes))) {
+            return invalid("is truncated");
+        }
+
+        const auto it = model.tensors.find(name);
+        if (it == model.tensors.end()) {
+            return invalid("holds another model");
+        }
+
+        ggml_tensor * tensor = it->second;
+
+        if (type != tensor->type || memcmp(ne, tensor->ne, sizeof(ne)) != 0 || nbytes != ggml_nbytes(tensor)) {
+            return invalid("holds another model");
+        }
+        if (offset % WHISPER_WEIGHT_CACHE_TENSOR_ALIGN != 0 || offset > data_size || data_size - offset < nbytes) {
+            return invalid("is truncated");
+        }
+
+        entries.emplace_back(tensor, offset);
+    }
+
+    uint8_t * data = (uint8_t *) addr + data_offset;
+
+    const auto buft = whisper_default_buffer_type(wctx.params);
+
+    if (buft == ggml_backend_cpu_buffer_type()) {
+        posix_madvise(addr, size, POSIX_MADV_WILLNEED);
+
+        model.buffer = ggml_backend_cpu_buffer_from_ptr(data, data_size);
+        for (const auto & e : entries) {
+            ggml_backend_tensor_alloc(model.buffer, e.first, data + e.second);
+        }
+
+        model.mapping      = addr;
+        model.mapping_size = size;
+    } else {
+        model.buffer = ggml_backend_alloc_ctx_tensors_from_buft(model.ctx, buft);
+        if (!model.buffer) {
+            WHISPER_LOG_ERROR("%s: failed to allocate memory for the model\n", __func__);
+            munmap(addr, size);
+            return false;
+        }
+
+        for (const auto & e : entries) {
+            ggml_backend_tensor_set(e.first, data + e.second, 0, ggml_nbytes(e.first));
+        }
+
+        munmap(addr, size);
+    }
+
+    model.cached   = true;
+    model.n_loaded = n_tensors;
+
+    WHISPER_LOG_INFO("%s: %d tensors from '%s' (%s), %8.2f MB\n", __func__, model.n_loaded, path,
+            model.mapping ? "mapped" : "copied", data_size / 1e6);
+
+    return true;
+#else
+    GGML_UNUSED(wctx);
+    GGML_UNUSED(path);
+
+    return false;
+#endif
+}
+
 // load the model from a ggml file
 //
 // file format:
@@ -1521,8 +2159,7 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
                 word = "";
             }
 
-            vocab.token_to_id[word] = i;
-            vocab.id_to_token[i] = word;
+            vocab.add_token(word);
 
             //printf("%s: vocab[%d] = '%s'\n", __func__, i, word.c_str());
         }
@@ -1572,17 +2209,25 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
                 } else {
                     word = "[_extra_token_" + std::to_string(i) + "]";
                 }
-                vocab.token_to_id[word] = i;
-                vocab.id_to_token[i] = word;
+                vocab.add_token(word);
             }
         }
 
+        vocab.build_trie();
+
         WHISPER_LOG_INFO("%s: n_langs       = %d\n", __func__, vocab.num_languages());
     }
 
     const ggml_type wtype = wctx.wtype;
     const ggml_type vtype = wctx.wtype == GGML_TYPE_F32 ? GGML_TYPE_F32 : GGML_TYPE_F16; // conv type
 
+    // the layer matrices are only ever multiplied with, so when they live in CPU memory they are stored in the
+    // interleaved layout of the CPU matmul kernels, converted while loading (see ggml_cpu_repack_type)
+    const bool cpu_weights = whisper_cpu_weights(wctx.params);
+
+    const ggml_type wtype_enc = cpu_weights ? ggml_cpu_repack_type(wtype, model.hparams.n_audio_state) : wtype;
+    const ggml_type wtype_dec = cpu_weights ? ggml_cpu_repack_type(wtype, model.hparams.n_text_state)  : wtype;
+
     // create the ggml context
     {
         const auto & hparams = model.hparams;
@@ -1657,24 +2302,24 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
                 layer.mlp_ln_w    = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
                 layer.mlp_ln_b    = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
 
-                layer.mlp_0_w     = ggml_new_tensor_2d(ctx, wtype,           n_audio_state, 4*n_audio_state);
+                layer.mlp_0_w     = ggml_new_tensor_2d(ctx, wtype_enc,       n_audio_state, 4*n_audio_state);
                 layer.mlp_0_b     = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 4*n_audio_state);
 
-                layer.mlp_1_w     = ggml_new_tensor_2d(ctx, wtype,         4*n_audio_state, n_audio_state);
+                layer.mlp_1_w     = ggml_new_tensor_2d(ctx, wtype_enc,     4*n_audio_state, n_audio_state);
                 layer.mlp_1_b     = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
 
                 layer.attn_ln_0_w = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
                 layer.attn_ln_0_b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
 
-                layer.attn_q_w    = ggml_new_tensor_2d(ctx, wtype,           n_audio_state, n_audio_state);
+                layer.attn_q_w    = ggml_new_tensor_2d(ctx, wtype_enc,       n_audio_state, n_audio_state);
                 layer.attn_q_b    = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
 
-                layer.attn_k_w    = ggml_new_tensor_2d(ctx, wtype,           n_audio_state, n_audio_state);
+                layer.attn_k_w    = ggml_new_tensor_2d(ctx, wtype_enc,       n_audio_state, n_audio_state);
 
-                layer.attn_v_w    = ggml_new_tensor_2d(ctx, wtype,           n_audio_state, n_audio_state);
+                layer.attn_v_w    = ggml_new_tensor_2d(ctx, wtype_enc,       n_audio_state, n_audio_state);
                 layer.attn_v_b    = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
 
-                layer.attn_ln_1_w = ggml_new_tensor_2d(ctx, wtype,           n_audio_state, n_audio_state);
+                layer.attn_ln_1_w = ggml_new_tensor_2d(ctx, wtype_enc,       n_audio_state, n_audio_state);
                 layer.attn_ln_1_b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_audio_state);
 
                 // map by name
@@ -1726,38 +2371,38 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
                 layer.mlp_ln_w          = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
                 layer.mlp_ln_b          = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
-                layer.mlp_0_w           = ggml_new_tensor_2d(ctx, wtype,           n_text_state, 4*n_text_state);
+                layer.mlp_0_w           = ggml_new_tensor_2d(ctx, wtype_dec,       n_text_state, 4*n_text_state);
                 layer.mlp_0_b           = ggml_new_tensor_1d(ctx, GGML_TYPE_F32, 4*n_text_state);
 
-                layer.mlp_1_w           = ggml_new_tensor_2d(ctx, wtype,         4*n_text_state, n_text_state);
+                layer.mlp_1_w           = ggml_new_tensor_2d(ctx, wtype_dec,     4*n_text_state, n_text_state);
                 layer.mlp_1_b           = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
                 layer.attn_ln_0_w       = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
                 layer.attn_ln_0_b       = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
-                layer.attn_q_w          = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
+                layer.attn_q_w          = ggml_new_tensor_2d(ctx, wtype_dec,       n_text_state, n_text_state);
                 layer.attn_q_b          = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
-                layer.attn_k_w          = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
+                layer.attn_k_w          = ggml_new_tensor_2d(ctx, wtype_dec,       n_text_state, n_text_state);
 
-                layer.attn_v_w          = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
+                layer.attn_v_w          = ggml_new_tensor_2d(ctx, wtype_dec,       n_text_state, n_text_state);
                 layer.attn_v_b          = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
-                layer.attn_ln_1_w       = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
+                layer.attn_ln_1_w       = ggml_new_tensor_2d(ctx, wtype_dec,       n_text_state, n_text_state);
                 layer.attn_ln_1_b       = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
                 layer.cross_attn_ln_0_w = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
                 layer.cross_attn_ln_0_b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
-                layer.cross_attn_q_w    = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
+                layer.cross_attn_q_w    = ggml_new_tensor_2d(ctx, wtype_dec,       n_text_state, n_text_state);
                 layer.cross_attn_q_b    = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
-                layer.cross_attn_k_w    = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
+                layer.cross_attn_k_w    = ggml_new_tensor_2d(ctx, wtype_dec,       n_text_state, n_text_state);
 
-                layer.cross_attn_v_w    = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
+                layer.cross_attn_v_w    = ggml_new_tensor_2d(ctx, wtype_dec,       n_text_state, n_text_state);
                 layer.cross_attn_v_b    = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
-                layer.cross_attn_ln_1_w = ggml_new_tensor_2d(ctx, wtype,           n_text_state, n_text_state);
+                layer.cross_attn_ln_1_w = ggml_new_tensor_2d(ctx, wtype_dec,       n_text_state, n_text_state);
                 layer.cross_attn_ln_1_b = ggml_new_tensor_1d(ctx, GGML_TYPE_F32,   n_text_state);
 
                 // map by name
@@ -1801,6 +2446,15 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
         }
     }
 
+    // tensors transformed by an earlier load, the rest of the model file is not needed
+    if (cpu_weights && wctx.params.weight_cache && whisper_weight_cache_load(wctx, wctx.params.weight_cache)) {
+        ggml_backend_buffer_set_usage(model.buffer, GGML_BACKEND_BUFFER_USAGE_WEIGHTS);
+
+        wctx.t_load_us = ggml_time_us() - t_start_us;
+
+        return true;
+    }
+
     // allocate tensors in the backend buffers
     model.buffer = ggml_backend_alloc_ctx_tensors_from_buft(model.ctx, whisper_default_buffer_type(wctx.params));
     if (!model.buffer) {
@@ -1876,7 +2530,20 @@ static bool whisper_model_load(struct whisper_model_loader * loader, whisper_con
 
             //printf("%s: [%5.5s] %s\n", __func__, ggml_backend_name(backend), name.c_str());
 
-            if (ggml_backend_buffer_is_host(model.buffer)) {
+            if (tensor->type != ggml_type(ttype)) {
+                // a layer matrix stored in the CPU's interleaved layout
+                if (ggml_cpu_repack_type(ggml_type(ttype), tensor->ne[1]) != tensor->type) {
+                    WHISPER_LOG_ERROR("%s: tensor '%s' has wrong type in model file: got %s, expected %s\n",
+                            __func__, name.data(), ggml_type_name(ggml_type(ttype)), ggml_type_name(tensor->type));
+                    return false;
+                }
+
+                read_buf.resize(ggml_nbytes(tensor));
+
+                loader->read(loader->context, read_buf.data(), read_buf.size());
+
+                ggml_cpu_repack(tensor->type, tensor->data, read_buf.data(), tensor->ne[1], tensor->ne[0]);
+            } else if (ggml_backend_buffer_is_host(model.buffer)) {
                 // for the CPU and Metal backend, we can read directly into the tensor
                 loader->read(loader->context, tensor->data, ggml_nbytes(tensor));
                 BYTESWAP_TENSOR(tensor);
@@ -1929,6 +2596,64 @@ static bool whisper_encode_external(const whisper_state & wstate) {
     return use_coreml || use_openvino;
 }
 
+// true if kv_cross already holds the encoder output for the window at seek (see whisper_encode_batch)
+static bool whisper_encoded_at(const whisper_context & wctx, const whisper_state & wstate, int seek) {
+    const int n_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wctx.model.hparams.n_audio_ctx;
+
+    return wstate.encoded_seek == seek && wstate.encoded_n_ctx == n_ctx;
+}
+
+// convolution + gelu
+//
+// mel: [2*n_ctx, n_mels, n_batch] -> [n_ctx, n_state, n_batch]
+//
+static struct ggml_tensor * whisper_conv_1d_ph_batch(
+        struct ggml_context * ctx0,
+         struct ggml_tensor * w,
+         struct ggml_tensor * x,
+                        int   s) {
+    const int64_t n_batch = x->ne[2];
+
+    struct ggml_tensor * cur = ggml_conv_1d_ph(ctx0, w, x, s, 1);
+
+    if (n_batch > 1) {
+        // ggml_conv_1d stores a batched result as [OL, N, OC] even though it labels it [OL, OC, N]
+        cur = ggml_reshape_3d(ctx0, cur, cur->ne[0], n_batch, cur->ne[1]);
+        cur = ggml_cont(ctx0, ggml_permute(ctx0, cur, 0, 2, 1, 3));
+    }
+
+    return cur;
+}
+
+static struct ggml_tensor * whisper_build_conv_stem(
+        struct ggml_context * ctx0,
+        const whisper_model & model,
+        const whisper_state & wstate,
+         struct ggml_tensor * mel) {
+    struct ggml_tensor * cur = nullptr;
+
+    // on the CPU the direct kernel convolves a tile at a time and applies the bias and GELU in place,
+    // instead of materializing the im2col matrix of each layer
+    if (ggml_backend_is_cpu(wstate.backends[0])) {
+        cur = ggml_conv_1d_direct(ctx0, model.e_conv_1_w, mel, model.e_conv_1_b, 1, 1, 1, true);
+        cur = ggml_conv_1d_direct(ctx0, model.e_conv_2_w, cur, model.e_conv_2_b, 2, 1, 1, true);
+
+        return cur;
+    }
+
+    cur = whisper_conv_1d_ph_batch(ctx0, model.e_conv_1_w, mel, 1);
+    cur = ggml_add(ctx0, cur, model.e_conv_1_b);
+
+    cur = ggml_gelu(ctx0, cur);
+
+    cur = whisper_conv_1d_ph_batch(ctx0, model.e_conv_2_w, cur, 2);
+    cur = ggml_add(ctx0, cur, model.e_conv_2_b);
+
+    cur = ggml_gelu(ctx0, cur);
+
+    return cur;
+}
+
 static struct ggml_cgraph * whisper_build_graph_conv(
         whisper_context & wctx,
           whisper_state & wstate) {
@@ -1957,18 +2682,7 @@ static struct ggml_cgraph * whisper_build_graph_conv(
     struct ggml_tensor * cur = nullptr;
 
     if (!whisper_encode_external(wstate)) {
-        // convolution + gelu
-        {
-            cur = ggml_conv_1d_ph(ctx0, model.e_conv_1_w, mel, 1, 1);
-            cur = ggml_add(ctx0, cur, model.e_conv_1_b);
-
-            cur = ggml_gelu(ctx0, cur);
-
-            cur = ggml_conv_1d_ph(ctx0, model.e_conv_2_w, cur, 2, 1);
-            cur = ggml_add(ctx0, cur, model.e_conv_2_b);
-
-            cur = ggml_gelu(ctx0, cur);
-        }
+        cur = whisper_build_conv_stem(ctx0, model, wstate, mel);
 
         ggml_set_name(cur, "embd_conv");
         wstate.embd_conv = cur;
@@ -1991,110 +2705,122 @@ static struct ggml_cgraph * whisper_build_graph_conv(
     return gf;
 }
 
-static struct ggml_cgraph * whisper_build_graph_encoder(
-        whisper_context & wctx,
-          whisper_state & wstate) {
-    const auto & model   = wctx.model;
-    const auto & hparams = model.hparams;
+// layer norm: w*norm(x) + b
+// fused: a single op that normalizes and scales each row in one pass (CPU)
+static struct ggml_tensor * whisper_layer_norm(
+        struct ggml_context * ctx0,
+                       bool   fused,
+         struct ggml_tensor * x,
+         struct ggml_tensor * w,
+         struct ggml_tensor * b,
+                      float   eps) {
+    if (fused) {
+        return ggml_norm_affine(ctx0, x, w, b, eps);
+    }
 
-    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
-    const int n_state = hparams.n_audio_state;
-    const int n_head  = hparams.n_audio_head;
-    const int n_layer = hparams.n_audio_layer;
-
-    const int n_state_head = n_state/n_head;
-
-    auto & kv_pad = wstate.kv_pad;
+    struct ggml_tensor * cur = ggml_norm(ctx0, x, eps);
 
-    WHISPER_ASSERT(!!kv_pad.buffer);
-
-    const int n_ctx_pad = GGML_PAD(n_ctx, 256);
-
-    struct ggml_init_params params = {
-        /*.mem_size   =*/ wstate.sched_encode.meta.size(),
-        /*.mem_buffer =*/ wstate.sched_encode.meta.data(),
-        /*.no_alloc   =*/ true,
-    };
+    if (w) {
+        cur = ggml_mul(ctx0, cur, w);
+    }
+    if (b) {
+        cur = ggml_add(ctx0, cur, b);
+    }
 
-    struct ggml_context * ctx0 = ggml_init(params);
+    return cur;
+}
 
-    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+// linear layer: w*x + b, optionally followed by GELU
+// fused: a single op that applies the bias and GELU to each block of the product while it is in cache (CPU)
+static struct ggml_tensor * whisper_linear(
+        struct ggml_context * ctx0,
+                       bool   fused,
+         struct ggml_tensor * w,
+         struct ggml_tensor * x,
+         struct ggml_tensor * b,
+                       bool   gelu) {
+    if (fused) {
+        return ggml_mul_mat_bias(ctx0, w, x, b, gelu);
+    }
 
-    struct ggml_tensor * cur = ggml_view_tensor(ctx0, wstate.embd_conv);
+    struct ggml_tensor * cur = ggml_mul_mat(ctx0, w, x);
 
-    const float KQscale = 1.0f/sqrtf(float(n_state_head));
+    if (b) {
+        cur = ggml_add(ctx0, cur, b);
+    }
+    if (gelu) {
+        cur = ggml_gelu(ctx0, cur);
+    }
 
-    // ===================================================================
-    // NOTE: experimenting with partial evaluation of the encoder (ignore)
-    //static int iter = -1;
-    //const int n_iter = 1500/n_ctx;
+    return cur;
+}
 
-    //iter = (iter + 1) % n_iter;
+// transformer blocks + final norm of the encoder
+//
+// inpL: [n_state, n_ctx*n_batch] - n_batch windows of n_ctx positions each, positional embedding already added
+// self-attention never crosses window boundaries, so every window is encoded exactly as it would be on its own
+//
+static struct ggml_tensor * whisper_build_encoder_blocks(
+        struct ggml_context * ctx0,
+         struct ggml_cgraph * gf,
+            whisper_context & wctx,
+              whisper_state & wstate,
+         struct ggml_tensor * inpL,
+                        int   n_ctx,
+                        int   n_batch) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
 
-    //if (iter == 0) {
-    //    memset(model.memory_cross_k->data, 0, ggml_nbytes(model.memory_cross_k));
-    //    memset(model.memory_cross_v->data, 0, ggml_nbytes(model.memory_cross_v));
-    //}
+    const int n_state = hparams.n_audio_state;
+    const int n_head  = hparams.n_audio_head;
+    const int n_layer = hparams.n_audio_layer;
 
-    static int iter = 0;
+    const int n_state_head = n_state/n_head;
 
-    const size_t e_pe_stride = model.e_pe->ne[0]*ggml_element_size(model.e_pe);
-    const size_t e_pe_offset = model.e_pe->ne[0]*ggml_element_size(model.e_pe)*n_ctx*iter;
+    auto & kv_pad = wstate.kv_pad;
 
-    struct ggml_tensor * e_pe = ggml_view_2d(ctx0, model.e_pe, model.e_pe->ne[0], n_ctx, e_pe_stride, e_pe_offset);
-    cur = ggml_add(ctx0, e_pe, ggml_cont(ctx0, ggml_transpose(ctx0, cur)));
+    const int n_ctx_pad = GGML_PAD(n_ctx, 256);
 
-    // ===================================================================
+    const float KQscale = 1.0f/sqrtf(float(n_state_head));
 
-    // original:
-    //cur = ggml_add(ctx0, model.e_pe, ggml_transpose(ctx0, cur));
+    // on the CPU the layer norms and the linear layers run as fused ops
+    const bool fused = ggml_backend_is_cpu(wstate.backends[0]);
 
-    struct ggml_tensor * inpL = cur;
+    struct ggml_tensor * cur = nullptr;
 
     for (int il = 0; il < n_layer; ++il) {
         const auto & layer = model.layers_encoder[il];
 
         // norm
         {
-            cur = ggml_norm(ctx0, inpL, hparams.eps);
-
-            // cur = ln_0_w*cur + ln_0_b
-            cur = ggml_add(ctx0,
-                    ggml_mul(ctx0, cur, layer.attn_ln_0_w),
-                    layer.attn_ln_0_b);
+            // cur = ln_0_w*norm(inpL) + ln_0_b
+            cur = whisper_layer_norm(ctx0, fused, inpL, layer.attn_ln_0_w, layer.attn_ln_0_b, hparams.eps);
         }
 
         // self-attention
         {
-            struct ggml_tensor * Qcur = ggml_mul_mat(ctx0,
-                    layer.attn_q_w,
-                    cur);
-
-            Qcur = ggml_add(ctx0, Qcur, layer.attn_q_b);
+            struct ggml_tensor * Qcur = whisper_linear(ctx0, fused, layer.attn_q_w, cur, layer.attn_q_b, false);
 
             //Qcur = ggml_scale(ctx0, Qcur, pow(float(n_state_head), -0.25));
 
             // note: no bias for Key
-            struct ggml_tensor * Kcur = ggml_mul_mat(ctx0,
-                    layer.attn_k_w,
-                    cur);
+            struct ggml_tensor * Kcur = whisper_linear(ctx0, fused, layer.attn_k_w, cur, nullptr, false);
 
             //Kcur = ggml_scale(ctx0, Kcur, pow(float(n_state_head), -0.25));
 
-            struct ggml_tensor * Vcur = ggml_mul_mat(ctx0,
-                    layer.attn_v_w,
-                    cur);
-
-            Vcur = ggml_add(ctx0, Vcur, layer.attn_v_b);
+            struct ggml_tensor * Vcur = whisper_linear(ctx0, fused, layer.attn_v_w, cur, layer.attn_v_b, false);
 
             // ------
 
             struct ggml_tensor * Q =
                 ggml_permute(ctx0,
-                        ggml_reshape_3d(ctx0, Qcur, n_state_head, n_head, n_ctx),
+                        ggml_reshape_4d(ctx0, Qcur, n_state_head, n_head, n_ctx, n_batch),
                         0, 2, 1, 3);
 
-            if (wctx.params.flash_attn) {
+            if (kv_pad.buffer) {
+                // the padded K/V buffer holds a single window
+                GGML_ASSERT(n_batch == 1);
+
                 ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcur, ggml_view_1d(ctx0, kv_pad.k, n_ctx*n_state, 0)));
                 ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vcur, ggml_view_1d(ctx0, kv_pad.v, n_ctx*n_state, 0)));
 
@@ -2115,11 +2841,29 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
                 cur = ggml_flash_attn_ext(ctx0, Q, K, V, nullptr, KQscale, 0.0f, 0.0f);
 
                 cur = ggml_reshape_2d(ctx0, cur, n_state, n_ctx);
+            } else if (wstate.flash_attn_audio) {
+                struct ggml_tensor * K =
+                    ggml_permute(ctx0,
+                            ggml_cast(ctx0,
+                                ggml_reshape_4d(ctx0, Kcur, n_state_head, n_head, n_ctx, n_batch),
+                                wctx.itype),
+                            0, 2, 1, 3);
+
+                struct ggml_tensor * V =
+                    ggml_permute(ctx0,
+                            ggml_cast(ctx0,
+                                ggml_reshape_4d(ctx0, Vcur, n_state_head, n_head, n_ctx, n_batch),
+                                wctx.itype),
+                            0, 2, 1, 3);
+
+                cur = ggml_flash_attn_ext(ctx0, Q, K, V, nullptr, KQscale, 0.0f, 0.0f);
+
+                cur = ggml_reshape_2d(ctx0, cur, n_state, n_ctx*n_batch);
             } else {
                 struct ggml_tensor * K =
                     ggml_permute(ctx0,
                             ggml_cast(ctx0,
-                                ggml_reshape_3d(ctx0, Kcur, n_state_head, n_head, n_ctx),
+                                ggml_reshape_4d(ctx0, Kcur, n_state_head, n_head, n_ctx, n_batch),
                                 wctx.itype),
                             0, 2, 1, 3);
 
@@ -2131,9 +2875,9 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
                 struct ggml_tensor * V =
                     ggml_cast(ctx0,
                             ggml_permute(ctx0,
-                                ggml_reshape_3d(ctx0,
+                                ggml_reshape_4d(ctx0,
                                     Vcur,
-                                    n_state_head, n_head, n_ctx),
+                                    n_state_head, n_head, n_ctx, n_batch),
                                 1, 2, 0, 3),
                             wctx.itype);
 
@@ -2141,17 +2885,13 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
 
                 struct ggml_tensor * KQV_merged = ggml_permute(ctx0, KQV, 0, 2, 1, 3);
 
-                cur = ggml_cont_2d(ctx0, KQV_merged, n_state, n_ctx);
+                cur = ggml_cont_2d(ctx0, KQV_merged, n_state, n_ctx*n_batch);
             }
         }
 
         // projection
         {
-            cur = ggml_mul_mat(ctx0,
-                    layer.attn_ln_1_w,
-                    cur);
-
-            cur = ggml_add(ctx0, cur, layer.attn_ln_1_b);
+            cur = whisper_linear(ctx0, fused, layer.attn_ln_1_w, cur, layer.attn_ln_1_b, false);
         }
 
         // add the input
@@ -2163,30 +2903,15 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
         {
             // norm
             {
-                cur = ggml_norm(ctx0, inpFF, hparams.eps);
-
-                // cur = mlp_ln_w*cur + mlp_ln_b
-                cur = ggml_add(ctx0,
-                        ggml_mul(ctx0, cur, layer.mlp_ln_w),
-                        layer.mlp_ln_b);
+                // cur = mlp_ln_w*norm(inpFF) + mlp_ln_b
+                cur = whisper_layer_norm(ctx0, fused, inpFF, layer.mlp_ln_w, layer.mlp_ln_b, hparams.eps);
             }
 
-            // fully connected
-            cur = ggml_mul_mat(ctx0,
-                    layer.mlp_0_w,
-                    cur);
-
-            cur = ggml_add(ctx0, cur, layer.mlp_0_b);
-
-            // GELU activation
-            cur = ggml_gelu(ctx0, cur);
+            // fully connected + GELU activation
+            cur = whisper_linear(ctx0, fused, layer.mlp_0_w, cur, layer.mlp_0_b, true);
 
             // projection
-            cur = ggml_mul_mat(ctx0,
-                    layer.mlp_1_w,
-                    cur);
-
-            cur = ggml_add(ctx0, cur, layer.mlp_1_b);
+            cur = whisper_linear(ctx0, fused, layer.mlp_1_w, cur, layer.mlp_1_b, false);
         }
 
         inpL = ggml_add(ctx0, cur, inpFF);
@@ -2196,14 +2921,61 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
 
     // norm
     {
-        cur = ggml_norm(ctx0, cur, hparams.eps);
-
-        // cur = ln_f_g*cur + ln_f_b
-        cur = ggml_add(ctx0,
-                ggml_mul(ctx0, cur, model.e_ln_w),
-                model.e_ln_b);
+        // cur = ln_f_g*norm(cur) + ln_f_b
+        cur = whisper_layer_norm(ctx0, fused, cur, model.e_ln_w, model.e_ln_b, hparams.eps);
     }
 
+
+    return cur;
+}
+
+static struct ggml_cgraph * whisper_build_graph_encoder(
+        whisper_context & wctx,
+          whisper_state & wstate) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
+
+    const int n_ctx   = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ wstate.sched_encode.meta.size(),
+        /*.mem_buffer =*/ wstate.sched_encode.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+
+    struct ggml_tensor * cur = ggml_view_tensor(ctx0, wstate.embd_conv);
+
+    // ===================================================================
+    // NOTE: experimenting with partial evaluation of the encoder (ignore)
+    //static int iter = -1;
+    //const int n_iter = 1500/n_ctx;
+
+    //iter = (iter + 1) % n_iter;
+
+    //if (iter == 0) {
+    //    memset(model.memory_cross_k->data, 0, ggml_nbytes(model.memory_cross_k));
+    //    memset(model.memory_cross_v->data, 0, ggml_nbytes(model.memory_cross_v));
+    //}
+
+    static int iter = 0;
+
+    const size_t e_pe_stride = model.e_pe->ne[0]*ggml_element_size(model.e_pe);
+    const size_t e_pe_offset = model.e_pe->ne[0]*ggml_element_size(model.e_pe)*n_ctx*iter;
+
+    struct ggml_tensor * e_pe = ggml_view_2d(ctx0, model.e_pe, model.e_pe->ne[0], n_ctx, e_pe_stride, e_pe_offset);
+    cur = ggml_add(ctx0, e_pe, ggml_cont(ctx0, ggml_transpose(ctx0, cur)));
+
+    // ===================================================================
+
+    // original:
+    //cur = ggml_add(ctx0, model.e_pe, ggml_transpose(ctx0, cur));
+
+    cur = whisper_build_encoder_blocks(ctx0, gf, wctx, wstate, cur, n_ctx, 1);
+
     ggml_build_forward_expand(gf, cur);
 
     wstate.embd_enc = cur;
@@ -2224,6 +2996,43 @@ static struct ggml_cgraph * whisper_build_graph_encoder(
     return gf;
 }
 
+// copy the cross-attention K and V ([n_state, n_ctx] each) of decoder layer il into the state's kv_cross
+static void whisper_build_cross_store(
+        struct ggml_context * ctx0,
+         struct ggml_cgraph * gf,
+      const whisper_context & wctx,
+              whisper_state & wstate,
+         struct ggml_tensor * Kcross,
+         struct ggml_tensor * Vcross,
+                        int   il,
+                        int   n_ctx) {
+    const int n_state   = wctx.model.hparams.n_audio_state;
+    const int n_ctx_pad = GGML_PAD(n_ctx, 256);
+
+    struct ggml_tensor * k;
+    struct ggml_tensor * v;
+
+    if (wstate.flash_attn_audio) {
+        k = ggml_view_1d(ctx0, wstate.kv_cross.k, n_state*n_ctx,
+                ggml_row_size(wstate.kv_cross.k->type, n_state)*(il*n_ctx_pad));
+
+        v = ggml_view_1d(ctx0, wstate.kv_cross.v, n_state*n_ctx,
+                ggml_row_size(wstate.kv_cross.v->type, n_state)*(il*n_ctx_pad));
+    } else {
+        Vcross = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcross, n_state, n_ctx));
+
+        k = ggml_view_1d(ctx0, wstate.kv_cross.k, n_state*n_ctx,
+                ggml_row_size(wstate.kv_cross.k->type, n_state)*(il*n_ctx));
+
+        v = ggml_view_2d(ctx0, wstate.kv_cross.v, n_ctx, n_state,
+                (   n_ctx)*ggml_element_size(wstate.kv_cross.v),
+                (il*n_ctx)*ggml_element_size(wstate.kv_cross.v)*n_state);
+    }
+
+    ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcross, k));
+    ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vcross, v));
+}
+
 // pre-compute cross-attention memory
 static struct ggml_cgraph * whisper_build_graph_cross(
         whisper_context & wctx,
@@ -2237,8 +3046,6 @@ static struct ggml_cgraph * whisper_build_graph_cross(
 
     const int n_state_head = n_state/n_head;
 
-    const int n_ctx_pad = GGML_PAD(n_ctx, 256);
-
     struct ggml_init_params params = {
         /*.mem_size   =*/ wstate.sched_cross.meta.size(),
         /*.mem_buffer =*/ wstate.sched_cross.meta.data(),
@@ -2270,37 +3077,197 @@ static struct ggml_cgraph * whisper_build_graph_cross(
                     Vcross,
                     layer.cross_attn_v_b);
 
-        struct ggml_tensor * k;
-        struct ggml_tensor * v;
+        whisper_build_cross_store(ctx0, gf, wctx, wstate, Kcross, Vcross, il, n_ctx);
+    }
 
-        if (wctx.params.flash_attn) {
-            k = ggml_view_1d(ctx0, wstate.kv_cross.k, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.k)*n_state)*(il*n_ctx_pad));
+    //ggml_graph_print(gf);
 
-            v = ggml_view_1d(ctx0, wstate.kv_cross.v, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.v)*n_state)*(il*n_ctx_pad));
-        } else {
-            Vcross = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcross, n_state, n_ctx));
+    ggml_free(ctx0);
 
-            k = ggml_view_1d(ctx0, wstate.kv_cross.k, n_state*n_ctx,
-                    (ggml_element_size(wstate.kv_cross.k)*n_state)*(il*n_ctx));
+    return gf;
+}
 
-            v = ggml_view_2d(ctx0, wstate.kv_cross.v, n_ctx, n_state,
-                    (   n_ctx)*ggml_element_size(wstate.kv_cross.v),
-                    (il*n_ctx)*ggml_element_size(wstate.kv_cross.v)*n_state);
-        }
+// conv + encoder + cross for the first window of several states in a single graph (see whisper_encode_batch)
+//
+// the windows are stacked along the batch dimension, so every weight matrix is read once for the whole batch
+// the lead state (states[0]) owns the scheduler, each state receives its own cross-attention KV
+//
+static struct ggml_cgraph * whisper_build_graph_encode_batch(
+        whisper_context & wctx,
+          whisper_state ** states,
+                     int   n_states) {
+    const auto & model   = wctx.model;
+    const auto & hparams = model.hparams;
 
-        ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcross, k));
-        ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vcross, v));
-    }
+    whisper_state & lead = *states[0];
 
-    //ggml_graph_print(gf);
+    const int n_ctx   = lead.exp_n_audio_ctx > 0 ? lead.exp_n_audio_ctx : hparams.n_audio_ctx;
+    const int n_state = hparams.n_audio_state;
+    const int n_head  = hparams.n_audio_head;
+    const int n_mels  = hparams.n_mels;
+
+    const int n_state_head = n_state/n_head;
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ lead.sched_batch.meta.size(),
+        /*.mem_buffer =*/ lead.sched_batch.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
+
+    struct ggml_tensor * mel = ggml_new_tensor_3d(ctx0, GGML_TYPE_F32, 2*n_ctx, n_mels, n_states);
+    ggml_set_name(mel, "mel");
+    ggml_set_input(mel);
+
+    struct ggml_tensor * cur = whisper_build_conv_stem(ctx0, model, lead, mel);
+
+    const size_t e_pe_stride = model.e_pe->ne[0]*ggml_element_size(model.e_pe);
+
+    struct ggml_tensor * e_pe = ggml_view_2d(ctx0, model.e_pe, model.e_pe->ne[0], n_ctx, e_pe_stride, 0);
+    cur = ggml_add(ctx0, ggml_cont(ctx0, ggml_transpose(ctx0, cur)), e_pe);
+    cur = ggml_reshape_2d(ctx0, cur, n_state, n_ctx*n_states);
+
+    cur = whisper_build_encoder_blocks(ctx0, gf, wctx, lead, cur, n_ctx, n_states);
+
+    const float Kscale = pow(float(n_state_head), -0.25);
+
+    for (int il = 0; il < hparams.n_text_layer; ++il) {
+        auto & layer = model.layers_decoder[il];
+
+        struct ggml_tensor * Kcross = ggml_mul_mat(ctx0,
+                layer.cross_attn_k_w,
+                cur);
+
+        Kcross = ggml_scale(ctx0, Kcross, Kscale);
+
+        struct ggml_tensor * Vcross = ggml_mul_mat(ctx0,
+                layer.cross_attn_v_w,
+                cur);
+
+        Vcross = ggml_add(ctx0,
+                    Vcross,
+                    layer.cross_attn_v_b);
+
+        for (int b = 0; b < n_states; ++b) {
+            struct ggml_tensor * k = ggml_view_2d(ctx0, Kcross, n_state, n_ctx, Kcross->nb[1], b*n_ctx*Kcross->nb[1]);
+            struct ggml_tensor * v = ggml_view_2d(ctx0, Vcross, n_state, n_ctx, Vcross->nb[1], b*n_ctx*Vcross->nb[1]);
+
+            whisper_build_cross_store(ctx0, gf, wctx, *states[b], k, v, il, n_ctx);
+        }
+    }
 
     ggml_free(ctx0);
 
     return gf;
 }
 
+// copy 2*n_ctx frames of the spectrogram starting at mel_offset into dst, zero-padded past the end
+static void whisper_mel_window(const whisper_mel & mel_inp, int mel_offset, int n_ctx, float * dst) {
+    memset(dst, 0, 2*n_ctx*mel_inp.n_mel*sizeof(float));
+
+    const int i0 = std::min(mel_offset,           mel_inp.n_len);
+    const int i1 = std::min(mel_offset + 2*n_ctx, mel_inp.n_len);
+
+    for (int j = 0; j < mel_inp.n_mel; ++j) {
+        for (int i = i0; i < i1; ++i) {
+            dst[j*2*n_ctx + (i - i0)] = mel_inp.data[j*mel_inp.n_len + i];
+        }
+    }
+}
+
+static const bool * whisper_cpumask_encode(const whisper_state & wstate) {
+    return wstate.use_cpumask_encode ? wstate.cpumask_encode : nullptr;
+}
+
+static const bool * whisper_cpumask_decode(const whisper_state & wstate) {
+    return wstate.use_cpumask_decode ? wstate.cpumask_decode : nullptr;
+}
+
+// total size of the compute buffers of the state, updating its high-water mark
+static size_t whisper_state_sched_size(whisper_state & wstate) {
+    const size_t size =
+        whisper_sched_size(wstate.sched_conv)   +
+        whisper_sched_size(wstate.sched_encode) +
+        whisper_sched_size(wstate.sched_cross)  +
+        whisper_sched_size(wstate.sched_decode) +
+        whisper_sched_size(wstate.sched_batch);
+
+    wstate.sched_size_max = std::max(wstate.sched_size_max, size);
+
+    return size;
+}
+
+// audio context bucket the compute buffers are reserved for
+static int whisper_audio_ctx_bucket(const whisper_context & wctx, int n_ctx) {
+    return std::max(n_ctx, std::min(wctx.model.hparams.n_audio_ctx, GGML_PAD(n_ctx, WHISPER_AUDIO_CTX_BUCKET)));
+}
+
+// make sure the conv, encoder and cross compute buffers hold the graphs for the audio context of the request
+// if they do not, they are measured again with the graphs for its bucket, which also replaces the ones reserved for a
+// smaller bucket
+static bool whisper_sched_reserve_encode(whisper_context & wctx, whisper_state & wstate) {
+    const int n_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : wctx.model.hparams.n_audio_ctx;
+
+    if (n_ctx <= wstate.sched_encode_n_ctx) {
+        return true;
+    }
+
+    const int n_ctx_bucket = whisper_audio_ctx_bucket(wctx, n_ctx);
+
+    whisper_sched * scheds[] = { &wstate.sched_conv, &wstate.sched_encode, &wstate.sched_cross };
+    for (auto * allocr : scheds) {
+        ggml_backend_sched_free(allocr->sched);
+        allocr->sched = nullptr;
+    }
+    wstate.sched_encode_n_ctx = 0;
+
+    // the graph builders read the audio context from the state
+    const int32_t exp_n_audio_ctx = wstate.exp_n_audio_ctx;
+    wstate.exp_n_audio_ctx = n_ctx_bucket;
+
+    const auto buft_cpu = whisper_cpu_buffer_type(wctx.params);
+
+    // each graph views the output of the previous one, so they are allocated in order
+    bool ok = whisper_sched_graph_init(wstate.sched_conv, wstate.backends, buft_cpu,
+            [&]() {
+                return whisper_build_graph_conv(wctx, wstate);
+            });
+
+    if (ok && !whisper_encode_external(wstate)) {
+        ok = whisper_sched_graph_init(wstate.sched_encode, wstate.backends, buft_cpu,
+                [&]() {
+                    return whisper_build_graph_encoder(wctx, wstate);
+                });
+    }
+
+    if (ok) {
+        ok = whisper_sched_graph_init(wstate.sched_cross, wstate.backends, buft_cpu,
+                [&]() {
+                    return whisper_build_graph_cross(wctx, wstate);
+                });
+    }
+
+    wstate.exp_n_audio_ctx = exp_n_audio_ctx;
+
+    if (!ok) {
+        WHISPER_LOG_ERROR("%s: failed to init the encoder allocators for n_ctx = %d\n", __func__, n_ctx_bucket);
+        return false;
+    }
+
+    wstate.sched_encode_n_ctx = n_ctx_bucket;
+
+    WHISPER_LOG_INFO("%s: compute buffer (conv)   = %7.2f MB, n_ctx = %d\n", __func__, whisper_sched_size(wstate.sched_conv)   / 1e6, n_ctx_bucket);
+    WHISPER_LOG_INFO("%s: compute buffer (encode) = %7.2f MB, n_ctx = %d\n", __func__, whisper_sched_size(wstate.sched_encode) / 1e6, n_ctx_bucket);
+    WHISPER_LOG_INFO("%s: compute buffer (cross)  = %7.2f MB, n_ctx = %d\n", __func__, whisper_sched_size(wstate.sched_cross)  / 1e6, n_ctx_bucket);
+
+    whisper_state_sched_size(wstate);
+
+    return true;
+}
+
 // evaluate the encoder with the given state
 //
 // given audio recording (more specifically, its log mel spectrogram), runs forward pass of the encoder
@@ -2320,6 +3287,12 @@ static bool whisper_encode_internal(
                    void * abort_callback_data) {
     const int64_t t_start_us = ggml_time_us();
 
+    wstate.encoded_seek = -1;
+
+    if (!whisper_sched_reserve_encode(wctx, wstate)) {
+        return false;
+    }
+
     // conv
     {
         auto & sched = wstate.sched_conv.sched;
@@ -2343,23 +3316,13 @@ static bool whisper_encode_internal(
 
             wstate.inp_mel.resize(ggml_nelements(mel));
 
-            float * dst = wstate.inp_mel.data();
-            memset(dst, 0, ggml_nbytes(mel));
-
-            const int i0 = std::min(mel_offset,           mel_inp.n_len);
-            const int i1 = std::min(mel_offset + 2*n_ctx, mel_inp.n_len);
-
-            for (int j = 0; j < mel_inp.n_mel; ++j) {
-                for (int i = i0; i < i1; ++i) {
-                    dst[j*2*n_ctx + (i - i0)] = mel_inp.data[j*mel_inp.n_len + i];
-                }
-            }
+            whisper_mel_window(mel_inp, mel_offset, n_ctx, wstate.inp_mel.data());
 
             ggml_backend_tensor_set(mel, wstate.inp_mel.data(), 0, ggml_nelements(mel)*sizeof(float));
         }
 
         if (!whisper_encode_external(wstate)) {
-            if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
+            if (!ggml_graph_compute_helper(sched, gf, n_threads, whisper_cpumask_encode(wstate), abort_callback, abort_callback_data)) {
                 return false;
             }
         } else {
@@ -2371,42 +3334,180 @@ static bool whisper_encode_internal(
         }
     }
 
-    // encoder
-    if (!whisper_encode_external(wstate)) {
-        auto & sched = wstate.sched_encode.sched;
+    // encoder
+    if (!whisper_encode_external(wstate)) {
+        auto & sched = wstate.sched_encode.sched;
+
+        ggml_cgraph * gf = whisper_build_graph_encoder(wctx, wstate);
+
+        if (!ggml_backend_sched_alloc_graph(sched, gf)) {
+            // should never happen as we pre-allocate the memory
+            return false;
+        }
+
+        if (!ggml_graph_compute_helper(sched, gf, n_threads, whisper_cpumask_encode(wstate), abort_callback, abort_callback_data)) {
+            return false;
+        }
+    }
+
+    // cross
+    {
+        auto & sched = wstate.sched_cross.sched;
+
+        ggml_cgraph * gf = whisper_build_graph_cross(wctx, wstate);
+
+        if (!ggml_backend_sched_alloc_graph(sched, gf)) {
+            // should never happen as we pre-allocate the memory
+            return false;
+        }
+
+        if (!ggml_graph_compute_helper(sched, gf, n_threads, whisper_cpumask_encode(wstate), abort_callback, abort_callback_data)) {
+            return false;
+        }
+    }
+
+    wstate.t_encode_us += ggml_time_us() - t_start_us;
+    wstate.n_encode++;
+
+    return !(abort_callback && abort_callback(abort_callback_data));
+}
+
+// whether every character of a token belongs to the script (a token may start or end inside a character)
+static bool whisper_token_in_script(const char * text, size_t n, const whisper_lang_script & script) {
+    const uint8_t * s = (const uint8_t *) text;
+
+    const auto allowed = [&](uint32_t lo, uint32_t hi) {
+        if (hi < 0x80 || (lo >= 0xA0 && hi <= 0xFF) || (lo >= 0x2000 && hi <= 0x206F)) {
+            return true;
+        }
+        for (const auto & r : script.ranges) {
+            if (lo <= r.second && hi >= r.first) {
+                return true;
+            }
+        }
+        return false;
+    };
+
+    size_t i = 0;
+
+    // the rest of a character that started in the previous token
+    if (i < n && (s[i] & 0xC0) == 0x80) {
+        if (!script.fragments) {
+            return false;
+        }
+        while (i < n && (s[i] & 0xC0) == 0x80) {
+            ++i;
+        }
+    }
+
+    while (i < n) {
+        const int len = s[i] < 0x80 ? 1 : (s[i] >> 5) == 0x06 ? 2 : (s[i] >> 4) == 0x0E ? 3 : (s[i] >> 3) == 0x1E ? 4 : 0;
+        if (len == 0) {
+            return false;
+        }
+
+        uint32_t cp = len == 1 ? s[i] : s[i] & (0x7F >> len);
+
+        int k = 1;
+        for (; k < len && i + k < n; ++k) {
+            if ((s[i + k] & 0xC0) != 0x80) {
+                return false;
+            }
+            cp = (cp << 6) | (s[i + k] & 0x3F);
+        }
+
+        // a character that continues in the next token - any code point with this prefix
+        if (k < len) {
+            const int rest = 6*(len - k);
+            return script.fragments && allowed(cp << rest, (cp << rest) | ((1u << rest) - 1));
+        }
+
+        if (!allowed(cp, cp)) {
+            return false;
+        }
+
+        i += len;
+    }
+
+    return true;
+}
+
+// the vocabulary subset of a language (its script, the byte tokens and all special and timestamp tokens), built on
+// first use from the tokenizer and the output projection; nullptr if the language has no script entry or the
+// subset would not be much smaller than the vocabulary
+static const whisper_vocab_subset * whisper_vocab_subset_get(whisper_context & ctx, int lang_id) {
+    std::lock_guard<std::mutex> lock(ctx.vocab_subsets_mutex);
+
+    const auto it = ctx.vocab_subsets.find(lang_id);
+    if (it != ctx.vocab_subsets.end()) {
+        return it->second.w ? &it->second : nullptr;
+    }
+
+    // an entry without weights records that the language uses the full vocabulary
+    auto & sub = ctx.vocab_subsets[lang_id];
+
+    const std::string lang = std::string(" ") + whisper_lang_str(lang_id) + " ";
+
+    const whisper_lang_script * script = nullptr;
+    for (const auto & sc : g_lang_scripts) {
+        if ((std::string(" ") + sc.langs + " ").find(lang) != std::string::npos) {
+            script = &sc;
+            break;
+        }
+    }
+
+    if (!script) {
+        return nullptr;
+    }
 
-        ggml_cgraph * gf = whisper_build_graph_encoder(wctx, wstate);
+    const auto & vocab = ctx.vocab;
+    const auto & d_te  = ctx.model.d_te;
 
-        if (!ggml_backend_sched_alloc_graph(sched, gf)) {
-            // should never happen as we pre-allocate the memory
-            return false;
+    for (whisper_token id = 0; id < vocab.n_vocab; ++id) {
+        if (id >= vocab.token_eot || vocab.token_len(id) == 1 || whisper_token_in_script(vocab.token_str(id), vocab.token_len(id), *script)) {
+            sub.ids.push_back(id);
         }
+    }
 
-        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
-            return false;
-        }
+    const int n_sub = sub.ids.size();
+
+    if (10*n_sub > 9*vocab.n_vocab) {
+        WHISPER_LOG_INFO("%s: '%s' uses %d of %d tokens - keeping the full output projection\n", __func__, whisper_lang_str(lang_id), n_sub, vocab.n_vocab);
+        sub.ids.clear();
+        return nullptr;
     }
 
-    // cross
-    {
-        auto & sched = wstate.sched_cross.sched;
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ ggml_tensor_overhead(),
+        /*.mem_buffer =*/ nullptr,
+        /*.no_alloc   =*/ true,
+    };
 
-        ggml_cgraph * gf = whisper_build_graph_cross(wctx, wstate);
+    sub.ctx = ggml_init(params);
+    sub.w   = ggml_new_tensor_2d(sub.ctx, d_te->type, d_te->ne[0], n_sub);
 
-        if (!ggml_backend_sched_alloc_graph(sched, gf)) {
-            // should never happen as we pre-allocate the memory
-            return false;
-        }
+    sub.buffer = ggml_backend_alloc_ctx_tensors_from_buft(sub.ctx, ggml_backend_buffer_get_type(ctx.model.buffer));
+    if (!sub.buffer) {
+        WHISPER_LOG_ERROR("%s: failed to allocate the vocabulary subset\n", __func__);
+        ggml_free(sub.ctx);
+        sub = whisper_vocab_subset();
+        return nullptr;
+    }
 
-        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
-            return false;
+    // gather the rows in runs of consecutive ids
+    const size_t row = d_te->nb[1];
+
+    std::vector<uint8_t> data(n_sub*row);
+    for (int i0 = 0, i1 = 0; i0 < n_sub; i0 = i1) {
+        for (i1 = i0 + 1; i1 < n_sub && sub.ids[i1] == sub.ids[i1 - 1] + 1; ++i1) {
         }
+        ggml_backend_tensor_get(d_te, data.data() + i0*row, sub.ids[i0]*row, (i1 - i0)*row);
     }
+    ggml_backend_tensor_set(sub.w, data.data(), 0, data.size());
 
-    wstate.t_encode_us += ggml_time_us() - t_start_us;
-    wstate.n_encode++;
+    WHISPER_LOG_INFO("%s: '%s' uses %d of %d tokens (%.2f MB)\n", __func__, whisper_lang_str(lang_id), n_sub, vocab.n_vocab, data.size()/1e6);
 
-    return !(abort_callback && abort_callback(abort_callback_data));
+    return &sub;
 }
 
 static struct ggml_cgraph * whisper_build_graph_decoder(
@@ -2433,6 +3534,7 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
     const int n_audio_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
 
     const int n_audio_ctx_pad = GGML_PAD(n_audio_ctx, 256);
+    const int n_audio_kv      = whisper_audio_kv_len(wstate, n_audio_ctx);
 
     const int32_t n_kv    = worst_case ? n_ctx            : kv_self.n;
     const int32_t kv_head = worst_case ? n_ctx - n_tokens : kv_self.head;
@@ -2449,6 +3551,10 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
 
     ggml_cgraph * gf = ggml_new_graph_custom(ctx0, WHISPER_MAX_NODES, false);
 
+    if (!worst_case) {
+        wstate.graph_decode.kv_store.clear();
+    }
+
     struct ggml_tensor * embd = ggml_new_tensor_1d(ctx0, GGML_TYPE_I32, n_tokens);
     ggml_set_name(embd, "embd");
     ggml_set_input(embd);
@@ -2525,23 +3631,34 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
 
                 if (wctx.params.flash_attn) {
                     k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state,
-                            (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + kv_head));
+                            ggml_row_size(kv_self.k->type, n_state)*(il*n_ctx + kv_head));
 
                     v = ggml_view_1d(ctx0, kv_self.v, n_tokens*n_state,
-                            (ggml_element_size(kv_self.v)*n_state)*(il*n_ctx + kv_head));
+                            ggml_row_size(kv_self.v->type, n_state)*(il*n_ctx + kv_head));
                 } else {
                     Vcur = ggml_transpose(ctx0, ggml_reshape_2d(ctx0, Vcur, n_state, n_tokens));
 
                     k = ggml_view_1d(ctx0, kv_self.k, n_tokens*n_state,
-                            (ggml_element_size(kv_self.k)*n_state)*(il*n_ctx + kv_head));
+                            ggml_row_size(kv_self.k->type, n_state)*(il*n_ctx + kv_head));
 
                     v = ggml_view_2d(ctx0, kv_self.v, n_tokens, n_state,
                             (   n_ctx)*ggml_element_size(kv_self.v),
                             (il*n_ctx)*ggml_element_size(kv_self.v)*n_state + kv_head*ggml_element_size(kv_self.v));
                 }
 
-                ggml_build_forward_expand(gf, ggml_cpy(ctx0, Kcur, k));
-                ggml_build_forward_expand(gf, ggml_cpy(ctx0, Vcur, v));
+                struct ggml_tensor * k_cpy = ggml_cpy(ctx0, Kcur, k);
+                struct ggml_tensor * v_cpy = ggml_cpy(ctx0, Vcur, v);
+
+                ggml_build_forward_expand(gf, k_cpy);
+                ggml_build_forward_expand(gf, v_cpy);
+
+                if (!worst_case) {
+                    const size_t k_step = ggml_row_size(kv_self.k->type, n_state);
+                    const size_t v_step = wctx.params.flash_attn ? ggml_row_size(kv_self.v->type, n_state) : ggml_element_size(kv_self.v);
+
+                    wstate.graph_decode.kv_store.push_back({ k_cpy, k->view_offs - k_step*kv_head, k_step });
+                    wstate.graph_decode.kv_store.push_back({ v_cpy, v->view_offs - v_step*kv_head, v_step });
+                }
             }
 
             // ------
@@ -2554,17 +3671,17 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
             struct ggml_tensor * K =
                 ggml_view_3d(ctx0, kv_self.k,
                         n_state_head, n_kv, n_head,
-                        ggml_element_size(kv_self.k)*n_state,
-                        ggml_element_size(kv_self.k)*n_state_head,
-                        ggml_element_size(kv_self.k)*n_state*n_ctx*il);
+                        ggml_row_size(kv_self.k->type, n_state),
+                        ggml_row_size(kv_self.k->type, n_state_head),
+                        ggml_row_size(kv_self.k->type, n_state)*n_ctx*il);
 
             if (wctx.params.flash_attn) {
                 struct ggml_tensor * V =
                     ggml_view_3d(ctx0, kv_self.v,
                             n_state_head, n_kv, n_head,
-                            ggml_element_size(kv_self.v)*n_state,
-                            ggml_element_size(kv_self.v)*n_state_head,
-                            ggml_element_size(kv_self.v)*n_state*n_ctx*il);
+                            ggml_row_size(kv_self.v->type, n_state),
+                            ggml_row_size(kv_self.v->type, n_state_head),
+                            ggml_row_size(kv_self.v->type, n_state)*n_ctx*il);
 
                 cur = ggml_flash_attn_ext(ctx0, Q, K, V, KQ_mask_f16, 1.0f, 0.0f, 0.0f);
 
@@ -2631,20 +3748,20 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
                         ggml_reshape_3d(ctx0, Qcur, n_state_head, n_head, n_tokens),
                         0, 2, 1, 3);
 
-            if (wctx.params.flash_attn) {
+            if (wstate.flash_attn_audio) {
                 struct ggml_tensor * Kcross =
                     ggml_view_3d(ctx0, wstate.kv_cross.k,
-                            n_state_head, n_audio_ctx_pad, n_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state,
-                            ggml_element_size(wstate.kv_cross.k)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state*n_audio_ctx_pad*il);
+                            n_state_head, n_audio_kv, n_head,
+                            ggml_row_size(wstate.kv_cross.k->type, n_state),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state_head),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state)*n_audio_ctx_pad*il);
 
                 struct ggml_tensor * Vcross =
                     ggml_view_3d(ctx0, wstate.kv_cross.v,
-                            n_state_head, n_audio_ctx_pad, n_head,
-                            ggml_element_size(wstate.kv_cross.v)*n_state,
-                            ggml_element_size(wstate.kv_cross.v)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.v)*n_state*n_audio_ctx_pad*il);
+                            n_state_head, n_audio_kv, n_head,
+                            ggml_row_size(wstate.kv_cross.v->type, n_state),
+                            ggml_row_size(wstate.kv_cross.v->type, n_state_head),
+                            ggml_row_size(wstate.kv_cross.v->type, n_state)*n_audio_ctx_pad*il);
 
                 cur = ggml_flash_attn_ext(ctx0, Q, Kcross, Vcross, nullptr, KQscale, 0.0f, 0.0f);
 
@@ -2653,9 +3770,9 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
                 struct ggml_tensor * Kcross =
                     ggml_view_3d(ctx0, wstate.kv_cross.k,
                             n_state_head, n_audio_ctx, n_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state,
-                            ggml_element_size(wstate.kv_cross.k)*n_state_head,
-                            ggml_element_size(wstate.kv_cross.k)*n_state*n_audio_ctx*il);
+                            ggml_row_size(wstate.kv_cross.k->type, n_state),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state_head),
+                            ggml_row_size(wstate.kv_cross.k->type, n_state)*n_audio_ctx*il);
 
                 struct ggml_tensor * Vcross =
                     ggml_view_3d(ctx0, wstate.kv_cross.v,
@@ -2770,7 +3887,17 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
     // might be useful in the future
     //cur = ggml_view_2d(ctx0, cur, cur->ne[0], 1, cur->nb[1], (cur->ne[1] - 1)*cur->nb[1]);
 
-    struct ggml_tensor * logits = ggml_mul_mat(ctx0, model.d_te, cur);
+    struct ggml_tensor * logits;
+
+    if (wstate.vocab_sub) {
+        // kept for the rows that turn out to need the full projection
+        ggml_set_name(cur, "hidden");
+        ggml_set_output(cur);
+
+        logits = ggml_mul_mat(ctx0, wstate.vocab_sub->w, cur);
+    } else {
+        logits = ggml_mul_mat(ctx0, model.d_te, cur);
+    }
 
     // [EXPERIMENTAL] Token-level timestamps with DTW
     if (wctx.params.dtw_token_timestamps && aheads_cross_QKs != nullptr) {
@@ -2789,6 +3916,208 @@ static struct ggml_cgraph * whisper_build_graph_decoder(
     return gf;
 }
 
+// drop the decoder graph kept by whisper_decode_internal, before anything else is allocated in sched_decode or the
+// self-attention cache it writes to is recreated
+static void whisper_graph_decode_release(whisper_state & wstate) {
+    if (wstate.graph_decode.gf) {
+        ggml_backend_sched_reset(wstate.sched_decode.sched);
+        wstate.graph_decode.gf = nullptr;
+    }
+}
+
+// point the KV cache writes of the kept decoder graph at a new KV head
+static void whisper_graph_decode_set_head(whisper_graph_decode & graph, int32_t kv_head) {
+    for (const auto & store : graph.kv_store) {
+        const size_t offs = store.offs + store.step*kv_head;
+
+        // the CPY node is a view of the same bytes as its destination
+        for (struct ggml_tensor * t : { store.cpy, store.cpy->src[1] }) {
+            t->view_offs = offs;
+            t->data      = (char *) t->view_src->data + offs;
+        }
+    }
+}
+
+// output projection of decoder rows onto the full vocabulary, for the rows whose restricted projection was not confident
+static struct ggml_cgraph * whisper_build_graph_proj(
+         whisper_context & wctx,
+         whisper_state   & wstate,
+                     int   n_rows) {
+    const auto & model = wctx.model;
+
+    struct ggml_init_params params = {
+        /*.mem_size   =*/ wstate.sched_decode.meta.size(),
+        /*.mem_buffer =*/ wstate.sched_decode.meta.data(),
+        /*.no_alloc   =*/ true,
+    };
+
+    struct ggml_context * ctx0 = ggml_init(params);
+
+    ggml_cgraph * gf = ggml_new_graph(ctx0);
+
+    struct ggml_tensor * hidden = ggml_new_tensor_2d(ctx0, GGML_TYPE_F32, model.hparams.n_text_state, n_rows);
+    ggml_set_name(hidden, "hidden");
+    ggml_set_input(hidden);
+
+    struct ggml_tensor * logits = ggml_mul_mat(ctx0, model.d_te, hidden);
+
+    ggml_build_forward_expand(gf, logits);
+
+    ggml_free(ctx0);
+
+    return gf;
+}
+
+// scatter the restricted logits of the rows that need them into wstate.logits
+// rows whose best subset token gets less than vocab_sub_thold of the subset's softmax are projected onto the full
+// vocabulary from the decoder's normalized output instead
+static bool whisper_decode_logits_sub(
+        whisper_context & wctx,
+          whisper_state & wstate,
+    const whisper_batch & batch,
+     struct ggml_tensor * logits,
+     struct ggml_tensor * hidden,
+              const int   n_threads) {
+    const int n_vocab = wctx.model.hparams.n_vocab;
+    const int n_state = wctx.model.hparams.n_text_state;
+
+    const auto & ids = wstate.vocab_sub->ids;
+    const int n_sub = ids.size();
+
+    auto & logits_out = wstate.logits;
+    auto & logits_sub = wstate.logits_sub;
+
+    logits_sub.resize(2*n_sub);
+
+    std::vector<int> rows_full;
+
+    for (int i = 0; i < batch.n_tokens; i++) {
+        if (batch.logits[i] == 0) {
+            continue;
+        }
+
+        ggml_backend_tensor_get(logits, logits_sub.data(), sizeof(float)*(n_sub*i), sizeof(float)*n_sub);
+
+        if (wstate.vocab_sub_thold > 0.0f) {
+            const float  max = ggml_cpu_vec_max_f32(n_sub, logits_sub.data());
+            const double sum = ggml_cpu_vec_soft_max_f32(n_sub, logits_sub.data() + n_sub, logits_sub.data(), max);
+
+            if (1.0/sum < wstate.vocab_sub_thold) {
+                rows_full.push_back(i);
+                continue;
+            }
+        }
+
+        float * out = logits_out.data() + n_vocab*i;
+
+        std::fill(out, out + n_vocab, -INFINITY);
+        for (int k = 0; k < n_sub; ++k) {
+            out[ids[k]] = logits_sub[k];
+        }
+    }
+
+    if (rows_full.empty()) {
+        return true;
+    }
+
+    const int n_rows = rows_full.size();
+
+    wstate.hidden.resize(n_rows*n_state);
+    for (int r = 0; r < n_rows; ++r) {
+        ggml_backend_tensor_get(hidden, wstate.hidden.data() + n_state*r, hidden->nb[1]*rows_full[r], sizeof(float)*n_state);
+    }
+
+    auto & sched = wstate.sched_decode.sched;
+
+    // the projection graph takes over sched_decode and its meta buffer
+    whisper_graph_decode_release(wstate);
+
+    ggml_cgraph * gf = whisper_build_graph_proj(wctx, wstate, n_rows);
+
+    if (!ggml_backend_sched_alloc_graph(sched, gf)) {
+        return false;
+    }
+
+    ggml_backend_tensor_set(ggml_graph_get_tensor(gf, "hidden"), wstate.hidden.data(), 0, sizeof(float)*n_rows*n_state);
+
+    struct ggml_tensor * logits_full = ggml_graph_node(gf, -1);
+
+    if (!ggml_graph_compute_helper(sched, gf, n_threads, whisper_cpumask_decode(wstate), nullptr, nullptr)) {
+        return false;
+    }
+
+    for (int r = 0; r < n_rows; ++r) {
+        ggml_backend_tensor_get(logits_full, logits_out.data() + n_vocab*rows_full[r], sizeof(float)*(n_vocab*r), sizeof(float)*n_vocab);
+    }
+
+    wstate.n_proj_full += n_rows;
+
+    return true;
+}
+
+// make sure the decoder compute buffer holds the graph for a batch of n_tokens, with the current KV cache size and
+// audio context
+// if it does not, it is measured again with the worst-case graph for the bucket of the batch: all of its rows project
+// onto the full vocabulary (which also covers whisper_build_graph_proj) and attend to the whole KV cache
+static bool whisper_sched_reserve_decode(whisper_context & wctx, whisper_state & wstate, int n_tokens) {
+    const auto & hparams = wctx.model.hparams;
+
+    const int n_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
+    const int n_kv  = wstate.kv_self.size;
+
+    if (n_tokens <= wstate.sched_decode_n_tokens && n_kv <= wstate.sched_decode_n_kv && n_ctx <= wstate.sched_decode_n_ctx) {
+        return true;
+    }
+
+    int n_tokens_bucket = std::max(WHISPER_DECODE_TOKENS_BUCKET, wstate.sched_decode_n_tokens);
+    while (n_tokens_bucket < n_tokens) {
+        n_tokens_bucket *= 2;
+    }
+    n_tokens_bucket = std::max(n_tokens, std::min(n_tokens_bucket, hparams.n_text_ctx));
+
+    const int n_ctx_bucket = std::max(wstate.sched_decode_n_ctx, whisper_audio_ctx_bucket(wctx, n_ctx));
+
+    whisper_graph_decode_release(wstate);
+
+    ggml_backend_sched_free(wstate.sched_decode.sched);
+    wstate.sched_decode.sched = nullptr;
+    wstate.sched_decode_n_tokens = 0;
+
+    // the graph builder reads these from the state
+    const int32_t exp_n_audio_ctx = wstate.exp_n_audio_ctx;
+    const auto *  vocab_sub       = wstate.vocab_sub;
+
+    wstate.exp_n_audio_ctx = n_ctx_bucket;
+    wstate.vocab_sub       = nullptr;
+
+    // the worst-case graph only reads the number of tokens of the batch
+    whisper_batch batch = { n_tokens_bucket, nullptr, nullptr, nullptr, nullptr, nullptr, };
+
+    const bool ok = whisper_sched_graph_init(wstate.sched_decode, wstate.backends, whisper_cpu_buffer_type(wctx.params),
+            [&]() {
+                return whisper_build_graph_decoder(wctx, wstate, batch, wctx.params.dtw_token_timestamps, true);
+            });
+
+    wstate.exp_n_audio_ctx = exp_n_audio_ctx;
+    wstate.vocab_sub       = vocab_sub;
+
+    if (!ok) {
+        WHISPER_LOG_ERROR("%s: failed to init the decoder allocator for n_tokens = %d\n", __func__, n_tokens_bucket);
+        return false;
+    }
+
+    wstate.sched_decode_n_tokens = n_tokens_bucket;
+    wstate.sched_decode_n_kv     = n_kv;
+    wstate.sched_decode_n_ctx    = n_ctx_bucket;
+
+    WHISPER_LOG_INFO("%s: compute buffer (decode) = %7.2f MB, n_tokens = %d, n_kv = %d, n_ctx = %d\n", __func__,
+            whisper_sched_size(wstate.sched_decode) / 1e6, n_tokens_bucket, n_kv, n_ctx_bucket);
+
+    whisper_state_sched_size(wstate);
+
+    return true;
+}
+
 // evaluate the decoder
 //
 // given text prompt + audio features -> computes the logits for the next token
@@ -2818,6 +4147,7 @@ static bool whisper_decode_internal(
     auto & logits_out = wstate.logits;
 
     struct ggml_tensor * logits;
+    struct ggml_tensor * hidden = nullptr;
 
     // find KV slot for the batch
     {
@@ -2827,7 +4157,9 @@ static bool whisper_decode_internal(
             return false;
         }
 
-        const uint32_t pad = whisper_kv_cache_get_padding(wctx);
+        // the window is rounded up to WHISPER_DECODE_KV_BUCKET cells so that consecutive tokens can share a graph,
+        // the extra cells are masked out
+        const uint32_t pad = std::max(whisper_kv_cache_get_padding(wctx), (uint32_t) WHISPER_DECODE_KV_BUCKET);
         kv_self.n = std::min(kv_self.size, std::max(pad, GGML_PAD(whisper_kv_cache_cell_max(kv_self), pad)));
 
         //kv_self.n = std::min((int32_t) hparams.n_text_ctx, std::max(32, whisper_kv_cache_cell_max(kv_self)));
@@ -2837,12 +4169,38 @@ static bool whisper_decode_internal(
     // decoder
     {
         auto & sched = wstate.sched_decode.sched;
+        auto & graph = wstate.graph_decode;
 
-        ggml_cgraph * gf = whisper_build_graph_decoder(wctx, wstate, batch, save_alignment_heads_QKs, false);
+        const int32_t n_kv        = wstate.kv_self.n;
+        const int32_t n_audio_ctx = wstate.exp_n_audio_ctx > 0 ? wstate.exp_n_audio_ctx : hparams.n_audio_ctx;
 
-        if (!ggml_backend_sched_alloc_graph(sched, gf)) {
-            // should never happen as we pre-allocate the memory
-            return false;
+        ggml_cgraph * gf = graph.gf;
+
+        if (gf && graph.n_tokens == n_tokens && graph.n_kv == n_kv && graph.n_audio_ctx == n_audio_ctx &&
+                  graph.save_aheads == save_alignment_heads_QKs && graph.vocab_sub == wstate.vocab_sub) {
+            whisper_graph_decode_set_head(graph, wstate.kv_self.head);
+        } else {
+            whisper_graph_decode_release(wstate);
+
+            if (!whisper_sched_reserve_decode(wctx, wstate, n_tokens)) {
+                return false;
+            }
+
+            gf = whisper_build_graph_decoder(wctx, wstate, batch, save_alignment_heads_QKs, false);
+
+            if (!ggml_backend_sched_alloc_graph(sched, gf)) {
+                // should never happen as we pre-allocate the memory
+                return false;
+            }
+
+            graph.gf          = gf;
+            graph.n_tokens    = n_tokens;
+            graph.n_kv        = n_kv;
+            graph.n_audio_ctx = n_audio_ctx;
+            graph.save_aheads = save_alignment_heads_QKs;
+            graph.vocab_sub   = wstate.vocab_sub;
+
+            wstate.n_graph_decode++;
         }
 
         // set the inputs
@@ -2895,17 +4253,29 @@ static bool whisper_decode_internal(
 
         logits = ggml_graph_node(gf, -1);
 
-        if (!ggml_graph_compute_helper(sched, gf, n_threads)) {
+        if (wstate.vocab_sub) {
+            hidden = ggml_graph_get_tensor(gf, "hidden");
+        }
+
+        // keep the graph allocated for the next token
+        if (!ggml_graph_compute_helper(sched, gf, n_threads, whisper_cpumask_decode(wstate), abort_callback, abort_callback_data, false)) {
+            whisper_graph_decode_release(wstate);
             return false;
         }
     }
 
     logits_out.resize(n_tokens*n_vocab);
-    for (int i = 0; i < n_tokens; i++) {
-        if (batch.logits[i] == 0) {
-            continue;
+    if (wstate.vocab_sub) {
+        if (!whisper_decode_logits_sub(wctx, wstate, batch, logits, hidden, n_threads)) {
+            return false;
+        }
+    } else {
+        for (int i = 0; i < n_tokens; i++) {
+            if (batch.logits[i] == 0) {
+                continue;
+            }
+            ggml_backend_tensor_get(logits, logits_out.data() + (n_vocab*i), sizeof(float)*(n_vocab*i), sizeof(float)*n_vocab);
         }
-        ggml_backend_tensor_get(logits, logits_out.data() + (n_vocab*i), sizeof(float)*(n_vocab*i), sizeof(float)*n_vocab);
     }
 
     if (batch.n_tokens > 1) {
@@ -3223,51 +4593,84 @@ static bool log_mel_spectrogram(
 // Regex (C++):
 // R"('s|'t|'re|'ve|'m|'ll|'d| ?[[:alpha:]]+| ?[[:digit:]]+| ?[^\s[:alpha:][:digit:]]+|\s+(?!\S)|\s+)"
 //
-static std::vector<whisper_vocab::id> tokenize(const whisper_vocab & vocab, const std::string & text) {
-    std::vector<std::string> words;
+// The C++ regex is matched by hand below (classic locale classes, first
+// alternative wins), then each word is covered by the longest vocab tokens.
+//
 
-    // first split the text into words
-    {
-        std::string str = text;
-        std::string pat = R"('s|'t|'re|'ve|'m|'ll|'d| ?[[:alpha:]]+| ?[[:digit:]]+| ?[^\s[:alpha:][:digit:]]+|\s+(?!\S)|\s+)";
+static bool tokenize_is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\v' || c == '\f' || c == '\r';
+}
+
+static bool tokenize_is_alpha(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static bool tokenize_is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
 
-        std::regex re(pat);
-        std::smatch m;
+static bool tokenize_is_other(char c) {
+    return !tokenize_is_space(c) && !tokenize_is_alpha(c) && !tokenize_is_digit(c);
+}
 
-        while (std::regex_search(str, m, re)) {
-            for (auto x : m) {
-                words.push_back(x);
+// length of the pre-tokenizer word starting at s[0] (n > 0)
+static size_t tokenize_word_len(const char * s, size_t n) {
+    if (s[0] == '\'' && n > 1) {
+        static const char * contractions[] = { "s", "t", "re", "ve", "m", "ll", "d" };
+        for (const char * c : contractions) {
+            const size_t len = strlen(c);
+            if (n > len && strncmp(s + 1, c, len) == 0) {
+                return len + 1;
             }
-            str = m.suffix();
         }
     }
 
-    // find the longest tokens that form the words:
+    // " ?[[:alpha:]]+", " ?[[:digit:]]+", " ?[^\s[:alpha:][:digit:]]+"
+    static bool (* const classes[])(char) = { tokenize_is_alpha, tokenize_is_digit, tokenize_is_other };
+    for (auto is_class : classes) {
+        size_t i = s[0] == ' ' && n > 1 && is_class(s[1]) ? 1 : 0;
+        if (!is_class(s[i])) {
+            continue;
+        }
+        while (i < n && is_class(s[i])) {
+            ++i;
+        }
+        return i;
+    }
+
+    // "\s+(?!\S)", else "\s+" - a run of spaces leaves its last one to the next word
+    size_t i = 0;
+    while (i < n && tokenize_is_space(s[i])) {
+        ++i;
+    }
+    if (i == n || i == 1) {
+        return i;
+    }
+    return i - 1;
+}
+
+static std::vector<whisper_vocab::id> tokenize(const whisper_vocab & vocab, const std::string & text) {
     std::vector<whisper_vocab::id> tokens;
-    for (const auto & word : words) {
-        if (word.empty()) continue;
-
-        int i = 0;
-        int n = word.size();
-        while (i < n) {
-            int j = n;
-            bool found = false;
-            while (j > i) {
-                auto sub = word.substr(i, j-i);
-                auto it = vocab.token_to_id.find(sub);
-                if (it != vocab.token_to_id.end()) {
-                    tokens.push_back(it->second);
-                    i = j;
-                    found = true;
-                    break;
-                }
-                --j;
-            }
-            if (!found) {
+
+    const char * s = text.data();
+    const size_t n = text.size();
+    for (size_t w = 0; w < n; ) {
+        const size_t w_len = tokenize_word_len(s + w, n - w);
+
+        // find the longest tokens that form the word
+        for (size_t i = w; i < w + w_len; ) {
+            whisper_vocab::id tid = -1;
+            const size_t len = vocab.match(s + i, w + w_len - i, tid);
+            if (len > 0) {
+                tokens.push_back(tid);
+                i += len;
+            } else {
                 WHISPER_LOG_ERROR("unknown token\n");
                 ++i;
             }
         }
+
+        w += w_len;
     }
 
     return tokens;
@@ -3338,7 +4741,16 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
     // at this point, we don't know yet how many decoders will be used
     // later during decoding, if more decoders are used, we will recreate the KV cache respectively
     state->kv_self_n_dec = 1;
-    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], ctx->itype,
+
+    // DTW reads the cross-attention weights, which flash attention never forms
+    state->flash_attn_audio = ctx->params.flash_attn ||
+        (ggml_backend_is_cpu(state->backends[0]) && !ctx->params.dtw_token_timestamps);
+
+    ggml_type type_k;
+    ggml_type type_v;
+
+    whisper_kv_cache_types(*ctx, state->backends[0], ctx->params.flash_attn, ctx->params.type_kv_self, type_k, type_v);
+    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], type_k, type_v,
                 ctx->model.hparams.n_text_state,
                 ctx->model.hparams.n_text_layer,
                 GGML_PAD(ctx->model.hparams.n_text_ctx, 256))) {
@@ -3352,7 +4764,8 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
         WHISPER_LOG_INFO("%s: kv self size  = %7.2f MB\n", __func__, memory_size / 1e6);
     }
 
-    if (!whisper_kv_cache_init(state->kv_cross, state->backends[0], ctx->itype,
+    whisper_kv_cache_types(*ctx, state->backends[0], state->flash_attn_audio, ctx->params.type_kv_cross, type_k, type_v);
+    if (!whisper_kv_cache_init(state->kv_cross, state->backends[0], type_k, type_v,
                 ctx->model.hparams.n_text_state,
                 ctx->model.hparams.n_text_layer,
                 GGML_PAD(ctx->model.hparams.n_audio_ctx, 256))) {
@@ -3366,16 +4779,16 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
         WHISPER_LOG_INFO("%s: kv cross size = %7.2f MB\n", __func__, memory_size / 1e6);
     }
 
-    if (!whisper_kv_cache_init(state->kv_pad, state->backends[0], ctx->itype,
-                ctx->model.hparams.n_audio_state,
-                1,
-                GGML_PAD(ctx->model.hparams.n_audio_ctx, 256))) {
-        WHISPER_LOG_ERROR("%s: whisper_kv_cache_init() failed for self-attention cache\n", __func__);
-        whisper_free_state(state);
-        return nullptr;
-    }
+    if (state->flash_attn_audio && !ggml_backend_is_cpu(state->backends[0])) {
+        if (!whisper_kv_cache_init(state->kv_pad, state->backends[0], ctx->itype, ctx->itype,
+                    ctx->model.hparams.n_audio_state,
+                    1,
+                    GGML_PAD(ctx->model.hparams.n_audio_ctx, 256))) {
+            WHISPER_LOG_ERROR("%s: whisper_kv_cache_init() failed for self-attention cache\n", __func__);
+            whisper_free_state(state);
+            return nullptr;
+        }
 
-    {
         const size_t memory_size = ggml_nbytes(state->kv_pad.k) + ggml_nbytes(state->kv_pad.v);
         WHISPER_LOG_INFO("%s: kv pad  size  = %7.2f MB\n", __func__, memory_size / 1e6);
     }
@@ -3403,97 +4816,28 @@ struct whisper_state * whisper_init_state(whisper_context * ctx) {
 #ifndef WHISPER_COREML_ALLOW_FALLBACK
         whisper_free_state(state);
         return nullptr;
-#endif
-    } else {
-        WHISPER_LOG_INFO("%s: Core ML model loaded\n", __func__);
-    }
-#endif
-
-    state->logits.reserve(ctx->vocab.n_vocab * ctx->model.hparams.n_text_ctx);
-
-    state->batch = whisper_batch_init(ctx->model.hparams.n_text_ctx, WHISPER_MAX_DECODERS);
-
-    // TAGS: WHISPER_DECODER_INIT
-    state->decoders[0].sequence.tokens.reserve(ctx->model.hparams.n_text_ctx);
-
-    state->decoders[0].probs.reserve    (ctx->vocab.n_vocab);
-    state->decoders[0].logits.reserve   (ctx->vocab.n_vocab);
-    state->decoders[0].logprobs.reserve (ctx->vocab.n_vocab);
-    state->decoders[0].logits_id.reserve(ctx->model.hparams.n_vocab);
-
-    state->decoders[0].rng = std::mt19937(0);
-
-    // conv allocator
-    {
-        bool ok = whisper_sched_graph_init(state->sched_conv, state->backends,
-                [&]() {
-                    return whisper_build_graph_conv(*ctx, *state);
-                });
-
-        if (!ok) {
-            WHISPER_LOG_ERROR("%s: failed to init conv allocator\n", __func__);
-            whisper_free_state(state);
-            return nullptr;
-        }
-
-        WHISPER_LOG_INFO("%s: compute buffer (conv)   = %7.2f MB\n", __func__, whisper_sched_size(state->sched_conv) / 1e6);
-    }
-
-    // encoder allocator
-    if (!whisper_encode_external(*state)) {
-        bool ok = whisper_sched_graph_init(state->sched_encode, state->backends,
-                [&]() {
-                    return whisper_build_graph_encoder(*ctx, *state);
-                });
-
-        if (!ok) {
-            WHISPER_LOG_ERROR("%s: failed to init encoder allocator\n", __func__);
-            whisper_free_state(state);
-            return nullptr;
-        }
-
-        WHISPER_LOG_INFO("%s: compute buffer (encode) = %7.2f MB\n", __func__, whisper_sched_size(state->sched_encode) / 1e6);
-    }
-
-    // cross allocator
-    {
-        bool ok = whisper_sched_graph_init(state->sched_cross, state->backends,
-                [&]() {
-                    return whisper_build_graph_cross(*ctx, *state);
-                });
-
-        if (!ok) {
-            WHISPER_LOG_ERROR("%s: failed to init cross allocator\n", __func__);
-            whisper_free_state(state);
-            return nullptr;
-        }
-
-        WHISPER_LOG_INFO("%s: compute buffer (cross)  = %7.2f MB\n", __func__, whisper_sched_size(state->sched_cross) / 1e6);
+#endif
+    } else {
+        WHISPER_LOG_INFO("%s: Core ML model loaded\n", __func__);
     }
+#endif
 
-    // decoder allocator
-    {
-        bool ok = whisper_sched_graph_init(state->sched_decode, state->backends,
-                [&]() {
-                    const auto & hparams = ctx->model.hparams;
+    state->logits.reserve(ctx->vocab.n_vocab * ctx->model.hparams.n_text_ctx);
 
-                    // TODO: make sure this is the worst-case scenario
-                    const int n_tokens = hparams.n_text_ctx;
-                    const int n_past   = 0;
+    state->batch = whisper_batch_init(ctx->model.hparams.n_text_ctx, WHISPER_MAX_DECODERS);
 
-                    whisper_batch_prep_legacy(state->batch, nullptr, n_tokens, n_past, 0);
+    // TAGS: WHISPER_DECODER_INIT
+    state->decoders[0].sequence.tokens.reserve(ctx->model.hparams.n_text_ctx);
 
-                    return whisper_build_graph_decoder(*ctx, *state, state->batch, ctx->params.dtw_token_timestamps, true);
-                });
+    state->decoders[0].probs.reserve    (ctx->vocab.n_vocab);
+    state->decoders[0].logits.reserve   (ctx->vocab.n_vocab);
+    state->decoders[0].logprobs.reserve (ctx->vocab.n_vocab);
+    state->decoders[0].logits_id.reserve(ctx->model.hparams.n_vocab);
 
-        if (!ok) {
-            WHISPER_LOG_ERROR("%s: failed to init decoder allocator\n", __func__);
-            whisper_free_state(state);
-            return nullptr;
-        }
+    state->decoders[0].rng = std::mt19937(0);
 
-        WHISPER_LOG_INFO("%s: compute buffer (decode) = %7.2f MB\n", __func__, whisper_sched_size(state->sched_decode) / 1e6);
-    }
+    // the compute buffers are reserved on first use, for the shapes of the requests (see whisper_sched_reserve_encode
+    // and whisper_sched_reserve_decode)
 
     return state;
 }
@@ -3563,6 +4907,14 @@ struct whisper_context_params whisper_context_default_params() {
         /*.flash_attn           =*/ false,
         /*.gpu_device           =*/ 0,
 
+        /*.type_kv_self         =*/ GGML_TYPE_F16,
+        /*.type_kv_cross        =*/ GGML_TYPE_F16,
+
+        /*.cpu_hugepages        =*/ GGML_CPU_HUGEPAGES_NONE,
+        /*.cpu_numa             =*/ false,
+
+        /*.weight_cache         =*/ nullptr,
+
         /*.dtw_token_timestamps =*/ false,
         /*.dtw_aheads_preset    =*/ WHISPER_AHEADS_NONE,
         /*.dtw_n_top            =*/ -1,
@@ -3664,9 +5016,17 @@ struct whisper_context * whisper_init_with_params_no_state(struct whisper_model_
         params.dtw_token_timestamps = false;
     }
 
+    for (ggml_type * type : { &params.type_kv_self, &params.type_kv_cross }) {
+        if (*type != GGML_TYPE_F16 && *type != GGML_TYPE_Q8_0 && *type != GGML_TYPE_Q4_0) {
+            WHISPER_LOG_WARN("%s: unsupported KV cache type %s - using f16\n", __func__, ggml_type_name(*type));
+            *type = GGML_TYPE_F16;
+        }
+    }
+
     WHISPER_LOG_INFO("%s: use gpu    = %d\n", __func__, params.use_gpu);
     WHISPER_LOG_INFO("%s: flash attn = %d\n", __func__, params.flash_attn);
     WHISPER_LOG_INFO("%s: gpu_device = %d\n", __func__, params.gpu_device);
+    WHISPER_LOG_INFO("%s: kv types   = %s / %s\n", __func__, ggml_type_name(params.type_kv_self), ggml_type_name(params.type_kv_cross));
     WHISPER_LOG_INFO("%s: dtw        = %d\n", __func__, params.dtw_token_timestamps);
 
     // TODO: temporary call to force backend registry initialization
@@ -3782,6 +5142,7 @@ void whisper_free_state(struct whisper_state * state) {
         ggml_backend_sched_free(state->sched_encode.sched);
         ggml_backend_sched_free(state->sched_cross.sched);
         ggml_backend_sched_free(state->sched_decode.sched);
+        ggml_backend_sched_free(state->sched_batch.sched);
 
         for (auto & backend : state->backends) {
             ggml_backend_free(backend);
@@ -3800,6 +5161,19 @@ void whisper_free(struct whisper_context * ctx) {
 
         ggml_backend_buffer_free(ctx->model.buffer);
 
+#ifdef _POSIX_MAPPED_FILES
+        if (ctx->model.mapping) {
+            munmap(ctx->model.mapping, ctx->model.mapping_size);
+        }
+#endif
+
+        for (auto & kv : ctx->vocab_subsets) {
+            if (kv.second.w) {
+                ggml_backend_buffer_free(kv.second.buffer);
+                ggml_free(kv.second.ctx);
+            }
+        }
+
         whisper_free_state(ctx->state);
 
         delete ctx;
@@ -3818,7 +5192,125 @@ void whisper_free_params(struct whisper_full_params * params) {
     }
 }
 
+bool whisper_weight_cache_loaded(struct whisper_context * ctx) {
+    return ctx->model.cached;
+}
+
+int whisper_weight_cache_save(struct whisper_context * ctx, const char * path,
+                              ggml_abort_callback abort_callback, void * abort_callback_data) {
+    const auto & model = ctx->model;
+
+    if (!whisper_cpu_weights(ctx->params) || !ggml_backend_buffer_is_host(model.buffer)) {
+        WHISPER_LOG_ERROR("%s: the weights are not in CPU memory\n", __func__);
+        return -1;
+    }
+
+    std::vector<uint8_t> header;
+
+    auto put = [&](const void * src, size_t n) {
+        header.insert(header.end(), (const uint8_t *) src, (const uint8_t *) src + n);
+    };
+
+    auto put_str = [&](const std::string & src) {
+        const uint32_t n = src.size();
+        put(&n, sizeof(n));
+        put(src.data(), n);
+    };
+
+    const uint32_t magic     = WHISPER_WEIGHT_CACHE_MAGIC;
+    const uint32_t version   = WHISPER_WEIGHT_CACHE_VERSION;
+    const uint32_t n_tensors = model.tensors.size();
+
+    put(&magic,   sizeof(magic));
+    put(&version, sizeof(version));
+    put_str(whisper_weight_cache_key());
+    put(&n_tensors, sizeof(n_tensors));
+
+    // filled in once the table is written
+    const size_t pos_data = header.size();
+
+    uint64_t data_offset = 0;
+    uint64_t data_size   = 0;
+
+    put(&data_offset, sizeof(data_offset));
+    put(&data_size,   sizeof(data_size));
+
+    for (const auto & kv : model.tensors) {
+        const ggml_tensor * tensor = kv.second;
+
+        const int32_t  type   = tensor->type;
+        const uint64_t nbytes = ggml_nbytes(tensor);
+
+        put_str(kv.first);
+        put(&type, sizeof(type));
+        put(tensor->ne, sizeof(tensor->ne));
+        put(&data_size, sizeof(data_size));
+        put(&nbytes, sizeof(nbytes));
+
+        data_size = GGML_PAD(data_size + nbytes, WHISPER_WEIGHT_CACHE_TENSOR_ALIGN);
+    }
+
+    data_offset = GGML_PAD(header.size(), WHISPER_WEIGHT_CACHE_ALIGN);
+
+    memcpy(header.data() + pos_data,                       &data_offset, sizeof(data_offset));
+    memcpy(header.data() + pos_data + sizeof(data_offset), &data_size,   sizeof(data_size));
+
+    header.resize(data_offset, 0);
+
+    // written next to the destination and renamed over it: a process that maps the old file keeps reading that one
+    const std::string path_tmp = std::string(path) + ".tmp." + std::to_string(ggml_time_us());
+
+    FILE * f = fopen(path_tmp.c_str(), "wb");
+    if (!f) {
+        WHISPER_LOG_ERROR("%s: failed to create '%s'\n", __func__, path_tmp.c_str());
+        return -1;
+    }
+
+    static const uint8_t zeros[WHISPER_WEIGHT_CACHE_TENSOR_ALIGN] = { 0 };
+    static const size_t chunk = 16u*1024*1024;
+
+    const auto aborted = [&]() {
+        return abort_callback && abort_callback(abort_callback_data);
+    };
+
+    fwrite(header.data(), 1, header.size(), f);
+
+    bool stopped = false;
+    for (const auto & kv : model.tensors) {
+        const ggml_tensor * tensor = kv.second;
+
+        const size_t nbytes = ggml_nbytes(tensor);
+
+        for (size_t off = 0; off < nbytes && !(stopped = aborted()); off += chunk) {
+            fwrite((const uint8_t *) tensor->data + off, 1, std::min(chunk, nbytes - off), f);
+        }
+        if (stopped) {
+            break;
+        }
+        fwrite(zeros, 1, GGML_PAD(nbytes, WHISPER_WEIGHT_CACHE_TENSOR_ALIGN) - nbytes, f);
+    }
+
+    if (stopped) {
+        fclose(f);
+        remove(path_tmp.c_str());
+        return -1;
+    }
+
+    const bool ok = !ferror(f);
+    if (fclose(f) != 0 || !ok || rename(path_tmp.c_str(), path) != 0) {
+        WHISPER_LOG_ERROR("%s: failed to write '%s'\n", __func__, path);
+        remove(path_tmp.c_str());
+        return -1;
+    }
+
+    WHISPER_LOG_INFO("%s: %d tensors to '%s', %8.2f MB\n", __func__, (int) n_tensors, path, data_size / 1e6);
+
+    return 0;
+}
+
 int whisper_pcm_to_mel_with_state(struct whisper_context * ctx, struct whisper_state * state, const float * samples, int n_samples, int n_threads) {
+    state->encoded_seek = -1;
+
     if (!log_mel_spectrogram(*state, samples, n_samples, WHISPER_SAMPLE_RATE, WHISPER_N_FFT, WHISPER_HOP_LENGTH, ctx->model.filters.n_mel, n_threads, ctx->model.filters, false, state->mel)) {
         WHISPER_LOG_ERROR("%s: failed to compute mel spectrogram\n", __func__);
         return -1;
@@ -3842,6 +5334,8 @@ int whisper_set_mel_with_state(
         return -1;
     }
 
+    state->encoded_seek = -1;
+
     state->mel.n_len     = n_len;
     state->mel.n_len_org = n_len;
     state->mel.n_mel     = n_mel;
@@ -3860,9 +5354,15 @@ int whisper_set_mel(
     return whisper_set_mel_with_state(ctx, ctx->state, data, n_len, n_mel);
 }
 
+static bool whisper_state_aborted(const whisper_state & state) {
+    return state.abort_callback && state.abort_callback(state.abort_callback_data);
+}
+
 int whisper_encode_with_state(struct whisper_context * ctx, struct whisper_state * state, int offset, int n_threads) {
-    if (!whisper_encode_internal(*ctx, *state, offset, n_threads, nullptr, nullptr)) {
-        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+    if (!whisper_encode_internal(*ctx, *state, offset, n_threads, state->abort_callback, state->abort_callback_data)) {
+        if (!whisper_state_aborted(*state)) {
+            WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+        }
         return -1;
     }
 
@@ -3878,13 +5378,120 @@ int whisper_encode(struct whisper_context * ctx, int offset, int n_threads) {
     return 0;
 }
 
+int whisper_encode_batch(struct whisper_context * ctx, struct whisper_state ** states, int n_states, int n_audio_ctx, int n_threads) {
+    if (n_states <= 0) {
+        return 0;
+    }
+
+    if (n_audio_ctx > whisper_n_audio_ctx(ctx)) {
+        WHISPER_LOG_ERROR("%s: audio_ctx is larger than the maximum allowed (%d > %d)\n", __func__, n_audio_ctx, whisper_n_audio_ctx(ctx));
+        return -1;
+    }
+
+    const int n_ctx = n_audio_ctx > 0 ? n_audio_ctx : ctx->model.hparams.n_audio_ctx;
+
+    for (int i = 0; i < n_states; ++i) {
+        if (states[i] == nullptr || states[i]->mel.n_mel != ctx->model.hparams.n_mels) {
+            WHISPER_LOG_ERROR("%s: state %d has no mel spectrogram\n", __func__, i);
+            return -1;
+        }
+        states[i]->exp_n_audio_ctx = n_audio_ctx;
+        states[i]->encoded_seek    = -1;
+    }
+
+    // the padded flash-attention buffer and the external encoders only hold a single window
+    if (n_states == 1 || states[0]->kv_pad.buffer || whisper_encode_external(*states[0])) {
+        for (int i = 0; i < n_states; ++i) {
+            if (!whisper_encode_internal(*ctx, *states[i], 0, n_threads, nullptr, nullptr)) {
+                WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+                return -1;
+            }
+            states[i]->encoded_seek  = 0;
+            states[i]->encoded_n_ctx = n_ctx;
+        }
+
+        return 0;
+    }
+
+    const int64_t t_start_us = ggml_time_us();
+
+    whisper_state & lead = *states[0];
+
+    if (lead.sched_batch_n < n_states || lead.sched_batch_n_ctx < n_ctx) {
+        ggml_backend_sched_free(lead.sched_batch.sched);
+        lead.sched_batch.sched = nullptr;
+        lead.sched_batch_n     = 0;
+        lead.sched_batch_n_ctx = 0;
+
+        bool ok = whisper_sched_graph_init(lead.sched_batch, lead.backends, whisper_cpu_buffer_type(ctx->params),
+                [&]() {
+                    return whisper_build_graph_encode_batch(*ctx, states, n_states);
+                });
+
+        if (!ok) {
+            WHISPER_LOG_ERROR("%s: failed to init batched encoder allocator\n", __func__);
+            return -1;
+        }
+
+        lead.sched_batch_n     = n_states;
+        lead.sched_batch_n_ctx = n_ctx;
+
+        WHISPER_LOG_INFO("%s: compute buffer (batch of %d) = %7.2f MB\n", __func__, n_states, whisper_sched_size(lead.sched_batch) / 1e6);
+
+        whisper_state_sched_size(lead);
+    }
+
+    auto & sched = lead.sched_batch.sched;
+
+    ggml_cgraph * gf = whisper_build_graph_encode_batch(*ctx, states, n_states);
+
+    if (!ggml_backend_sched_alloc_graph(sched, gf)) {
+        // should never happen as we pre-allocate the memory
+        return -1;
+    }
+
+    // set the input
+    {
+        struct ggml_tensor * mel = ggml_graph_get_tensor(gf, "mel");
+
+        const int64_t n_window = 2*n_ctx*ctx->model.hparams.n_mels;
+
+        lead.inp_mel.resize(ggml_nelements(mel));
+
+        for (int i = 0; i < n_states; ++i) {
+            whisper_mel_window(states[i]->mel, 0, n_ctx, lead.inp_mel.data() + i*n_window);
+        }
+
+        ggml_backend_tensor_set(mel, lead.inp_mel.data(), 0, ggml_nelements(mel)*sizeof(float));
+    }
+
+    if (!ggml_graph_compute_helper(sched, gf, n_threads, whisper_cpumask_encode(lead), nullptr, nullptr)) {
+        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+        return -1;
+    }
+
+    // the pass is shared, so split its cost between the states for the timings report
+    const int64_t t_us = (ggml_time_us() - t_start_us)/n_states;
+
+    for (int i = 0; i < n_states; ++i) {
+        states[i]->t_encode_us  += t_us;
+        states[i]->n_encode++;
+        states[i]->encoded_seek  = 0;
+        states[i]->encoded_n_ctx = n_ctx;
+    }
+
+    return 0;
+}
+
 int whisper_decode_with_state(struct whisper_context * ctx, struct whisper_state * state, const whisper_token * tokens, int n_tokens, int n_past, int n_threads) {
     whisper_batch_prep_legacy(state->batch, tokens, n_tokens, n_past, 0);
 
     whisper_kv_cache_seq_rm(state->kv_self, 0, n_past, -1);
 
-    if (!whisper_decode_internal(*ctx, *state, state->batch, n_threads, false, nullptr, nullptr)) {
-        WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+    if (!whisper_decode_internal(*ctx, *state, state->batch, n_threads, false, state->abort_callback, state->abort_callback_data)) {
+        if (!whisper_state_aborted(*state)) {
+            WHISPER_LOG_ERROR("%s: failed to eval\n", __func__);
+        }
         return 1;
     }
 
@@ -3982,8 +5589,8 @@ int whisper_lang_auto_detect_with_state(
         return -2;
     }
 
-    // run the encoder
-    if (whisper_encode_with_state(ctx, state, seek, n_threads) != 0) {
+    // run the encoder, unless whisper_encode_batch() already did
+    if (!whisper_encoded_at(*ctx, *state, seek) && whisper_encode_with_state(ctx, state, seek, n_threads) != 0) {
         WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
         return -6;
     }
@@ -4145,7 +5752,7 @@ float * whisper_get_logits_from_state(struct whisper_state * state) {
 }
 
 const char * whisper_token_to_str(struct whisper_context * ctx, whisper_token token) {
-    return ctx->vocab.id_to_token.at(token).c_str();
+    return ctx->vocab.token_str(token);
 }
 
 whisper_token whisper_token_eot(struct whisper_context * ctx) {
@@ -4214,7 +5821,12 @@ void whisper_print_timings(struct whisper_context * ctx) {
         const int32_t n_batchd = std::max(1, ctx->state->n_batchd);
         const int32_t n_prompt = std::max(1, ctx->state->n_prompt);
 
-        WHISPER_LOG_INFO("%s:     fallbacks = %3d p / %3d h\n", __func__, ctx->state->n_fail_p, ctx->state->n_fail_h);
+        WHISPER_LOG_INFO("%s:     fallbacks = %3d p / %3d h / %3d e\n", __func__, ctx->state->n_fail_p, ctx->state->n_fail_h, ctx->state->n_fail_e);
+        if (ctx->state->n_proj_full > 0) {
+            WHISPER_LOG_INFO("%s:     full proj = %5d rows outside the vocabulary subset\n", __func__, ctx->state->n_proj_full);
+        }
+        WHISPER_LOG_INFO("%s: decode graphs = %5d built\n", __func__, ctx->state->n_graph_decode);
+        WHISPER_LOG_INFO("%s: compute bufs  = %8.2f MB (high-water mark)\n", __func__, ctx->state->sched_size_max / 1e6);
         WHISPER_LOG_INFO("%s:      mel time = %8.2f ms\n", __func__, ctx->state->t_mel_us / 1000.0f);
         WHISPER_LOG_INFO("%s:   sample time = %8.2f ms / %5d runs (%8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_sample_us, n_sample, 1e-3f * ctx->state->t_sample_us / n_sample);
         WHISPER_LOG_INFO("%s:   encode time = %8.2f ms / %5d runs (%8.2f ms per run)\n", __func__, 1e-3f * ctx->state->t_encode_us, n_encode, 1e-3f * ctx->state->t_encode_us / n_encode);
@@ -4225,6 +5837,28 @@ void whisper_print_timings(struct whisper_context * ctx) {
     WHISPER_LOG_INFO("%s:    total time = %8.2f ms\n", __func__, (t_end_us - ctx->t_start_us)/1000.0f);
 }
 
+size_t whisper_compute_buffer_size_max_from_state(struct whisper_state * state) {
+    return state->sched_size_max;
+}
+
+void whisper_set_cpumask_with_state(struct whisper_state * state, const bool * cpumask_encode, const bool * cpumask_decode) {
+    state->use_cpumask_encode = cpumask_encode != nullptr;
+    state->use_cpumask_decode = cpumask_decode != nullptr;
+    state->cpumask_inherited  = false;
+
+    if (cpumask_encode) {
+        memcpy(state->cpumask_encode, cpumask_encode, sizeof(state->cpumask_encode));
+    }
+    if (cpumask_decode) {
+        memcpy(state->cpumask_decode, cpumask_decode, sizeof(state->cpumask_decode));
+    }
+}
+
+void whisper_set_abort_callback_with_state(struct whisper_state * state, ggml_abort_callback abort_callback, void * user_data) {
+    state->abort_callback      = abort_callback;
+    state->abort_callback_data = user_data;
+}
+
 void whisper_reset_timings(struct whisper_context * ctx) {
     ctx->t_start_us = ggml_time_us();
     if (ctx->state != nullptr) {
@@ -4653,9 +6287,9 @@ static void whisper_suppress_invalid_grammar(
     std::vector<whisper_grammar_candidate>                              candidates_grammar;
 
     for (whisper_token id = 0; id < eot; ++id) {
-        const std::string & text = ctx.vocab.id_to_token[id];
-        if (!text.empty()) {
-            candidates_decoded.push_back(decode_utf8(text.c_str(), grammar.partial_utf8));
+        const char * text = ctx.vocab.token_str(id);
+        if (*text) {
+            candidates_decoded.push_back(decode_utf8(text, grammar.partial_utf8));
             candidates_grammar.push_back({ id, candidates_decoded.back().first.data(), candidates_decoded.back().second });
         }
     }
@@ -4678,18 +6312,18 @@ static void whisper_grammar_accept_token(whisper_context & ctx, whisper_grammar
         return;
     }
 
-    //fprintf(stderr, "Accept: '%s'\n", ctx.vocab.id_to_token[token].c_str());
+    //fprintf(stderr, "Accept: '%s'\n", ctx.vocab.token_str(token));
 
-    const std::string & text = ctx.vocab.id_to_token[token];
+    const char * text = ctx.vocab.token_str(token);
 
-    if (text.rfind("[_", 0) == 0) {
+    if (strncmp(text, "[_", 2) == 0) {
         // fprintf(stderr, " (skipped)\n");
         return;
     }
     // fprintf(stderr, "\n");
 
     // Note terminating 0 in decoded string
-    const auto   decoded     = decode_utf8(text.c_str(), grammar.partial_utf8);
+    const auto   decoded     = decode_utf8(text, grammar.partial_utf8);
     const auto & code_points = decoded.first;
     for (auto it = code_points.begin(), end = code_points.end() - 1; it != end; ++it) {
         grammar.stacks = whisper_grammar_accept(grammar.rules, grammar.stacks, *it);
@@ -4724,6 +6358,9 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
         /*.strategy          =*/ strategy,
 
         /*.n_threads         =*/ std::min(4, (int32_t) std::thread::hardware_concurrency()),
+        /*.n_threads_mel     =*/ 0,
+        /*.n_threads_encode  =*/ 0,
+        /*.n_threads_decode  =*/ 0,
         /*.n_max_text_ctx    =*/ 16384,
         /*.offset_ms         =*/ 0,
         /*.duration_ms       =*/ 0,
@@ -4758,6 +6395,9 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
         /*.language          =*/ "en",
         /*.detect_language   =*/ false,
 
+        /*.vocab_subset       =*/ false,
+        /*.vocab_subset_thold =*/ 0.5f,
+
         /*.suppress_blank    =*/ true,
         /*.suppress_non_speech_tokens =*/ false,
 
@@ -4769,6 +6409,7 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
         /*.entropy_thold     =*/  2.4f,
         /*.logprob_thold     =*/ -1.0f,
         /*.no_speech_thold   =*/  0.6f,
+        /*.fail_early        =*/ false,
 
         /*.greedy            =*/ {
             /*.best_of   =*/ -1,
@@ -4799,6 +6440,10 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
         /*.n_grammar_rules =*/ 0,
         /*.i_start_rule    =*/ 0,
         /*.grammar_penalty =*/ 100.0f,
+
+        /*.draft_ctx      =*/ nullptr,
+        /*.draft_state    =*/ nullptr,
+        /*.draft_n_tokens =*/ 5,
     };
 
     switch (strategy) {
@@ -4821,6 +6466,11 @@ struct whisper_full_params whisper_full_default_params(enum whisper_sampling_str
     return result;
 }
 
+// threads of a stage of whisper_full: its own count when set, n_threads otherwise
+static int whisper_full_threads(const whisper_full_params & params, int n_threads_stage) {
+    return n_threads_stage > 0 ? n_threads_stage : params.n_threads;
+}
+
 // forward declarations
 static std::vector<float> get_signal_energy(const float * signal, int n_samples, int n_samples_per_half_window);
 static void whisper_exp_compute_token_level_timestamps(
@@ -4866,53 +6516,262 @@ static int whisper_wrap_segment(struct whisper_context & ctx, struct whisper_sta
         const auto txt = whisper_token_to_str(&ctx, token.id);
         const int cur = strlen(txt);
 
-        if (acc + cur > max_len && i > 0 && should_split_on_word(txt, split_on_word)) {
-            state.result_all.back().text = std::move(text);
-            state.result_all.back().t1 = token.t0;
-            state.result_all.back().tokens.resize(i);
-            state.result_all.back().speaker_turn_next = false;
+        if (acc + cur > max_len && i > 0 && should_split_on_word(txt, split_on_word)) {
+            state.result_all.back().text = std::move(text);
+            state.result_all.back().t1 = token.t0;
+            state.result_all.back().tokens.resize(i);
+            state.result_all.back().speaker_turn_next = false;
+
+            state.result_all.push_back({});
+            state.result_all.back().t0 = token.t0;
+            state.result_all.back().t1 = segment.t1;
+
+            // add tokens [i, end] to the new segment
+            state.result_all.back().tokens.insert(
+                state.result_all.back().tokens.end(),
+                    segment.tokens.begin() + i,
+                    segment.tokens.end());
+
+            state.result_all.back().speaker_turn_next = segment.speaker_turn_next;
+
+            acc = 0;
+            text = "";
+
+            segment = state.result_all.back();
+            i = -1;
+
+            res++;
+        } else {
+            acc += cur;
+            text += txt;
+        }
+    }
+
+    state.result_all.back().text = std::move(text);
+
+    return res;
+}
+
+static const std::vector<std::string> non_speech_tokens = {
+    "\"", "#", "(", ")", "*", "+", "/", ":", ";", "<", "=", ">", "@", "[", "\\", "]", "^",
+    "_", "`", "{", "|", "}", "~", "「", "」", "『", "』", "<<", ">>", "<<<", ">>>", "--",
+    "---", "-(", "-[", "('", "(\"", "((", "))", "(((", ")))", "[[", "]]", "{{", "}}", "♪♪",
+    "♪♪♪","♩", "♪", "♫", "♬", "♭", "♮", "♯"
+};
+
+// recompute state.suppress_pre/suppress_post when the suppression params differ from the cached ones
+static void whisper_suppress_cache_update(
+              struct whisper_context & ctx,
+               struct whisper_state  & state,
+    const struct whisper_full_params & params) {
+    if (state.suppress_valid &&
+        state.suppress_tdrz       == params.tdrz_enable &&
+        state.suppress_non_speech == params.suppress_non_speech_tokens &&
+        state.suppress_has_regex  == (params.suppress_regex != nullptr) &&
+        (params.suppress_regex == nullptr || state.suppress_regex == params.suppress_regex)) {
+        return;
+    }
+
+    const auto & vocab = ctx.vocab;
+
+    auto & pre = state.suppress_pre;
+    pre.clear();
+
+    // suppress <|notimestamps|> token
+    // ref: https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L410-L412
+    pre.push_back(vocab.token_not);
+
+    // suppress sot and nosp tokens
+    pre.push_back(vocab.token_sot);
+    pre.push_back(vocab.token_nosp); // TODO: ignore this token for now
+
+    // [TDRZ] when tinydiarize is disabled, suppress solm token
+    if (params.tdrz_enable == false) {
+        pre.push_back(vocab.token_solm);
+    }
+
+    // suppress task tokens
+    pre.push_back(vocab.token_translate);
+    pre.push_back(vocab.token_transcribe);
+    pre.push_back(vocab.token_prev);
+
+    // suppress lang tokens
+    for (size_t i = 0; i < g_lang.size(); ++i) {
+        pre.push_back(whisper_token_lang(&ctx, i));
+    }
+
+    auto & post = state.suppress_post;
+    post.clear();
+
+    // suppress any tokens matching a regular expression
+    // ref: https://github.com/openai/whisper/discussions/1041
+    if (params.suppress_regex != nullptr) {
+        std::regex re(params.suppress_regex);
+        for (whisper_vocab::id tid = 0; tid < vocab.n_tokens(); ++tid) {
+            if (std::regex_match(vocab.token_str(tid), re)) {
+                post.push_back(tid);
+            }
+        }
+    }
+
+    // suppress non-speech tokens
+    // ref: https://github.com/openai/whisper/blob/7858aa9c08d98f75575035ecd6481f462d66ca27/whisper/tokenizer.py#L224-L253
+    if (params.suppress_non_speech_tokens) {
+        for (const std::string & token : non_speech_tokens) {
+            const std::string suppress_tokens[] = {token, " " + token};
+            for (const std::string & suppress_token : suppress_tokens) {
+                const whisper_vocab::id tid = vocab.find(suppress_token);
+                if (tid >= 0) {
+                    post.push_back(tid);
+                }
+            }
+        }
+
+        // allow hyphens "-" and single quotes "'" between words, but not at the beginning of a word
+        for (const char * suppress_token : { " -", " '" }) {
+            const whisper_vocab::id tid = vocab.find(suppress_token, 2);
+            if (tid >= 0) {
+                post.push_back(tid);
+            }
+        }
+    }
+
+    state.suppress_valid      = true;
+    state.suppress_tdrz       = params.tdrz_enable;
+    state.suppress_non_speech = params.suppress_non_speech_tokens;
+    state.suppress_has_regex  = params.suppress_regex != nullptr;
+    state.suppress_regex      = params.suppress_regex ? params.suppress_regex : "";
+}
+
+struct whisper_logits_exp {
+    float  logit_max;
+    float  max_text;
+    double sum_text; // sum of exp(logit - logit_max) over the text tokens
+    double sum_ts;   // and over the timestamp tokens
+
+    float logsumexp() const {
+        return logf(sum_text + sum_ts) + logit_max;
+    }
+
+    // the log of the timestamps' total probability and the max text token logprob, for the timestamp rule
+    bool timestamp_wins() const {
+        return sum_ts > 0.0 && float(log(sum_ts)) + logit_max - logsumexp() > max_text - logsumexp();
+    }
+};
+
+// one max pass and one exp/sum pass with ggml's vector kernels, leaving
+// exp(logit - logit_max) in probs; the text and timestamp ranges are reduced separately
+static whisper_logits_exp whisper_logits_exp_sum(
+        const whisper_vocab      & vocab,
+        const std::vector<float> & logits,
+              std::vector<float> & probs) {
+    const int n_logits = logits.size();
+    const int n_text   = vocab.token_beg;
+
+    whisper_logits_exp res;
+    res.max_text  = ggml_cpu_vec_max_f32(n_text, logits.data());
+    res.logit_max = std::max(res.max_text, ggml_cpu_vec_max_f32(n_logits - n_text, logits.data() + n_text));
+    res.sum_text  = 0.0;
+    res.sum_ts    = 0.0;
+
+    if (res.logit_max == -INFINITY) {
+        std::fill(probs.begin(), probs.end(), 0.0f);
+        return res;
+    }
+
+    res.sum_text = ggml_cpu_vec_soft_max_f32(n_text, probs.data(), logits.data(), res.logit_max);
+    res.sum_ts   = ggml_cpu_vec_soft_max_f32(n_logits - n_text, probs.data() + n_text, logits.data() + n_text, res.logit_max);
+
+    return res;
+}
+
+// finish log_softmax into logprobs and softmax into probs in one pass
+static void whisper_logits_normalize(
+        const whisper_logits_exp & ex,
+        const std::vector<float> & logits,
+              std::vector<float> & logprobs,
+              std::vector<float> & probs) {
+    const int n_logits = logits.size();
+
+    if (ex.logit_max == -INFINITY) {
+        std::fill(logprobs.begin(), logprobs.end(), -INFINITY);
+        return;
+    }
+
+    const float logsumexp = ex.logsumexp();
+    const float scale     = 1.0/(ex.sum_text + ex.sum_ts);
+
+    const float * src = logits.data();
+    float * dst_logprobs = logprobs.data();
+    float * dst_probs    = probs.data();
+    for (int i = 0; i < n_logits; ++i) {
+        dst_logprobs[i] = src[i] - logsumexp;
+        dst_probs[i]   *= scale;
+    }
+}
+
+// greedy pick straight from the exp pass, without normalizing probs and logprobs:
+// the same token, p, plog and timestamp fields as whisper_sample_token(best = true)
+static whisper_token_data whisper_logits_best(
+        const whisper_vocab      & vocab,
+        const whisper_logits_exp & ex,
+        const std::vector<float> & logits,
+        const std::vector<float> & probs) {
+    whisper_token_data result = {
+        0, 0, 0.0f, 0.0f, 0.0f, 0.0f, -1, -1, -1, 0.0f,
+    };
+
+    if (ex.logit_max == -INFINITY) {
+        return result;
+    }
 
-            state.result_all.push_back({});
-            state.result_all.back().t0 = token.t0;
-            state.result_all.back().t1 = segment.t1;
+    const int n_logits = logits.size();
+    const int n_text   = vocab.token_beg;
 
-            // add tokens [i, end] to the new segment
-            state.result_all.back().tokens.insert(
-                state.result_all.back().tokens.end(),
-                    segment.tokens.begin() + i,
-                    segment.tokens.end());
+    const float scale     = 1.0/(ex.sum_text + ex.sum_ts);
+    const float logsumexp = ex.logsumexp();
 
-            state.result_all.back().speaker_turn_next = segment.speaker_turn_next;
+    // timestamp with the highest probability (first one on ties)
+    {
+        float max_ts = 0.0f;
+        for (int i = n_text; i < n_logits; ++i) {
+            if (max_ts < probs[i]) {
+                max_ts = probs[i];
+                result.tid = i;
+            }
+        }
 
-            acc = 0;
-            text = "";
+        const double sum_ts = ex.sum_ts*scale;
 
-            segment = state.result_all.back();
-            i = -1;
+        result.pt    = max_ts*scale/(sum_ts + 1e-10);
+        result.ptsum = sum_ts;
+    }
 
-            res++;
-        } else {
-            acc += cur;
-            text += txt;
+    if (ex.timestamp_wins()) {
+        // text tokens are masked: the pick is the best timestamp
+        if (result.tid >= 0) {
+            result.id   = result.tid;
+            result.p    = probs[result.id]*scale;
+            result.plog = logits[result.id] - logsumexp;
+            result.pt   = result.p;
         }
+        return result;
     }
 
-    state.result_all.back().text = std::move(text);
+    // no timestamp outweighs the best text token: the first text token at the max
+    const float * it = std::find(logits.data(), logits.data() + n_text, ex.max_text);
+    if (it != logits.data() + n_text && probs[it - logits.data()] > 0.0f) {
+        result.id   = it - logits.data();
+        result.p    = probs[result.id]*scale;
+        result.plog = logits[result.id] - logsumexp;
+    }
 
-    return res;
+    return result;
 }
 
-static const std::vector<std::string> non_speech_tokens = {
-    "\"", "#", "(", ")", "*", "+", "/", ":", ";", "<", "=", ">", "@", "[", "\\", "]", "^",
-    "_", "`", "{", "|", "}", "~", "「", "」", "『", "』", "<<", ">>", "<<<", ">>>", "--",
-    "---", "-(", "-[", "('", "(\"", "((", "))", "(((", ")))", "[[", "]]", "{{", "}}", "♪♪",
-    "♪♪♪","♩", "♪", "♫", "♬", "♭", "♮", "♯"
-};
-
 // process the logits for the selected decoder
 // - applies logit filters
 // - computes logprobs and probs
-// TODO: optimize
 static void whisper_process_logits(
               struct whisper_context & ctx,
                struct whisper_state  & state,
@@ -4923,7 +6782,7 @@ static void whisper_process_logits(
     const auto & tokens_cur = decoder.sequence.tokens;
 
     const bool is_initial = tokens_cur.size() == 0;
-    const int  n_logits   = vocab.id_to_token.size();
+    const int  n_logits   = vocab.n_tokens();
 
     WHISPER_ASSERT(n_logits == ctx.vocab.n_vocab);
 
@@ -4934,12 +6793,15 @@ static void whisper_process_logits(
     auto & logprobs = decoder.logprobs;
     {
         logits.resize(n_logits);
-        memcpy(logits.data(), state.logits.data() + decoder.i_batch*n_logits, n_logits*sizeof(float));
 
+        const float * src = state.logits.data() + decoder.i_batch*n_logits;
         if (temperature > 0.0f) {
+            float * dst = logits.data();
             for (int i = 0; i < n_logits; i++) {
-                logits[i] /= temperature;
+                dst[i] = src[i] / temperature;
             }
+        } else {
+            memcpy(logits.data(), src, n_logits*sizeof(float));
         }
 
         // will be populated a bit later
@@ -4947,6 +6809,8 @@ static void whisper_process_logits(
         logprobs.resize(n_logits);
     }
 
+    whisper_suppress_cache_update(ctx, state, params);
+
     // apply logit filters here
     // ref: https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L480-L493
     {
@@ -4954,76 +6818,30 @@ static void whisper_process_logits(
         // https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L388-L390
         if (params.suppress_blank) {
             if (is_initial) {
-                logits[vocab.token_eot]           = -INFINITY;
-                logits[vocab.token_to_id.at(" ")] = -INFINITY;
+                logits[vocab.token_eot] = -INFINITY;
+                const whisper_vocab::id space = vocab.find(" ");
+                if (space >= 0) {
+                    logits[space] = -INFINITY;
+                }
             }
         }
 
-        // suppress <|notimestamps|> token
-        // ref: https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L410-L412
-        logits[vocab.token_not] = -INFINITY;
         if (params.no_timestamps) {
-            for (int i = vocab.token_beg; i < n_logits; ++i) {
-                logits[i] = -INFINITY;
-            }
-        }
-
-        // suppress sot and nosp tokens
-        logits[vocab.token_sot]  = -INFINITY;
-        logits[vocab.token_nosp] = -INFINITY; // TODO: ignore this token for now
-
-        // [TDRZ] when tinydiarize is disabled, suppress solm token
-        if (params.tdrz_enable == false) {
-            logits[vocab.token_solm] = -INFINITY;
+            std::fill(logits.begin() + vocab.token_beg, logits.end(), -INFINITY);
         }
 
-        // suppress task tokens
-        logits[vocab.token_translate]  = -INFINITY;
-        logits[vocab.token_transcribe] = -INFINITY;
-        logits[vocab.token_prev]       = -INFINITY;
-
-        // suppress lang tokens
-        for (size_t i = 0; i < g_lang.size(); ++i) {
-            logits[whisper_token_lang(&ctx, i)] = -INFINITY;
+        // <|notimestamps|>, sot, nosp, solm, task and language tokens
+        for (const whisper_token tid : state.suppress_pre) {
+            logits[tid] = -INFINITY;
         }
 
-        // suppress prev token
-        logits[vocab.token_prev] = -INFINITY;
-
         if (params.logits_filter_callback) {
             params.logits_filter_callback(&ctx, &state, tokens_cur.data(), tokens_cur.size(), logits.data(), params.logits_filter_callback_user_data);
         }
 
-        // suppress any tokens matching a regular expression
-        // ref: https://github.com/openai/whisper/discussions/1041
-        if (params.suppress_regex != nullptr) {
-            std::regex re(params.suppress_regex);
-            for (std::pair<whisper_vocab::token, whisper_vocab::id> token_id : vocab.token_to_id) {
-                if (std::regex_match(token_id.first, re)) {
-                    logits[token_id.second] = -INFINITY;
-                }
-            }
-        }
-
-        // suppress non-speech tokens
-        // ref: https://github.com/openai/whisper/blob/7858aa9c08d98f75575035ecd6481f462d66ca27/whisper/tokenizer.py#L224-L253
-        if (params.suppress_non_speech_tokens) {
-            for (const std::string & token : non_speech_tokens) {
-                const std::string suppress_tokens[] = {token, " " + token};
-                for (const std::string & suppress_token : suppress_tokens) {
-                    if (vocab.token_to_id.find(suppress_token) != vocab.token_to_id.end()) {
-                        logits[vocab.token_to_id.at(suppress_token)] = -INFINITY;
-                    }
-                }
-            }
-
-            // allow hyphens "-" and single quotes "'" between words, but not at the beginning of a word
-            if (vocab.token_to_id.find(" -") != vocab.token_to_id.end()) {
-                logits[vocab.token_to_id.at(" -")] = -INFINITY;
-            }
-            if (vocab.token_to_id.find(" '") != vocab.token_to_id.end()) {
-                logits[vocab.token_to_id.at(" '")] = -INFINITY;
-            }
+        // suppress_regex matches and non-speech tokens
+        for (const whisper_token tid : state.suppress_post) {
+            logits[tid] = -INFINITY;
         }
 
         // timestamps have to appear in pairs, except directly before EOT; mask logits accordingly
@@ -5036,13 +6854,9 @@ static void whisper_process_logits(
 
             if (last_was_timestamp) {
                 if (penultimate_was_timestamp) {
-                    for (int i = vocab.token_beg; i < n_logits; ++i) {
-                        logits[i] = -INFINITY;
-                    }
+                    std::fill(logits.begin() + vocab.token_beg, logits.end(), -INFINITY);
                 } else {
-                    for (int i = 0; i < vocab.token_eot; ++i) {
-                        logits[i] = -INFINITY;
-                    }
+                    std::fill(logits.begin(), logits.begin() + vocab.token_eot, -INFINITY);
                 }
             }
         }
@@ -5068,96 +6882,39 @@ static void whisper_process_logits(
             }
         }
 
-        // populate the logprobs array (log_softmax)
-        {
-            const float logit_max = *std::max_element(logits.begin(), logits.end());
-            float logsumexp = 0.0f;
-            for (int i = 0; i < n_logits; ++i) {
-                if (logits[i] > -INFINITY) {
-                    logsumexp += expf(logits[i] - logit_max);
-                }
-            }
-            logsumexp = logf(logsumexp) + logit_max;
-
-            for (int i = 0; i < n_logits; ++i) {
-                if (logits[i] > -INFINITY) {
-                    logprobs[i] = logits[i] - logsumexp;
-                } else {
-                    logprobs[i] = -INFINITY;
-                }
-            }
-        }
+        // exp(logit - max) and its sums, for log_softmax and the timestamp rule
+        whisper_logits_exp ex = whisper_logits_exp_sum(vocab, logits, probs);
 
         // if sum of probability over timestamps is above any other token, sample timestamp
         // ref: https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L431-L437
-        {
-            // logsumexp over timestamps
-            float timestamp_logprob = -INFINITY;
-            {
-                float logsumexp = 0.0f;
-                const float logprob_max = *std::max_element(logprobs.begin() + vocab.token_beg, logprobs.end());
-                for (int i = vocab.token_beg; i < n_logits; ++i) {
-                    if (logprobs[i] > -INFINITY) {
-                        logsumexp += expf(logprobs[i] - logprob_max);
-                    }
-                }
-                if (logsumexp > 0.0f) {
-                    timestamp_logprob = logf(logsumexp) + logprob_max;
-                }
-            }
+        const bool timestamp_wins = ex.timestamp_wins();
+        if (!timestamp_wins && params.n_grammar_rules > 0) {
+            whisper_suppress_invalid_grammar(ctx, params, logits, decoder.grammar);
 
-            const float max_text_token_logprob = *std::max_element(logprobs.begin(), logprobs.begin() + vocab.token_beg);
-
-            //WHISPER_LOG_INFO("timestamp_logprob=%f max_text_token_logprob=%f\n", timestamp_logprob, max_text_token_logprob);
-
-            if (timestamp_logprob > max_text_token_logprob) {
-                for (int i = 0; i < vocab.token_beg; ++i) {
-                    logits[i]   = -INFINITY;
-                    logprobs[i] = -INFINITY;
-                }
-            } else {
-                if (params.n_grammar_rules > 0) {
-                    whisper_suppress_invalid_grammar(ctx, params, logits, decoder.grammar);
-
-                    // populate the logprobs array (log_softmax)
-                    {
-                        const float logit_max = *std::max_element(logits.begin(), logits.end());
-                        float logsumexp = 0.0f;
-                        for (int i = 0; i < n_logits; ++i) {
-                            if (logits[i] > -INFINITY) {
-                                logsumexp += expf(logits[i] - logit_max);
-                            }
-                        }
-                        logsumexp = logf(logsumexp) + logit_max;
+            ex = whisper_logits_exp_sum(vocab, logits, probs);
+        }
 
-                        for (int i = 0; i < n_logits; ++i) {
-                            if (logits[i] > -INFINITY) {
-                                logprobs[i] = logits[i] - logsumexp;
-                            } else {
-                                logprobs[i] = -INFINITY;
-                            }
-                        }
-                    }
-                }
-            }
+        // greedy at t = 0 only needs the best token: pick it here and skip the probability arrays
+        decoder.has_best = params.strategy == WHISPER_SAMPLING_GREEDY && temperature <= 0.0f;
+        if (decoder.has_best) {
+            decoder.best = whisper_logits_best(vocab, ex, logits, probs);
+            return;
         }
-    }
 
-    // compute probs
-    {
-        for (int i = 0; i < n_logits; ++i) {
-            if (logits[i] == -INFINITY) {
-                probs[i] = 0.0f;
-            } else {
-                probs[i] = expf(logprobs[i]);
-            }
+        // populate the logprobs (log_softmax) and probs arrays
+        whisper_logits_normalize(ex, logits, logprobs, probs);
+
+        if (timestamp_wins) {
+            std::fill(logits.begin(),   logits.begin()   + vocab.token_beg, -INFINITY);
+            std::fill(logprobs.begin(), logprobs.begin() + vocab.token_beg, -INFINITY);
+            std::fill(probs.begin(),    probs.begin()    + vocab.token_beg, 0.0f);
         }
     }
 
 #if 0
     // print first 100 logits - token string : logit
     //for (int i = 0; i < 10; i++) {
-    //    const auto token   = vocab.id_to_token.at(i);
+    //    const auto token   = vocab.token_str(i);
     //    const auto prob    = probs[i];
     //    const auto logit   = logits[i];
     //    const auto logprob = logprobs[i];
@@ -5177,7 +6934,7 @@ static void whisper_process_logits(
         });
 
         for (int i = 0; i < 10; i++) {
-            const auto token   = vocab.id_to_token.at(pairs[i].second);
+            const std::string token = vocab.token_str(pairs[i].second);
             const auto prob    = pairs[i].first;
             const auto logit   = logits[pairs[i].second];
             const auto logprob = logprobs[pairs[i].second];
@@ -5188,23 +6945,23 @@ static void whisper_process_logits(
     }
 
     // "And", "and", " And", " and"
-    //printf("logits[\"and\"]  = %f\n", logits[vocab.token_to_id.at("and")]);
-    //printf("logits[\"And\"]  = %f\n", logits[vocab.token_to_id.at("And")]);
-    //printf("logits[\" and\"] = %f\n", logits[vocab.token_to_id.at(" and")]);
-    //printf("logits[\" And\"] = %f\n", logits[vocab.token_to_id.at(" And")]);
-    //printf("logits[\" so\"]  = %f\n", logits[vocab.token_to_id.at(" so")]);
-
-    //printf("logprobs[\"and\"]  = %f\n", logprobs[vocab.token_to_id.at("and")]);
-    //printf("logprobs[\"And\"]  = %f\n", logprobs[vocab.token_to_id.at("And")]);
-    //printf("logprobs[\" and\"] = %f\n", logprobs[vocab.token_to_id.at(" and")]);
-    //printf("logprobs[\" And\"] = %f\n", logprobs[vocab.token_to_id.at(" And")]);
-    //printf("logprobs[\" so\"]  = %f\n", logprobs[vocab.token_to_id.at(" so")]);
-
-    //printf("probs[\"and\"]  = %f\n", probs[vocab.token_to_id.at("and")]);
-    //printf("probs[\"And\"]  = %f\n", probs[vocab.token_to_id.at("And")]);
-    //printf("probs[\" and\"] = %f\n", probs[vocab.token_to_id.at(" and")]);
-    //printf("probs[\" And\"] = %f\n", probs[vocab.token_to_id.at(" And")]);
-    //printf("probs[\" so\"]  = %f\n", probs[vocab.token_to_id.at(" so")]);
+    //printf("logits[\"and\"]  = %f\n", logits[vocab.find("and")]);
+    //printf("logits[\"And\"]  = %f\n", logits[vocab.find("And")]);
+    //printf("logits[\" and\"] = %f\n", logits[vocab.find(" and")]);
+    //printf("logits[\" And\"] = %f\n", logits[vocab.find(" And")]);
+    //printf("logits[\" so\"]  = %f\n", logits[vocab.find(" so")]);
+
+    //printf("logprobs[\"and\"]  = %f\n", logprobs[vocab.find("and")]);
+    //printf("logprobs[\"And\"]  = %f\n", logprobs[vocab.find("And")]);
+    //printf("logprobs[\" and\"] = %f\n", logprobs[vocab.find(" and")]);
+    //printf("logprobs[\" And\"] = %f\n", logprobs[vocab.find(" And")]);
+    //printf("logprobs[\" so\"]  = %f\n", logprobs[vocab.find(" so")]);
+
+    //printf("probs[\"and\"]  = %f\n", probs[vocab.find("and")]);
+    //printf("probs[\"And\"]  = %f\n", probs[vocab.find("And")]);
+    //printf("probs[\" and\"] = %f\n", probs[vocab.find(" and")]);
+    //printf("probs[\" And\"] = %f\n", probs[vocab.find(" And")]);
+    //printf("probs[\" so\"]  = %f\n", probs[vocab.find(" so")]);
 #endif
 }
 
@@ -5229,6 +6986,10 @@ static whisper_token_data whisper_sample_token(
         0, 0, 0.0f, 0.0f, 0.0f, 0.0f, -1, -1, -1, 0.0f,
     };
 
+    if (best && decoder.has_best) {
+        return decoder.best;
+    }
+
     const auto & vocab = ctx.vocab;
 
     const auto & probs    = decoder.probs;
@@ -5355,6 +7116,129 @@ static std::vector<whisper_token_data> whisper_sample_token_topk(
     return result;
 }
 
+// speculative decoding step for decoder 0 (greedy, temperature 0)
+//
+// the draft model catches up with the accepted tokens (prompt + decoder sequence), greedily drafts up to n_draft
+// tokens with the same logit filters, and the model then decodes [last token, draft...] in one batch with logits
+// for every position. row r of state.logits is valid for as long as the first r draft tokens get accepted, so the
+// caller can skip the next decodes while the sampled tokens match spec_draft (spec_pos0 is the position of row 0)
+// returns false if a decode of either model failed or was aborted
+static bool whisper_decode_speculative(
+        struct whisper_context & ctx,
+          struct whisper_state & state,
+        struct whisper_context & dctx,
+          struct whisper_state & dstate,
+    const std::vector<whisper_token> & prompt,
+              whisper_decoder & decoder,
+    std::vector<whisper_token> & draft_hist,
+    std::vector<whisper_token> & spec_draft,
+                           int & spec_pos0,
+    const whisper_full_params & params) {
+    std::vector<whisper_token> seq(prompt);
+    for (const auto & token : decoder.sequence.tokens) {
+        seq.push_back(token.id);
+    }
+
+    const int n_past  = seq.size() - 1; // position of the newest token
+    const int n_draft = std::min(params.draft_n_tokens, whisper_n_text_ctx(&ctx) - 1 - n_past);
+
+    spec_draft.clear();
+
+    if (n_draft > 0) {
+        // drop what the draft cache holds beyond the accepted tokens and feed the rest
+        size_t n_keep = 0;
+        while (n_keep < draft_hist.size() && n_keep < seq.size() && draft_hist[n_keep] == seq[n_keep]) {
+            n_keep++;
+        }
+        if (n_keep == seq.size()) {
+            n_keep--;
+        }
+
+        whisper_kv_cache_seq_rm(dstate.kv_self, 0, n_keep, -1);
+        draft_hist.resize(n_keep);
+
+        whisper_batch_prep_legacy(dstate.batch, seq.data() + n_keep, seq.size() - n_keep, n_keep, 0);
+        if (!whisper_decode_internal(dctx, dstate, dstate.batch, whisper_full_threads(params, params.n_threads_decode), false, params.abort_callback, params.abort_callback_user_data)) {
+            return false;
+        }
+        draft_hist.insert(draft_hist.end(), seq.begin() + n_keep, seq.end());
+
+        // the timestamp rules in whisper_process_logits() follow the decoder's sliding window
+        auto & ddecoder = dstate.decoders[0];
+        ddecoder.sequence.tokens = decoder.sequence.tokens;
+        ddecoder.has_ts          = decoder.has_ts;
+        ddecoder.seek_delta      = decoder.seek_delta;
+        ddecoder.i_batch         = seq.size() - n_keep - 1;
+
+        for (int j = 0; j < n_draft; ++j) {
+            whisper_process_logits(dctx, dstate, ddecoder, params, 0.0f);
+
+            const whisper_token_data token = whisper_sample_token(dctx, ddecoder, true);
+            spec_draft.push_back(token.id);
+
+            if (token.id == whisper_token_eot(&dctx) || j == n_draft - 1) {
+                break;
+            }
+
+            ddecoder.sequence.tokens.push_back(token);
+            if (token.id > whisper_token_beg(&dctx)) {
+                ddecoder.seek_delta = 2*(token.id - whisper_token_beg(&dctx));
+                ddecoder.has_ts     = true;
+            }
+
+            whisper_batch_prep_legacy(dstate.batch, &token.id, 1, draft_hist.size(), 0);
+            if (!whisper_decode_internal(dctx, dstate, dstate.batch, whisper_full_threads(params, params.n_threads_decode), false, params.abort_callback, params.abort_callback_user_data)) {
+                return false;
+            }
+            draft_hist.push_back(token.id);
+            ddecoder.i_batch = 0;
+        }
+    }
+
+    // verify: positions after n_past may hold rejected draft tokens from the previous round
+    whisper_kv_cache_seq_rm(state.kv_self, 0, n_past, -1);
+
+    auto & batch = state.batch;
+
+    batch.n_tokens = 1 + spec_draft.size();
+    for (int j = 0; j < batch.n_tokens; ++j) {
+        batch.token   [j]    = j == 0 ? seq.back() : spec_draft[j - 1];
+        batch.pos     [j]    = n_past + j;
+        batch.n_seq_id[j]    = 1;
+        batch.seq_id  [j][0] = 0;
+        batch.logits  [j]    = 1;
+    }
+
+    if (!whisper_decode_internal(ctx, state, batch, whisper_full_threads(params, params.n_threads_decode), false, params.abort_callback, params.abort_callback_user_data)) {
+        return false;
+    }
+
+    spec_pos0 = n_past;
+    decoder.i_batch = 0;
+
+    return true;
+}
+
+static double whisper_tokens_entropy(const std::vector<whisper_token_data> & tokens, int i0, int i1) {
+    int cnt = 0;
+    double entropy = 0.0f;
+
+    std::map<whisper_token, int> token_counts;
+    for (int i = i0; i < i1; ++i) {
+        token_counts[tokens[i].id]++;
+        cnt++;
+    }
+
+    for (const auto & kv : token_counts) {
+        const auto p = kv.second/(double)cnt;
+        entropy -= p*log(p);
+
+        //WHISPER_LOG_DEBUG("entropy: %d %f %f, count %d\n", kv.first, p, log(p), kv.second);
+    }
+
+    return entropy;
+}
+
 // ref: https://github.com/openai/whisper/blob/0b1ba3d46ebf7fe6f953acfd8cad62a4f851b49f/whisper/decoding.py#L178-L192
 static void whisper_sequence_score(
         const struct whisper_full_params & params,
@@ -5381,27 +7265,67 @@ static void whisper_sequence_score(
     sequence.score = result/penalty;
 
     // compute the entropy of the sequence of the last 32 tokens
-    {
-        const int n = 32;
+    sequence.entropy = whisper_tokens_entropy(sequence.tokens, std::max(0, sequence.result_len - WHISPER_ENTROPY_N), sequence.result_len);
+}
 
-        int cnt = 0;
-        double entropy = 0.0f;
+// update the repetition runs after a token was appended to the sequence
+static void whisper_sequence_track(whisper_sequence & sequence) {
+    const auto & tokens = sequence.tokens;
+    const int n = tokens.size();
 
-        std::map<whisper_token, int> token_counts;
-        for (int i = std::max(0, sequence.result_len - n); i < sequence.result_len; ++i) {
-            token_counts[sequence.tokens[i].id]++;
-            cnt++;
-        }
+    for (int p = 1; p <= WHISPER_REP_MAX_PERIOD; ++p) {
+        int & run = sequence.n_rep[p - 1];
+        run = n > p && tokens[n - 1].id == tokens[n - 1 - p].id ? run + 1 : 0;
+    }
+}
+
+// whether the decoder can no longer pass the checks of the temperature fallback (fail_early)
+// sum_logprobs holds the sum over the first result_len tokens while decoding, and since every future token has
+// plog <= 0, a result that grows to the end of the window scores at best sum_logprobs_all/n_max on average
+static bool whisper_decoder_doomed(
+        const struct whisper_full_params & params,
+                   const whisper_decoder & decoder,
+                                     int   n_max) {
+    const auto & sequence = decoder.sequence;
 
-        for (const auto & kv : token_counts) {
-            const auto p = kv.second/(double)cnt;
-            entropy -= p*log(p);
+    const int  result_len = sequence.result_len;
+    const bool completed  = decoder.completed;
 
-            //WHISPER_LOG_DEBUG("entropy: %d %f %f, count %d\n", kv.first, p, log(p), kv.second);
+    // the result as it stands, if the decoder can still finish with it
+    bool keep_passes = false;
+    if (result_len > 0 && (completed || !(params.single_segment || params.no_timestamps))) {
+        keep_passes = sequence.sum_logprobs/result_len >= params.logprob_thold;
+        if (completed && result_len > WHISPER_ENTROPY_N) {
+            keep_passes = keep_passes && whisper_tokens_entropy(sequence.tokens, result_len - WHISPER_ENTROPY_N, result_len) >= params.entropy_thold;
         }
+    }
+
+    if (keep_passes) {
+        return false;
+    }
 
-        sequence.entropy = entropy;
+    if (completed) {
+        return true;
     }
+
+    // a result that grows with the tokens still to come
+    if (sequence.sum_logprobs_all/n_max < params.logprob_thold) {
+        return true;
+    }
+
+    // verbatim repetition of a short phrase over a whole entropy window: if it goes on, the window it leaves at the
+    // end of the result fails the entropy check (a decoder that has not placed a timestamp fails at n_max anyway)
+    if (params.single_segment || params.no_timestamps || result_len == 0) {
+        const int n = sequence.tokens.size();
+
+        for (int p = 1; p <= WHISPER_REP_MAX_PERIOD; ++p) {
+            if (sequence.n_rep[p - 1] >= WHISPER_ENTROPY_N) {
+                return whisper_tokens_entropy(sequence.tokens, n - WHISPER_ENTROPY_N, n) < params.entropy_thold;
+            }
+        }
+    }
+
+    return false;
 }
 
 int whisper_full_with_state(
@@ -5417,17 +7341,25 @@ int whisper_full_with_state(
 
     if (n_samples > 0) {
         // compute log mel spectrogram
-        if (whisper_pcm_to_mel_with_state(ctx, state, samples, n_samples, params.n_threads) != 0) {
+        if (whisper_pcm_to_mel_with_state(ctx, state, samples, n_samples, whisper_full_threads(params, params.n_threads_mel)) != 0) {
             WHISPER_LOG_ERROR("%s: failed to compute log mel spectrogram\n", __func__);
             return -2;
         }
     }
 
+    // the restricted output projection only applies to this run
+    struct vocab_sub_guard {
+        whisper_state * state;
+        ~vocab_sub_guard() { state->vocab_sub = nullptr; }
+    } vocab_sub_reset = { state };
+
+    state->vocab_sub = nullptr;
+
     // auto-detect language if not specified
     if (params.language == nullptr || strlen(params.language) == 0 || strcmp(params.language, "auto") == 0 || params.detect_language) {
         std::vector<float> probs(whisper_lang_max_id() + 1, 0.0f);
 
-        const auto lang_id = whisper_lang_auto_detect_with_state(ctx, state, 0, params.n_threads, probs.data());
+        const auto lang_id = whisper_lang_auto_detect_with_state(ctx, state, 0, whisper_full_threads(params, params.n_threads_encode), probs.data());
         if (lang_id < 0) {
             WHISPER_LOG_ERROR("%s: failed to auto-detect language\n", __func__);
             return -3;
@@ -5439,6 +7371,9 @@ int whisper_full_with_state(
         if (params.detect_language) {
             return 0;
         }
+    } else if (params.vocab_subset && whisper_lang_id(params.language) >= 0 && ctx->model.n_loaded > 0) {
+        state->vocab_sub       = whisper_vocab_subset_get(*ctx, whisper_lang_id(params.language));
+        state->vocab_sub_thold = params.vocab_subset_thold;
     }
 
     if (params.token_timestamps) {
@@ -5453,6 +7388,8 @@ int whisper_full_with_state(
     const int seek_start = params.offset_ms/10;
     const int seek_end = params.duration_ms == 0 ? whisper_n_len_from_state(state) : seek_start + params.duration_ms/10;
 
+    state->full_seek = seek_start;
+
     // if length of spectrogram is less than 1.0s (100 frames), then return
     // basically don't process anything that is less than 1.0s
     // see issue #39: https://github.com/ggerganov/whisper.cpp/issues/39
@@ -5547,6 +7484,31 @@ int whisper_full_with_state(
     }
     state->exp_n_audio_ctx = params.audio_ctx;
 
+    // the draft model works on the same mel, window by window
+    whisper_context * draft_ctx   = params.draft_ctx;
+    whisper_state   * draft_state = params.draft_state;
+    if (draft_ctx && draft_state) {
+        if (params.strategy != WHISPER_SAMPLING_GREEDY || params.draft_n_tokens < 1 || params.grammar_rules != nullptr ||
+            draft_ctx->vocab.n_vocab != ctx->vocab.n_vocab || draft_ctx->model.hparams.n_mels != ctx->model.hparams.n_mels) {
+            WHISPER_LOG_WARN("%s: not using the draft model (needs greedy sampling without grammar, the same vocabulary and mel bins)\n", __func__);
+            draft_ctx   = nullptr;
+            draft_state = nullptr;
+        } else {
+            draft_state->mel             = state->mel;
+            draft_state->exp_n_audio_ctx = params.audio_ctx;
+            draft_state->encoded_seek    = -1;
+
+            // a draft state without CPUs of its own runs on those of the state it drafts for
+            if (draft_state->cpumask_inherited || (!draft_state->use_cpumask_encode && !draft_state->use_cpumask_decode)) {
+                whisper_set_cpumask_with_state(draft_state, whisper_cpumask_encode(*state), whisper_cpumask_decode(*state));
+                draft_state->cpumask_inherited = true;
+            }
+        }
+    } else {
+        draft_ctx   = nullptr;
+        draft_state = nullptr;
+    }
+
     // these tokens determine the task that will be performed
     std::vector<whisper_token> prompt_init = { whisper_token_sot(ctx), };
 
@@ -5577,10 +7539,25 @@ int whisper_full_with_state(
     int seek = seek_start;
 
     std::vector<whisper_token> prompt;
+
+    // speculative decoding state: tokens in the draft KV cache by position, and the draft tokens of the last
+    // verification batch, which started at position spec_pos0
+    std::vector<whisper_token> draft_hist;
+    std::vector<whisper_token> spec_draft;
+    int spec_pos0 = -1;
     prompt.reserve(whisper_n_text_ctx(ctx));
 
+    // a beam search candidate extends the sequence of decoder_idx by one token
     struct beam_candidate {
         int decoder_idx;
+
+        whisper_token_data token;
+
+        double sum_logprobs_all;
+    };
+
+    // the state of a decoder before the beam search step, while the decoders are reassigned to the best candidates
+    struct beam_parent {
         int seek_delta;
 
         bool has_ts;
@@ -5592,8 +7569,13 @@ int whisper_full_with_state(
     std::vector<std::vector<beam_candidate>> bc_per_dec(n_decoders);
     std::vector<beam_candidate> beam_candidates;
 
+    std::vector<beam_parent>    beam_parents(n_decoders);
+    std::vector<whisper_seq_id> beam_src(n_decoders);
+
     // main loop
     while (true) {
+        state->full_seek = seek;
+
         if (params.progress_callback) {
             const int progress_cur = (100*(seek - seek_start))/(seek_end - seek_start);
 
@@ -5614,11 +7596,27 @@ int whisper_full_with_state(
         }
 
         // encode audio features starting at offset seek
-        if (!whisper_encode_internal(*ctx, *state, seek, params.n_threads, params.abort_callback, params.abort_callback_user_data)) {
+        if (whisper_encoded_at(*ctx, *state, seek)) {
+            if (params.abort_callback && params.abort_callback(params.abort_callback_user_data)) {
+                WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
+                return -6;
+            }
+        } else if (!whisper_encode_internal(*ctx, *state, seek, whisper_full_threads(params, params.n_threads_encode), params.abort_callback, params.abort_callback_user_data)) {
             WHISPER_LOG_ERROR("%s: failed to encode\n", __func__);
             return -6;
         }
 
+        if (draft_ctx) {
+            if (!whisper_encode_internal(*draft_ctx, *draft_state, seek, whisper_full_threads(params, params.n_threads_encode), params.abort_callback, params.abort_callback_user_data)) {
+                WHISPER_LOG_ERROR("%s: failed to encode with the draft model\n", __func__);
+                return -6;
+            }
+
+            // the cached self-attention belongs to the previous window's audio
+            whisper_kv_cache_clear(draft_state->kv_self);
+            draft_hist.clear();
+        }
+
         // if there is a very short audio segment left to process, we remove any past prompt since it tends
         // to confuse the decoder and often make it repeat or hallucinate stuff
         if (seek > seek_start && seek + 500 >= seek_end) {
@@ -5651,6 +7649,9 @@ int whisper_full_with_state(
 
             n_decoders_cur = std::max(1, n_decoders_cur);
 
+            const bool speculate = draft_ctx && t_cur < 1e-6f && n_decoders_cur == 1 && ctx->model.n_loaded > 0;
+            spec_pos0 = -1;
+
             WHISPER_LOG_DEBUG("\n%s: strategy = %d, decoding with %d decoders, temperature = %.2f\n", __func__, params.strategy, n_decoders_cur, t_cur);
 
             // TAGS: WHISPER_DECODER_INIT
@@ -5665,6 +7666,8 @@ int whisper_full_with_state(
                 decoder.sequence.entropy          = 0.0;
                 decoder.sequence.score            = -INFINITY;
 
+                std::fill(decoder.sequence.n_rep, decoder.sequence.n_rep + WHISPER_REP_MAX_PERIOD, 0);
+
                 decoder.seek_delta = 100*WHISPER_CHUNK_SIZE;
 
                 decoder.failed    = false;
@@ -5697,7 +7700,7 @@ int whisper_full_with_state(
                 // print the prompt
                 WHISPER_LOG_DEBUG("\n\n");
                 for (int i = 0; i < (int) prompt.size(); i++) {
-                    WHISPER_LOG_DEBUG("%s: prompt[%d] = %s\n", __func__, i, ctx->vocab.id_to_token.at(prompt[i]).c_str());
+                    WHISPER_LOG_DEBUG("%s: prompt[%d] = %s\n", __func__, i, ctx->vocab.token_str(prompt[i]));
                 }
                 WHISPER_LOG_DEBUG("\n\n");
 
@@ -5705,12 +7708,13 @@ int whisper_full_with_state(
                 if (state->kv_self_n_dec < n_decoders_cur) {
                     WHISPER_LOG_DEBUG("%s: recreating KV cache: n_decoders_cur = %d\n", __func__, n_decoders_cur);
 
+                    whisper_graph_decode_release(*state);
                     whisper_kv_cache_free(state->kv_self);
 
                     // overallocate to workaround KV cache fragmentation issues
                     const int factor = n_decoders_cur > 1 ? n_decoders_cur + 2 : 1;
 
-                    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], ctx->itype,
+                    if (!whisper_kv_cache_init(state->kv_self, state->backends[0], state->kv_self.type_k, state->kv_self.type_v,
                                 ctx->model.hparams.n_text_state,
                                 ctx->model.hparams.n_text_layer,
                                 GGML_PAD(ctx->model.hparams.n_text_ctx, 256)*factor)) {
@@ -5726,7 +7730,7 @@ int whisper_full_with_state(
 
                 whisper_batch_prep_legacy(state->batch, prompt.data(), prompt.size(), 0, 0);
 
-                if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
+                if (!whisper_decode_internal(*ctx, *state, state->batch, whisper_full_threads(params, params.n_threads_decode), false, params.abort_callback, params.abort_callback_user_data)) {
                     WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
                     return -8;
                 }
@@ -5738,11 +7742,16 @@ int whisper_full_with_state(
 
                     whisper_process_logits(*ctx, *state, state->decoders[0], params, t_cur);
 
+                    // all decoders continue from the prompt, sharing its cells
+                    for (int j = 0; j < n_decoders_cur; ++j) {
+                        beam_src[j] = j == 0 ? -1 : 0;
+                    }
+
+                    whisper_kv_cache_seq_fork(state->kv_self, beam_src.data(), n_decoders_cur);
+
                     for (int j = 1; j < n_decoders_cur; ++j) {
                         auto & decoder = state->decoders[j];
 
-                        whisper_kv_cache_seq_cp(state->kv_self, 0, j, -1, -1);
-
                         memcpy(decoder.probs.data(),    state->decoders[0].probs.data(),    decoder.probs.size()*sizeof(decoder.probs[0]));
                         memcpy(decoder.logits.data(),   state->decoders[0].logits.data(),   decoder.logits.size()*sizeof(decoder.logits[0]));
                         memcpy(decoder.logprobs.data(), state->decoders[0].logprobs.data(), decoder.logprobs.size()*sizeof(decoder.logprobs[0]));
@@ -5790,22 +7799,21 @@ int whisper_full_with_state(
                                         }
 
                                         decoder.sequence.sum_logprobs_all += decoder.sequence.tokens.back().plog;
+                                        whisper_sequence_track(decoder.sequence);
                                     } break;
                                 case whisper_sampling_strategy::WHISPER_SAMPLING_BEAM_SEARCH:
                                     {
                                         const auto tokens_new = whisper_sample_token_topk(*ctx, decoder, params.beam_search.beam_size);
 
                                         for (const auto & token : tokens_new) {
-                                            bc_per_dec[j].push_back({ j, decoder.seek_delta, decoder.has_ts, decoder.sequence, decoder.grammar, });
-                                            bc_per_dec[j].back().sequence.tokens.push_back(token);
-                                            bc_per_dec[j].back().sequence.sum_logprobs_all += token.plog;
+                                            bc_per_dec[j].push_back({ j, token, decoder.sequence.sum_logprobs_all + token.plog, });
                                         }
                                     } break;
                             };
                         }
                     };
 
-                    const int n_threads = std::min(params.n_threads, n_decoders_cur);
+                    const int n_threads = std::min(whisper_full_threads(params, params.n_threads_decode), n_decoders_cur);
 
                     if (n_threads == 1) {
                         process();
@@ -5839,12 +7847,36 @@ int whisper_full_with_state(
                             beam_candidates.begin(),
                             beam_candidates.end(),
                             [](const beam_candidate & a, const beam_candidate & b) {
-                        if (a.sequence.sum_logprobs_all != b.sequence.sum_logprobs_all) {
-                            return a.sequence.sum_logprobs_all > b.sequence.sum_logprobs_all;
+                        if (a.sum_logprobs_all != b.sum_logprobs_all) {
+                            return a.sum_logprobs_all > b.sum_logprobs_all;
                         }
                         return a.decoder_idx < b.decoder_idx;
                     });
 
+                    // the decoders are overwritten by their children below
+                    for (int j = 0; j < n_decoders_cur; ++j) {
+                        auto & decoder = state->decoders[j];
+
+                        beam_src[j] = -1;
+
+                        if (decoder.completed || decoder.failed) {
+                            continue;
+                        }
+
+                        auto & parent = beam_parents[j];
+
+                        std::swap(parent.sequence, decoder.sequence);
+                        std::swap(parent.grammar,  decoder.grammar);
+
+                        parent.seek_delta = decoder.seek_delta;
+                        parent.has_ts     = decoder.has_ts;
+                    }
+
+                    const auto candidates_equal = [&](const beam_candidate & a, const beam_candidate & b) {
+                        return a.token.id == b.token.id && (a.decoder_idx == b.decoder_idx ||
+                            whisper_sequence_tokens_equal(beam_parents[a.decoder_idx].sequence, beam_parents[b.decoder_idx].sequence));
+                    };
+
                     uint32_t cur_c = 0;
 
                     for (int j = 0; j < n_decoders_cur; ++j) {
@@ -5860,32 +7892,28 @@ int whisper_full_with_state(
 
                         auto & cur = beam_candidates[cur_c++];
 
-                        while (beam_candidates.size() > cur_c && whisper_sequence_tokens_equal(beam_candidates[cur_c].sequence, cur.sequence) && i > 0) {
+                        while (beam_candidates.size() > cur_c && candidates_equal(beam_candidates[cur_c], cur) && i > 0) {
                             ++cur_c;
                         }
 
-                        decoder.seek_delta = cur.seek_delta;
-                        decoder.has_ts     = cur.has_ts;
-                        decoder.sequence   = cur.sequence;
-                        decoder.grammar    = cur.grammar;
+                        const auto & parent = beam_parents[cur.decoder_idx];
 
-                        whisper_kv_cache_seq_cp(state->kv_self, cur.decoder_idx, WHISPER_MAX_DECODERS + j, -1, -1);
-
-                        WHISPER_LOG_DEBUG("%s: beam search: decoder %d: from decoder %d: token = %10s, plog = %8.5f, sum_logprobs = %8.5f\n",
-                                __func__, j, cur.decoder_idx, ctx->vocab.id_to_token.at(decoder.sequence.tokens.back().id).c_str(), decoder.sequence.tokens.back().plog, decoder.sequence.sum_logprobs_all);
-                    }
+                        decoder.seek_delta = parent.seek_delta;
+                        decoder.has_ts     = parent.has_ts;
+                        decoder.sequence   = parent.sequence;
+                        decoder.grammar    = parent.grammar;
 
-                    for (int j = 0; j < n_decoders_cur; ++j) {
-                        auto & decoder = state->decoders[j];
+                        decoder.sequence.tokens.push_back(cur.token);
+                        decoder.sequence.sum_logprobs_all = cur.sum_logprobs_all;
+                        whisper_sequence_track(decoder.sequence);
 
-                        if (decoder.completed || decoder.failed) {
-                            continue;
-                        }
+                        beam_src[j] = cur.decoder_idx;
 
-                        whisper_kv_cache_seq_rm(state->kv_self, j,                           -1, -1);
-                        whisper_kv_cache_seq_cp(state->kv_self, WHISPER_MAX_DECODERS + j, j, -1, -1);
-                        whisper_kv_cache_seq_rm(state->kv_self, WHISPER_MAX_DECODERS + j,    -1, -1);
+                        WHISPER_LOG_DEBUG("%s: beam search: decoder %d: from decoder %d: token = %10s, plog = %8.5f, sum_logprobs = %8.5f\n",
+                                __func__, j, cur.decoder_idx, ctx->vocab.token_str(decoder.sequence.tokens.back().id), decoder.sequence.tokens.back().plog, decoder.sequence.sum_logprobs_all);
                     }
+
+                    whisper_kv_cache_seq_fork(state->kv_self, beam_src.data(), n_decoders_cur);
                 }
 
                 // update the decoder state
@@ -5921,6 +7949,7 @@ int whisper_full_with_state(
 
                             seek_delta = seek_delta_new;
                             result_len = i + 1;
+                            decoder.sequence.sum_logprobs = decoder.sequence.sum_logprobs_all;
                             has_ts = true;
                         }
 
@@ -5928,9 +7957,9 @@ int whisper_full_with_state(
 
 #ifdef WHISPER_DEBUG
                         {
-                            const auto tt = token.pt > 0.10 ? ctx->vocab.id_to_token.at(token.tid) : "[?]";
+                            const std::string tt = token.pt > 0.10 ? ctx->vocab.token_str(token.tid) : "[?]";
                             WHISPER_LOG_DEBUG("%s: id = %3d, decoder = %d, token = %6d, p = %6.3f, ts = %10s, %6.3f, result_len = %4d '%s'\n",
-                                    __func__, i, j, token.id, token.p, tt.c_str(), token.pt, result_len, ctx->vocab.id_to_token.at(token.id).c_str());
+                                    __func__, i, j, token.id, token.p, tt.c_str(), token.pt, result_len, ctx->vocab.token_str(token.id));
                         }
 #endif
 
@@ -5942,6 +7971,7 @@ int whisper_full_with_state(
                             if (result_len == 0 && !params.no_timestamps) {
                                 if (seek + seek_delta + 100 >= seek_end) {
                                     result_len = i + 1;
+                                    decoder.sequence.sum_logprobs = decoder.sequence.sum_logprobs_all;
                                 } else {
                                     WHISPER_LOG_DEBUG("%s: decoder %d failed (result_len = 0)\n", __func__, j);
                                     failed = true;
@@ -5951,6 +7981,7 @@ int whisper_full_with_state(
 
                             if (params.single_segment || params.no_timestamps) {
                                 result_len = i + 1;
+                                decoder.sequence.sum_logprobs = decoder.sequence.sum_logprobs_all;
                                 seek_delta = 100*WHISPER_CHUNK_SIZE;
                             }
 
@@ -5993,12 +8024,58 @@ int whisper_full_with_state(
                     if (completed_all) {
                         break;
                     }
+
+                    // the best decoder will fail the checks below whichever it is - start the fallback right away
+                    if (params.fail_early && it != (int) temperatures.size() - 1) {
+                        bool doomed_all = true;
+
+                        for (int j = 0; j < n_decoders_cur; ++j) {
+                            const auto & decoder = state->decoders[j];
+
+                            if (!decoder.failed && !whisper_decoder_doomed(params, decoder, n_max)) {
+                                doomed_all = false;
+                                break;
+                            }
+                        }
+
+                        if (doomed_all) {
+                            WHISPER_LOG_DEBUG("%s: all decoders bound to fail after %d tokens\n", __func__, i + 1);
+
+                            for (int j = 0; j < n_decoders_cur; ++j) {
+                                state->decoders[j].failed = true;
+                            }
+
+                            state->n_fail_e++;
+
+                            break;
+                        }
+                    }
                 }
 
                 state->t_sample_us += ggml_time_us() - t_start_sample_us;
 
-                // obtain logits for the next token
-                {
+                // obtain logits for the next token, from the last verification batch while the draft holds
+                if (speculate) {
+                    auto & decoder = state->decoders[0];
+
+                    const int row = prompt.size() + i - spec_pos0;
+
+                    if (spec_pos0 < 0 || row < 1 || row > (int) spec_draft.size() || spec_draft[row - 1] != decoder.sequence.tokens.back().id) {
+                        if (!whisper_decode_speculative(*ctx, *state, *draft_ctx, *draft_state, prompt, decoder,
+                                    draft_hist, spec_draft, spec_pos0, params)) {
+                            WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
+                            return -9;
+                        }
+                    } else {
+                        decoder.i_batch = row;
+                    }
+
+                    const int64_t t_start_sample_us = ggml_time_us();
+
+                    whisper_process_logits(*ctx, *state, decoder, params, t_cur);
+
+                    state->t_sample_us += ggml_time_us() - t_start_sample_us;
+                } else {
                     auto & batch = state->batch;
 
                     batch.n_tokens = 0;
@@ -6026,7 +8103,7 @@ int whisper_full_with_state(
 
                     assert(batch.n_tokens > 0);
 
-                    if (!whisper_decode_internal(*ctx, *state, state->batch, params.n_threads, false, params.abort_callback, params.abort_callback_user_data)) {
+                    if (!whisper_decode_internal(*ctx, *state, state->batch, whisper_full_threads(params, params.n_threads_decode), false, params.abort_callback, params.abort_callback_user_data)) {
                         WHISPER_LOG_ERROR("%s: failed to decode\n", __func__);
                         return -9;
                     }
@@ -6055,7 +8132,7 @@ int whisper_full_with_state(
                             }
                         };
 
-                        const int n_threads = std::min(params.n_threads, n_decoders_cur);
+                        const int n_threads = std::min(whisper_full_threads(params, params.n_threads_decode), n_decoders_cur);
 
                         if (n_threads == 1) {
                             process();
@@ -6131,7 +8208,7 @@ int whisper_full_with_state(
 
             if (success) {
                 //for (auto & token : ctx->decoders[best_decoder_id].sequence.tokens) {
-                //    WHISPER_LOG_DEBUG("%s: token = %d, p = %6.3f, pt = %6.3f, ts = %s, str = %s\n", __func__, token.id, token.p, token.pt, ctx->vocab.id_to_token.at(token.tid).c_str(), ctx->vocab.id_to_token.at(token.id).c_str());
+                //    WHISPER_LOG_DEBUG("%s: token = %d, p = %6.3f, pt = %6.3f, ts = %s, str = %s\n", __func__, token.id, token.p, token.pt, ctx->vocab.token_str(token.tid), ctx->vocab.token_str(token.id));
                 //}
 
                 break;
@@ -6173,8 +8250,8 @@ int whisper_full_with_state(
 
                 for (int i = 0; i < (int) tokens_cur.size(); i++) {
                     //printf("%s: %18s %6.3f %18s %6.3f\n", __func__,
-                    //        ctx->vocab.id_to_token[tokens_cur[i].id].c_str(), tokens_cur[i].p,
-                    //        ctx->vocab.id_to_token[tokens_cur[i].tid].c_str(), tokens_cur[i].pt);
+                    //        ctx->vocab.token_str(tokens_cur[i].id), tokens_cur[i].p,
+                    //        ctx->vocab.token_str(tokens_cur[i].tid), tokens_cur[i].pt);
 
                     if (params.print_special || tokens_cur[i].id < whisper_token_eot(ctx)) {
                         text += whisper_token_to_str(ctx, tokens_cur[i].id);
@@ -6201,7 +8278,7 @@ int whisper_full_with_state(
                                 }
                             }
 
-                            //printf("tt0 = %d, tt1 = %d, text = %s, token = %s, token_id = %d, tid = %d\n", tt0, tt1, text.c_str(), ctx->vocab.id_to_token[tokens_cur[i].id].c_str(), tokens_cur[i].id, tokens_cur[i].tid);
+                            //printf("tt0 = %d, tt1 = %d, text = %s, token = %s, token_id = %d, tid = %d\n", tt0, tt1, text.c_str(), ctx->vocab.token_str(tokens_cur[i].id), tokens_cur[i].id, tokens_cur[i].tid);
 
                             result_all.push_back({ tt0, tt1, text, {}, speaker_turn_next });
                             for (int j = i0; j <= i; j++) {
@@ -6434,6 +8511,29 @@ int whisper_full_lang_id(struct whisper_context * ctx) {
     return ctx->state->lang_id;
 }
 
+int whisper_full_get_seek_from_state(struct whisper_state * state) {
+    return state->full_seek;
+}
+
+int whisper_full_n_fallbacks_from_state(struct whisper_state * state) {
+    return state->n_fail_p;
+}
+
+int whisper_full_n_fallbacks_early_from_state(struct whisper_state * state) {
+    return state->n_fail_e;
+}
+
+int whisper_full_get_prompt_past_from_state(struct whisper_state * state, whisper_token * tokens, int n_max_tokens) {
+    const int n = (int) state->prompt_past.size();
+    if (n > n_max_tokens) {
+        return -n;
+    }
+
+    std::copy(state->prompt_past.begin(), state->prompt_past.end(), tokens);
+
+    return n;
+}
+
 int64_t whisper_full_get_segment_t0_from_state(struct whisper_state * state, int i_segment) {
     return state->result_all[i_segment].t0;
 }
@@ -6475,11 +8575,11 @@ int whisper_full_n_tokens(struct whisper_context * ctx, int i_segment) {
 }
 
 const char * whisper_full_get_token_text_from_state(struct whisper_context * ctx, struct whisper_state * state, int i_segment, int i_token) {
-    return ctx->vocab.id_to_token[state->result_all[i_segment].tokens[i_token].id].c_str();
+    return ctx->vocab.token_str(state->result_all[i_segment].tokens[i_token].id);
 }
 
 const char* whisper_full_get_token_text(struct whisper_context * ctx, int i_segment, int i_token) {
-    return ctx->vocab.id_to_token[ctx->state->result_all[i_segment].tokens[i_token].id].c_str();
+    return ctx->vocab.token_str(ctx->state->result_all[i_segment].tokens[i_token].id);
 }
 
 whisper_token whisper_full_get_token_id_from_state(struct whisper_state * state, int i_segment, int i_token) {
@@ -1,4 +1,5 @@
 #include "app.h"
+#include "env.h"
 #include "overlay.h"
 #include "paste.h"
 #include "ui_settings.h"
@@ -56,14 +57,6 @@ typedef struct {
 static int chunk_queue_sentinel;
 #define CHUNK_QUEUE_SENTINEL ((gpointer) &chunk_queue_sentinel)
 
-static const char *env_get(const char *preferred, const char *legacy) {
-    const char *v = preferred ? getenv(preferred) : NULL;
-    if (v && *v) return v;
-    v = legacy ? getenv(legacy) : NULL;
-    if (v && *v) return v;
-    return NULL;
-}
-
 static void try_trim_heap(void) {
 #ifdef __GLIBC__
     (void)malloc_trim(0);
@@ -236,6 +229,9 @@ void app_cleanup(void) {
     cancel_model_unload_timer(app);
     overlay_hide(app);
 
+    // Stop the chunk being transcribed instead of waiting it out; the worker
+    // thread drops whatever is still queued.
+    transcriber_cancel(app->transcriber);
     if (app->chunk_queue) {
         g_async_queue_push(app->chunk_queue, CHUNK_QUEUE_SENTINEL); // sentinel to stop worker
     }
@@ -553,6 +549,12 @@ static gpointer worker_thread_main(gpointer data) {
         if (item == CHUNK_QUEUE_SENTINEL) break;
         AudioChunk *chunk = item;
 
+        if (a->shutting_down) {
+            free(chunk->samples);
+            free(chunk);
+            continue;
+        }
+
         if (chunk->flush) {
             free(chunk);
             FinalizePaste *fp = calloc(1, sizeof(*fp));
@@ -588,9 +590,15 @@ static gpointer worker_thread_main(gpointer data) {
             if (a->config && a->config->initial_prompt && *a->config->initial_prompt) {
                 prompt_copy = strdup(a->config->initial_prompt);
             }
+            // Later chunks of a recording continue from the text of the previous one.
+            g_mutex_lock(&a->accum_mutex);
+            const bool continues = a->accum_text->len > 0;
+            g_mutex_unlock(&a->accum_mutex);
             char *text = transcriber_process_ex(a->transcriber, chunk->samples, chunk->count,
                                                 a->config->language, a->config->translate_to_english,
                                                 prompt_copy,
+                                                TRANSCRIBE_PRIORITY_INTERACTIVE,
+                                                continues,
                                                 &err);
             const gint64 t1_us = g_get_monotonic_time();
             dbg_chunk(a, "worker: transcribe done in %.2fs (text_len=%zu)",
@@ -0,0 +1,811 @@
+#define _GNU_SOURCE // struct ucred
+#include "daemon.h"
+#include "audio.h"
+#include "config.h"
+#include "env.h"
+#include "ipc.h"
+#include "transcribe.h"
+#include "wav.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+// Long inputs ('W'/'F') are cut into windows below whisper's 30 s limit and
+// each window's text is streamed back as soon as it is ready; 'W' audio is
+// decoded while it is still arriving. Cuts land on the quietest 30 ms frame
+// near the end of a window to avoid splitting words.
+#define DAEMON_WINDOW_SAMPLES (SAMPLE_RATE * 28)
+#define DAEMON_SPLIT_SEARCH_SAMPLES (SAMPLE_RATE * 4)
+#define DAEMON_SPLIT_FRAME 480
+#define DAEMON_MIN_SAMPLES (SAMPLE_RATE + 160)
+
+// Limits on what a client may make the daemon allocate: audio per request
+// (two hours) and the length of a string field (path, language, prompt).
+#define DAEMON_MAX_SAMPLES ((size_t)SAMPLE_RATE * 60 * 60 * 2)
+#define DAEMON_MAX_FIELD (64 * 1024)
+
+// Jobs from different clients run on parallel lanes; the worker maps them onto
+// separate whisper states sharing one copy of the weights (AURISCRIBE_SESSIONS).
+// One extra lane only takes interactive ('T') jobs, so dictation reaches the
+// worker right away even when every other lane is busy with a batch job; the
+// worker then pauses one of those mid-window and redoes that window later.
+#define DAEMON_MAX_LANES 8
+
+typedef struct DaemonJob {
+    int fd;
+    bool stream;
+    // samples[taken, count) is what the lane has not decoded yet. For 'W' the
+    // client thread appends until input_done while the lane takes windows off
+    // the front; both hold the Daemon's mutex to touch these.
+    float *samples;
+    size_t count;
+    size_t capacity;
+    size_t taken;
+    bool input_done;
+    const char *input_error;
+    char *language;
+    char *prompt;
+    bool translate;
+    TranscribePriority priority;
+    bool done;
+    struct DaemonJob *next;
+} DaemonJob;
+
+// One per connection, listed in the Daemon while its (detached) thread runs.
+typedef struct DaemonClient {
+    struct Daemon *daemon;
+    int fd;
+    struct DaemonClient *next;
+} DaemonClient;
+
+typedef struct Daemon {
+    Transcriber *transcriber;
+    char *model_path;
+    pthread_mutex_t load_mutex;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t queue_cond;
+    pthread_cond_t done_cond;
+    pthread_cond_t input_cond; // more 'W' audio arrived, or its end
+    DaemonJob *head;
+    DaemonJob *tail;
+    bool stopping;
+    // Connected clients: daemon_run wakes them at shutdown and waits until the
+    // last one is gone, since they use this Daemon (which lives on its stack).
+    DaemonClient *clients;
+    int n_clients;
+    pthread_cond_t clients_cond;
+} Daemon;
+
+static volatile sig_atomic_t daemon_stop_signal = 0;
+
+static char *read_str_field(int fd) {
+    uint32_t n = 0;
+    if (!ipc_read_u32(fd, &n) || n > DAEMON_MAX_FIELD) return NULL;
+    return ipc_read_str(fd, n);
+}
+
+bool daemon_socket_path(char *out, size_t out_len) {
+    if (!out || out_len == 0) return false;
+    const char *env = env_get("AURISCRIBE_DAEMON_SOCKET", NULL);
+    const char *runtime = getenv("XDG_RUNTIME_DIR");
+    int n;
+    if (env) {
+        n = snprintf(out, out_len, "%s", env);
+    } else if (runtime && *runtime) {
+        n = snprintf(out, out_len, "%s/auriscribe.sock", runtime);
+    } else {
+        return false; // no per-user directory to put it in
+    }
+    return n > 0 && (size_t)n < out_len && (size_t)n < sizeof(((struct sockaddr_un *)0)->sun_path);
+}
+
+bool daemon_peer_is_self(int fd) {
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    return getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0 && len == sizeof(cred) &&
+           cred.uid == getuid();
+}
+
+static void job_free(DaemonJob *job) {
+    if (!job) return;
+    free(job->samples);
+    free(job->language);
+    free(job->prompt);
+    free(job);
+}
+
+typedef struct {
+    Daemon *daemon;
+    bool interactive_only;
+} DaemonLane;
+
+// Interactive jobs queue behind other interactive jobs but ahead of every
+// background one; background jobs are FIFO. Returns false (after replying)
+// when the daemon is stopping.
+static bool daemon_submit(Daemon *d, DaemonJob *job) {
+    pthread_mutex_lock(&d->mutex);
+    if (d->stopping) {
+        // The lanes are gone or going; nothing would take the job.
+        pthread_mutex_unlock(&d->mutex);
+        (void)ipc_write_msg(job->fd, 'E', "Daemon shutting down");
+        return false;
+    }
+    DaemonJob *prev = NULL;
+    if (job->priority == TRANSCRIBE_PRIORITY_INTERACTIVE) {
+        for (DaemonJob *it = d->head; it && it->priority == TRANSCRIBE_PRIORITY_INTERACTIVE; it = it->next) {
+            prev = it;
+        }
+    } else {
+        prev = d->tail;
+    }
+    job->next = prev ? prev->next : d->head;
+    if (prev) prev->next = job;
+    else d->head = job;
+    if (!job->next) d->tail = job;
+    pthread_cond_broadcast(&d->queue_cond);
+    pthread_mutex_unlock(&d->mutex);
+    return true;
+}
+
+static void daemon_wait(Daemon *d, DaemonJob *job) {
+    pthread_mutex_lock(&d->mutex);
+    while (!job->done) {
+        pthread_cond_wait(&d->done_cond, &d->mutex);
+    }
+    pthread_mutex_unlock(&d->mutex);
+}
+
+static bool daemon_can_take(const Daemon *d, bool interactive_only) {
+    return d->head && (!interactive_only || d->head->priority == TRANSCRIBE_PRIORITY_INTERACTIVE);
+}
+
+static DaemonJob *daemon_pop(Daemon *d, bool interactive_only) {
+    pthread_mutex_lock(&d->mutex);
+    while (!daemon_can_take(d, interactive_only) && !d->stopping) {
+        pthread_cond_wait(&d->queue_cond, &d->mutex);
+    }
+    DaemonJob *job = daemon_can_take(d, interactive_only) ? d->head : NULL;
+    if (job) {
+        d->head = job->next;
+        if (!d->head) d->tail = NULL;
+    }
+    pthread_mutex_unlock(&d->mutex);
+    return job;
+}
+
+static void daemon_finish(Daemon *d, DaemonJob *job) {
+    pthread_mutex_lock(&d->mutex);
+    job->done = true;
+    pthread_cond_broadcast(&d->done_cond);
+    pthread_mutex_unlock(&d->mutex);
+}
+
+static bool daemon_ensure_loaded(Daemon *d) {
+    pthread_mutex_lock(&d->load_mutex);
+    bool ok = transcriber_is_loaded(d->transcriber);
+    if (!ok) {
+        fprintf(stderr, "daemon: loading model %s\n", d->model_path);
+        ok = transcriber_load(d->transcriber, ENGINE_WHISPER, d->model_path);
+    }
+    pthread_mutex_unlock(&d->load_mutex);
+    return ok;
+}
+
+static int daemon_lane_count(void) {
+    const char *s = env_get("AURISCRIBE_SESSIONS", NULL);
+    int n = (s && *s) ? atoi(s) : 2;
+    if (n < 1) n = 1;
+    if (n > DAEMON_MAX_LANES) n = DAEMON_MAX_LANES;
+    return n;
+}
+
+// Transcribe one window, padding short input up to whisper's minimum length.
+static char *daemon_transcribe(Daemon *d, const float *samples, size_t count,
+                               const DaemonJob *job, char **error_out) {
+    if (error_out) *error_out = NULL;
+    if (!daemon_ensure_loaded(d)) {
+        if (error_out) *error_out = strdup("Failed to load model");
+        return NULL;
+    }
+
+    const char *lang = job->language && *job->language ? job->language : "auto";
+    const char *prompt = job->prompt && *job->prompt ? job->prompt : NULL;
+
+    if (count >= DAEMON_MIN_SAMPLES) {
+        return transcriber_process_ex(d->transcriber, samples, count, lang, job->translate, prompt,
+                                      job->priority, false, error_out);
+    }
+
+    float *padded = calloc(DAEMON_MIN_SAMPLES, sizeof(float));
+    if (!padded) {
+        if (error_out) *error_out = strdup("Out of memory");
+        return NULL;
+    }
+    if (count) memcpy(padded, samples, count * sizeof(float));
+    char *text = transcriber_process_ex(d->transcriber, padded, DAEMON_MIN_SAMPLES, lang, job->translate, prompt,
+                                        job->priority, false, error_out);
+    free(padded);
+    return text;
+}
+
+static size_t daemon_next_split(const float *samples, size_t count) {
+    if (count <= DAEMON_WINDOW_SAMPLES) return count;
+
+    size_t best = DAEMON_WINDOW_SAMPLES;
+    float best_energy = INFINITY;
+    for (size_t pos = DAEMON_WINDOW_SAMPLES - DAEMON_SPLIT_SEARCH_SAMPLES;
+         pos + DAEMON_SPLIT_FRAME <= DAEMON_WINDOW_SAMPLES;
+         pos += DAEMON_SPLIT_FRAME) {
+        float e = 0.0f;
+        for (size_t i = 0; i < DAEMON_SPLIT_FRAME; i++) {
+            e += samples[pos + i] * samples[pos + i];
+        }
+        if (e < best_energy) {
+            best_energy = e;
+            best = pos + DAEMON_SPLIT_FRAME / 2;
+        }
+    }
+    return best;
+}
+
+static void daemon_run_job(Daemon *d, DaemonJob *job) {
+    if (!job->stream) {
+        char *err = NULL;
+        char *text = daemon_transcribe(d, job->samples, job->count, job, &err);
+        if (text) {
+            (void)ipc_write_msg(job->fd, 'R', text);
+        } else {
+            (void)ipc_write_msg(job->fd, 'E', err ? err : "Transcription failed");
+        }
+        free(text);
+        free(err);
+        return;
+    }
+
+    char *all = strdup("");
+    bool any = false;
+    while (all) {
+        // Wait until a whole window (plus the room to search for its cut) has
+        // arrived or the audio has ended, then copy it out: the client thread
+        // may move the buffer while the window is being decoded.
+        pthread_mutex_lock(&d->mutex);
+        while (!job->input_done && job->count - job->taken <= DAEMON_WINDOW_SAMPLES && !d->stopping) {
+            pthread_cond_wait(&d->input_cond, &d->mutex);
+        }
+        const char *refused = job->input_error;
+        if (!refused && !job->input_done && job->count - job->taken <= DAEMON_WINDOW_SAMPLES) {
+            refused = "Daemon shutting down";
+        } else if (!refused && job->input_done && job->count == job->taken && !any) {
+            refused = "No audio";
+        }
+        size_t n = 0;
+        float *window = NULL;
+        if (!refused && job->count > job->taken) {
+            n = daemon_next_split(job->samples + job->taken, job->count - job->taken);
+            window = malloc(n * sizeof(float));
+            if (window) {
+                memcpy(window, job->samples + job->taken, n * sizeof(float));
+                job->taken += n;
+            }
+        }
+        pthread_mutex_unlock(&d->mutex);
+        if (refused || (n > 0 && !window)) {
+            (void)ipc_write_msg(job->fd, 'E', refused ? refused : "Out of memory");
+            free(all);
+            return;
+        }
+        if (n == 0) break;
+        any = true;
+
+        char *err = NULL;
+        char *text = daemon_transcribe(d, window, n, job, &err);
+        free(window);
+        if (!text) {
+            (void)ipc_write_msg(job->fd, 'E', err ? err : "Transcription failed");
+            free(err);
+            free(all);
+            return;
+        }
+        free(err);
+
+        if (*text) {
+            if (!ipc_write_msg(job->fd, 'S', text)) {
+                // Client went away; don't keep the model busy for nobody.
+                free(text);
+                free(all);
+                return;
+            }
+            const size_t len = strlen(all);
+            char *grown = realloc(all, len + strlen(text) + 2);
+            if (grown) {
+                all = grown;
+                if (len > 0) strcat(all, " ");
+                strcat(all, text);
+            }
+        }
+        free(text);
+    }
+
+    (void)ipc_write_msg(job->fd, all ? 'R' : 'E', all ? all : "Out of memory");
+    free(all);
+}
+
+static void *daemon_transcribe_thread(void *arg) {
+    DaemonLane *lane = arg;
+    Daemon *d = lane->daemon;
+    for (;;) {
+        DaemonJob *job = daemon_pop(d, lane->interactive_only);
+        if (!job) break;
+        daemon_run_job(d, job);
+        daemon_finish(d, job);
+    }
+    return NULL;
+}
+
+static bool same_model_path(const char *a, const char *b) {
+    if (!a || !b) return false;
+    char ra[4096];
+    char rb[4096];
+    if (realpath(a, ra) && realpath(b, rb)) return strcmp(ra, rb) == 0;
+    return strcmp(a, b) == 0;
+}
+
+// 'T' (one-shot, same payload as the worker): n_samples, lang, prompt,
+// translate, n_threads (ignored), samples. Returns NULL on a broken stream,
+// with *error_out set when the request was refused.
+static DaemonJob *read_pcm_job(int fd, char **error_out) {
+    DaemonJob *job = calloc(1, sizeof(*job));
+    if (!job) return NULL;
+    job->fd = fd;
+    job->input_done = true;
+    job->priority = TRANSCRIBE_PRIORITY_INTERACTIVE;
+
+    uint32_t n_samples = 0;
+    uint8_t translate = 0;
+    uint32_t n_threads = 0;
+    if (!ipc_read_u32(fd, &n_samples) ||
+        !(job->language = read_str_field(fd)) ||
+        !(job->prompt = read_str_field(fd)) ||
+        !ipc_read_u8(fd, &translate) ||
+        !ipc_read_u32(fd, &n_threads)) {
+        job_free(job);
+        return NULL;
+    }
+    job->translate = translate != 0;
+    job->count = n_samples;
+    if (job->count > DAEMON_MAX_SAMPLES) {
+        *error_out = strdup("Audio too long");
+        job_free(job);
+        return NULL;
+    }
+    if (n_samples > 0) {
+        job->samples = malloc((size_t)n_samples * sizeof(float));
+        if (!job->samples || !ipc_read_exact(fd, job->samples, (size_t)n_samples * sizeof(float))) {
+            job_free(job);
+            return NULL;
+        }
+    }
+    return job;
+}
+
+// 'F': path, lang, prompt, translate.
+static DaemonJob *read_file_job(int fd, char **error_out) {
+    DaemonJob *job = calloc(1, sizeof(*job));
+    if (!job) return NULL;
+    job->fd = fd;
+    job->stream = true;
+    job->input_done = true;
+    job->priority = TRANSCRIBE_PRIORITY_BACKGROUND;
+
+    uint8_t translate = 0;
+    char *path = read_str_field(fd);
+    if (!path ||
+        !(job->language = read_str_field(fd)) ||
+        !(job->prompt = read_str_field(fd)) ||
+        !ipc_read_u8(fd, &translate)) {
+        free(path);
+        job_free(job);
+        return NULL;
+    }
+    job->translate = translate != 0;
+    job->samples = wav_load_mono16k(path, &job->count, error_out);
+    free(path);
+    if (job->samples && job->count > DAEMON_MAX_SAMPLES) {
+        free(job->samples);
+        job->samples = NULL;
+        *error_out = strdup("Audio too long");
+    }
+    return job;
+}
+
+// Room for n more samples at the end of a 'W' buffer. What the lane has taken
+// is dropped first once it is at least as much as what is left, so the copy
+// stays proportional to the audio decoded. Called with the Daemon's mutex held.
+static bool job_reserve(DaemonJob *job, size_t n) {
+    if (job->taken > 0 && job->taken >= job->count - job->taken) {
+        memmove(job->samples, job->samples + job->taken, (job->count - job->taken) * sizeof(float));
+        job->count -= job->taken;
+        job->taken = 0;
+    }
+    if (job->count + n <= job->capacity) return true;
+    size_t capacity = job->capacity ? job->capacity * 2 : (size_t)DAEMON_WINDOW_SAMPLES * 2;
+    while (capacity < job->count + n) capacity *= 2;
+    float *grown = realloc(job->samples, capacity * sizeof(float));
+    if (!grown) return false;
+    job->samples = grown;
+    job->capacity = capacity;
+    return true;
+}
+
+static bool skip_bytes(int fd, size_t n) {
+    char buf[4096];
+    while (n > 0) {
+        const size_t k = n < sizeof(buf) ? n : sizeof(buf);
+        if (!ipc_read_exact(fd, buf, k)) return false;
+        n -= k;
+    }
+    return true;
+}
+
+// 'W': lang, prompt, translate, n_threads (ignored), then chunks of u32
+// n_samples + samples, ended by an empty chunk. The job is queued once the
+// header is in, so its lane decodes each window while later audio is still
+// arriving. Returns false when the connection has to be closed.
+static bool daemon_stream_job(Daemon *d, int fd) {
+    DaemonJob *job = calloc(1, sizeof(*job));
+    if (!job) return false;
+    job->fd = fd;
+    job->stream = true;
+    job->priority = TRANSCRIBE_PRIORITY_BACKGROUND;
+
+    uint8_t translate = 0;
+    uint32_t n_threads = 0;
+    if (!(job->language = read_str_field(fd)) ||
+        !(job->prompt = read_str_field(fd)) ||
+        !ipc_read_u8(fd, &translate) ||
+        !ipc_read_u32(fd, &n_threads)) {
+        job_free(job);
+        return false;
+    }
+    job->translate = translate != 0;
+    if (!daemon_submit(d, job)) {
+        job_free(job);
+        return false;
+    }
+
+    const char *input_error = NULL;
+    size_t total = 0;
+    for (;;) {
+        uint32_t n = 0;
+        if (!ipc_read_u32(fd, &n)) {
+            input_error = "Connection lost";
+            break;
+        }
+        if (n == 0) break;
+        if (n > DAEMON_MAX_SAMPLES - total) {
+            input_error = "Audio too long";
+            break;
+        }
+        total += n;
+
+        // Only this thread grows the buffer, so the tail can be filled
+        // without the lock. Once the job is over (it failed, or the daemon is
+        // stopping) the rest of the audio is read and dropped.
+        float *tail = NULL;
+        pthread_mutex_lock(&d->mutex);
+        if (!job->done) {
+            if (job_reserve(job, n)) tail = job->samples + job->count;
+            else input_error = "Out of memory";
+        }
+        pthread_mutex_unlock(&d->mutex);
+        if (input_error) break;
+        if (!(tail ? ipc_read_exact(fd, tail, (size_t)n * sizeof(float))
+                   : skip_bytes(fd, (size_t)n * sizeof(float)))) {
+            input_error = "Connection lost";
+            break;
+        }
+        if (tail) {
+            pthread_mutex_lock(&d->mutex);
+            job->count += n;
+            pthread_cond_broadcast(&d->input_cond);
+            pthread_mutex_unlock(&d->mutex);
+        }
+    }
+
+    pthread_mutex_lock(&d->mutex);
+    job->input_done = true;
+    job->input_error = input_error;
+    pthread_cond_broadcast(&d->input_cond);
+    pthread_mutex_unlock(&d->mutex);
+    daemon_wait(d, job);
+    job_free(job);
+    return !input_error;
+}
+
+static void *daemon_client_thread(void *arg) {
+    DaemonClient *c = arg;
+    Daemon *d = c->daemon;
+    const int fd = c->fd;
+
+    for (;;) {
+        char magic[4];
+        uint8_t cmd = 0;
+        if (!ipc_read_exact(fd, magic, 4)) break;
+        if (memcmp(magic, "AURI", 4) != 0) {
+            (void)ipc_write_msg(fd, 'E', "Bad magic");
+            break;
+        }
+        if (!ipc_read_u8(fd, &cmd)) break;
+
+        if (cmd == 'Q') {
+            (void)ipc_write_msg(fd, 'O', "bye");
+            break;
+        }
+
+        if (cmd == 'U') {
+            // The model is shared; clients only detach from it.
+            (void)ipc_write_msg(fd, 'O', "unloaded");
+            continue;
+        }
+
+        if (cmd == 'L') {
+            uint32_t threads = 0;
+            uint32_t gpu_device = 0;
+            uint8_t use_gpu = 1;
+            char *path = read_str_field(fd);
+            if (!path || !ipc_read_u32(fd, &threads) || !ipc_read_u32(fd, &gpu_device) || !ipc_read_u8(fd, &use_gpu)) {
+                free(path);
+                break;
+            }
+            const bool ok = same_model_path(path, d->model_path);
+            free(path);
+            (void)ipc_write_msg(fd, ok ? 'O' : 'E', ok ? "loaded" : "Daemon serves a different model");
+            continue;
+        }
+
+        if (cmd == 'W') {
+            if (!daemon_stream_job(d, fd)) break;
+            continue;
+        }
+
+        if (cmd == 'T' || cmd == 'F') {
+            char *err = NULL;
+            DaemonJob *job = cmd == 'F' ? read_file_job(fd, &err) : read_pcm_job(fd, &err);
+            if (!job) {
+                if (err) (void)ipc_write_msg(fd, 'E', err);
+                free(err);
+                break;
+            }
+            if (!job->samples) {
+                (void)ipc_write_msg(fd, 'E', err ? err : "No audio");
+                free(err);
+                job_free(job);
+                continue;
+            }
+            free(err);
+            if (daemon_submit(d, job)) daemon_wait(d, job);
+            job_free(job);
+            continue;
+        }
+
+        (void)ipc_write_msg(fd, 'E', "Unknown command");
+        break;
+    }
+
+    // Unlisted first: daemon_run may shut down the fds of listed clients.
+    pthread_mutex_lock(&d->mutex);
+    DaemonClient **link = &d->clients;
+    while (*link != c) link = &(*link)->next;
+    *link = c->next;
+    d->n_clients--;
+    pthread_cond_broadcast(&d->clients_cond);
+    pthread_mutex_unlock(&d->mutex);
+    close(fd);
+    free(c);
+    return NULL;
+}
+
+static void on_stop_signal(int sig) {
+    (void)sig;
+    daemon_stop_signal = 1;
+}
+
+static int daemon_listen(const char *path) {
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return -1;
+
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+
+    // Refuse to steal the socket from a live daemon; clear a stale one.
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+        fprintf(stderr, "daemon: another instance is already listening on %s\n", path);
+        close(fd);
+        return -1;
+    }
+    unlink(path);
+
+    const mode_t old_mask = umask(0077);
+    const int rc = bind(fd, (struct sockaddr *)&addr, sizeof(addr));
+    umask(old_mask);
+    if (rc != 0 || listen(fd, 16) != 0) {
+        fprintf(stderr, "daemon: cannot listen on %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static void print_usage(void) {
+    fprintf(stderr, "Usage: auriscribe --daemon [--model PATH] [--socket PATH]\n");
+}
+
+int daemon_run(int argc, char **argv) {
+    const char *model_arg = NULL;
+    const char *socket_arg = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "--daemon") == 0) continue;
+        if (strcmp(argv[i], "--model") == 0 && i + 1 < argc) model_arg = argv[++i];
+        else if (strcmp(argv[i], "--socket") == 0 && i + 1 < argc) socket_arg = argv[++i];
+        else {
+            print_usage();
+            return 2;
+        }
+    }
+
+    Config *cfg = config_load();
+    Daemon d;
+    memset(&d, 0, sizeof(d));
+    d.model_path = strdup(model_arg ? model_arg : (cfg->model_path ? cfg->model_path : ""));
+    config_free(cfg);
+
+    if (!*d.model_path) {
+        fprintf(stderr, "daemon: no model selected (pass --model or pick one in Settings)\n");
+        free(d.model_path);
+        return 1;
+    }
+
+    char sock_path[108];
+    if (socket_arg) {
+        snprintf(sock_path, sizeof(sock_path), "%s", socket_arg);
+    } else if (!daemon_socket_path(sock_path, sizeof(sock_path))) {
+        fprintf(stderr, "daemon: cannot resolve socket path (set XDG_RUNTIME_DIR or pass --socket)\n");
+        free(d.model_path);
+        return 1;
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_stop_signal;
+    sigemptyset(&sa.sa_mask);
+    sigaction(SIGINT, &sa, NULL); // no SA_RESTART: accept() must return EINTR
+    sigaction(SIGTERM, &sa, NULL);
+
+    // A daemon keeps its worker long enough for the thread tuning to finish;
+    // the result is kept for the app's workers too. AURISCRIBE_TUNE=0 opts out.
+    setenv("AURISCRIBE_TUNE", "1", 0);
+
+    pthread_mutex_init(&d.load_mutex, NULL);
+    d.transcriber = transcriber_new();
+    transcriber_set_use_daemon(d.transcriber, false);
+    if (!transcriber_load(d.transcriber, ENGINE_WHISPER, d.model_path)) {
+        fprintf(stderr, "daemon: failed to load model: %s\n", d.model_path);
+        transcriber_free(d.transcriber);
+        free(d.model_path);
+        return 1;
+    }
+
+    const int listen_fd = daemon_listen(sock_path);
+    if (listen_fd < 0) {
+        transcriber_free(d.transcriber);
+        free(d.model_path);
+        return 1;
+    }
+
+    pthread_mutex_init(&d.mutex, NULL);
+    pthread_cond_init(&d.queue_cond, NULL);
+    pthread_cond_init(&d.done_cond, NULL);
+    pthread_cond_init(&d.input_cond, NULL);
+    pthread_cond_init(&d.clients_cond, NULL);
+
+    const int n_lanes = daemon_lane_count() + 1;
+    pthread_t lanes[DAEMON_MAX_LANES + 1];
+    DaemonLane lane_args[DAEMON_MAX_LANES + 1];
+    for (int i = 0; i < n_lanes; i++) {
+        lane_args[i].daemon = &d;
+        lane_args[i].interactive_only = i == n_lanes - 1;
+        pthread_create(&lanes[i], NULL, daemon_transcribe_thread, &lane_args[i]);
+    }
+
+    printf("Auriscribe daemon listening on %s (model: %s)\n", sock_path, d.model_path);
+    fflush(stdout);
+
+    while (!daemon_stop_signal) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "daemon: accept failed: %s\n", strerror(errno));
+            break;
+        }
+        // Keep client sockets out of worker processes spawned on reload.
+        (void)fcntl(fd, F_SETFD, FD_CLOEXEC);
+        if (!daemon_peer_is_self(fd)) {
+            fprintf(stderr, "daemon: refused a client of another user\n");
+            close(fd);
+            continue;
+        }
+        DaemonClient *c = calloc(1, sizeof(*c));
+        pthread_t th;
+        if (!c) {
+            close(fd);
+            continue;
+        }
+        c->daemon = &d;
+        c->fd = fd;
+        pthread_mutex_lock(&d.mutex);
+        c->next = d.clients;
+        d.clients = c;
+        d.n_clients++;
+        pthread_mutex_unlock(&d.mutex);
+        if (pthread_create(&th, NULL, daemon_client_thread, c) != 0) {
+            pthread_mutex_lock(&d.mutex);
+            d.clients = c->next;
+            d.n_clients--;
+            pthread_mutex_unlock(&d.mutex);
+            close(fd);
+            free(c);
+            continue;
+        }
+        pthread_detach(th);
+    }
+
+    close(listen_fd);
+    unlink(sock_path);
+
+    // Let the jobs in flight finish, then stop; a 'W' job still waiting for
+    // audio is refused. Queued clients see EOF on exit.
+    pthread_mutex_lock(&d.mutex);
+    d.stopping = true;
+    while (d.head) {
+        DaemonJob *job = d.head;
+        d.head = job->next;
+        (void)ipc_write_msg(job->fd, 'E', "Daemon shutting down");
+        job->done = true;
+    }
+    d.tail = NULL;
+    pthread_cond_broadcast(&d.queue_cond);
+    pthread_cond_broadcast(&d.done_cond);
+    pthread_cond_broadcast(&d.input_cond);
+    pthread_mutex_unlock(&d.mutex);
+    for (int i = 0; i < n_lanes; i++) {
+        pthread_join(lanes[i], NULL);
+    }
+
+    // Wake the clients still reading their socket and wait for them to go.
+    pthread_mutex_lock(&d.mutex);
+    for (DaemonClient *c = d.clients; c; c = c->next) {
+        shutdown(c->fd, SHUT_RDWR);
+    }
+    while (d.n_clients > 0) {
+        pthread_cond_wait(&d.clients_cond, &d.mutex);
+    }
+    pthread_mutex_unlock(&d.mutex);
+
+    transcriber_free(d.transcriber);
+    free(d.model_path);
+    return 0;
+}
@@ -0,0 +1,21 @@
+#ifndef DAEMON_H
+#define DAEMON_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+// Headless mode: keep one model resident and serve transcription requests
+// over a Unix domain socket (see README "Daemon mode" for the protocol).
+// Returns a process exit status.
+int daemon_run(int argc, char **argv);
+
+// Resolve the daemon socket path ($AURISCRIBE_DAEMON_SOCKET, else
+// $XDG_RUNTIME_DIR/auriscribe.sock). False when neither is set: there is no
+// fallback in a shared directory such as /tmp.
+bool daemon_socket_path(char *out, size_t out_len);
+
+// Whether the process at the other end of a connected Unix socket runs as
+// this user. Audio and transcripts only go to (and come from) such peers.
+bool daemon_peer_is_self(int fd);
+
+#endif
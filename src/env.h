@@ -0,0 +1,8 @@
+#ifndef ENV_H
+#define ENV_H
+
+// Environment override: the AURISCRIBE_* variable, else its legacy
+// XFCE_WHISPER_* name (either may be NULL); NULL when unset or empty.
+const char *env_get(const char *preferred, const char *legacy);
+
+#endif
@@ -0,0 +1,80 @@
+#include "ipc.h"
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+bool ipc_read_exact(int fd, void *buf, size_t n) {
+    uint8_t *p = (uint8_t *)buf;
+    size_t off = 0;
+    while (off < n) {
+        ssize_t r = read(fd, p + off, n - off);
+        if (r == 0) return false;
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        off += (size_t)r;
+    }
+    return true;
+}
+
+bool ipc_write_exact(int fd, const void *buf, size_t n) {
+    const uint8_t *p = (const uint8_t *)buf;
+    size_t off = 0;
+    while (off < n) {
+        ssize_t w = write(fd, p + off, n - off);
+        if (w < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+        off += (size_t)w;
+    }
+    return true;
+}
+
+bool ipc_read_u32(int fd, uint32_t *out) {
+    uint8_t b[4];
+    if (!ipc_read_exact(fd, b, sizeof(b))) return false;
+    *out = (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
+    return true;
+}
+
+bool ipc_write_u32(int fd, uint32_t v) {
+    uint8_t b[4] = {
+        (uint8_t)(v & 0xff),
+        (uint8_t)((v >> 8) & 0xff),
+        (uint8_t)((v >> 16) & 0xff),
+        (uint8_t)((v >> 24) & 0xff),
+    };
+    return ipc_write_exact(fd, b, sizeof(b));
+}
+
+bool ipc_read_u8(int fd, uint8_t *out) {
+    return ipc_read_exact(fd, out, 1);
+}
+
+bool ipc_write_u8(int fd, uint8_t v) {
+    return ipc_write_exact(fd, &v, 1);
+}
+
+bool ipc_write_msg(int fd, char type, const char *s) {
+    const char magic[4] = { 'A', 'U', 'R', '1' };
+    if (!ipc_write_exact(fd, magic, 4)) return false;
+    if (!ipc_write_u8(fd, (uint8_t)type)) return false;
+    const uint32_t n = s ? (uint32_t)strlen(s) : 0;
+    if (!ipc_write_u32(fd, n)) return false;
+    if (n && !ipc_write_exact(fd, s, n)) return false;
+    return true;
+}
+
+char *ipc_read_str(int fd, uint32_t n) {
+    char *s = calloc(1, (size_t)n + 1);
+    if (!s) return NULL;
+    if (n && !ipc_read_exact(fd, s, n)) {
+        free(s);
+        return NULL;
+    }
+    s[n] = '\0';
+    return s;
+}
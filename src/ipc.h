@@ -0,0 +1,25 @@
+#ifndef IPC_H
+#define IPC_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+// Framing of the worker protocol, spoken between the app and its worker and
+// between daemon clients and the daemon: integers are little-endian, requests
+// start with "AURI" and a command byte, replies are "AUR1", a type byte, a u32
+// length and the payload. All of these retry on EINTR and fail on EOF.
+bool ipc_read_exact(int fd, void *buf, size_t n);
+bool ipc_write_exact(int fd, const void *buf, size_t n);
+bool ipc_read_u32(int fd, uint32_t *out);
+bool ipc_write_u32(int fd, uint32_t v);
+bool ipc_read_u8(int fd, uint8_t *out);
+bool ipc_write_u8(int fd, uint8_t v);
+
+// Reply frame with a NUL-terminated payload (NULL for an empty one).
+bool ipc_write_msg(int fd, char type, const char *s);
+
+// n bytes as an allocated NUL-terminated string, NULL on failure.
+char *ipc_read_str(int fd, uint32_t n);
+
+#endif
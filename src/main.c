@@ -1,6 +1,7 @@
 #include <gtk/gtk.h>
 #include <libayatana-appindicator/app-indicator.h>
 #include "app.h"
+#include "daemon.h"
 #include <X11/Xlib.h>
 #include <string.h>
 
@@ -133,6 +134,11 @@ static void on_shutdown(GtkApplication *gtk_app, gpointer data) {
 }
 
 int main(int argc, char *argv[]) {
+    // Headless mode: no GTK/X11, just the shared model behind a socket.
+    if (argc >= 2 && strcmp(argv[1], "--daemon") == 0) {
+        return daemon_run(argc, argv);
+    }
+
     // Must be called before any other Xlib call in the process.
     // This makes global hotkey handling reliable when GTK/GDK is also using X11.
     XInitThreads();
@@ -1,139 +1,114 @@
 #include "transcribe.h"
+#include "env.h"
+#include "daemon.h"
+#include "ipc.h"
 #include <errno.h>
+#include <pthread.h>
 #include <signal.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/un.h>
 #include <sys/wait.h>
 #include <unistd.h>
 
-static const char *env_get(const char *preferred, const char *legacy) {
-    const char *v = preferred ? getenv(preferred) : NULL;
-    if (v && *v) return v;
-    v = legacy ? getenv(legacy) : NULL;
-    if (v && *v) return v;
-    return NULL;
-}
-
-static int transcriber_default_threads(void) {
-    long n = sysconf(_SC_NPROCESSORS_ONLN);
-    if (n < 1) n = 1;
-    if (n > 8) n = 8;
-    return (int)n;
-}
-
+// 0 leaves the thread count to the worker, which tunes it per model.
 static int transcriber_threads(void) {
     const char *env = env_get("AURISCRIBE_THREADS", "XFCE_WHISPER_THREADS");
-    if (!env || !*env) return transcriber_default_threads();
+    if (!env || !*env) return 0;
     int n = atoi(env);
     if (n < 1) n = 1;
     if (n > 64) n = 64;
     return n;
 }
 
-static bool read_exact(int fd, void *buf, size_t n) {
-    uint8_t *p = (uint8_t *)buf;
-    size_t off = 0;
-    while (off < n) {
-        ssize_t r = read(fd, p + off, n - off);
-        if (r == 0) return false;
-        if (r < 0) {
-            if (errno == EINTR) continue;
-            return false;
-        }
-        off += (size_t)r;
-    }
-    return true;
-}
-
-static bool write_exact(int fd, const void *buf, size_t n) {
-    const uint8_t *p = (const uint8_t *)buf;
-    size_t off = 0;
-    while (off < n) {
-        ssize_t w = write(fd, p + off, n - off);
-        if (w < 0) {
-            if (errno == EINTR) continue;
-            return false;
-        }
-        off += (size_t)w;
-    }
-    return true;
-}
-
-static bool write_u32(int fd, uint32_t v) {
-    uint8_t b[4] = {
-        (uint8_t)(v & 0xff),
-        (uint8_t)((v >> 8) & 0xff),
-        (uint8_t)((v >> 16) & 0xff),
-        (uint8_t)((v >> 24) & 0xff),
-    };
-    return write_exact(fd, b, sizeof(b));
-}
-
-static bool read_u32(int fd, uint32_t *out) {
-    uint8_t b[4];
-    if (!read_exact(fd, b, sizeof(b))) return false;
-    *out = (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
-    return true;
-}
-
-static bool write_u8(int fd, uint8_t v) {
-    return write_exact(fd, &v, 1);
-}
-
-static bool read_u8(int fd, uint8_t *out) {
-    return read_exact(fd, out, 1);
-}
-
-static bool read_msg(int fd, char *type_out, char **payload_out) {
+static bool read_msg_n(int fd, char *type_out, char **payload_out, uint32_t *len_out) {
     *payload_out = NULL;
     char magic[4];
-    if (!read_exact(fd, magic, 4)) return false;
+    if (!ipc_read_exact(fd, magic, 4)) return false;
     if (memcmp(magic, "AUR1", 4) != 0) return false;
     uint8_t t = 0;
-    if (!read_u8(fd, &t)) return false;
+    if (!ipc_read_u8(fd, &t)) return false;
     uint32_t n = 0;
-    if (!read_u32(fd, &n)) return false;
+    if (!ipc_read_u32(fd, &n)) return false;
     char *s = calloc(1, (size_t)n + 1);
     if (!s) return false;
-    if (n && !read_exact(fd, s, n)) {
+    if (n && !ipc_read_exact(fd, s, n)) {
         free(s);
         return false;
     }
     s[n] = '\0';
     *type_out = (char)t;
     *payload_out = s;
+    if (len_out) *len_out = n;
     return true;
 }
 
+static bool read_msg(int fd, char *type_out, char **payload_out) {
+    return read_msg_n(fd, type_out, payload_out, NULL);
+}
+
 static bool send_magic_cmd(int fd, char cmd) {
     const char magic[4] = { 'A', 'U', 'R', 'I' };
-    if (!write_exact(fd, magic, 4)) return false;
-    return write_u8(fd, (uint8_t)cmd);
+    if (!ipc_write_exact(fd, magic, 4)) return false;
+    return ipc_write_u8(fd, (uint8_t)cmd);
 }
 
+typedef struct TranscriberReply {
+    uint32_t id;
+    char type;
+    char *text;
+    struct TranscriberReply *next;
+} TranscriberReply;
+
 struct Transcriber {
     EngineType type;
     pid_t worker_pid;
     int to_worker_fd;
     int from_worker_fd;
     int err_fd;
+    int control_fd; // out-of-band cancel channel to an own worker
     bool loaded;
     bool loading;
     bool load_failed;
+    bool use_daemon;
+    bool remote; // attached to a shared daemon instead of an own worker
+
+    // Request/reply routing; transcriber_process_ex may be called from several threads.
+    pthread_mutex_t io_mutex;
+    pthread_cond_t reply_cond;
+    uint32_t next_id;
+    uint64_t io_generation; // bumped whenever the worker connection goes away
+    bool reader_active;
+    TranscriberReply *replies;
 };
 
+static void transcriber_drop_replies(Transcriber *t) {
+    while (t->replies) {
+        TranscriberReply *r = t->replies;
+        t->replies = r->next;
+        free(r->text);
+        free(r);
+    }
+    t->io_generation++;
+    pthread_cond_broadcast(&t->reply_cond);
+}
+
 static void transcriber_kill_worker(Transcriber *t) {
     if (!t) return;
+    transcriber_drop_replies(t);
     if (t->to_worker_fd != -1) close(t->to_worker_fd);
     if (t->from_worker_fd != -1) close(t->from_worker_fd);
     if (t->err_fd != -1) close(t->err_fd);
+    if (t->control_fd != -1) close(t->control_fd);
     t->to_worker_fd = -1;
     t->from_worker_fd = -1;
     t->err_fd = -1;
+    t->control_fd = -1;
 
     if (t->worker_pid > 0) {
         // Try graceful.
@@ -148,16 +123,82 @@ static void transcriber_kill_worker(Transcriber *t) {
         (void)waitpid(t->worker_pid, NULL, 0);
         t->worker_pid = 0;
     }
+    t->remote = false;
     t->loaded = false;
     t->loading = false;
     t->load_failed = false;
     t->type = ENGINE_NONE;
 }
 
+static bool send_load_cmd(Transcriber *t, const char *model_path) {
+    const bool no_gpu = env_get("AURISCRIBE_NO_GPU", "XFCE_WHISPER_NO_GPU") != NULL;
+    const char *gpu_device_s = env_get("AURISCRIBE_GPU_DEVICE", "XFCE_WHISPER_GPU_DEVICE");
+    uint32_t gpu_device = 0;
+    if (gpu_device_s && *gpu_device_s) gpu_device = (uint32_t)atoi(gpu_device_s);
+
+    if (!send_magic_cmd(t->to_worker_fd, 'L')) return false;
+    const uint32_t path_len = (uint32_t)strlen(model_path);
+    return ipc_write_u32(t->to_worker_fd, path_len) &&
+           ipc_write_exact(t->to_worker_fd, model_path, path_len) &&
+           ipc_write_u32(t->to_worker_fd, (uint32_t)transcriber_threads()) &&
+           ipc_write_u32(t->to_worker_fd, gpu_device) &&
+           ipc_write_u8(t->to_worker_fd, no_gpu ? 0 : 1);
+}
+
+// Attach to a running daemon that already has `model_path` resident. The
+// daemon speaks the worker protocol, so the rest of Transcriber is unchanged.
+static bool transcriber_connect_daemon(Transcriber *t, const char *model_path) {
+    if (!t->use_daemon) return false;
+
+    char path[108];
+    if (!daemon_socket_path(path, sizeof(path))) return false;
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd < 0) return false;
+    struct sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", path);
+    if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+        close(fd);
+        return false;
+    }
+    // Whoever listens gets the dictation audio and its text gets pasted.
+    if (!daemon_peer_is_self(fd)) {
+        fprintf(stderr, "Daemon socket %s belongs to another user; not attaching\n", path);
+        close(fd);
+        return false;
+    }
+
+    // A daemon that exits mid-request must not take the app down with it.
+    signal(SIGPIPE, SIG_IGN);
+
+    t->to_worker_fd = fd;
+    t->from_worker_fd = dup(fd);
+    t->err_fd = -1;
+    t->remote = true;
+
+    char resp_type = 0;
+    char *payload = NULL;
+    if (t->from_worker_fd < 0 || !send_load_cmd(t, model_path) ||
+        !read_msg(t->from_worker_fd, &resp_type, &payload) || resp_type != 'O') {
+        if (payload) fprintf(stderr, "Daemon not usable: %s\n", payload);
+        free(payload);
+        transcriber_kill_worker(t);
+        return false;
+    }
+    free(payload);
+    return true;
+}
+
+// The worker reads cancel requests from this descriptor (see transcriber_cancel).
+#define WORKER_CONTROL_FD 3
+
 static bool transcriber_start_worker(Transcriber *t) {
     int to_child[2] = {-1, -1};
     int from_child[2] = {-1, -1};
     int err_child[2] = {-1, -1};
+    int control[2] = {-1, -1};
     if (pipe(to_child) != 0) return false;
     if (pipe(from_child) != 0) {
         close(to_child[0]); close(to_child[1]);
@@ -168,6 +209,12 @@ static bool transcriber_start_worker(Transcriber *t) {
         close(from_child[0]); close(from_child[1]);
         return false;
     }
+    if (pipe(control) != 0) {
+        close(to_child[0]); close(to_child[1]);
+        close(from_child[0]); close(from_child[1]);
+        close(err_child[0]); close(err_child[1]);
+        return false;
+    }
 
     pid_t pid = fork();
     if (pid == 0) {
@@ -177,10 +224,17 @@ static bool transcriber_start_worker(Transcriber *t) {
         close(to_child[0]); close(to_child[1]);
         close(from_child[0]); close(from_child[1]);
         close(err_child[0]); close(err_child[1]);
+        if (control[1] != WORKER_CONTROL_FD) close(control[1]);
+        if (control[0] != WORKER_CONTROL_FD) {
+            dup2(control[0], WORKER_CONTROL_FD);
+            close(control[0]);
+        }
 
         // Dev (run from build dir) + installed (in PATH).
-        execl("./auriscribe-worker", "auriscribe-worker", NULL);
-        execlp("auriscribe-worker", "auriscribe-worker", NULL);
+        char control_fd[16];
+        snprintf(control_fd, sizeof(control_fd), "%d", WORKER_CONTROL_FD);
+        execl("./auriscribe-worker", "auriscribe-worker", "--control-fd", control_fd, NULL);
+        execlp("auriscribe-worker", "auriscribe-worker", "--control-fd", control_fd, NULL);
         _exit(127);
     }
 
@@ -188,17 +242,20 @@ static bool transcriber_start_worker(Transcriber *t) {
         close(to_child[0]); close(to_child[1]);
         close(from_child[0]); close(from_child[1]);
         close(err_child[0]); close(err_child[1]);
+        close(control[0]); close(control[1]);
         return false;
     }
 
     close(to_child[0]);
     close(from_child[1]);
     close(err_child[1]);
+    close(control[0]);
 
     t->worker_pid = pid;
     t->to_worker_fd = to_child[1];
     t->from_worker_fd = from_child[0];
     t->err_fd = err_child[0];
+    t->control_fd = control[1];
     (void)fcntl(t->err_fd, F_SETFL, fcntl(t->err_fd, F_GETFL, 0) | O_NONBLOCK);
     return true;
 }
@@ -251,38 +308,39 @@ Transcriber *transcriber_new(void) {
     t->to_worker_fd = -1;
     t->from_worker_fd = -1;
     t->err_fd = -1;
+    t->control_fd = -1;
     t->loaded = false;
     t->loading = false;
     t->load_failed = false;
+    t->use_daemon = true;
+    t->remote = false;
+    pthread_mutex_init(&t->io_mutex, NULL);
+    pthread_cond_init(&t->reply_cond, NULL);
     return t;
 }
 
+void transcriber_set_use_daemon(Transcriber *t, bool use_daemon) {
+    if (t) t->use_daemon = use_daemon;
+}
+
 bool transcriber_load(Transcriber *t, EngineType type, const char *model_path) {
     transcriber_unload(t);
     if (!t || type != ENGINE_WHISPER) return false;
     if (!model_path || !*model_path) return false;
 
+    if (transcriber_connect_daemon(t, model_path)) {
+        t->type = ENGINE_WHISPER;
+        t->loaded = true;
+        return true;
+    }
+
     if (!transcriber_start_worker(t)) {
         fprintf(stderr, "Failed to start auriscribe-worker\n");
         transcriber_kill_worker(t);
         return false;
     }
 
-    const bool no_gpu = env_get("AURISCRIBE_NO_GPU", "XFCE_WHISPER_NO_GPU") != NULL;
-    const char *gpu_device_s = env_get("AURISCRIBE_GPU_DEVICE", "XFCE_WHISPER_GPU_DEVICE");
-    uint32_t gpu_device = 0;
-    if (gpu_device_s && *gpu_device_s) gpu_device = (uint32_t)atoi(gpu_device_s);
-
-    if (!send_magic_cmd(t->to_worker_fd, 'L')) {
-        transcriber_kill_worker(t);
-        return false;
-    }
-    const uint32_t path_len = (uint32_t)strlen(model_path);
-    if (!write_u32(t->to_worker_fd, path_len) ||
-        !write_exact(t->to_worker_fd, model_path, path_len) ||
-        !write_u32(t->to_worker_fd, (uint32_t)transcriber_threads()) ||
-        !write_u32(t->to_worker_fd, gpu_device) ||
-        !write_u8(t->to_worker_fd, no_gpu ? 0 : 1)) {
+    if (!send_load_cmd(t, model_path)) {
         transcriber_kill_worker(t);
         return false;
     }
@@ -312,27 +370,19 @@ bool transcriber_load_async(Transcriber *t, EngineType type, const char *model_p
     if (!t || type != ENGINE_WHISPER) return false;
     if (!model_path || !*model_path) return false;
 
+    if (transcriber_connect_daemon(t, model_path)) {
+        t->type = ENGINE_WHISPER;
+        t->loaded = true;
+        return true;
+    }
+
     if (!transcriber_start_worker(t)) {
         fprintf(stderr, "Failed to start auriscribe-worker\n");
         transcriber_kill_worker(t);
         return false;
     }
 
-    const bool no_gpu = env_get("AURISCRIBE_NO_GPU", "XFCE_WHISPER_NO_GPU") != NULL;
-    const char *gpu_device_s = env_get("AURISCRIBE_GPU_DEVICE", "XFCE_WHISPER_GPU_DEVICE");
-    uint32_t gpu_device = 0;
-    if (gpu_device_s && *gpu_device_s) gpu_device = (uint32_t)atoi(gpu_device_s);
-
-    if (!send_magic_cmd(t->to_worker_fd, 'L')) {
-        transcriber_kill_worker(t);
-        return false;
-    }
-    const uint32_t path_len = (uint32_t)strlen(model_path);
-    if (!write_u32(t->to_worker_fd, path_len) ||
-        !write_exact(t->to_worker_fd, model_path, path_len) ||
-        !write_u32(t->to_worker_fd, (uint32_t)transcriber_threads()) ||
-        !write_u32(t->to_worker_fd, gpu_device) ||
-        !write_u8(t->to_worker_fd, no_gpu ? 0 : 1)) {
+    if (!send_load_cmd(t, model_path)) {
         transcriber_kill_worker(t);
         return false;
     }
@@ -347,7 +397,7 @@ bool transcriber_load_async(Transcriber *t, EngineType type, const char *model_p
 void transcriber_unload(Transcriber *t) {
     if (!t) return;
 
-    if (t->worker_pid <= 0) {
+    if (t->worker_pid <= 0 && !t->remote) {
         t->loaded = false;
         t->loading = false;
         t->load_failed = false;
@@ -355,6 +405,8 @@ void transcriber_unload(Transcriber *t) {
         return;
     }
 
+    // Don't make the worker finish requests nobody will read.
+    transcriber_cancel(t);
     (void)send_magic_cmd(t->to_worker_fd, 'Q');
     char resp_type = 0;
     char *payload = NULL;
@@ -362,28 +414,54 @@ void transcriber_unload(Transcriber *t) {
     free(payload);
 
     // Close pipes; reap child.
+    transcriber_drop_replies(t);
     if (t->to_worker_fd != -1) close(t->to_worker_fd);
     if (t->from_worker_fd != -1) close(t->from_worker_fd);
     if (t->err_fd != -1) close(t->err_fd);
+    if (t->control_fd != -1) close(t->control_fd);
     t->to_worker_fd = -1;
     t->from_worker_fd = -1;
     t->err_fd = -1;
-    (void)waitpid(t->worker_pid, NULL, 0);
+    t->control_fd = -1;
+    if (t->worker_pid > 0) (void)waitpid(t->worker_pid, NULL, 0);
     t->worker_pid = 0;
+    t->remote = false;
     t->loaded = false;
     t->loading = false;
     t->load_failed = false;
     t->type = ENGINE_NONE;
 }
 
+void transcriber_cancel(Transcriber *t) {
+    if (!t) return;
+
+    pthread_mutex_lock(&t->io_mutex);
+    const int fd = t->control_fd;
+    const uint32_t id = t->next_id;
+    pthread_mutex_unlock(&t->io_mutex);
+    if (fd < 0) return;
+
+    // One write, so it can't interleave with another cancel.
+    const uint8_t msg[5] = {
+        'C',
+        (uint8_t)(id & 0xff),
+        (uint8_t)((id >> 8) & 0xff),
+        (uint8_t)((id >> 16) & 0xff),
+        (uint8_t)((id >> 24) & 0xff),
+    };
+    (void)ipc_write_exact(fd, msg, sizeof(msg));
+}
+
 void transcriber_free(Transcriber *t) {
     if (!t) return;
     transcriber_kill_worker(t);
+    pthread_cond_destroy(&t->reply_cond);
+    pthread_mutex_destroy(&t->io_mutex);
     free(t);
 }
 
 bool transcriber_is_loaded(Transcriber *t) {
-    return t && t->loaded && t->worker_pid > 0;
+    return t && t->loaded && (t->worker_pid > 0 || t->remote);
 }
 
 bool transcriber_is_loading(Transcriber *t) {
@@ -391,7 +469,7 @@ bool transcriber_is_loading(Transcriber *t) {
 }
 
 bool transcriber_is_active(Transcriber *t) {
-    return t && t->worker_pid > 0;
+    return t && (t->worker_pid > 0 || t->remote);
 }
 
 EngineType transcriber_get_type(Transcriber *t) {
@@ -400,16 +478,67 @@ EngineType transcriber_get_type(Transcriber *t) {
 
 char *transcriber_process(Transcriber *t, const float *samples, size_t count,
                           const char *language, bool translate) {
-    return transcriber_process_ex(t, samples, count, language, translate, NULL, NULL);
+    return transcriber_process_ex(t, samples, count, language, translate, NULL,
+                                  TRANSCRIBE_PRIORITY_INTERACTIVE, false, NULL);
 }
 
-char *transcriber_process_ex(Transcriber *t, const float *samples, size_t count,
-                             const char *language, bool translate,
-                             const char *initial_prompt,
-                             char **error_out) {
-    if (error_out) *error_out = NULL;
-    if (!t) return NULL;
+// Wait for the numbered reply `id`. Caller holds io_mutex. Whichever waiting
+// thread finds no reader active becomes the reader and files every reply it
+// sees by id, so concurrent requests can complete out of order.
+static bool transcriber_wait_reply(Transcriber *t, uint32_t id, uint64_t generation,
+                                   char *type_out, char **text_out) {
+    for (;;) {
+        if (t->io_generation != generation) return false;
+
+        for (TranscriberReply **pp = &t->replies; *pp; pp = &(*pp)->next) {
+            TranscriberReply *r = *pp;
+            if (r->id != id) continue;
+            *pp = r->next;
+            *type_out = r->type;
+            *text_out = r->text;
+            free(r);
+            return true;
+        }
 
+        if (t->reader_active) {
+            pthread_cond_wait(&t->reply_cond, &t->io_mutex);
+            continue;
+        }
+
+        t->reader_active = true;
+        const int fd = t->from_worker_fd;
+        pthread_mutex_unlock(&t->io_mutex);
+        char msg_type = 0;
+        char *payload = NULL;
+        uint32_t len = 0;
+        const bool ok = read_msg_n(fd, &msg_type, &payload, &len);
+        pthread_mutex_lock(&t->io_mutex);
+        t->reader_active = false;
+
+        TranscriberReply *r = NULL;
+        if (ok && msg_type == 'N' && len >= 5) r = calloc(1, sizeof(*r));
+        if (!r) {
+            free(payload);
+            pthread_cond_broadcast(&t->reply_cond);
+            return false;
+        }
+        const uint8_t *p = (const uint8_t *)payload;
+        r->id = (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+        r->type = (char)p[4];
+        r->text = strdup(payload + 5);
+        free(payload);
+        r->next = t->replies;
+        t->replies = r;
+        pthread_cond_broadcast(&t->reply_cond);
+    }
+}
+
+static char *transcriber_process_locked(Transcriber *t, const float *samples, size_t count,
+                                        const char *language, bool translate,
+                                        const char *initial_prompt,
+                                        TranscribePriority priority,
+                                        bool continue_context,
+                                        char **error_out) {
     if (t->loading && !t->loaded) {
         char resp_type = 0;
         char *payload = NULL;
@@ -439,7 +568,17 @@ char *transcriber_process_ex(Transcriber *t, const float *samples, size_t count,
     if (!transcriber_is_loaded(t)) return NULL;
     if (t->type != ENGINE_WHISPER) return NULL;
 
-    if (!send_magic_cmd(t->to_worker_fd, 'T')) {
+    // A daemon connection is served one request at a time (the daemon ranks it
+    // as interactive); an own worker gets numbered requests with a priority so
+    // several threads can have one in flight.
+    const bool numbered = !t->remote;
+    const uint32_t id = ++t->next_id;
+    const uint64_t generation = t->io_generation;
+
+    if (!send_magic_cmd(t->to_worker_fd, numbered ? 'P' : 'T') ||
+        (numbered && !ipc_write_u32(t->to_worker_fd, id)) ||
+        (numbered && !ipc_write_u8(t->to_worker_fd, (priority == TRANSCRIBE_PRIORITY_BACKGROUND ? 1 : 0) |
+                                                (continue_context ? 0x80 : 0)))) {
         transcriber_kill_worker(t);
         if (error_out) *error_out = strdup("Worker communication error");
         return NULL;
@@ -451,14 +590,14 @@ char *transcriber_process_ex(Transcriber *t, const float *samples, size_t count,
     const char *prompt = initial_prompt ? initial_prompt : "";
     const uint32_t prompt_len = (uint32_t)strlen(prompt);
 
-    if (!write_u32(t->to_worker_fd, n_samples) ||
-        !write_u32(t->to_worker_fd, lang_len) ||
-        (lang_len && !write_exact(t->to_worker_fd, lang, lang_len)) ||
-        !write_u32(t->to_worker_fd, prompt_len) ||
-        (prompt_len && !write_exact(t->to_worker_fd, prompt, prompt_len)) ||
-        !write_u8(t->to_worker_fd, translate ? 1 : 0) ||
-        !write_u32(t->to_worker_fd, (uint32_t)transcriber_threads()) ||
-        (n_samples && !write_exact(t->to_worker_fd, samples, (size_t)n_samples * sizeof(float)))) {
+    if (!ipc_write_u32(t->to_worker_fd, n_samples) ||
+        !ipc_write_u32(t->to_worker_fd, lang_len) ||
+        (lang_len && !ipc_write_exact(t->to_worker_fd, lang, lang_len)) ||
+        !ipc_write_u32(t->to_worker_fd, prompt_len) ||
+        (prompt_len && !ipc_write_exact(t->to_worker_fd, prompt, prompt_len)) ||
+        !ipc_write_u8(t->to_worker_fd, translate ? 1 : 0) ||
+        !ipc_write_u32(t->to_worker_fd, (uint32_t)transcriber_threads()) ||
+        (n_samples && !ipc_write_exact(t->to_worker_fd, samples, (size_t)n_samples * sizeof(float)))) {
         transcriber_kill_worker(t);
         if (error_out) *error_out = strdup("Worker communication error");
         return NULL;
@@ -466,8 +605,11 @@ char *transcriber_process_ex(Transcriber *t, const float *samples, size_t count,
 
     char resp_type = 0;
     char *payload = NULL;
-    if (!read_msg(t->from_worker_fd, &resp_type, &payload)) {
-        transcriber_kill_worker(t);
+    const bool got = numbered
+        ? transcriber_wait_reply(t, id, generation, &resp_type, &payload)
+        : read_msg(t->from_worker_fd, &resp_type, &payload);
+    if (!got) {
+        if (t->io_generation == generation) transcriber_kill_worker(t);
         if (error_out) *error_out = strdup("Worker communication error");
         return NULL;
     }
@@ -476,6 +618,11 @@ char *transcriber_process_ex(Transcriber *t, const float *samples, size_t count,
         return payload; // already allocated
     }
 
+    if (resp_type == 'C') {
+        free(payload); // canceled by transcriber_cancel(): no text, no error
+        return NULL;
+    }
+
     if (error_out) {
         char *stderr_tail = read_worker_stderr_nonblocking(t->err_fd);
         if (stderr_tail && *stderr_tail) {
@@ -502,3 +649,19 @@ char *transcriber_process_ex(Transcriber *t, const float *samples, size_t count,
     free(payload);
     return NULL;
 }
+
+char *transcriber_process_ex(Transcriber *t, const float *samples, size_t count,
+                             const char *language, bool translate,
+                             const char *initial_prompt,
+                             TranscribePriority priority,
+                             bool continue_context,
+                             char **error_out) {
+    if (error_out) *error_out = NULL;
+    if (!t) return NULL;
+
+    pthread_mutex_lock(&t->io_mutex);
+    char *text = transcriber_process_locked(t, samples, count, language, translate, initial_prompt,
+                                            priority, continue_context, error_out);
+    pthread_mutex_unlock(&t->io_mutex);
+    return text;
+}
@@ -12,23 +12,44 @@ typedef enum {
 
 typedef struct Transcriber Transcriber;
 
+// Interactive requests (dictation) go ahead of background ones (batch jobs)
+// and can pause a running background request, which later resumes at the
+// start of the window it was interrupted in.
+typedef enum {
+    TRANSCRIBE_PRIORITY_INTERACTIVE,
+    TRANSCRIBE_PRIORITY_BACKGROUND
+} TranscribePriority;
+
 Transcriber *transcriber_new(void);
 bool transcriber_load(Transcriber *t, EngineType type, const char *model_path);
 bool transcriber_load_async(Transcriber *t, EngineType type, const char *model_path);
 void transcriber_unload(Transcriber *t);
 void transcriber_free(Transcriber *t);
 
+// When enabled (default), loading first tries to attach to a running
+// `auriscribe --daemon` serving the same model instead of spawning a worker.
+void transcriber_set_use_daemon(Transcriber *t, bool use_daemon);
+
+// Stop every request issued so far: transcriber_process_ex calls still in
+// flight return NULL without an error within one compute step, and the model
+// stays loaded. Safe to call from any thread. No-op when attached to a daemon.
+void transcriber_cancel(Transcriber *t);
+
 bool transcriber_is_loaded(Transcriber *t);
 bool transcriber_is_loading(Transcriber *t);
 bool transcriber_is_active(Transcriber *t);
 EngineType transcriber_get_type(Transcriber *t);
 
-// Returns allocated string, caller must free
+// Returns allocated string, caller must free. With continue_context the
+// request is decoded with the text of the previous interactive request as
+// context (the next chunk of one dictation); ignored when attached to a daemon.
 char *transcriber_process(Transcriber *t, const float *samples, size_t count,
                           const char *language, bool translate);
 char *transcriber_process_ex(Transcriber *t, const float *samples, size_t count,
                              const char *language, bool translate,
                              const char *initial_prompt,
+                             TranscribePriority priority,
+                             bool continue_context,
                              char **error_out);
 
 #endif
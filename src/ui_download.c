@@ -1,4 +1,5 @@
 #include "ui_download.h"
+#include "env.h"
 #include "config.h"
 #include <stdio.h>
 #include <stdlib.h>
@@ -24,14 +25,6 @@ typedef struct {
 //   https://huggingface.co/<repo>/resolve/main/ggml-<model>.bin
 #define DEFAULT_HF_REPO "ggerganov/whisper.cpp"
 
-static const char *env_get(const char *preferred, const char *legacy) {
-    const char *v = preferred ? getenv(preferred) : NULL;
-    if (v && *v) return v;
-    v = legacy ? getenv(legacy) : NULL;
-    if (v && *v) return v;
-    return NULL;
-}
-
 static const ModelInfo models[] = {
     // One-click presets (Hugging Face), aligned to whisper.cpp's models/download-ggml-model.sh list.
     // File name saved locally is the same as whisper.cpp expects: ggml-<model>.bin
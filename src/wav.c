@@ -0,0 +1,225 @@
+#include "wav.h"
+#include "audio.h"
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static uint16_t le16(const uint8_t *p) {
+    return (uint16_t)(p[0] | (p[1] << 8));
+}
+
+static uint32_t le32(const uint8_t *p) {
+    return (uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+static void set_error(char **error_out, const char *msg) {
+    if (error_out && !*error_out) *error_out = strdup(msg);
+}
+
+static float sample_at(const uint8_t *p, uint16_t format, uint16_t bits) {
+    if (format == 3) {
+        float f;
+        memcpy(&f, p, sizeof(f));
+        return f;
+    }
+    switch (bits) {
+        case 16: return (float)(int16_t)le16(p) / 32768.0f;
+        case 24: {
+            int32_t v = (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;
+            return (float)v / 8388608.0f;
+        }
+        case 32: return (float)(int32_t)le32(p) / 2147483648.0f;
+        default: return 0.0f;
+    }
+}
+
+// Band-limited resampling: every output sample is interpolated from the input
+// with a Hann-windowed sinc whose cutoff sits a little below the lower of the
+// two Nyquist frequencies, so downsampling does not fold what lies above 8 kHz
+// back into the speech band. The kernel is tabulated per 1/WAV_SINC_RES of a
+// zero crossing and interpolated linearly.
+#define WAV_SINC_ZEROS 16
+#define WAV_SINC_RES 256
+
+static float *resample(const float *in, size_t n_in, uint32_t rate, size_t n_out) {
+    const double step = (double)rate / (double)SAMPLE_RATE;
+    const double cutoff = (step > 1.0 ? 1.0 / step : 1.0) * 0.95; // of the input's Nyquist frequency
+    const double half = WAV_SINC_ZEROS / cutoff;                    // kernel half-width, input samples
+
+    const size_t n_table = WAV_SINC_ZEROS * WAV_SINC_RES + 2;
+    float *table = malloc(n_table * sizeof(float));
+    float *out = malloc(n_out * sizeof(float));
+    if (!table || !out) {
+        free(table);
+        free(out);
+        return NULL;
+    }
+    for (size_t k = 0; k < n_table; k++) {
+        const double z = (double)k / WAV_SINC_RES;
+        const double sinc = k == 0 ? 1.0 : sin(M_PI * z) / (M_PI * z);
+        const double window = z < WAV_SINC_ZEROS ? 0.5 * (1.0 + cos(M_PI * z / WAV_SINC_ZEROS)) : 0.0;
+        table[k] = (float)(sinc * window);
+    }
+
+    for (size_t i = 0; i < n_out; i++) {
+        const double pos = (double)i * step;
+        const double first = ceil(pos - half);
+        const size_t j0 = first > 0.0 ? (size_t)first : 0;
+        float acc = 0.0f;
+        float sum = 0.0f;
+        for (size_t j = j0; j < n_in && (double)j <= pos + half; j++) {
+            const double z = fabs(pos - (double)j) * cutoff * WAV_SINC_RES;
+            const size_t k = (size_t)z;
+            if (k + 1 >= n_table) continue;
+            const float w = table[k] + (table[k + 1] - table[k]) * (float)(z - (double)k);
+            acc += w * in[j];
+            sum += w;
+        }
+        // Dividing by the kernel's sum keeps the gain at 1, also at the edges.
+        out[i] = sum != 0.0f ? acc / sum : 0.0f;
+    }
+    free(table);
+    return out;
+}
+
+float *wav_load_mono16k(const char *path, size_t *count_out, char **error_out) {
+    if (count_out) *count_out = 0;
+    if (error_out) *error_out = NULL;
+    if (!path || !*path) {
+        set_error(error_out, "No file path given");
+        return NULL;
+    }
+
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        set_error(error_out, "Cannot open file");
+        return NULL;
+    }
+    long file_size = -1;
+    if (fseek(f, 0, SEEK_END) == 0) file_size = ftell(f);
+    if (file_size < 0 || fseek(f, 0, SEEK_SET) != 0) {
+        fclose(f);
+        set_error(error_out, "Cannot read file");
+        return NULL;
+    }
+
+    uint8_t hdr[12];
+    if (fread(hdr, 1, sizeof(hdr), f) != sizeof(hdr) ||
+        memcmp(hdr, "RIFF", 4) != 0 || memcmp(hdr + 8, "WAVE", 4) != 0) {
+        fclose(f);
+        set_error(error_out, "Not a WAV file");
+        return NULL;
+    }
+
+    uint16_t format = 0;
+    uint16_t channels = 0;
+    uint32_t rate = 0;
+    uint16_t bits = 0;
+    bool have_fmt = false;
+    uint8_t *data = NULL;
+    uint32_t data_len = 0;
+
+    for (;;) {
+        uint8_t ch[8];
+        if (fread(ch, 1, sizeof(ch), f) != sizeof(ch)) break;
+        const uint32_t len = le32(ch + 4);
+
+        if (memcmp(ch, "fmt ", 4) == 0 && len >= 16) {
+            uint8_t fmt[40] = {0};
+            const size_t want = len < sizeof(fmt) ? len : sizeof(fmt);
+            if (fread(fmt, 1, want, f) != want) break;
+            format = le16(fmt);
+            channels = le16(fmt + 2);
+            rate = le32(fmt + 4);
+            bits = le16(fmt + 14);
+            if (format == 0xFFFE && want >= 26) {
+                // WAVE_FORMAT_EXTENSIBLE: the subformat GUID starts with the real format tag.
+                format = le16(fmt + 24);
+            }
+            have_fmt = true;
+            if (len > want && fseek(f, (long)(len - want), SEEK_CUR) != 0) break;
+        } else if (memcmp(ch, "data", 4) == 0) {
+            // Streamed WAVs may carry a bogus length (0xFFFFFFFF); keep whatever
+            // is actually there, up to the end of the file.
+            const long pos = ftell(f);
+            const size_t left = pos >= 0 && pos < file_size ? (size_t)(file_size - pos) : 0;
+            const size_t want = len < left ? len : left;
+            data = malloc(want ? want : 1);
+            if (!data) {
+                fclose(f);
+                set_error(error_out, "Out of memory");
+                return NULL;
+            }
+            data_len = (uint32_t)fread(data, 1, want, f);
+            break;
+        } else if (fseek(f, (long)(len + (len & 1)), SEEK_CUR) != 0) {
+            break;
+        }
+    }
+    fclose(f);
+
+    if (!have_fmt || !data) {
+        free(data);
+        set_error(error_out, "Malformed WAV file");
+        return NULL;
+    }
+
+    const bool supported =
+        channels > 0 && rate > 0 &&
+        ((format == 1 && (bits == 16 || bits == 24 || bits == 32)) ||
+         (format == 3 && bits == 32));
+    if (!supported) {
+        free(data);
+        set_error(error_out, "Unsupported WAV encoding (need 16/24/32-bit PCM or 32-bit float)");
+        return NULL;
+    }
+
+    const size_t frame_bytes = (size_t)channels * (bits / 8);
+    const size_t n_in = data_len / frame_bytes;
+    if (n_in == 0) {
+        free(data);
+        set_error(error_out, "WAV file has no audio");
+        return NULL;
+    }
+
+    float *mono = malloc(n_in * sizeof(float));
+    if (!mono) {
+        free(data);
+        set_error(error_out, "Out of memory");
+        return NULL;
+    }
+    for (size_t i = 0; i < n_in; i++) {
+        const uint8_t *p = data + i * frame_bytes;
+        float acc = 0.0f;
+        for (uint16_t c = 0; c < channels; c++) {
+            acc += sample_at(p + (size_t)c * (bits / 8), format, bits);
+        }
+        mono[i] = acc / (float)channels;
+    }
+    free(data);
+
+    if (rate == SAMPLE_RATE) {
+        if (count_out) *count_out = n_in;
+        return mono;
+    }
+
+    const double step = (double)rate / (double)SAMPLE_RATE;
+    const size_t n_out = (size_t)((double)n_in / step);
+    if (n_out == 0) {
+        free(mono);
+        set_error(error_out, "WAV file has no audio");
+        return NULL;
+    }
+    float *out = resample(mono, n_in, rate, n_out);
+    free(mono);
+    if (!out) {
+        set_error(error_out, "Out of memory");
+        return NULL;
+    }
+
+    if (count_out) *count_out = n_out;
+    return out;
+}
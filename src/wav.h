@@ -0,0 +1,12 @@
+#ifndef WAV_H
+#define WAV_H
+
+#include <stddef.h>
+
+// Load a RIFF/WAVE file as mono float samples at SAMPLE_RATE (16 kHz).
+// Accepts 16/24/32-bit integer PCM and 32-bit float, any channel count
+// (downmixed) and any sample rate (resampled with an anti-aliasing filter).
+// Returns allocated buffer (caller must free) or NULL with *error_out set.
+float *wav_load_mono16k(const char *path, size_t *count_out, char **error_out);
+
+#endif
@@ -1,4 +1,6 @@
+#define _GNU_SOURCE // sched_getaffinity
 #include <errno.h>
+#include <sched.h>
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdio.h>
@@ -7,19 +9,17 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <dirent.h>
 #include <dlfcn.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include "env.h"
+#include "ipc.h"
 // whisper.cpp header (vendored)
 #include "whisper.h"
 #include "ggml-backend.h"
 
-static const char *env_get(const char *preferred, const char *legacy) {
-    const char *v = preferred ? getenv(preferred) : NULL;
-    if (v && *v) return v;
-    v = legacy ? getenv(legacy) : NULL;
-    if (v && *v) return v;
-    return NULL;
-}
-
 static uint64_t fnv1a64_update(uint64_t h, const void *data, size_t n) {
     const uint8_t *p = (const uint8_t *)data;
     for (size_t i = 0; i < n; i++) {
@@ -70,6 +70,27 @@ static char *cache_dir(void) {
     return NULL;
 }
 
+// $XDG_CACHE_HOME/auriscribe, created if missing; NULL when it cannot be.
+static char *app_cache_dir(void) {
+    char *base = cache_dir();
+    if (!base) return NULL;
+
+    size_t appdir_n = strlen(base) + strlen("/auriscribe") + 1;
+    char *appdir = malloc(appdir_n);
+    if (!appdir) {
+        free(base);
+        return NULL;
+    }
+    snprintf(appdir, appdir_n, "%s/auriscribe", base);
+    free(base);
+
+    if (!ensure_dir(appdir)) {
+        free(appdir);
+        return NULL;
+    }
+    return appdir;
+}
+
 static int warmup_vulkan(void) {
     if (env_get("AURISCRIBE_NO_GPU", "XFCE_WHISPER_NO_GPU")) {
         return 0;
@@ -88,23 +109,9 @@ static int warmup_vulkan(void) {
     uint64_t icd_hash = 1469598103934665603ULL;
     if (icd && *icd) icd_hash = fnv1a64_update(icd_hash, icd, strlen(icd));
 
-    char *base = cache_dir();
-    if (!base) {
-        fprintf(stderr, "vulkan-warmup: cannot resolve cache dir\n");
-        return 0;
-    }
-
-    size_t appdir_n = strlen(base) + strlen("/auriscribe") + 1;
-    char *appdir = malloc(appdir_n);
+    char *appdir = app_cache_dir();
     if (!appdir) {
-        free(base);
-        return 0;
-    }
-    snprintf(appdir, appdir_n, "%s/auriscribe", base);
-    free(base);
-
-    if (!ensure_dir(appdir)) {
-        free(appdir);
+        fprintf(stderr, "vulkan-warmup: cannot resolve cache dir\n");
         return 0;
     }
 
@@ -147,81 +154,6 @@ static int warmup_vulkan(void) {
     return 0;
 }
 
-static bool read_exact(int fd, void *buf, size_t n) {
-    uint8_t *p = (uint8_t *)buf;
-    size_t off = 0;
-    while (off < n) {
-        ssize_t r = read(fd, p + off, n - off);
-        if (r == 0) return false;
-        if (r < 0) {
-            if (errno == EINTR) continue;
-            return false;
-        }
-        off += (size_t)r;
-    }
-    return true;
-}
-
-static bool write_exact(int fd, const void *buf, size_t n) {
-    const uint8_t *p = (const uint8_t *)buf;
-    size_t off = 0;
-    while (off < n) {
-        ssize_t w = write(fd, p + off, n - off);
-        if (w < 0) {
-            if (errno == EINTR) continue;
-            return false;
-        }
-        off += (size_t)w;
-    }
-    return true;
-}
-
-static bool read_u32(int fd, uint32_t *out) {
-    uint8_t b[4];
-    if (!read_exact(fd, b, sizeof(b))) return false;
-    *out = (uint32_t)b[0] | ((uint32_t)b[1] << 8) | ((uint32_t)b[2] << 16) | ((uint32_t)b[3] << 24);
-    return true;
-}
-
-static bool write_u32(int fd, uint32_t v) {
-    uint8_t b[4] = {
-        (uint8_t)(v & 0xff),
-        (uint8_t)((v >> 8) & 0xff),
-        (uint8_t)((v >> 16) & 0xff),
-        (uint8_t)((v >> 24) & 0xff),
-    };
-    return write_exact(fd, b, sizeof(b));
-}
-
-static bool read_u8(int fd, uint8_t *out) {
-    return read_exact(fd, out, 1);
-}
-
-static bool write_u8(int fd, uint8_t v) {
-    return write_exact(fd, &v, 1);
-}
-
-static bool write_msg(int fd, char type, const char *s) {
-    const char magic[4] = { 'A', 'U', 'R', '1' };
-    if (!write_exact(fd, magic, 4)) return false;
-    if (!write_u8(fd, (uint8_t)type)) return false;
-    const uint32_t n = s ? (uint32_t)strlen(s) : 0;
-    if (!write_u32(fd, n)) return false;
-    if (n && !write_exact(fd, s, n)) return false;
-    return true;
-}
-
-static char *read_bytes_str(int fd, uint32_t n) {
-    char *s = calloc(1, (size_t)n + 1);
-    if (!s) return NULL;
-    if (n && !read_exact(fd, s, n)) {
-        free(s);
-        return NULL;
-    }
-    s[n] = '\0';
-    return s;
-}
-
 static char *trim_leading_space(char *s) {
     if (!s) return NULL;
     size_t i = 0;
@@ -231,40 +163,102 @@ static char *trim_leading_space(char *s) {
     return s;
 }
 
-static char *whisper_run(struct whisper_context *ctx, const float *samples, int n_samples,
-                         const char *language, bool translate, int n_threads,
-                         const char *initial_prompt) {
+typedef struct {
+    ggml_abort_callback fn;
+    void *data;
+    bool hit;
+} RunStop;
+
+static bool run_abort(void *user_data) {
+    RunStop *stop = user_data;
+    if (!stop->hit && stop->fn(stop->data)) stop->hit = true;
+    return stop->hit;
+}
+
+static bool run_encoder_begin(struct whisper_context *ctx, struct whisper_state *state, void *user_data) {
+    (void)ctx;
+    (void)state;
+    return !run_abort(user_data);
+}
+
+// Threads of the log mel spectrogram, the encoder and the decoder of a run.
+typedef struct {
+    int mel;
+    int encode;
+    int decode;
+} StageThreads;
+
+// Returns the untrimmed text of all segments, or NULL on failure. When
+// stop_fn is given it is polled inside the graphs and before every window;
+// once it returns true the run ends early, *stopped_out is set and the text
+// covers the windows before whisper_full_get_seek_from_state(). A text context
+// (the prompt cache's tokens, or what was saved at a preemption) replaces
+// initial_prompt. With a draft state, draft_ctx proposes draft_tokens tokens
+// per step (speculative decoding).
+static char *whisper_run(struct whisper_context *ctx, struct whisper_state *state,
+                         const float *samples, int n_samples,
+                         const char *language, bool translate, const StageThreads *threads,
+                         const char *initial_prompt, int offset_ms,
+                         const whisper_token *context, int n_context,
+                         struct whisper_context *draft_ctx, struct whisper_state *draft_state, int draft_tokens,
+                         ggml_abort_callback stop_fn, void *stop_data, bool *stopped_out) {
     struct whisper_full_params params = whisper_full_default_params(WHISPER_SAMPLING_GREEDY);
-    params.n_threads = n_threads;
+    params.n_threads = threads->decode;
+    params.n_threads_mel = threads->mel;
+    params.n_threads_encode = threads->encode;
+    params.n_threads_decode = threads->decode;
+    params.offset_ms = offset_ms;
     params.print_progress = false;
     params.print_special = false;
     params.print_realtime = false;
     params.print_timestamps = false;
     params.translate = translate;
     params.single_segment = true;
-    params.no_context = true;
-    if (initial_prompt && *initial_prompt) {
+    params.no_context = true; // states are shared by all requests; context comes with the job
+    params.fail_early = true; // retry a looping window at the next temperature without decoding it to the end
+    if (context && n_context > 0) {
+        params.prompt_tokens = context;
+        params.prompt_n_tokens = n_context;
+    } else if (initial_prompt && *initial_prompt) {
         params.initial_prompt = initial_prompt;
     }
 
     if (language && *language) {
         params.language = language;
         params.detect_language = false;
+        params.vocab_subset = true; // project onto the language's tokens, full vocabulary when unsure
     } else {
         params.detect_language = true;
         params.language = NULL;
     }
 
-    if (whisper_full(ctx, params, samples, n_samples) != 0) {
+    if (draft_ctx && draft_state) {
+        params.draft_ctx = draft_ctx;
+        params.draft_state = draft_state;
+        params.draft_n_tokens = draft_tokens;
+    }
+
+    RunStop stop = { stop_fn, stop_data, false };
+    if (stop_fn) {
+        params.abort_callback = run_abort;
+        params.abort_callback_user_data = &stop;
+        params.encoder_begin_callback = run_encoder_begin;
+        params.encoder_begin_callback_user_data = &stop;
+    }
+
+    // samples == NULL: the state already holds the mel (and maybe the encoded first window)
+    const int ret = whisper_full_with_state(ctx, state, params, samples, n_samples);
+    if (stopped_out) *stopped_out = stop.hit;
+    if (ret != 0 && !stop.hit) {
         return NULL;
     }
 
-    const int n_segments = whisper_full_n_segments(ctx);
+    const int n_segments = whisper_full_n_segments_from_state(state);
     if (n_segments <= 0) return strdup("");
 
     size_t total_len = 0;
     for (int i = 0; i < n_segments; i++) {
-        const char *t = whisper_full_get_segment_text(ctx, i);
+        const char *t = whisper_full_get_segment_text_from_state(state, i);
         if (t) total_len += strlen(t);
     }
 
@@ -272,11 +266,1488 @@ static char *whisper_run(struct whisper_context *ctx, const float *samples, int
     if (!out) return NULL;
     out[0] = '\0';
     for (int i = 0; i < n_segments; i++) {
-        const char *t = whisper_full_get_segment_text(ctx, i);
+        const char *t = whisper_full_get_segment_text_from_state(state, i);
         if (t) strcat(out, t);
     }
 
-    return trim_leading_space(out);
+    return out;
+}
+
+// Session pool: the weights live once in a state-less whisper_context and each
+// session owns a whisper_state plus a thread, so independent requests decode in
+// parallel. Session 0's state is created at load time; the others are created
+// the first time concurrency actually needs them.
+#define WORKER_MAX_SESSIONS 8
+
+// Request priority ('P' requests; 'T' and 'N' are interactive). Interactive
+// jobs queue ahead of background ones and, when every session is busy, make a
+// background job yield its session: it stops within a graph node (on the CPU)
+// and later resumes at the start of the window it was in, which is computed
+// again.
+#define WORKER_PRIORITY_INTERACTIVE 0
+#define WORKER_PRIORITY_BACKGROUND 1
+// Set in the 'P' priority byte: decode with the text of the last finished
+// interactive request as context (the next chunk of the same dictation).
+#define WORKER_FLAG_CONTINUE 0x80
+
+typedef struct WorkerJob {
+    uint32_t id;
+    bool numbered; // 'N'/'P' request: the reply carries the request id
+    uint8_t priority;
+    bool continues;         // WORKER_FLAG_CONTINUE
+    float *samples;
+    uint32_t n_samples;
+    char *lang;
+    char *prompt;
+    bool translate;
+    int n_threads;
+    bool preempted;
+    int resume_ms;          // where to continue after a preemption
+    char *done_text;        // text of the windows finished before it
+    whisper_token *context; // decoder text context at that point
+    int n_context;
+    unsigned cancel_epoch;  // 'T' requests: cancel count when it arrived
+    struct WorkerJob *next;
+} WorkerJob;
+
+// Jobs handed out together share one encoder pass over their first windows
+// (whisper_encode_batch), so the encoder weights are read once per group.
+typedef struct {
+    int n_members;
+    int n_arrived;
+    int n_states;
+    struct whisper_state *states[WORKER_MAX_SESSIONS];
+    bool done;
+    bool ok;
+    pthread_cond_t cond;
+} WorkerBatch;
+
+typedef struct {
+    struct Worker *worker;
+    struct whisper_state *state;
+    struct whisper_state *draft_state; // created on first use when a draft model is loaded
+    pthread_t thread;
+    pthread_cond_t cond;
+    WorkerJob *job;
+    WorkerBatch *batch;
+    atomic_bool yielding; // claimed a preemption; the job stops at the next check
+    size_t compute_size;  // compute buffer high-water mark last reported for state
+} WorkerSession;
+
+// A set of CPUs, indexed like the masks of whisper_set_cpumask_with_state.
+typedef struct {
+    bool cpu[GGML_MAX_N_THREADS];
+} CpuSet;
+
+// Thread counts and CPUs measured fastest for a model (see worker_tune).
+typedef struct {
+    int n_threads_mel;
+    int n_threads_encode;
+    int n_threads_decode;
+    CpuSet encode;
+    CpuSet decode;
+} WorkerTuning;
+
+typedef struct Worker {
+    struct whisper_context *ctx;
+    struct whisper_context *draft_ctx; // optional smaller model for speculative decoding
+    int draft_tokens;
+    WorkerSession sessions[WORKER_MAX_SESSIONS];
+    int n_sessions;
+    int n_busy;
+    int total_threads;
+    WorkerTuning *tuning; // when the load left the thread count to the worker, once known
+    atomic_ulong n_started; // jobs handed to sessions, so the tuning notices it was disturbed
+    int encode_batch;
+    atomic_int yield_wanted; // interactive jobs still waiting for a session to yield
+    // Cancellation (control channel): numbered requests up to cancel_id and
+    // 'T' requests received before the last cancel are dropped.
+    atomic_uint cancel_id;
+    atomic_uint cancel_epoch;
+    // Prompt cache: the last initial prompt with its tokens, so chunks sharing
+    // a prompt skip the tokenizer, and the text tokens of the last finished
+    // interactive request for WORKER_FLAG_CONTINUE jobs.
+    char *prompt_text;
+    whisper_token *prompt_tokens;
+    int n_prompt_tokens;
+    whisper_token *carry;
+    int n_carry;
+    WorkerJob *head;
+    WorkerJob *tail;
+    bool stopping;
+    pthread_mutex_t mutex;
+    pthread_cond_t idle_cond;
+    pthread_mutex_t out_mutex;
+    int out_fd;
+    // Left by the last load for worker_background_thread, which works on them
+    // while the worker serves requests: the weight caches it missed (main,
+    // draft model) and where to keep the tuning when it has to be measured.
+    char *weight_cache[2];
+    char *tuning_path;
+    pthread_t background_thread;
+    bool background_running;
+    atomic_bool background_stop; // unloading: give up the cache writes and the tuning
+} Worker;
+
+static void job_free(WorkerJob *job) {
+    if (!job) return;
+    free(job->samples);
+    free(job->lang);
+    free(job->prompt);
+    free(job->done_text);
+    free(job->context);
+    free(job);
+}
+
+// Remember what a preempted job's next window depends on besides the audio:
+// the decoder's text context and the detected language. The session's state
+// is reused by other jobs before this one resumes.
+static void worker_save_context(struct whisper_state *state, WorkerJob *job) {
+    free(job->context);
+    job->context = NULL;
+    job->n_context = 0;
+    const int n = whisper_full_get_prompt_past_from_state(state, NULL, 0);
+    if (n < 0) {
+        job->context = malloc((size_t)(-n) * sizeof(whisper_token));
+        if (job->context) {
+            job->n_context = whisper_full_get_prompt_past_from_state(state, job->context, -n);
+        }
+    }
+
+    if (!job->lang || !*job->lang) {
+        const char *lang = whisper_lang_str(whisper_full_lang_id_from_state(state));
+        if (lang) {
+            free(job->lang);
+            job->lang = strdup(lang);
+        }
+    }
+}
+
+// Give a fresh job its decoder context as tokens: the initial prompt (through
+// the prompt cache) followed, for a continuing job, by the carried text. The
+// decoder only looks at the last n_text_ctx/2 context tokens, so the carried
+// text is cut from the front to leave the prompt in view.
+static void worker_prepare_context(Worker *w, WorkerJob *job) {
+    const bool have_prompt = job->prompt && *job->prompt;
+    if (!have_prompt && !job->continues) return;
+
+    whisper_token *tokens = NULL;
+    int n_tokens = 0;
+    pthread_mutex_lock(&w->mutex);
+    const bool cached = !have_prompt || (w->prompt_text && strcmp(w->prompt_text, job->prompt) == 0);
+    pthread_mutex_unlock(&w->mutex);
+    if (!cached) {
+        // A BPE token covers at least one byte.
+        tokens = malloc((strlen(job->prompt) + 1) * sizeof(whisper_token));
+        char *text = strdup(job->prompt);
+        if (!tokens || !text) {
+            free(tokens);
+            free(text);
+            return;
+        }
+        n_tokens = whisper_tokenize(w->ctx, job->prompt, tokens, (int)strlen(job->prompt) + 1);
+        if (n_tokens < 0) n_tokens = 0;
+
+        pthread_mutex_lock(&w->mutex);
+        free(w->prompt_text);
+        free(w->prompt_tokens);
+        w->prompt_text = text;
+        w->prompt_tokens = tokens;
+        w->n_prompt_tokens = n_tokens;
+        pthread_mutex_unlock(&w->mutex);
+    }
+
+    pthread_mutex_lock(&w->mutex);
+    const int n_prompt = have_prompt ? w->n_prompt_tokens : 0;
+    int n_carry = job->continues ? w->n_carry : 0;
+    const int n_room = whisper_n_text_ctx(w->ctx) / 2 - n_prompt;
+    if (n_carry > n_room) n_carry = n_room > 0 ? n_room : 0;
+    if (n_prompt + n_carry > 0) {
+        job->context = malloc((size_t)(n_prompt + n_carry) * sizeof(whisper_token));
+        if (job->context) {
+            if (n_prompt > 0) memcpy(job->context, w->prompt_tokens, (size_t)n_prompt * sizeof(whisper_token));
+            if (n_carry > 0) {
+                memcpy(job->context + n_prompt, w->carry + (w->n_carry - n_carry),
+                       (size_t)n_carry * sizeof(whisper_token));
+            }
+            job->n_context = n_prompt + n_carry;
+        }
+    }
+    pthread_mutex_unlock(&w->mutex);
+}
+
+// Keep the text tokens of a finished interactive run for the next continuing job.
+static void worker_save_carry(Worker *w, struct whisper_state *state) {
+    const whisper_token eot = whisper_token_eot(w->ctx);
+    const int n_segments = whisper_full_n_segments_from_state(state);
+    int n = 0;
+    for (int i = 0; i < n_segments; i++) n += whisper_full_n_tokens_from_state(state, i);
+
+    whisper_token *carry = n > 0 ? malloc((size_t)n * sizeof(whisper_token)) : NULL;
+    int n_carry = 0;
+    if (carry) {
+        for (int i = 0; i < n_segments; i++) {
+            const int n_seg = whisper_full_n_tokens_from_state(state, i);
+            for (int j = 0; j < n_seg; j++) {
+                const whisper_token id = whisper_full_get_token_id_from_state(state, i, j);
+                if (id < eot) carry[n_carry++] = id; // skip special and timestamp tokens
+            }
+        }
+    }
+
+    pthread_mutex_lock(&w->mutex);
+    free(w->carry);
+    w->carry = carry;
+    w->n_carry = n_carry;
+    pthread_mutex_unlock(&w->mutex);
+}
+
+static int worker_pool_size(void) {
+    const char *s = env_get("AURISCRIBE_SESSIONS", NULL);
+    int n = (s && *s) ? atoi(s) : 2;
+    if (n < 1) n = 1;
+    if (n > WORKER_MAX_SESSIONS) n = WORKER_MAX_SESSIONS;
+    return n;
+}
+
+// Weight cache: the tensors of a model as loaded for this CPU (repacked for
+// its matmul kernels) are kept in $XDG_CACHE_HOME/auriscribe/weights-<model>-
+// <cpu>-<build>.bin and mapped by the next loads, which then skip converting
+// the model file. <model> hashes the file's identity and its first 64 KiB
+// (hparams, mel filters, start of the vocabulary) rather than all of it, which
+// would cost as much as the load it saves; <build> hashes the worker binary,
+// which has ggml linked in. A load that misses the cache has it written in the
+// background. AURISCRIBE_NO_WEIGHT_CACHE=1 turns it off.
+#define WEIGHT_CACHE_HEAD_BYTES (64 * 1024)
+
+static uint64_t model_identity_hash(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        return 0;
+    }
+    uint64_t h = 1469598103934665603ULL;
+    h = fnv1a64_update(h, &st.st_dev, sizeof(st.st_dev));
+    h = fnv1a64_update(h, &st.st_ino, sizeof(st.st_ino));
+    h = fnv1a64_update(h, &st.st_size, sizeof(st.st_size));
+    h = fnv1a64_update(h, &st.st_mtim.tv_sec, sizeof(st.st_mtim.tv_sec));
+    h = fnv1a64_update(h, &st.st_mtim.tv_nsec, sizeof(st.st_mtim.tv_nsec));
+
+    uint8_t buf[8192];
+    size_t off = 0;
+    while (off < WEIGHT_CACHE_HEAD_BYTES) {
+        ssize_t r = read(fd, buf, sizeof(buf));
+        if (r == 0) break;
+        if (r < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        h = fnv1a64_update(h, buf, (size_t)r);
+        off += (size_t)r;
+    }
+    close(fd);
+    return h;
+}
+
+// The CPU feature flags the kernels (and so the repacked layouts) are picked by.
+static uint64_t cpu_flags_hash(void) {
+    uint64_t h = 1469598103934665603ULL;
+    FILE *f = fopen("/proc/cpuinfo", "r");
+    if (!f) return h;
+
+    char *line = NULL;
+    size_t cap = 0;
+    while (getline(&line, &cap, f) > 0) {
+        if (strncmp(line, "flags", 5) == 0 || strncmp(line, "Features", 8) == 0) {
+            h = fnv1a64_update(h, line, strlen(line));
+            break;
+        }
+    }
+    free(line);
+    fclose(f);
+    return h;
+}
+
+// Whether whisper keeps the weights in GPU memory, which the cache does not cover.
+static bool worker_gpu_weights(bool use_gpu) {
+    if (!use_gpu) return false;
+    for (size_t i = 0; i < ggml_backend_dev_count(); i++) {
+        if (ggml_backend_dev_type(ggml_backend_dev_get(i)) == GGML_BACKEND_DEVICE_TYPE_GPU) return true;
+    }
+    return false;
+}
+
+static char *worker_weight_cache_path(const char *model_path, bool use_gpu) {
+    if (env_get("AURISCRIBE_NO_WEIGHT_CACHE", NULL) || worker_gpu_weights(use_gpu)) return NULL;
+
+    const uint64_t model_hash = model_identity_hash(model_path);
+    if (model_hash == 0) return NULL;
+
+    char *appdir = app_cache_dir();
+    if (!appdir) return NULL;
+
+    char *p = malloc(strlen(appdir) + 128);
+    if (p) {
+        sprintf(p, "%s/weights-%016llx-%016llx-%016llx.bin", appdir,
+                (unsigned long long)model_hash,
+                (unsigned long long)cpu_flags_hash(),
+                (unsigned long long)hash_file_fnv1a64("/proc/self/exe"));
+    }
+    free(appdir);
+    return p;
+}
+
+// Keep the cache path of a context for worker_background_thread when the load missed it.
+static void worker_weight_cache_note(Worker *w, int i, struct whisper_context *ctx, char *path) {
+    if (ctx && path && !whisper_weight_cache_loaded(ctx)) {
+        w->weight_cache[i] = path;
+    } else {
+        free(path);
+    }
+}
+
+// Caches written by other builds of the worker cannot be used again: remove
+// the <prefix>-<model>-<cpu>-<build> files of the directory of path that have
+// another <build>.
+static void cache_prune(const char *path, const char *prefix) {
+    const char *slash = strrchr(path, '/');
+    const size_t n_prefix = strlen(prefix);
+    unsigned long long model, cpu, build;
+    if (!slash || strncmp(slash + 1, prefix, n_prefix) != 0 ||
+        sscanf(slash + 1 + n_prefix, "-%16llx-%16llx-%16llx", &model, &cpu, &build) != 3) return;
+
+    char *dir = strndup(path, (size_t)(slash - path));
+    DIR *d = dir ? opendir(dir) : NULL;
+    if (!d) {
+        free(dir);
+        return;
+    }
+    struct dirent *e;
+    while ((e = readdir(d))) {
+        unsigned long long m, c, b;
+        if (strncmp(e->d_name, prefix, n_prefix) == 0 &&
+            sscanf(e->d_name + n_prefix, "-%16llx-%16llx-%16llx", &m, &c, &b) == 3 && b != build) {
+            (void)unlinkat(dirfd(d), e->d_name, 0);
+        }
+    }
+    closedir(d);
+    free(dir);
+}
+
+// abort_callback of the cache writes: the worker unloads, and nobody would wait
+// for the rest of a file that only later loads use.
+static bool worker_background_stopped(void *data) {
+    Worker *w = data;
+    return atomic_load(&w->background_stop);
+}
+
+static void worker_weight_cache_save(Worker *w) {
+    for (int i = 0; i < 2; i++) {
+        struct whisper_context *ctx = i == 0 ? w->ctx : w->draft_ctx;
+        if (!ctx || !w->weight_cache[i]) continue;
+        if (whisper_weight_cache_save(ctx, w->weight_cache[i], worker_background_stopped, w) == 0) {
+            cache_prune(w->weight_cache[i], "weights");
+        } else if (!atomic_load(&w->background_stop)) {
+            fprintf(stderr, "auriscribe-worker: failed to write the weight cache %s\n", w->weight_cache[i]);
+        }
+    }
+}
+
+// Thread tuning: when the load leaves the thread count to the worker (no
+// AURISCRIBE_THREADS), it measures once per model and CPU how many threads the
+// mel, the encoder and the decoder run fastest with, and on which CPUs: all it
+// may use, one per core, and the fast cores of a hybrid or big.LITTLE CPU (as
+// sysfs describes them) with and without their SMT siblings. The result is
+// kept in $XDG_CACHE_HOME/auriscribe/threads-<model>-<cpu>-<build>.txt, where
+// <cpu> also covers the CPUs the worker is allowed on; sessions split the tuned
+// counts between them as they split a given thread count. The measurement runs
+// after the load, only while no request is being served: a request stops the
+// step being measured, which runs again once the worker is idle. A sweep takes
+// minutes of idle time and starts over after an unload, so only loads that ask
+// for it (AURISCRIBE_TUNE, which the daemon sets) measure; others use a result
+// already kept for the model and CPU. Until there is one the worker runs one
+// thread per core (at most 8) wherever the scheduler puts them. With the
+// weights on a GPU the counts would describe the GPU's speed, not the CPU's,
+// so such loads are not tuned.
+#define TUNE_SAMPLES (30 * WHISPER_SAMPLE_RATE)
+#define TUNE_DECODE_STEPS 8
+#define TUNE_ATTEMPTS 3
+#define TUNE_MAX_COUNTS 32
+
+enum { TUNE_MEL, TUNE_ENCODE, TUNE_DECODE };
+
+static int cpuset_count(const CpuSet *set) {
+    int n = 0;
+    for (int i = 0; i < GGML_MAX_N_THREADS; i++) n += set->cpu[i];
+    return n;
+}
+
+// "0-3,8,10-11", as sysfs and the tuning cache write CPU lists.
+static bool cpuset_parse(CpuSet *set, const char *s) {
+    memset(set, 0, sizeof(*set));
+    while (*s && *s != '\n') {
+        char *end;
+        const long first = strtol(s, &end, 10);
+        if (end == s || first < 0) return false;
+        long last = first;
+        s = end;
+        if (*s == '-') {
+            last = strtol(s + 1, &end, 10);
+            if (end == s + 1 || last < first) return false;
+            s = end;
+        }
+        for (long i = first; i <= last && i < GGML_MAX_N_THREADS; i++) set->cpu[i] = true;
+        if (*s == ',') s++;
+        else if (*s && *s != '\n') return false;
+    }
+    return cpuset_count(set) > 0;
+}
+
+static void cpuset_format(const CpuSet *set, char *out, size_t n) {
+    size_t off = 0;
+    out[0] = '\0';
+    for (int i = 0; i < GGML_MAX_N_THREADS; i++) {
+        if (!set->cpu[i]) continue;
+        int last = i;
+        while (last + 1 < GGML_MAX_N_THREADS && set->cpu[last + 1]) last++;
+        const int r = last > i ? snprintf(out + off, n - off, "%s%d-%d", off ? "," : "", i, last)
+                               : snprintf(out + off, n - off, "%s%d", off ? "," : "", i);
+        if (r < 0 || (size_t)r >= n - off) break;
+        off += (size_t)r;
+        i = last;
+    }
+}
+
+// The CPUs the worker may run on (sched_getaffinity), none when unknown.
+static void cpuset_allowed(CpuSet *set) {
+    memset(set, 0, sizeof(*set));
+    cpu_set_t affinity;
+    if (sched_getaffinity(0, sizeof(affinity), &affinity) != 0) return;
+    for (int i = 0; i < GGML_MAX_N_THREADS && i < CPU_SETSIZE; i++) set->cpu[i] = CPU_ISSET(i, &affinity);
+}
+
+static bool read_sysfs(const char *path, char *buf, size_t n) {
+    FILE *f = fopen(path, "r");
+    if (!f) return false;
+    const bool ok = fgets(buf, (int)n, f) != NULL;
+    fclose(f);
+    return ok;
+}
+
+static int tune_add_cpuset(CpuSet *sets, int n_sets, const CpuSet *set) {
+    if (cpuset_count(set) == 0) return n_sets;
+    for (int i = 0; i < n_sets; i++) {
+        if (memcmp(&sets[i], set, sizeof(*set)) == 0) return n_sets;
+    }
+    sets[n_sets] = *set;
+    return n_sets + 1;
+}
+
+// One CPU per core of a set: the first of its SMT siblings in the set.
+static void cpuset_cores(const CpuSet *set, CpuSet *cores) {
+    memset(cores, 0, sizeof(*cores));
+    char path[128];
+    char buf[2048];
+    for (int i = 0; i < GGML_MAX_N_THREADS; i++) {
+        if (!set->cpu[i]) continue;
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/core_cpus_list", i);
+        bool ok = read_sysfs(path, buf, sizeof(buf));
+        if (!ok) {
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/thread_siblings_list", i);
+            ok = read_sysfs(path, buf, sizeof(buf));
+        }
+        CpuSet siblings;
+        int first = i;
+        if (ok && cpuset_parse(&siblings, buf)) {
+            for (int j = 0; j < i; j++) {
+                if (siblings.cpu[j] && set->cpu[j]) {
+                    first = j;
+                    break;
+                }
+            }
+        }
+        cores->cpu[first] = true;
+    }
+}
+
+// The fast cores of a set: the P-cores of an Intel hybrid CPU, else the CPUs
+// of the largest capacity (arm big.LITTLE), else of the highest maximum
+// frequency. All of the set when sysfs tells them apart by neither.
+static void cpuset_fast(const CpuSet *set, CpuSet *fast) {
+    memset(fast, 0, sizeof(*fast));
+    char path[128];
+    char buf[2048];
+    if (read_sysfs("/sys/devices/cpu_core/cpus", buf, sizeof(buf)) && cpuset_parse(fast, buf)) {
+        for (int i = 0; i < GGML_MAX_N_THREADS; i++) fast->cpu[i] = fast->cpu[i] && set->cpu[i];
+        if (cpuset_count(fast) > 0) return;
+    }
+
+    static const char *const ranks[] = { "cpu_capacity", "cpufreq/cpuinfo_max_freq" };
+    for (int r = 0; r < 2; r++) {
+        long rank[GGML_MAX_N_THREADS];
+        long max = -1;
+        bool known = true;
+        for (int i = 0; i < GGML_MAX_N_THREADS && known; i++) {
+            if (!set->cpu[i]) continue;
+            snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", i, ranks[r]);
+            known = read_sysfs(path, buf, sizeof(buf));
+            rank[i] = known ? atol(buf) : 0;
+            if (rank[i] > max) max = rank[i];
+        }
+        if (!known) continue;
+        for (int i = 0; i < GGML_MAX_N_THREADS; i++) fast->cpu[i] = set->cpu[i] && rank[i] == max;
+        return;
+    }
+    *fast = *set;
+}
+
+// The CPU sets worth measuring, without duplicates; returns how many. With
+// NUMA placement ggml pins the threads itself, so only the allowed CPUs count.
+static int tune_cpusets(CpuSet sets[4]) {
+    CpuSet all;
+    cpuset_allowed(&all);
+    int n_sets = tune_add_cpuset(sets, 0, &all);
+    if (n_sets == 0 || ggml_is_numa()) return n_sets;
+
+    CpuSet cores;
+    CpuSet fast;
+    CpuSet fast_cores;
+    cpuset_cores(&all, &cores);
+    cpuset_fast(&all, &fast);
+    for (int i = 0; i < GGML_MAX_N_THREADS; i++) fast_cores.cpu[i] = fast.cpu[i] && cores.cpu[i];
+
+    n_sets = tune_add_cpuset(sets, n_sets, &cores);
+    n_sets = tune_add_cpuset(sets, n_sets, &fast);
+    n_sets = tune_add_cpuset(sets, n_sets, &fast_cores);
+    return n_sets;
+}
+
+// Thread counts tried on n CPUs, largest first: n, then 3/4, 1/2, 3/8, 1/4 ... of n, down to 1.
+static int tune_thread_counts(int n, int counts[TUNE_MAX_COUNTS]) {
+    int k = 0;
+    counts[k++] = n;
+    for (int d = 4; n * 2 / d >= 1 && k < TUNE_MAX_COUNTS - 1; d *= 2) {
+        const int c3 = 3 * n / d;
+        const int c2 = 2 * n / d;
+        if (c3 >= 1 && c3 < counts[k - 1]) counts[k++] = c3;
+        if (c2 >= 1 && c2 < counts[k - 1]) counts[k++] = c2;
+    }
+    return k;
+}
+
+// Run a stage once; returns its seconds (the decoder's per token), -1 on failure.
+static double tune_run(Worker *w, struct whisper_state *state, int stage, const float *pcm, int n_threads) {
+    if (stage == TUNE_DECODE) {
+        // A fresh prompt, then single tokens as greedy decoding feeds them.
+        const whisper_token prompt[2] = { whisper_token_sot(w->ctx), whisper_token_not(w->ctx) };
+        if (whisper_decode_with_state(w->ctx, state, prompt, 2, 0, n_threads) != 0) return -1;
+        const int64_t t0 = ggml_time_us();
+        for (int i = 0; i < TUNE_DECODE_STEPS; i++) {
+            if (whisper_decode_with_state(w->ctx, state, &prompt[1], 1, 2 + i, n_threads) != 0) return -1;
+        }
+        return (ggml_time_us() - t0) / 1e6 / TUNE_DECODE_STEPS;
+    }
+
+    const int64_t t0 = ggml_time_us();
+    const int ret = stage == TUNE_MEL ? whisper_pcm_to_mel_with_state(w->ctx, state, pcm, TUNE_SAMPLES, n_threads)
+                                      : whisper_encode_with_state(w->ctx, state, 0, n_threads);
+    return ret == 0 ? (ggml_time_us() - t0) / 1e6 : -1;
+}
+
+// abort_callback of the tuning state: a request was handed to a session since
+// the worker was last found idle, or the worker unloads. The run then gives the
+// CPUs back within one graph node.
+typedef struct {
+    Worker *w;
+    unsigned long n_started;
+} TuneAbort;
+
+static bool tune_abort(void *data) {
+    const TuneAbort *stop = data;
+    return atomic_load(&stop->w->background_stop) || atomic_load(&stop->w->n_started) != stop->n_started;
+}
+
+// Wait until no request is queued or running; false when the worker unloads.
+static bool tune_wait_idle(TuneAbort *stop) {
+    Worker *w = stop->w;
+    pthread_mutex_lock(&w->mutex);
+    while ((w->head || w->n_busy > 0) && !atomic_load(&w->background_stop)) {
+        pthread_cond_wait(&w->idle_cond, &w->mutex);
+    }
+    stop->n_started = atomic_load(&w->n_started);
+    pthread_mutex_unlock(&w->mutex);
+    return !atomic_load(&w->background_stop);
+}
+
+// Best of `repeat` runs made while the worker was idle; runs a request
+// interrupted are made again once it is done. -1 on failure, when requests
+// kept coming or when the worker unloads.
+static double tune_measure(Worker *w, struct whisper_state *state, TuneAbort *stop, int stage,
+                           const float *pcm, int n_threads, int repeat) {
+    for (int attempt = 0; attempt < TUNE_ATTEMPTS; attempt++) {
+        if (!tune_wait_idle(stop)) return -1;
+
+        double best = -1;
+        for (int i = 0; i < repeat && !tune_abort(stop); i++) {
+            const double t = tune_run(w, state, stage, pcm, n_threads);
+            if (t < 0 && !tune_abort(stop)) return -1;
+            if (t >= 0 && (best < 0 || t < best)) best = t;
+        }
+        if (!tune_abort(stop)) return best;
+    }
+    return -1;
+}
+
+// Fastest thread count of a stage on a set of CPUs (0 if none could be
+// measured). Counts are tried from the largest down, until one is slower than
+// the best so far.
+static int tune_sweep(Worker *w, struct whisper_state *state, TuneAbort *stop, int stage, const float *pcm,
+                      const CpuSet *set, int repeat, double *time_out) {
+    int counts[TUNE_MAX_COUNTS];
+    const int n_counts = tune_thread_counts(cpuset_count(set), counts);
+    int best = 0;
+    double best_time = -1;
+    for (int i = 0; i < n_counts; i++) {
+        const double t = tune_measure(w, state, stop, stage, pcm, counts[i], repeat);
+        if (t < 0 || (best_time >= 0 && t > best_time)) break;
+        best = counts[i];
+        best_time = t;
+    }
+    *time_out = best_time;
+    return best;
+}
+
+static bool worker_tune(Worker *w, WorkerTuning *tuning) {
+    CpuSet sets[4];
+    const int n_sets = tune_cpusets(sets);
+    float *pcm = malloc(TUNE_SAMPLES * sizeof(float));
+    struct whisper_state *state = pcm && n_sets > 0 ? whisper_init_state(w->ctx) : NULL;
+    bool ok = state != NULL;
+
+    TuneAbort stop = { w, 0 };
+    if (ok) {
+        whisper_set_abort_callback_with_state(state, tune_abort, &stop);
+
+        // Low noise as the audio: the work of the stages does not depend on it,
+        // and the decoder sees a realistic encoder output. The first runs (their
+        // times unused) give the encoder its input and reserve the compute buffers.
+        uint32_t x = 1;
+        for (int i = 0; i < TUNE_SAMPLES; i++) {
+            x = x * 1664525u + 1013904223u;
+            pcm[i] = ((float)(x >> 8) / 16777216.0f - 0.5f) * 0.02f;
+        }
+        const int n = cpuset_count(&sets[0]);
+        ok = tune_measure(w, state, &stop, TUNE_MEL, pcm, n, 1) >= 0 &&
+             tune_measure(w, state, &stop, TUNE_ENCODE, pcm, n, 1) >= 0 &&
+             tune_measure(w, state, &stop, TUNE_DECODE, pcm, n, 1) >= 0;
+    }
+
+    double best_encode = -1;
+    double best_decode = -1;
+    for (int i = 0; ok && i < n_sets; i++) {
+        whisper_set_cpumask_with_state(state, sets[i].cpu, sets[i].cpu);
+        double t_encode;
+        double t_decode;
+        const int n_encode = tune_sweep(w, state, &stop, TUNE_ENCODE, pcm, &sets[i], 1, &t_encode);
+        const int n_decode = n_encode > 0 ? tune_sweep(w, state, &stop, TUNE_DECODE, pcm, &sets[i], 2, &t_decode) : 0;
+        ok = n_decode > 0;
+        if (ok && (best_encode < 0 || t_encode < best_encode)) {
+            best_encode = t_encode;
+            tuning->n_threads_encode = n_encode;
+            tuning->encode = sets[i];
+        }
+        if (ok && (best_decode < 0 || t_decode < best_decode)) {
+            best_decode = t_decode;
+            tuning->n_threads_decode = n_decode;
+            tuning->decode = sets[i];
+        }
+    }
+
+    if (ok) {
+        // Sessions compute the mel on a thread that ran a decoder graph last,
+        // so its threads share the CPUs of the decoder: measure it there.
+        whisper_set_cpumask_with_state(state, NULL, tuning->decode.cpu);
+        double t_mel;
+        ok = tune_measure(w, state, &stop, TUNE_DECODE, pcm, tuning->n_threads_decode, 1) >= 0 &&
+             (tuning->n_threads_mel = tune_sweep(w, state, &stop, TUNE_MEL, pcm, &tuning->decode, 2, &t_mel)) > 0;
+    }
+
+    if (state) whisper_free_state(state);
+    free(pcm);
+    return ok && !atomic_load(&w->background_stop);
+}
+
+static void worker_tuning_log(const WorkerTuning *tuning, const char *how) {
+    char encode[2048];
+    char decode[2048];
+    cpuset_format(&tuning->encode, encode, sizeof(encode));
+    cpuset_format(&tuning->decode, decode, sizeof(decode));
+    fprintf(stderr, "auriscribe-worker: %s threads: mel %d, encode %d on CPUs %s, decode %d on CPUs %s\n",
+            how, tuning->n_threads_mel, tuning->n_threads_encode, encode, tuning->n_threads_decode, decode);
+}
+
+static char *worker_tuning_path(const char *model_path) {
+    const uint64_t model_hash = model_identity_hash(model_path);
+    if (model_hash == 0) return NULL;
+
+    CpuSet allowed;
+    cpuset_allowed(&allowed);
+    const uint64_t cpu_hash = fnv1a64_update(cpu_flags_hash(), allowed.cpu, sizeof(allowed.cpu));
+
+    char *appdir = app_cache_dir();
+    if (!appdir) return NULL;
+
+    char *p = malloc(strlen(appdir) + 128);
+    if (p) {
+        sprintf(p, "%s/threads-%016llx-%016llx-%016llx.txt", appdir,
+                (unsigned long long)model_hash,
+                (unsigned long long)cpu_hash,
+                (unsigned long long)hash_file_fnv1a64("/proc/self/exe"));
+    }
+    free(appdir);
+    return p;
+}
+
+static WorkerTuning *worker_tuning_load(const char *path) {
+    FILE *f = fopen(path, "r");
+    if (!f) return NULL;
+
+    WorkerTuning *tuning = calloc(1, sizeof(*tuning));
+    bool have_encode = false;
+    bool have_decode = false;
+    char line[2100];
+    char cpus[2048];
+    while (tuning && fgets(line, sizeof(line), f)) {
+        int n = 0;
+        if (sscanf(line, "mel %d", &n) == 1) {
+            tuning->n_threads_mel = n;
+        } else if (sscanf(line, "encode %d %2047s", &n, cpus) == 2) {
+            tuning->n_threads_encode = n;
+            have_encode = cpuset_parse(&tuning->encode, cpus);
+        } else if (sscanf(line, "decode %d %2047s", &n, cpus) == 2) {
+            tuning->n_threads_decode = n;
+            have_decode = cpuset_parse(&tuning->decode, cpus);
+        }
+    }
+    fclose(f);
+
+    if (tuning && (!have_encode || !have_decode || tuning->n_threads_mel < 1 ||
+                   tuning->n_threads_encode < 1 || tuning->n_threads_decode < 1)) {
+        free(tuning);
+        tuning = NULL;
+    }
+    return tuning;
+}
+
+static bool worker_tuning_save(const char *path, const WorkerTuning *tuning) {
+    char *tmp = malloc(strlen(path) + 8);
+    if (!tmp) return false;
+    sprintf(tmp, "%s.tmp", path);
+
+    char encode[2048];
+    char decode[2048];
+    cpuset_format(&tuning->encode, encode, sizeof(encode));
+    cpuset_format(&tuning->decode, decode, sizeof(decode));
+
+    FILE *f = fopen(tmp, "w");
+    bool ok = f != NULL;
+    if (f) {
+        fprintf(f, "mel %d\nencode %d %s\ndecode %d %s\n", tuning->n_threads_mel,
+                tuning->n_threads_encode, encode, tuning->n_threads_decode, decode);
+        ok = fclose(f) == 0;
+    }
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok) (void)unlink(tmp);
+    free(tmp);
+    return ok;
+}
+
+// Threads of a job's stages: the tuned counts, or the load's when there are
+// none, split between the n_busy sessions running and capped by the request
+// (max_threads > 0). Caller holds w->mutex.
+static StageThreads worker_stage_threads_locked(const Worker *w, int n_busy, int max_threads) {
+    const WorkerTuning *t = w->tuning;
+    int n[3] = {
+        t ? t->n_threads_mel : w->total_threads,
+        t ? t->n_threads_encode : w->total_threads,
+        t ? t->n_threads_decode : w->total_threads,
+    };
+    for (int i = 0; i < 3; i++) {
+        n[i] /= n_busy > 0 ? n_busy : 1;
+        if (max_threads > 0 && n[i] > max_threads) n[i] = max_threads;
+        if (n[i] < 1) n[i] = 1;
+    }
+    const StageThreads threads = { n[0], n[1], n[2] };
+    return threads;
+}
+
+// Whether a load without a kept tuning should measure one (see worker_tune).
+static bool worker_tune_wanted(void) {
+    const char *s = env_get("AURISCRIBE_TUNE", NULL);
+    return s && strcmp(s, "0") != 0;
+}
+
+// Threads when the load leaves it to the worker and there is no tuning (yet):
+// one per core, at most 8.
+static int worker_default_threads(void) {
+    CpuSet all;
+    CpuSet cores;
+    cpuset_allowed(&all);
+    cpuset_cores(&all, &cores);
+    int n = cpuset_count(&cores);
+    if (n < 1) n = 1;
+    if (n > 8) n = 8;
+    return n;
+}
+
+// Work left by a load, done while the worker serves requests: the weight
+// caches first, so the tuning is not measured against the writing.
+static void *worker_background_thread(void *arg) {
+    Worker *w = arg;
+    worker_weight_cache_save(w);
+    if (!w->tuning_path) return NULL;
+
+    WorkerTuning *tuning = calloc(1, sizeof(*tuning));
+    if (tuning && worker_tune(w, tuning)) {
+        if (worker_tuning_save(w->tuning_path, tuning)) {
+            cache_prune(w->tuning_path, "threads");
+        }
+        worker_tuning_log(tuning, "measured");
+        pthread_mutex_lock(&w->mutex);
+        w->tuning = tuning;
+        pthread_mutex_unlock(&w->mutex);
+    } else {
+        free(tuning);
+    }
+    return NULL;
+}
+
+static void worker_background_start(Worker *w) {
+    if (!w->weight_cache[0] && !w->weight_cache[1] && !w->tuning_path) return;
+    w->background_running = pthread_create(&w->background_thread, NULL, worker_background_thread, w) == 0;
+}
+
+// Stop the cache writes and the tuning, wait until they have let go of the
+// weights and forget what the load left.
+static void worker_background_join(Worker *w) {
+    atomic_store(&w->background_stop, true);
+    pthread_mutex_lock(&w->mutex);
+    pthread_cond_broadcast(&w->idle_cond);
+    pthread_mutex_unlock(&w->mutex);
+    if (w->background_running) pthread_join(w->background_thread, NULL);
+    w->background_running = false;
+    atomic_store(&w->background_stop, false);
+
+    for (int i = 0; i < 2; i++) {
+        free(w->weight_cache[i]);
+        w->weight_cache[i] = NULL;
+    }
+    free(w->tuning_path);
+    free(w->tuning);
+    w->tuning_path = NULL;
+    w->tuning = NULL;
+}
+
+// Draft model for speculative decoding: AURISCRIBE_DRAFT_MODEL names a smaller
+// model with the same vocabulary (e.g. tiny for base/small/medium, not for
+// large-v3), AURISCRIBE_DRAFT_TOKENS how many tokens it proposes per step.
+static void worker_load_draft(Worker *w, struct whisper_context_params cparams) {
+    const char *path = env_get("AURISCRIBE_DRAFT_MODEL", NULL);
+    if (!path || !*path) return;
+
+    char *weight_cache = worker_weight_cache_path(path, cparams.use_gpu);
+    cparams.weight_cache = weight_cache;
+    w->draft_ctx = whisper_init_from_file_with_params_no_state(path, cparams);
+    if (!w->draft_ctx) {
+        free(weight_cache);
+        fprintf(stderr, "auriscribe-worker: failed to load draft model %s\n", path);
+        return;
+    }
+    if (whisper_n_vocab(w->draft_ctx) != whisper_n_vocab(w->ctx) ||
+        whisper_model_n_mels(w->draft_ctx) != whisper_model_n_mels(w->ctx)) {
+        fprintf(stderr, "auriscribe-worker: draft model %s does not match the loaded model, ignoring it\n", path);
+        whisper_free(w->draft_ctx);
+        w->draft_ctx = NULL;
+        free(weight_cache);
+        return;
+    }
+    worker_weight_cache_note(w, 1, w->draft_ctx, weight_cache);
+
+    const char *s = env_get("AURISCRIBE_DRAFT_TOKENS", NULL);
+    const int n = s ? atoi(s) : 0;
+    w->draft_tokens = n > 0 ? n : 5;
+}
+
+// Max first windows per batched encoder pass. Batching pays off where weight
+// traffic dominates (GPU, reduced audio context); a CPU encoder at the full
+// 30 s context is compute bound, so it stays off there unless asked for.
+static int worker_encode_batch_size(bool use_gpu) {
+    const char *s = env_get("AURISCRIBE_ENCODE_BATCH", NULL);
+    int n = (s && *s) ? atoi(s) : (use_gpu ? WORKER_MAX_SESSIONS : 1);
+    if (n < 1) n = 1;
+    if (n > WORKER_MAX_SESSIONS) n = WORKER_MAX_SESSIONS;
+    return n;
+}
+
+static void worker_reply(Worker *w, const WorkerJob *job, char type, const char *text) {
+    pthread_mutex_lock(&w->out_mutex);
+    if (!job->numbered) {
+        (void)ipc_write_msg(w->out_fd, type, text);
+    } else {
+        const char magic[4] = { 'A', 'U', 'R', '1' };
+        const uint32_t n = text ? (uint32_t)strlen(text) : 0;
+        (void)(ipc_write_exact(w->out_fd, magic, 4) &&
+               ipc_write_u8(w->out_fd, (uint8_t)'N') &&
+               ipc_write_u32(w->out_fd, n + 5) &&
+               ipc_write_u32(w->out_fd, job->id) &&
+               ipc_write_u8(w->out_fd, (uint8_t)type) &&
+               (n == 0 || ipc_write_exact(w->out_fd, text, n)));
+    }
+    pthread_mutex_unlock(&w->out_mutex);
+}
+
+static void worker_reply_ok(Worker *w, const char *text) {
+    pthread_mutex_lock(&w->out_mutex);
+    (void)ipc_write_msg(w->out_fd, 'O', text);
+    pthread_mutex_unlock(&w->out_mutex);
+}
+
+static void worker_reply_error(Worker *w, const char *text) {
+    pthread_mutex_lock(&w->out_mutex);
+    (void)ipc_write_msg(w->out_fd, 'E', text);
+    pthread_mutex_unlock(&w->out_mutex);
+}
+
+// Queue order: interactive jobs (FIFO), then background jobs (FIFO). A
+// preempted background job goes back to the front of its class.
+// Caller holds w->mutex.
+static void worker_enqueue_locked(Worker *w, WorkerJob *job) {
+    WorkerJob **pp = w->tail ? &w->tail->next : &w->head;
+    if (job->priority == WORKER_PRIORITY_INTERACTIVE || job->preempted) {
+        pp = &w->head;
+        while (*pp && (*pp)->priority == WORKER_PRIORITY_INTERACTIVE) pp = &(*pp)->next;
+    }
+    job->next = *pp;
+    *pp = job;
+    if (!job->next) w->tail = job;
+}
+
+// Hand queued jobs to idle sessions, preferring ones that already own a state.
+// Jobs started by the same call are grouped for a batched encoder pass.
+// Caller holds w->mutex.
+static void worker_dispatch_locked(Worker *w) {
+    WorkerSession *started[WORKER_MAX_SESSIONS];
+    int n_started = 0;
+
+    for (int pass = 0; pass < 2 && w->head; pass++) {
+        for (int i = 0; i < w->n_sessions && w->head; i++) {
+            WorkerSession *s = &w->sessions[i];
+            if (s->job) continue;
+            if (pass == 0 && !s->state) continue;
+            WorkerJob *job = w->head;
+            w->head = job->next;
+            if (!w->head) w->tail = NULL;
+            job->next = NULL;
+            s->job = job;
+            s->batch = NULL;
+            w->n_busy++;
+            atomic_fetch_add(&w->n_started, 1);
+            started[n_started++] = s;
+        }
+    }
+
+    for (int i = 0; i < n_started; i += w->encode_batch) {
+        const int n = n_started - i < w->encode_batch ? n_started - i : w->encode_batch;
+        WorkerBatch *b = n > 1 ? calloc(1, sizeof(*b)) : NULL;
+        if (b) {
+            b->n_members = n;
+            pthread_cond_init(&b->cond, NULL);
+        }
+        for (int j = i; j < i + n; j++) {
+            started[j]->batch = b;
+            pthread_cond_signal(&started[j]->cond);
+        }
+    }
+
+    // Interactive jobs still queued found no idle session: ask background
+    // jobs to yield, one per waiting job, minus the yields already under way.
+    int waiting = 0;
+    int yielding = 0;
+    for (WorkerJob *j = w->head; j && j->priority == WORKER_PRIORITY_INTERACTIVE; j = j->next) waiting++;
+    for (int i = 0; i < w->n_sessions; i++) {
+        if (atomic_load(&w->sessions[i].yielding)) yielding++;
+    }
+    atomic_store(&w->yield_wanted, waiting > yielding ? waiting - yielding : 0);
+}
+
+// abort_callback / encoder_begin_callback of background jobs. Cheap until an
+// interactive job is waiting; then exactly one session claims each yield.
+static bool worker_should_yield(void *data) {
+    WorkerSession *s = data;
+    if (atomic_load(&s->yielding)) return true;
+    Worker *w = s->worker;
+    if (atomic_load_explicit(&w->yield_wanted, memory_order_relaxed) <= 0) return false;
+
+    pthread_mutex_lock(&w->mutex);
+    if (atomic_load(&w->yield_wanted) > 0) {
+        atomic_fetch_sub(&w->yield_wanted, 1);
+        atomic_store(&s->yielding, true);
+    }
+    pthread_mutex_unlock(&w->mutex);
+    return atomic_load(&s->yielding);
+}
+
+static bool worker_job_canceled(Worker *w, const WorkerJob *job) {
+    if (job->numbered) {
+        return atomic_load_explicit(&w->cancel_epoch, memory_order_relaxed) != 0 &&
+               job->id <= atomic_load_explicit(&w->cancel_id, memory_order_relaxed);
+    }
+    return job->cancel_epoch != atomic_load_explicit(&w->cancel_epoch, memory_order_relaxed);
+}
+
+// abort_callback / encoder_begin_callback of every job: a cancel stops it
+// within one graph node on the CPU (at the next graph on a GPU); background
+// jobs also stop to yield their session.
+static bool worker_should_stop(void *data) {
+    WorkerSession *s = data;
+    if (worker_job_canceled(s->worker, s->job)) return true;
+    return s->job->priority == WORKER_PRIORITY_BACKGROUND && worker_should_yield(s);
+}
+
+// Returns a + b (either may be NULL); frees both.
+static char *concat_free(char *a, char *b) {
+    if (!a) return b;
+    if (!b) return a;
+    const size_t na = strlen(a);
+    char *out = realloc(a, na + strlen(b) + 1);
+    if (!out) {
+        free(a);
+        free(b);
+        return NULL;
+    }
+    strcpy(out + na, b);
+    free(b);
+    return out;
+}
+
+// Queue a chain of jobs (linked through ->next) and start as many as possible.
+static void worker_submit(Worker *w, WorkerJob *jobs) {
+    if (!jobs) return;
+
+    pthread_mutex_lock(&w->mutex);
+    while (jobs) {
+        WorkerJob *next = jobs->next;
+        worker_enqueue_locked(w, jobs);
+        jobs = next;
+    }
+    worker_dispatch_locked(w);
+    pthread_mutex_unlock(&w->mutex);
+}
+
+// Compute this job's mel, then meet the rest of the group: the last member to
+// arrive encodes everyone's first window in one pass with the whole thread
+// budget while the others wait. Returns true if s->state is ready for
+// whisper_run(NULL, 0); false means fall back to passing the samples.
+static bool worker_batch_encode(Worker *w, WorkerSession *s, const WorkerJob *job, const StageThreads *threads) {
+    WorkerBatch *b = s->batch;
+    const bool have_mel = s->state && !job->preempted &&
+        whisper_pcm_to_mel_with_state(w->ctx, s->state, job->samples, (int)job->n_samples, threads->mel) == 0;
+
+    pthread_mutex_lock(&w->mutex);
+    if (have_mel) b->states[b->n_states++] = s->state;
+    if (++b->n_arrived == b->n_members) {
+        const int n_threads = worker_stage_threads_locked(w, 1, 0).encode;
+        pthread_mutex_unlock(&w->mutex);
+        const bool ok = b->n_states > 0 &&
+            whisper_encode_batch(w->ctx, b->states, b->n_states, 0, n_threads) == 0;
+        pthread_mutex_lock(&w->mutex);
+        b->ok = ok;
+        b->done = true;
+        pthread_cond_broadcast(&b->cond);
+    } else {
+        while (!b->done) pthread_cond_wait(&b->cond, &w->mutex);
+    }
+    const bool ok = have_mel && b->ok;
+    s->batch = NULL;
+    if (--b->n_members == 0) {
+        pthread_cond_destroy(&b->cond);
+        free(b);
+    }
+    pthread_mutex_unlock(&w->mutex);
+    return ok;
+}
+
+static void *worker_session_thread(void *arg) {
+    Worker *w = arg;
+
+    pthread_mutex_lock(&w->mutex);
+    int idx = 0;
+    while (idx < w->n_sessions && !pthread_equal(w->sessions[idx].thread, pthread_self())) idx++;
+    WorkerSession *s = &w->sessions[idx];
+
+    for (;;) {
+        while (!s->job && !w->stopping) {
+            pthread_cond_wait(&s->cond, &w->mutex);
+        }
+        if (!s->job) break;
+
+        WorkerJob *job = s->job;
+        // Split the thread budget between sessions that are decoding right now.
+        const StageThreads threads = worker_stage_threads_locked(w, w->n_busy, job->n_threads);
+        const WorkerTuning *tuning = w->tuning;
+        pthread_mutex_unlock(&w->mutex);
+
+        if (!s->state) {
+            s->state = whisper_init_state(w->ctx);
+        }
+        if (w->draft_ctx && !s->draft_state) {
+            s->draft_state = whisper_init_state(w->draft_ctx);
+        }
+        if (tuning) {
+            if (s->state) whisper_set_cpumask_with_state(s->state, tuning->encode.cpu, tuning->decode.cpu);
+            if (s->draft_state) whisper_set_cpumask_with_state(s->draft_state, tuning->encode.cpu, tuning->decode.cpu);
+        }
+        const bool encoded = s->batch && worker_batch_encode(w, s, job, &threads);
+        if (!job->preempted) worker_prepare_context(w, job);
+        bool paused = false;
+        if (worker_job_canceled(w, job)) {
+            worker_reply(w, job, 'C', "");
+        } else if (!s->state) {
+            worker_reply(w, job, 'E', "Failed to allocate whisper state");
+        } else {
+            bool stopped = false;
+            char *text = whisper_run(w->ctx, s->state,
+                                     encoded ? NULL : job->samples, encoded ? 0 : (int)job->n_samples,
+                                     job->lang, job->translate, &threads, job->prompt, job->resume_ms,
+                                     job->context, job->n_context,
+                                     w->draft_ctx, s->draft_state, w->draft_tokens,
+                                     worker_should_stop, s, &stopped);
+            if (stopped && worker_job_canceled(w, job)) {
+                worker_reply(w, job, 'C', "");
+                free(text);
+            } else if (text && stopped) {
+                // Keep the finished windows and requeue the rest of the job.
+                job->done_text = concat_free(job->done_text, text);
+                job->resume_ms = 10 * whisper_full_get_seek_from_state(s->state);
+                job->preempted = true;
+                worker_save_context(s->state, job);
+                paused = true;
+            } else if (text) {
+                if (job->priority == WORKER_PRIORITY_INTERACTIVE) worker_save_carry(w, s->state);
+                char *all = concat_free(job->done_text, text);
+                job->done_text = NULL;
+                if (all) {
+                    worker_reply(w, job, 'R', trim_leading_space(all));
+                } else {
+                    worker_reply(w, job, 'E', "Out of memory");
+                }
+                free(all);
+            } else {
+                worker_reply(w, job, 'E', "Transcription failed");
+            }
+        }
+        if (!paused) job_free(job);
+
+        // Compute buffers grow to the largest shape a job needed and stay there.
+        const size_t compute_size = s->state ? whisper_compute_buffer_size_max_from_state(s->state) : 0;
+        if (compute_size > s->compute_size) {
+            fprintf(stderr, "auriscribe-worker: session %d compute buffers %.1f MB (high-water mark)\n",
+                    idx, compute_size / 1e6);
+            s->compute_size = compute_size;
+        }
+
+        pthread_mutex_lock(&w->mutex);
+        s->job = NULL;
+        w->n_busy--;
+        atomic_store(&s->yielding, false);
+        if (paused) worker_enqueue_locked(w, job);
+        worker_dispatch_locked(w);
+        pthread_cond_broadcast(&w->idle_cond);
+    }
+
+    pthread_mutex_unlock(&w->mutex);
+    return NULL;
+}
+
+// Wait for every queued and running job, then stop sessions and free the model.
+static void worker_unload(Worker *w) {
+    if (!w->ctx) return;
+
+    pthread_mutex_lock(&w->mutex);
+    while (w->head || w->n_busy > 0) {
+        pthread_cond_wait(&w->idle_cond, &w->mutex);
+    }
+    w->stopping = true;
+    for (int i = 0; i < w->n_sessions; i++) {
+        pthread_cond_signal(&w->sessions[i].cond);
+    }
+    pthread_mutex_unlock(&w->mutex);
+
+    int n_fallbacks = 0;
+    int n_fallbacks_early = 0;
+    for (int i = 0; i < w->n_sessions; i++) {
+        WorkerSession *s = &w->sessions[i];
+        pthread_join(s->thread, NULL);
+        if (s->state) {
+            n_fallbacks += whisper_full_n_fallbacks_from_state(s->state);
+            n_fallbacks_early += whisper_full_n_fallbacks_early_from_state(s->state);
+        }
+        pthread_cond_destroy(&s->cond);
+        if (s->state) whisper_free_state(s->state);
+        if (s->draft_state) whisper_free_state(s->draft_state);
+        s->state = NULL;
+        s->draft_state = NULL;
+    }
+    w->n_sessions = 0;
+    w->stopping = false;
+    if (n_fallbacks > 0) {
+        fprintf(stderr, "auriscribe-worker: %d windows retried at a higher temperature, %d of them stopped early\n",
+                n_fallbacks, n_fallbacks_early);
+    }
+
+    worker_background_join(w);
+    if (w->draft_ctx) whisper_free(w->draft_ctx);
+    w->draft_ctx = NULL;
+    free(w->prompt_text);
+    free(w->prompt_tokens);
+    free(w->carry);
+    w->prompt_text = NULL;
+    w->prompt_tokens = NULL;
+    w->carry = NULL;
+    w->n_prompt_tokens = 0;
+    w->n_carry = 0;
+    whisper_free(w->ctx);
+    w->ctx = NULL;
+}
+
+static enum ggml_type kv_type_from_name(const char *name, size_t n) {
+    if (n == 4 && strncmp(name, "q8_0", n) == 0) return GGML_TYPE_Q8_0;
+    if (n == 4 && strncmp(name, "q4_0", n) == 0) return GGML_TYPE_Q4_0;
+    return GGML_TYPE_F16;
+}
+
+// KV cache types: AURISCRIBE_KV_TYPE=q8_0 (or q4_0) quantizes the self- and
+// cross-attention caches, "q8_0,q4_0" sets them separately. The quantized caches
+// live on the CPU backend only; there flash attention is turned on as well, as
+// the V caches can only be quantized with it.
+static void worker_kv_types(struct whisper_context_params *cparams, bool use_gpu) {
+    const char *s = env_get("AURISCRIBE_KV_TYPE", NULL);
+    if (!s || !*s) return;
+
+    const char *comma = strchr(s, ',');
+    cparams->type_kv_self = kv_type_from_name(s, comma ? (size_t)(comma - s) : strlen(s));
+    cparams->type_kv_cross = comma ? kv_type_from_name(comma + 1, strlen(comma + 1)) : cparams->type_kv_self;
+    if (!use_gpu && (cparams->type_kv_self != GGML_TYPE_F16 || cparams->type_kv_cross != GGML_TYPE_F16)) {
+        cparams->flash_attn = true;
+    }
+}
+
+// Memory placement of the CPU weight and compute buffers:
+// AURISCRIBE_HUGE_PAGES=thp backs them with transparent huge pages, =hugetlb
+// with reserved ones (vm.nr_hugepages, transparent when they run out).
+// AURISCRIBE_NUMA=distribute spreads the compute threads over the nodes and
+// interleaves the buffers across them, =isolate keeps both on the node the
+// worker started on, =numactl follows the cpuset of numactl. NUMA is set up
+// once per process, by the first load that asks for it.
+static void worker_placement(struct whisper_context_params *cparams) {
+    const char *hp = env_get("AURISCRIBE_HUGE_PAGES", NULL);
+    if (hp && strcmp(hp, "hugetlb") == 0) cparams->cpu_hugepages = GGML_CPU_HUGEPAGES_HUGETLB;
+    else if (hp && (strcmp(hp, "thp") == 0 || strcmp(hp, "1") == 0)) cparams->cpu_hugepages = GGML_CPU_HUGEPAGES_THP;
+
+    const char *numa = env_get("AURISCRIBE_NUMA", NULL);
+    if (!numa) return;
+
+    enum ggml_numa_strategy strategy = GGML_NUMA_STRATEGY_DISABLED;
+    if (strcmp(numa, "distribute") == 0) strategy = GGML_NUMA_STRATEGY_DISTRIBUTE;
+    else if (strcmp(numa, "isolate") == 0) strategy = GGML_NUMA_STRATEGY_ISOLATE;
+    else if (strcmp(numa, "numactl") == 0) strategy = GGML_NUMA_STRATEGY_NUMACTL;
+    if (strategy == GGML_NUMA_STRATEGY_DISABLED) {
+        fprintf(stderr, "auriscribe-worker: unknown AURISCRIBE_NUMA=%s, ignoring it\n", numa);
+        return;
+    }
+
+    static bool numa_init = false;
+    if (!numa_init) {
+        ggml_numa_init(strategy);
+        numa_init = true;
+    }
+    cparams->cpu_numa = ggml_is_numa();
+}
+
+static bool worker_load(Worker *w, const char *path, int threads, int gpu_device, bool use_gpu) {
+    struct whisper_context_params cparams = whisper_context_default_params();
+    cparams.use_gpu = use_gpu;
+    cparams.gpu_device = gpu_device;
+    worker_kv_types(&cparams, use_gpu);
+    worker_placement(&cparams);
+
+    char *weight_cache = worker_weight_cache_path(path, use_gpu);
+    cparams.weight_cache = weight_cache;
+    w->ctx = whisper_init_from_file_with_params_no_state(path, cparams);
+    worker_weight_cache_note(w, 0, w->ctx, weight_cache);
+    cparams.weight_cache = NULL;
+    if (!w->ctx) return false;
+
+    struct whisper_state *state = whisper_init_state(w->ctx);
+    if (!state) {
+        worker_background_join(w);
+        whisper_free(w->ctx);
+        w->ctx = NULL;
+        return false;
+    }
+    worker_load_draft(w, cparams);
+
+    w->total_threads = threads > 0 ? threads : worker_default_threads();
+    if (threads <= 0 && !worker_gpu_weights(use_gpu)) {
+        w->tuning_path = worker_tuning_path(path);
+        w->tuning = w->tuning_path ? worker_tuning_load(w->tuning_path) : NULL;
+        if (w->tuning) worker_tuning_log(w->tuning, "tuned");
+        if (w->tuning || !worker_tune_wanted()) {
+            free(w->tuning_path);
+            w->tuning_path = NULL;
+        }
+    }
+    w->encode_batch = worker_encode_batch_size(use_gpu);
+    w->n_sessions = worker_pool_size();
+    for (int i = 0; i < w->n_sessions; i++) {
+        WorkerSession *s = &w->sessions[i];
+        s->worker = w;
+        s->state = i == 0 ? state : NULL;
+        s->draft_state = NULL;
+        s->job = NULL;
+        s->batch = NULL;
+        s->compute_size = 0;
+        atomic_store(&s->yielding, false);
+        pthread_cond_init(&s->cond, NULL);
+    }
+    // Session threads look themselves up by thread id, so hold the lock until all ids are stored.
+    pthread_mutex_lock(&w->mutex);
+    for (int i = 0; i < w->n_sessions; i++) {
+        pthread_create(&w->sessions[i].thread, NULL, worker_session_thread, w);
+    }
+    pthread_mutex_unlock(&w->mutex);
+    worker_background_start(w);
+    return true;
+}
+
+// 'T' / 'N' / 'P' payload: n_samples, lang, prompt, translate, n_threads, samples.
+// Returns false on a broken stream; *job_out is NULL (with an error already
+// reported) when the request was read but could not be accepted.
+static bool read_transcribe_job(Worker *w, int in_fd, WorkerJob **job_out) {
+    *job_out = NULL;
+
+    uint32_t n_samples_u32 = 0;
+    uint32_t lang_len = 0;
+    uint32_t prompt_len = 0;
+    uint8_t translate = 0;
+    uint32_t n_threads = 0;
+
+    if (!ipc_read_u32(in_fd, &n_samples_u32)) return false;
+    if (!ipc_read_u32(in_fd, &lang_len)) return false;
+    char *lang = ipc_read_str(in_fd, lang_len);
+    if (!lang) return false;
+
+    if (!ipc_read_u32(in_fd, &prompt_len)) {
+        free(lang);
+        return false;
+    }
+    char *prompt = ipc_read_str(in_fd, prompt_len);
+    if (!prompt) {
+        free(lang);
+        return false;
+    }
+
+    if (!ipc_read_u8(in_fd, &translate) || !ipc_read_u32(in_fd, &n_threads)) {
+        free(lang);
+        free(prompt);
+        return false;
+    }
+
+    const size_t n_samples = (size_t)n_samples_u32;
+    float *samples = NULL;
+    if (n_samples > 0) {
+        samples = malloc(n_samples * sizeof(float));
+        if (!samples) {
+            free(lang);
+            free(prompt);
+            return false;
+        }
+        if (!ipc_read_exact(in_fd, samples, n_samples * sizeof(float))) {
+            free(samples);
+            free(lang);
+            free(prompt);
+            return false;
+        }
+    }
+
+    WorkerJob *job = calloc(1, sizeof(*job));
+    if (!job) {
+        free(samples);
+        free(lang);
+        free(prompt);
+        worker_reply_error(w, "Out of memory");
+        return true;
+    }
+    job->samples = samples;
+    job->n_samples = n_samples_u32;
+    job->lang = lang;
+    job->prompt = prompt;
+    job->translate = translate != 0;
+    job->n_threads = (int)n_threads;
+    *job_out = job;
+    return true;
+}
+
+// Control channel, read on its own thread so a cancel is seen while the main
+// loop is blocked on a request payload: 'C' + u32 id cancels every numbered
+// request up to id, plus the 'T' requests already received. Running jobs
+// stop at their next abort check (after the current graph node on the CPU)
+// and queued ones are dropped; each replies 'C'. The model stays loaded.
+static void worker_cancel(Worker *w, uint32_t id) {
+    atomic_store(&w->cancel_id, id);
+    atomic_fetch_add(&w->cancel_epoch, 1);
+
+    pthread_mutex_lock(&w->mutex);
+    WorkerJob **pp = &w->head;
+    w->tail = NULL;
+    while (*pp) {
+        WorkerJob *job = *pp;
+        if (worker_job_canceled(w, job)) {
+            *pp = job->next;
+            worker_reply(w, job, 'C', "");
+            job_free(job);
+        } else {
+            w->tail = job;
+            pp = &job->next;
+        }
+    }
+    worker_dispatch_locked(w);
+    pthread_cond_broadcast(&w->idle_cond);
+    pthread_mutex_unlock(&w->mutex);
+}
+
+typedef struct {
+    Worker *worker;
+    int fd;
+} WorkerControl;
+
+static void *worker_control_thread(void *arg) {
+    WorkerControl *c = arg;
+    uint8_t cmd = 0;
+    while (ipc_read_u8(c->fd, &cmd)) {
+        uint32_t id = 0;
+        if (cmd != 'C' || !ipc_read_u32(c->fd, &id)) break;
+        worker_cancel(c->worker, id);
+    }
+    return NULL;
+}
+
+static bool input_pending(int fd) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    return poll(&pfd, 1, 0) > 0;
 }
 
 int main(int argc, char **argv) {
@@ -285,32 +1756,58 @@ int main(int argc, char **argv) {
     }
 
     const int in_fd = STDIN_FILENO;
-    const int out_fd = STDOUT_FILENO;
 
-    struct whisper_context *ctx = NULL;
+    Worker w;
+    memset(&w, 0, sizeof(w));
+    w.out_fd = STDOUT_FILENO;
+    pthread_mutex_init(&w.mutex, NULL);
+    pthread_cond_init(&w.idle_cond, NULL);
+    pthread_mutex_init(&w.out_mutex, NULL);
+
+    WorkerControl control = { &w, -1 };
+    if (argc >= 3 && strcmp(argv[1], "--control-fd") == 0) {
+        control.fd = atoi(argv[2]);
+        pthread_t control_thread;
+        if (pthread_create(&control_thread, NULL, worker_control_thread, &control) == 0) {
+            pthread_detach(control_thread);
+        }
+    }
+
+    // Transcription requests that are already waiting in the pipe are submitted
+    // together so idle sessions start them as one batched-encoder group.
+    WorkerJob *pending = NULL;
+    WorkerJob *pending_tail = NULL;
 
     for (;;) {
+        if (pending && !input_pending(in_fd)) {
+            worker_submit(&w, pending);
+            pending = pending_tail = NULL;
+        }
+
         char magic[4];
-        if (!read_exact(in_fd, magic, 4)) break;
+        if (!ipc_read_exact(in_fd, magic, 4)) break;
         if (memcmp(magic, "AURI", 4) != 0) {
-            (void)write_msg(out_fd, 'E', "Bad magic");
+            worker_reply_error(&w, "Bad magic");
             break;
         }
 
         uint8_t cmd = 0;
-        if (!read_u8(in_fd, &cmd)) break;
+        if (!ipc_read_u8(in_fd, &cmd)) break;
+
+        if (pending && cmd != 'T' && cmd != 'N' && cmd != 'P') {
+            worker_submit(&w, pending);
+            pending = pending_tail = NULL;
+        }
 
         if (cmd == 'Q') {
-            (void)write_msg(out_fd, 'O', "bye");
+            worker_unload(&w);
+            worker_reply_ok(&w, "bye");
             break;
         }
 
         if (cmd == 'U') {
-            if (ctx) {
-                whisper_free(ctx);
-                ctx = NULL;
-            }
-            (void)write_msg(out_fd, 'O', "unloaded");
+            worker_unload(&w);
+            worker_reply_ok(&w, "unloaded");
             continue;
         }
 
@@ -320,116 +1817,70 @@ int main(int argc, char **argv) {
             uint32_t gpu_device = 0;
             uint8_t use_gpu = 1;
 
-            if (!read_u32(in_fd, &path_len)) break;
-            char *path = read_bytes_str(in_fd, path_len);
+            if (!ipc_read_u32(in_fd, &path_len)) break;
+            char *path = ipc_read_str(in_fd, path_len);
             if (!path) {
-                (void)write_msg(out_fd, 'E', "Out of memory");
+                worker_reply_error(&w, "Out of memory");
                 continue;
             }
-            if (!read_u32(in_fd, &threads) || !read_u32(in_fd, &gpu_device) || !read_u8(in_fd, &use_gpu)) {
+            if (!ipc_read_u32(in_fd, &threads) || !ipc_read_u32(in_fd, &gpu_device) || !ipc_read_u8(in_fd, &use_gpu)) {
                 free(path);
                 break;
             }
 
-            if (ctx) {
-                whisper_free(ctx);
-                ctx = NULL;
-            }
-
-            struct whisper_context_params cparams = whisper_context_default_params();
-            cparams.use_gpu = use_gpu ? true : false;
-            cparams.gpu_device = (int)gpu_device;
-
-            ctx = whisper_init_from_file_with_params(path, cparams);
+            worker_unload(&w);
+            const bool ok = worker_load(&w, path, (int)threads, (int)gpu_device, use_gpu != 0);
             free(path);
 
-            if (!ctx) {
-                (void)write_msg(out_fd, 'E', "Failed to load model");
+            if (!ok) {
+                worker_reply_error(&w, "Failed to load model");
                 continue;
             }
 
-            (void)write_msg(out_fd, 'O', "loaded");
+            worker_reply_ok(&w, "loaded");
             continue;
         }
 
-        if (cmd == 'T') {
-            if (!ctx) {
-                (void)write_msg(out_fd, 'E', "No model loaded");
-                continue;
-            }
+        if (cmd == 'T' || cmd == 'N' || cmd == 'P') {
+            // A cancel sent after this request covers it, also one that
+            // arrives while its samples are still being read.
+            const unsigned cancel_epoch = atomic_load(&w.cancel_epoch);
+            uint32_t id = 0;
+            uint8_t priority = WORKER_PRIORITY_INTERACTIVE;
+            if (cmd != 'T' && !ipc_read_u32(in_fd, &id)) break;
+            if (cmd == 'P' && !ipc_read_u8(in_fd, &priority)) break;
 
-            uint32_t n_samples_u32 = 0;
-            uint32_t lang_len = 0;
-            uint32_t prompt_len = 0;
-            uint8_t translate = 0;
-            uint32_t n_threads = 0;
-
-            if (!read_u32(in_fd, &n_samples_u32)) break;
-            if (!read_u32(in_fd, &lang_len)) break;
-            char *lang = read_bytes_str(in_fd, lang_len);
-            if (!lang && lang_len != 0) {
-                (void)write_msg(out_fd, 'E', "Out of memory");
-                continue;
-            }
+            WorkerJob *job = NULL;
+            if (!read_transcribe_job(&w, in_fd, &job)) break;
+            if (!job) continue;
+            job->id = id;
+            job->numbered = cmd != 'T';
+            job->cancel_epoch = cancel_epoch;
+            // The carried text is one per worker, not per stream: this assumes a
+            // single dictation sends continuing requests, each after the reply to
+            // the previous chunk (as the app does), so the last interactive
+            // request to finish is that previous chunk. The daemon never sets it.
+            job->continues = (priority & WORKER_FLAG_CONTINUE) != 0;
+            priority &= (uint8_t)~WORKER_FLAG_CONTINUE;
+            job->priority = priority == WORKER_PRIORITY_INTERACTIVE ? WORKER_PRIORITY_INTERACTIVE : WORKER_PRIORITY_BACKGROUND;
 
-            if (!read_u32(in_fd, &prompt_len)) {
-                free(lang);
-                break;
-            }
-            char *prompt = read_bytes_str(in_fd, prompt_len);
-            if (!prompt && prompt_len != 0) {
-                free(lang);
-                (void)write_msg(out_fd, 'E', "Out of memory");
+            if (!w.ctx) {
+                worker_reply(&w, job, 'E', "No model loaded");
+                job_free(job);
                 continue;
             }
 
-            if (!read_u8(in_fd, &translate) || !read_u32(in_fd, &n_threads)) {
-                free(lang);
-                free(prompt);
-                break;
-            }
-
-            const size_t n_samples = (size_t)n_samples_u32;
-            float *samples = NULL;
-            if (n_samples > 0) {
-                samples = malloc(n_samples * sizeof(float));
-                if (!samples) {
-                    free(lang);
-                    free(prompt);
-                    (void)write_msg(out_fd, 'E', "Out of memory");
-                    continue;
-                }
-                if (!read_exact(in_fd, samples, n_samples * sizeof(float))) {
-                    free(samples);
-                    free(lang);
-                    free(prompt);
-                    break;
-                }
-            }
-
-            char *text = whisper_run(ctx, samples, (int)n_samples_u32, lang, translate != 0, (int)n_threads, prompt);
-            free(samples);
-            free(lang);
-            free(prompt);
-
-            if (!text) {
-                (void)write_msg(out_fd, 'E', "Transcription failed");
-                continue;
-            }
-
-            const char magic2[4] = { 'A', 'U', 'R', '1' };
-            (void)write_exact(out_fd, magic2, 4);
-            (void)write_u8(out_fd, (uint8_t)'R');
-            (void)write_u32(out_fd, (uint32_t)strlen(text));
-            (void)write_exact(out_fd, text, strlen(text));
-            free(text);
+            if (pending_tail) pending_tail->next = job;
+            else pending = job;
+            pending_tail = job;
             continue;
         }
 
-        (void)write_msg(out_fd, 'E', "Unknown command");
+        worker_reply_error(&w, "Unknown command");
         break;
     }
 
-    if (ctx) whisper_free(ctx);
+    worker_submit(&w, pending);
+    worker_unload(&w);
     return 0;
 }